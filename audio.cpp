@@ -0,0 +1,244 @@
+#include "audio.h"
+#include "audio_file.h"
+#include "options.h"
+
+#ifdef _WIN32
+#include "audio_winmm.h"
+#elif defined(RNHVE_ALSA)
+#include "audio_alsa.h"
+#endif
+
+#include <chrono>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+
+// either platform capture or file/tone generator
+struct audio
+{
+	audio_state *state;
+#ifdef _WIN32
+	audio_winmm *capture;
+#elif defined(RNHVE_ALSA)
+	audio_alsa *capture;
+#else
+	void *capture;
+#endif
+	audio_file *file;
+};
+
+struct audio *audio_init(audio_state &state, const audio_config &config)
+{
+	if(config.backend == AUDIO_NONE)
+	{
+		cerr << "audio_init: no audio backend" << endl;
+		return NULL;
+	}
+
+	audio *a = new audio();
+
+	a->state = &state;
+	state.chunks = new audio_ring(AUDIO_QUEUE_SIZE, FRAME_RING_DROP_OLDEST);
+
+	if(config.backend == AUDIO_CAPTURE)
+	{
+#ifdef _WIN32
+		a->capture = audio_winmm_init(state);
+#elif defined(RNHVE_ALSA)
+		a->capture = audio_alsa_init(state, config.device);
+#else
+		cerr << "audio: built without ALSA (install libasound2-dev and rebuild), use --audio-wav or --audio-tone" << endl;
+#endif
+		if(!a->capture)
+		{
+			audio_close(a);
+			return NULL;
+		}
+	}
+	else if( (a->file = audio_file_init(state, config)) == NULL)
+	{
+		audio_close(a);
+		return NULL;
+	}
+
+	return a;
+}
+
+void audio_close(struct audio *a)
+{
+	if(!a)
+		return;
+
+#ifdef _WIN32
+	audio_winmm_close(a->capture);
+#elif defined(RNHVE_ALSA)
+	audio_alsa_close(a->capture);
+#endif
+	audio_file_close(a->file);
+
+	delete a->state->chunks; //capture is stopped, nobody pushes anymore
+	a->state->chunks = NULL;
+
+	delete a;
+}
+
+void audio_publish(audio_state &state, const void *samples, int bytes, int64_t captured_us)
+{
+	audio_chunk chunk;
+
+	if(bytes > (int)sizeof(chunk.samples))
+		bytes = sizeof(chunk.samples);
+
+	memcpy(chunk.samples, samples, bytes);
+	chunk.bytes = bytes;
+	chunk.sequence = state.next_sequence++;
+	chunk.captured_us = captured_us;
+
+	//delivered when the last sample was captured
+	const int count = bytes / (CHANNELS * BYTES_PER_SAMPLE);
+	const int64_t duration_us = (int64_t)count * 1000000 / SAMPLE_RATE;
+	const int64_t sample_us = (int64_t)(state.captured_samples * 1000000 / SAMPLE_RATE);
+
+	chunk.pts_us = clock_sync_map(&state.clock, sample_us, captured_us - duration_us);
+	state.captured_samples += count;
+
+	state.chunks->push(std::move(chunk));
+
+	{  // use the scope operator to release the lock before notify()
+		lock_guard<mutex> guard(*state.data_mutex);
+		*state.data_ready = true;
+	}
+	state.cv->notify_one();
+}
+
+void audio_overrun(audio_state &state)
+{
+	state.overruns.fetch_add(1, memory_order_relaxed);
+	state.clock.resync = true;
+}
+
+int64_t audio_now_us()
+{
+	return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool audio_drain(audio_state &state, audio_batch *batch)
+{
+	audio_chunk chunk;
+
+	batch->bytes = batch->chunks = 0;
+
+	while(batch->chunks < AUDIO_QUEUE_SIZE && state.chunks->pop(chunk))
+	{
+		if(batch->chunks == 0)
+		{
+			batch->first_sequence = chunk.sequence;
+			batch->pts_us = chunk.pts_us;
+		}
+
+		//chunks dropped from the ring (or between batches)
+		if(chunk.sequence != state.expected_sequence)
+			state.lost += chunk.sequence - state.expected_sequence;
+		state.expected_sequence = chunk.sequence + 1;
+
+		memcpy((uint8_t*)batch->samples + batch->bytes, chunk.samples, chunk.bytes);
+		batch->bytes += chunk.bytes;
+		batch->captured_us[batch->chunks++] = chunk.captured_us;
+	}
+
+	return batch->chunks > 0;
+}
+
+void audio_sent(audio_state &state, const audio_batch &batch)
+{
+	const int64_t now = audio_now_us();
+
+	for(int i = 0; i < batch.chunks; ++i)
+	{
+		const double ms = (now - batch.captured_us[i]) / 1000.0;
+
+		state.latency_ms += ms;
+
+		if(ms > state.max_latency_ms)
+			state.max_latency_ms = ms;
+	}
+
+	state.sent += batch.chunks;
+	++state.batches;
+}
+
+void audio_report(ostream &out, const audio_state &state)
+{
+	out << "audio chunks sent " << state.sent << " in " << state.batches << " batches, lost " << state.lost;
+
+	if(state.chunks)
+		out << " (queue overflow " << state.chunks->dropped_oldest() << ")";
+
+	out << ", device overruns " << state.overruns.load();
+
+	if(state.sent)
+		out << ", capture to send avg " << state.latency_ms / state.sent << " ms, max " << state.max_latency_ms << " ms";
+
+	out << endl;
+
+	clock_sync_report(out, state.clock);
+}
+
+int audio_options(int *argc, char *argv[], audio_config *config)
+{
+	const char *device = option_value(argc, argv, "audio-device");
+	const char *wav = option_value(argc, argv, "audio-wav");
+	const char *tone = option_value(argc, argv, "audio-tone");
+	const bool none = option_flag(argc, argv, "no-audio");
+
+	config->backend = AUDIO_CAPTURE;
+	config->device = device;
+	config->file = NULL;
+	config->tone_hz = 0.0f;
+
+	if((wav != NULL) + (tone != NULL) + none > 1)
+	{
+		cerr << "--audio-wav, --audio-tone and --no-audio are mutually exclusive" << endl;
+		return -1;
+	}
+
+	if(none)
+		config->backend = AUDIO_NONE;
+	else if(wav)
+	{
+		if(*wav == '\0')
+		{
+			cerr << "invalid --audio-wav, expected .wav file" << endl;
+			return -1;
+		}
+
+		config->backend = AUDIO_WAV;
+		config->file = wav;
+	}
+	else if(tone)
+	{
+		char *end;
+		config->tone_hz = strtof(tone, &end);
+
+		if(*tone == '\0' || *end != '\0' || config->tone_hz <= 0.0f || config->tone_hz >= SAMPLE_RATE / 2)
+		{
+			cerr << "invalid --audio-tone '" << tone << "', expected frequency in Hz below " << SAMPLE_RATE / 2 << endl;
+			return -1;
+		}
+
+		config->backend = AUDIO_TONE;
+	}
+
+	return 0;
+}
+
+void audio_usage(ostream &out)
+{
+	out << "audio options:" << endl
+	    << "       --audio-device <name> # ALSA capture device, e.g. hw:1,0, default 'default'" << endl
+	    << "       --audio-wav <file.wav> # 16 bit mono " << SAMPLE_RATE << " Hz file in a loop instead of capture" << endl
+	    << "       --audio-tone <hz> # synthetic sine tone instead of capture" << endl
+	    << "       --no-audio # video only (e.g. with --metadata or --timestamps)" << endl;
+}
@@ -0,0 +1,137 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Audio capture
+ * - raw signed 16-bit mono PCM chunks of AUDIO_BUFFER_SAMPLES
+ * - WinMM (Windows) or ALSA (Linux) capture, WAV file or synthetic tone for testing (or none)
+ * - chunks go from capture thread to sender through lock free ring, stamped at capture
+ * - sequence numbers and overflow counters, sender drains all pending chunks at once
+ * - sample clock mapped to host timeline for presentation timestamps, drift reported
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef AUDIO_H
+#define AUDIO_H
+
+// Lock free handoff of chunks to the sender
+#include "frame_ring.h"
+
+// Sample clock on host timeline
+#include "frame_clock.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <stdint.h>
+
+#define SAMPLE_RATE 24000
+#define CHANNELS 1
+#define BYTES_PER_SAMPLE 2
+// AAudio framesPerBurst on DevKit is 642 in regular performance mode, 290 in LOW_LATENCY mode
+#define AUDIO_BUFFER_SAMPLES 642
+// chunks waiting for sender (~430 ms), also the most sent in one batch
+#define AUDIO_QUEUE_SIZE 16
+
+// AUDIO_NONE is for the caller to skip audio altogether, audio_init fails with it
+enum audio_backend { AUDIO_CAPTURE, AUDIO_WAV, AUDIO_TONE, AUDIO_NONE };
+
+struct audio_config
+{
+	audio_backend backend;
+	const char *device; //ALSA capture device, NULL for "default"
+	const char *file;   //16 bit mono SAMPLE_RATE .wav, played in a loop
+	float tone_hz;
+};
+
+struct audio_chunk
+{
+	int16_t samples[AUDIO_BUFFER_SAMPLES * CHANNELS];
+	int bytes;
+	uint64_t sequence;   //consecutive from capture, gaps are chunks lost to overflow
+	int64_t captured_us; //steady clock, when capture delivered the chunk
+	int64_t pts_us;      //first sample on host timeline (sample clock mapped)
+};
+
+// pending chunks drained by sender at once, samples are contiguous
+struct audio_batch
+{
+	int16_t samples[AUDIO_QUEUE_SIZE * AUDIO_BUFFER_SAMPLES * CHANNELS];
+	int bytes;
+	int chunks;
+	uint64_t first_sequence;
+	int64_t pts_us; //first sample of the batch
+	int64_t captured_us[AUDIO_QUEUE_SIZE];
+};
+
+typedef frame_ring<audio_chunk> audio_ring;
+
+// the mutex and condition variable only wake up the audio sender (depth video has its own)
+struct audio_state
+{
+	audio_ring* chunks; // set by audio_init, pop from sender thread only
+	std::mutex* data_mutex; // guards data_ready
+	std::condition_variable* cv;
+	bool* data_ready;
+
+	uint64_t next_sequence; // capture thread only
+	uint64_t captured_samples; // capture thread only, sample clock
+	clock_sync clock; // capture thread only, sample clock to host timeline
+	std::atomic<uint64_t> overruns; // capture device overflows (samples lost before the ring)
+
+	// sender thread only
+	uint64_t expected_sequence;
+	uint64_t lost; // sequence gaps
+	uint64_t batches;
+	uint64_t sent;
+	double latency_ms; // capture to send
+	double max_latency_ms;
+
+	audio_state() :
+		chunks(NULL),
+		data_mutex(NULL),
+		cv(NULL),
+		data_ready(NULL),
+		next_sequence(0),
+		captured_samples(0),
+		overruns(0),
+		expected_sequence(0),
+		lost(0),
+		batches(0),
+		sent(0),
+		latency_ms(0.0),
+		max_latency_ms(0.0)
+	{
+		clock_sync_init(&clock, "audio");
+	}
+};
+
+struct audio;
+
+// starts capture, NULL on failure
+struct audio *audio_init(audio_state &state, const audio_config &config);
+void audio_close(struct audio *a);
+
+// backends, from capture thread
+// copies the samples to the ring with next sequence number (dropping the oldest chunk if sender doesn't keep up)
+// and presentation timestamp, wakes the sender
+// overrun resynchronizes the sample clock (lost samples are a step)
+void audio_publish(audio_state &state, const void *samples, int bytes, int64_t captured_us);
+void audio_overrun(audio_state &state);
+int64_t audio_now_us();
+
+// sender, pops all the pending chunks (up to AUDIO_QUEUE_SIZE) into batch, false if there were none
+bool audio_drain(audio_state &state, audio_batch *batch);
+// sender, after the batch went to the network
+void audio_sent(audio_state &state, const audio_batch &batch);
+void audio_report(std::ostream &out, const audio_state &state);
+
+// removes recognized options from argv, -1 on invalid value
+int audio_options(int *argc, char *argv[], audio_config *config);
+void audio_usage(std::ostream &out);
+
+#endif
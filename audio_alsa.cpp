@@ -0,0 +1,134 @@
+#include "audio_alsa.h"
+
+#include <alsa/asoundlib.h>
+
+#include <iostream>
+#include <thread>
+
+using namespace std;
+
+// periods in ALSA buffer, capture survives sender stalls of about (PERIODS - 1) * 27 ms
+static const unsigned int PERIODS = 4;
+
+struct audio_alsa
+{
+	audio_state *state;
+	snd_pcm_t *pcm;
+	thread worker_thread;
+	volatile bool keep_working;
+
+	audio_alsa() :
+		state(NULL),
+		pcm(NULL),
+		keep_working(true)
+	{}
+};
+
+//0 on success, -1 on failure
+static int configure(audio_alsa *a)
+{
+	snd_pcm_hw_params_t *hw;
+	snd_pcm_uframes_t period = AUDIO_BUFFER_SAMPLES;
+	snd_pcm_uframes_t buffer = AUDIO_BUFFER_SAMPLES * PERIODS;
+	unsigned int rate = SAMPLE_RATE;
+	int err;
+
+	snd_pcm_hw_params_alloca(&hw);
+
+	if( (err = snd_pcm_hw_params_any(a->pcm, hw)) < 0 ||
+		(err = snd_pcm_hw_params_set_access(a->pcm, hw, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0 ||
+		(err = snd_pcm_hw_params_set_format(a->pcm, hw, SND_PCM_FORMAT_S16_LE)) < 0 ||
+		(err = snd_pcm_hw_params_set_channels(a->pcm, hw, CHANNELS)) < 0 ||
+		(err = snd_pcm_hw_params_set_rate_near(a->pcm, hw, &rate, NULL)) < 0 ||
+		(err = snd_pcm_hw_params_set_period_size_near(a->pcm, hw, &period, NULL)) < 0 ||
+		(err = snd_pcm_hw_params_set_buffer_size_near(a->pcm, hw, &buffer)) < 0 ||
+		(err = snd_pcm_hw_params(a->pcm, hw)) < 0)
+	{
+		cerr << "audio: failed to configure ALSA capture, " << snd_strerror(err) << endl;
+		return -1;
+	}
+
+	if(rate != SAMPLE_RATE)
+	{
+		cerr << "audio: ALSA device doesn't support " << SAMPLE_RATE << " Hz (nearest " << rate << " Hz)" << endl;
+		return -1;
+	}
+
+	cout << "audio: ALSA capture " << rate << " Hz, period " << period << " frames, buffer " << buffer << " frames" << endl;
+
+	if( (err = snd_pcm_prepare(a->pcm)) < 0)
+	{
+		cerr << "audio: failed to prepare ALSA capture, " << snd_strerror(err) << endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void audio_alsa_thread(audio_alsa *a)
+{
+	int16_t buffer[AUDIO_BUFFER_SAMPLES * CHANNELS];
+
+	//blocks at most one period, so stop request is noticed quickly
+	while(a->keep_working)
+	{
+		snd_pcm_sframes_t frames = snd_pcm_readi(a->pcm, buffer, AUDIO_BUFFER_SAMPLES);
+
+		if(frames == -EPIPE)
+			audio_overrun(*a->state);
+
+		if(frames < 0)
+		{
+			if( (frames = snd_pcm_recover(a->pcm, (int)frames, 1)) < 0)
+			{
+				cerr << "audio: ALSA capture failed, " << snd_strerror((int)frames) << endl;
+				break;
+			}
+			continue;
+		}
+
+		audio_publish(*a->state, buffer, (int)frames * CHANNELS * BYTES_PER_SAMPLE, audio_now_us());
+	}
+}
+
+struct audio_alsa *audio_alsa_init(audio_state &state, const char *device)
+{
+	audio_alsa *a = new audio_alsa();
+	int err;
+
+	a->state = &state;
+
+	if( (err = snd_pcm_open(&a->pcm, device ? device : "default", SND_PCM_STREAM_CAPTURE, 0)) < 0)
+	{
+		cerr << "audio: unable to open ALSA device " << (device ? device : "default") << ", " << snd_strerror(err) << endl;
+		a->pcm = NULL;
+		audio_alsa_close(a);
+		return NULL;
+	}
+
+	if(configure(a) < 0)
+	{
+		audio_alsa_close(a);
+		return NULL;
+	}
+
+	a->worker_thread = thread(audio_alsa_thread, a);
+
+	return a;
+}
+
+void audio_alsa_close(struct audio_alsa *a)
+{
+	if(!a)
+		return;
+
+	a->keep_working = false;
+
+	if(a->worker_thread.joinable())
+		a->worker_thread.join();
+
+	if(a->pcm)
+		snd_pcm_close(a->pcm);
+
+	delete a;
+}
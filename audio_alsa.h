@@ -0,0 +1,25 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Audio capture on Linux using ALSA
+ * - period of AUDIO_BUFFER_SAMPLES, short buffer of few periods for low latency
+ * - blocking reads in capture thread, each period published as audio chunk
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef AUDIO_ALSA_H
+#define AUDIO_ALSA_H
+
+#include "audio.h"
+
+struct audio_alsa;
+
+// device NULL for "default", NULL on failure
+struct audio_alsa *audio_alsa_init(audio_state &state, const char *device);
+void audio_alsa_close(struct audio_alsa *a);
+
+#endif
@@ -0,0 +1,392 @@
+#include "audio_codec.h"
+#include "options.h"
+
+#ifdef RNHVE_OPUS
+#include <opus/opus.h>
+#endif
+
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+
+static const int DEFAULT_BITRATE = 24000;
+// frames concealed at most for a sequence gap, longer gaps are just skipped
+static const int MAX_CONCEALED_MS = 100;
+
+struct audio_encoder
+{
+#ifdef RNHVE_OPUS
+	OpusEncoder *opus;
+#endif
+	int frame_samples;   //per channel
+	int delay;
+	vector<int16_t> pending; //samples waiting for a whole frame
+	int64_t pending_pts;     //of the first pending sample
+	vector<uint8_t> out;
+	uint32_t sequence;
+
+	audio_encoder() :
+#ifdef RNHVE_OPUS
+		opus(NULL),
+#endif
+		frame_samples(0),
+		delay(0),
+		pending_pts(0),
+		sequence(0)
+	{}
+};
+
+struct audio_decoder
+{
+#ifdef RNHVE_OPUS
+	OpusDecoder *opus;
+#endif
+	int sample_rate;
+	int channels;
+	uint32_t expected;
+	bool started;
+
+	audio_decoder() :
+#ifdef RNHVE_OPUS
+		opus(NULL),
+#endif
+		sample_rate(0),
+		channels(0),
+		expected(0),
+		started(false)
+	{}
+};
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v & 0xFF; p[1] = v >> 8; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v & 0xFFFF); put16(p + 2, v >> 16); }
+static uint16_t get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static uint32_t get32(const uint8_t *p) { return get16(p) | ((uint32_t)get16(p + 2) << 16); }
+static void put64(uint8_t *p, uint64_t v) { put32(p, v & 0xFFFFFFFF); put32(p + 4, v >> 32); }
+static uint64_t get64(const uint8_t *p) { return get32(p) | ((uint64_t)get32(p + 4) << 32); }
+
+static int64_t samples_us(int64_t samples, int sample_rate)
+{
+	return samples * 1000000 / sample_rate;
+}
+
+//the longest Opus frame fitting in capture chunk, so each chunk completes at least one frame
+static float default_frame_ms()
+{
+	const float chunk_ms = 1000.0f * AUDIO_BUFFER_SAMPLES / SAMPLE_RATE;
+	const float frames[] = {20.0f, 10.0f, 5.0f, 2.5f};
+
+	for(float ms : frames)
+		if(ms <= chunk_ms)
+			return ms;
+
+	return 2.5f;
+}
+
+struct audio_encoder *audio_encoder_init(const audio_codec_config &config)
+{
+#ifndef RNHVE_OPUS
+	(void)config;
+	cerr << "audio codec: built without Opus (install libopus-dev and rebuild)" << endl;
+	return NULL;
+#else
+	audio_encoder *e = new audio_encoder();
+	const float frame_ms = config.frame_ms > 0.0f ? config.frame_ms : default_frame_ms();
+	const int bitrate = config.bitrate > 0 ? config.bitrate : DEFAULT_BITRATE;
+	int err;
+
+	e->frame_samples = (int)(SAMPLE_RATE * frame_ms / 1000.0f);
+
+	//restricted low delay skips speech mode lookahead (2.5 ms instead of 6.5 ms)
+	if( (e->opus = opus_encoder_create(SAMPLE_RATE, CHANNELS, OPUS_APPLICATION_RESTRICTED_LOWDELAY, &err)) == NULL )
+	{
+		cerr << "audio codec: failed to create Opus encoder, " << opus_strerror(err) << endl;
+		audio_encoder_close(e);
+		return NULL;
+	}
+
+	if(opus_encoder_ctl(e->opus, OPUS_SET_BITRATE(bitrate)) != OPUS_OK ||
+		opus_encoder_ctl(e->opus, OPUS_GET_LOOKAHEAD(&e->delay)) != OPUS_OK)
+	{
+		cerr << "audio codec: failed to configure Opus encoder (bitrate " << bitrate << ")" << endl;
+		audio_encoder_close(e);
+		return NULL;
+	}
+
+	cout << "audio: Opus " << bitrate << " bit/s, " << frame_ms << " ms frames, lookahead " <<
+		1000.0f * e->delay / SAMPLE_RATE << " ms" << endl;
+
+	return e;
+#endif
+}
+
+void audio_encoder_close(struct audio_encoder *e)
+{
+	if(!e)
+		return;
+#ifdef RNHVE_OPUS
+	if(e->opus)
+		opus_encoder_destroy(e->opus);
+#endif
+	delete e;
+}
+
+int audio_encoder_encode(struct audio_encoder *e, const int16_t *samples, int count, int64_t pts_us, const uint8_t **out)
+{
+	//the latest timestamp is the best, the pending samples came just before
+	e->pending_pts = pts_us - samples_us(e->pending.size() / CHANNELS, SAMPLE_RATE);
+	e->pending.insert(e->pending.end(), samples, samples + count * CHANNELS);
+
+	const int frame = e->frame_samples * CHANNELS;
+	int frames = (int)e->pending.size() / frame;
+
+	if(frames > 255)
+		frames = 255;
+
+	if(frames == 0)
+		return 0;
+
+	e->out.resize(AUDIO_CODEC_HEADER_SIZE + frames * (2 + AUDIO_CODEC_MAX_PACKET));
+
+	uint8_t *header = &e->out[0];
+	uint8_t *p = header + AUDIO_CODEC_HEADER_SIZE;
+
+	header[0] = 'R';
+	header[1] = 'A';
+	header[2] = AUDIO_CODEC_VERSION;
+	header[3] = AUDIO_CODEC_OPUS;
+	put16(header + 4, SAMPLE_RATE);
+	header[6] = CHANNELS;
+	header[7] = frames;
+	put16(header + 8, e->frame_samples);
+	put32(header + 10, e->sequence);
+	put64(header + 14, (uint64_t)e->pending_pts);
+
+	for(int f = 0; f < frames; ++f)
+	{
+		int size = -1;
+#ifdef RNHVE_OPUS
+		size = opus_encode(e->opus, &e->pending[f * frame], e->frame_samples, p + 2, AUDIO_CODEC_MAX_PACKET);
+#endif
+		if(size < 0)
+		{
+			cerr << "audio codec: failed to encode frame" << endl;
+			return -1;
+		}
+
+		put16(p, size);
+		p += 2 + size;
+	}
+
+	e->pending.erase(e->pending.begin(), e->pending.begin() + frames * frame);
+	e->sequence += frames;
+
+	*out = header;
+
+	return (int)(p - header);
+}
+
+int audio_encoder_frame_samples(const struct audio_encoder *e)
+{
+	return e->frame_samples;
+}
+
+int audio_encoder_delay(const struct audio_encoder *e)
+{
+	return e->delay;
+}
+
+struct audio_decoder *audio_decoder_init()
+{
+#ifndef RNHVE_OPUS
+	cerr << "audio codec: built without Opus (install libopus-dev and rebuild)" << endl;
+	return NULL;
+#else
+	return new audio_decoder();
+#endif
+}
+
+void audio_decoder_close(struct audio_decoder *d)
+{
+	if(!d)
+		return;
+#ifdef RNHVE_OPUS
+	if(d->opus)
+		opus_decoder_destroy(d->opus);
+#endif
+	delete d;
+}
+
+int audio_decoder_decode(struct audio_decoder *d, const uint8_t *data, int size, int16_t *samples, int max_count, int64_t *pts_us)
+{
+#ifndef RNHVE_OPUS
+	(void)samples; //no decoder without Opus, every packet fails
+#endif
+	if(size < AUDIO_CODEC_HEADER_SIZE || data[0] != 'R' || data[1] != 'A' ||
+		data[2] != AUDIO_CODEC_VERSION || data[3] != AUDIO_CODEC_OPUS)
+	{
+		cerr << "audio codec: unknown aux frame" << endl;
+		return -1;
+	}
+
+	const int sample_rate = get16(data + 4);
+	const int channels = data[6];
+	const int packets = data[7];
+	const int frame_samples = get16(data + 8);
+	const uint32_t sequence = get32(data + 10);
+	const int64_t pts = (int64_t)get64(data + 14);
+
+	if(sample_rate == 0 || channels == 0 || frame_samples == 0)
+	{
+		cerr << "audio codec: invalid aux frame header" << endl;
+		return -1;
+	}
+
+#ifdef RNHVE_OPUS
+	if(!d->opus || sample_rate != d->sample_rate || channels != d->channels)
+	{
+		int err;
+
+		if(d->opus)
+			opus_decoder_destroy(d->opus);
+
+		if( (d->opus = opus_decoder_create(sample_rate, channels, &err)) == NULL )
+		{
+			cerr << "audio codec: failed to create Opus decoder, " << opus_strerror(err) << endl;
+			return -1;
+		}
+
+		d->sample_rate = sample_rate;
+		d->channels = channels;
+		d->started = false;
+	}
+#endif
+
+	int written = 0;
+
+	//conceal frames lost between aux frames (within limits)
+	if(d->started && sequence != d->expected)
+	{
+		uint32_t lost = sequence - d->expected;
+		const uint32_t max_lost = MAX_CONCEALED_MS * sample_rate / 1000 / frame_samples;
+
+		for(uint32_t f = 0; f < lost && f < max_lost && written + frame_samples <= max_count; ++f)
+		{
+			int decoded = -1;
+#ifdef RNHVE_OPUS
+			decoded = opus_decode(d->opus, NULL, 0, samples + written * channels, frame_samples, 0);
+#endif
+			if(decoded < 0)
+				return -1;
+			written += decoded;
+		}
+	}
+
+	const int concealed = written;
+
+	const uint8_t *p = data + AUDIO_CODEC_HEADER_SIZE;
+	const uint8_t *end = data + size;
+
+	for(int i = 0; i < packets; ++i)
+	{
+		if(end - p < 2 || end - p - 2 < get16(p))
+		{
+			cerr << "audio codec: truncated aux frame" << endl;
+			return -1;
+		}
+
+		const int length = get16(p);
+		int decoded = -1;
+
+		if(written + frame_samples > max_count)
+		{
+			cerr << "audio codec: decode buffer too small" << endl;
+			return -1;
+		}
+#ifdef RNHVE_OPUS
+		decoded = opus_decode(d->opus, p + 2, length, samples + written * channels, max_count - written, 0);
+#endif
+		if(decoded < 0)
+		{
+			cerr << "audio codec: failed to decode packet" << endl;
+			return -1;
+		}
+
+		written += decoded;
+		p += 2 + length;
+	}
+
+	d->expected = sequence + packets;
+	d->started = true;
+
+	//concealed samples come before the first packet
+	if(pts_us)
+		*pts_us = pts - samples_us(concealed, sample_rate);
+
+	return written;
+}
+
+int audio_codec_options(int *argc, char *argv[], audio_codec_config *config)
+{
+	const char *codec = option_value(argc, argv, "audio-codec");
+	const char *frame = option_value(argc, argv, "audio-frame");
+	const char *bitrate = option_value(argc, argv, "audio-bitrate");
+
+	config->type = AUDIO_CODEC_PCM;
+	config->frame_ms = 0.0f;
+	config->bitrate = 0;
+
+	if(codec)
+	{
+		if(strcmp(codec, "opus") == 0)
+			config->type = AUDIO_CODEC_OPUS;
+		else if(strcmp(codec, "pcm") != 0)
+		{
+			cerr << "invalid --audio-codec '" << codec << "', expected pcm or opus" << endl;
+			return -1;
+		}
+	}
+
+	if(frame)
+	{
+		char *end;
+		config->frame_ms = strtof(frame, &end);
+		const float ms = config->frame_ms;
+
+		if(*frame == '\0' || *end != '\0' || (ms != 2.5f && ms != 5.0f && ms != 10.0f && ms != 20.0f))
+		{
+			cerr << "invalid --audio-frame '" << frame << "', expected 2.5, 5, 10 or 20 ms" << endl;
+			return -1;
+		}
+	}
+
+	if(bitrate)
+	{
+		char *end;
+		config->bitrate = strtol(bitrate, &end, 10);
+
+		if(*bitrate == '\0' || *end != '\0' || config->bitrate < 6000 || config->bitrate > 510000)
+		{
+			cerr << "invalid --audio-bitrate '" << bitrate << "', expected 6000-510000 bits per second" << endl;
+			return -1;
+		}
+	}
+
+	if((frame || bitrate) && config->type != AUDIO_CODEC_OPUS)
+	{
+		cerr << "--audio-frame and --audio-bitrate need --audio-codec opus" << endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+void audio_codec_usage(ostream &out)
+{
+	out << "audio codec options:" << endl
+	    << "       --audio-codec <pcm/opus> # audio aux channel encoding, default pcm (raw samples)" << endl
+	    << "       --audio-frame <ms> # Opus frame 2.5, 5, 10 or 20 ms, default " << default_frame_ms() << endl
+	    << "       --audio-bitrate <bps> # Opus bitrate, default " << DEFAULT_BITRATE << endl;
+}
@@ -0,0 +1,74 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Audio codec
+ * - optional Opus encoding of the audio aux channel (~24 kbit/s instead of 384 kbit/s PCM)
+ * - low delay mode, 2.5-20 ms frames, default the longest frame fitting in AUDIO_BUFFER_SAMPLES chunk
+ * - self describing aux frame: header (codec, rate, channels, frame size, sequence, timestamp) + packets
+ * - decoder for the receiving end and loopback checks, conceals lost frames
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef AUDIO_CODEC_H
+#define AUDIO_CODEC_H
+
+// audio format and chunk sizes
+#include "audio.h"
+
+#include <ostream>
+#include <stdint.h>
+
+// aux frame with codec packets
+// 0-3 'R' 'A' version codec, 4-5 sample rate, 6 channels, 7 packets, 8-9 frame samples (per channel),
+// 10-13 sequence of the first packet (consecutive), 14-21 presentation timestamp of the first packet (int64 us)
+// then packets as 2 byte length + data, all little endian
+#define AUDIO_CODEC_VERSION 2
+#define AUDIO_CODEC_HEADER_SIZE 22
+#define AUDIO_CODEC_MAX_PACKET 1276
+
+enum audio_codec_type { AUDIO_CODEC_PCM = 0, AUDIO_CODEC_OPUS = 1 };
+
+struct audio_codec_config
+{
+	audio_codec_type type; //PCM sends raw samples, no header (as before)
+	float frame_ms;        //2.5, 5, 10 or 20, 0 for default
+	int bitrate;           //bits per second, 0 for default
+};
+
+struct audio_encoder;
+
+// NULL on failure (e.g. built without Opus)
+struct audio_encoder *audio_encoder_init(const audio_codec_config &config);
+void audio_encoder_close(struct audio_encoder *e);
+
+// samples (interleaved, count per channel) are buffered until a whole frame is there
+// pts_us is presentation timestamp of the first of the samples
+// out points to aux frame with all the complete frames (up to 255), valid until the next call
+// returns aux frame size, 0 if no frame was completed, -1 on failure
+int audio_encoder_encode(struct audio_encoder *e, const int16_t *samples, int count, int64_t pts_us, const uint8_t **out);
+
+// samples per channel in codec frame
+int audio_encoder_frame_samples(const struct audio_encoder *e);
+// codec algorithmic delay in samples (lookahead), not counting frame buffering
+int audio_encoder_delay(const struct audio_encoder *e);
+
+struct audio_decoder;
+
+struct audio_decoder *audio_decoder_init();
+void audio_decoder_close(struct audio_decoder *d);
+
+// decodes aux frame into interleaved samples (max_count per channel)
+// frames lost between aux frames (sequence gaps) are concealed first
+// pts_us (may be NULL) is set to presentation timestamp of the first sample written
+// returns samples per channel written, -1 on failure
+int audio_decoder_decode(struct audio_decoder *d, const uint8_t *data, int size, int16_t *samples, int max_count, int64_t *pts_us);
+
+// removes recognized options from argv, -1 on invalid value
+int audio_codec_options(int *argc, char *argv[], audio_codec_config *config);
+void audio_codec_usage(std::ostream &out);
+
+#endif
@@ -0,0 +1,147 @@
+#include "audio_file.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <math.h>
+#include <string.h>
+
+using namespace std;
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+struct audio_file
+{
+	audio_state *state;
+	vector<int16_t> samples; //whole file or one tone period set, played in a loop
+	thread worker_thread;
+	volatile bool keep_working;
+
+	audio_file() :
+		state(NULL),
+		keep_working(true)
+	{}
+};
+
+static uint32_t le32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+static uint16_t le16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+//0 on success, -1 on failure
+static int load_wav(const char *file, vector<int16_t> *samples)
+{
+	ifstream in(file, ios::binary);
+
+	if(!in)
+	{
+		cerr << "audio: unable to open file " << file << endl;
+		return -1;
+	}
+
+	vector<uint8_t> data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+
+	if(data.size() < 12 || memcmp(&data[0], "RIFF", 4) || memcmp(&data[8], "WAVE", 4))
+	{
+		cerr << "audio: " << file << " is not a .wav file" << endl;
+		return -1;
+	}
+
+	bool format_ok = false;
+
+	//chunks are word aligned
+	for(size_t pos = 12; pos + 8 <= data.size(); )
+	{
+		const uint8_t *chunk = &data[pos];
+		const size_t size = le32(chunk + 4);
+		const size_t available = data.size() - pos - 8 < size ? data.size() - pos - 8 : size;
+
+		if(!memcmp(chunk, "fmt ", 4) && available >= 16)
+			format_ok = le16(chunk + 8) == 1 && le16(chunk + 10) == CHANNELS &&
+				le32(chunk + 12) == SAMPLE_RATE && le16(chunk + 22) == 8 * BYTES_PER_SAMPLE;
+		else if(!memcmp(chunk, "data", 4) && format_ok)
+		{
+			samples->resize(available / sizeof(int16_t));
+			memcpy(&(*samples)[0], chunk + 8, samples->size() * sizeof(int16_t));
+			break;
+		}
+
+		pos += 8 + size + (size & 1);
+	}
+
+	if(!format_ok || samples->size() < AUDIO_BUFFER_SAMPLES * CHANNELS)
+	{
+		cerr << "audio: " << file << " has to be 16 bit PCM, " << CHANNELS << " channel, " << SAMPLE_RATE <<
+			" Hz with at least " << AUDIO_BUFFER_SAMPLES << " samples" << endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+//one second, integer frequencies loop without a click
+static void generate_tone(float hz, vector<int16_t> *samples)
+{
+	samples->resize(SAMPLE_RATE * CHANNELS);
+
+	for(int i = 0; i < SAMPLE_RATE; ++i)
+		for(int c = 0; c < CHANNELS; ++c)
+			(*samples)[i * CHANNELS + c] = (int16_t)(8192.0 * sin(2 * M_PI * hz * i / SAMPLE_RATE));
+}
+
+static void audio_file_thread(audio_file *f)
+{
+	const chrono::microseconds period(1000000LL * AUDIO_BUFFER_SAMPLES / SAMPLE_RATE);
+	const size_t chunk = AUDIO_BUFFER_SAMPLES * CHANNELS;
+	vector<int16_t> buffer(chunk);
+	chrono::steady_clock::time_point next = chrono::steady_clock::now();
+	size_t pos = 0;
+
+	while(f->keep_working)
+	{
+		//chunk is ready when its last sample would have been captured
+		next += period;
+		this_thread::sleep_until(next);
+
+		for(size_t i = 0; i < chunk; ++i, pos = (pos + 1) % f->samples.size())
+			buffer[i] = f->samples[pos];
+
+		audio_publish(*f->state, &buffer[0], chunk * BYTES_PER_SAMPLE, audio_now_us());
+	}
+}
+
+struct audio_file *audio_file_init(audio_state &state, const audio_config &config)
+{
+	audio_file *f = new audio_file();
+	f->state = &state;
+
+	if(config.backend == AUDIO_WAV)
+	{
+		if(load_wav(config.file, &f->samples) < 0)
+		{
+			delete f;
+			return NULL;
+		}
+	}
+	else
+		generate_tone(config.tone_hz, &f->samples);
+
+	f->worker_thread = thread(audio_file_thread, f);
+
+	return f;
+}
+
+void audio_file_close(struct audio_file *f)
+{
+	if(!f)
+		return;
+
+	f->keep_working = false;
+
+	if(f->worker_thread.joinable())
+		f->worker_thread.join();
+
+	delete f;
+}
@@ -0,0 +1,25 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Audio file and tone
+ * - 16 bit mono SAMPLE_RATE .wav in a loop or synthetic sine tone
+ * - chunks of AUDIO_BUFFER_SAMPLES published at real time rate, like capture would
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef AUDIO_FILE_H
+#define AUDIO_FILE_H
+
+#include "audio.h"
+
+struct audio_file;
+
+// AUDIO_WAV or AUDIO_TONE config, NULL on failure
+struct audio_file *audio_file_init(audio_state &state, const audio_config &config);
+void audio_file_close(struct audio_file *f);
+
+#endif
@@ -2,9 +2,15 @@
 
 #include "audio_winmm.h"
 
-struct audio* audio_init(audio_state& cfg)
+#include <iostream>
+
+using namespace std;
+
+static void CALLBACK audio_callback_wavedata(HWAVEIN hwi, UINT uMsg, DWORD_PTR dwInstance, DWORD_PTR dwParam1, DWORD_PTR dwParam2);
+
+struct audio_winmm* audio_winmm_init(audio_state& state)
 {
-    audio* a = new audio();
+    audio_winmm* a = new audio_winmm();
 
     // Fill the WAVEFORMATEX struct to indicate the format of our recorded audio
     //   For this example we'll use medium quality, ie: 24000 Hz, mono, 16-bit signed ints
@@ -18,16 +24,23 @@ struct audio* audio_init(audio_state& cfg)
     wfx.nAvgBytesPerSec = wfx.nBlockAlign * wfx.nSamplesPerSec;
 
     // Open our 'waveIn' recording device
-    waveInOpen(&a->wi,                   // fill our 'wi' handle
+    MMRESULT result = waveInOpen(&a->wi, // fill our 'wi' handle
         WAVE_MAPPER,                    // use default device (easiest)
         &wfx,                           // tell it our format
         (DWORD_PTR)audio_callback_wavedata,   // call us back when a buffer is full
-        (DWORD_PTR)&cfg,                 // dwInstance (user data to pass back to the callback)
+        (DWORD_PTR)&state,               // dwInstance (user data to pass back to the callback)
         CALLBACK_FUNCTION | WAVE_FORMAT_DIRECT   // tell it callback is a function CALLBACK_FUNCTION
     );
 
+    if (result != MMSYSERR_NOERROR)
+    {
+        cerr << "audio: unable to open WinMM capture device, error " << result << endl;
+        delete a;
+        return NULL;
+    }
+
     // initialise the headers and buffers
-    for (int i = 0; i < 2; ++i)
+    for (int i = 0; i < AUDIO_WINMM_BUFFERS; ++i)
     {
         a->headers[i].lpData = a->buffers[i];                         // give it a pointer to our buffer
         a->headers[i].dwBufferLength = AUDIO_BUFFER_SAMPLES * CHANNELS * BYTES_PER_SAMPLE;   // tell it the size of that buffer in bytes
@@ -49,11 +62,10 @@ struct audio* audio_init(audio_state& cfg)
 
 /// <summary>
 /// Callback implementation
-/// In the callback thread, lock the audio buffer and
-/// copy the PCM data straight over
-/// releasing the lock at the end and releasing the audio buffers back to the WaveIn device
+/// In the callback thread, copy the PCM data straight over to the lock free audio ring
+/// and wake up the sender, then release the audio buffers back to the WaveIn device
 /// </summary>
-void CALLBACK audio_callback_wavedata(HWAVEIN hwi, UINT uMsg, DWORD_PTR dwInstance, DWORD_PTR dwParam1, DWORD_PTR dwParam2)
+static void CALLBACK audio_callback_wavedata(HWAVEIN hwi, UINT uMsg, DWORD_PTR dwInstance, DWORD_PTR dwParam1, DWORD_PTR dwParam2)
 {
     // only process DATA, no need to do anything with open/close
     if (WIM_DATA == uMsg)
@@ -61,14 +73,7 @@ void CALLBACK audio_callback_wavedata(HWAVEIN hwi, UINT uMsg, DWORD_PTR dwInstan
         WAVEHDR* h = (WAVEHDR*)dwParam1;
         audio_state* state = (audio_state*)dwInstance;
 
-        {  // use the scope operator to release the lock before notify()
-            std::lock_guard<std::mutex> guard(*state->data_mutex);
-            memcpy(state->audio_buffer, h->lpData, h->dwBytesRecorded);
-            state->audio_data_length_written = h->dwBytesRecorded;
-            state->audio_data_ready = true;
-            *state->data_ready = true;
-        }
-        state->cv->notify_one();
+        audio_publish(*state, h->lpData, h->dwBytesRecorded, audio_now_us());
 
         // then re-add the buffer to the queue
         h->dwFlags = 0;          // clear the 'done' flag
@@ -78,8 +83,11 @@ void CALLBACK audio_callback_wavedata(HWAVEIN hwi, UINT uMsg, DWORD_PTR dwInstan
     }
 }
 
-void audio_close(audio* a)
+void audio_winmm_close(audio_winmm* a)
 {
+    if (!a)
+        return;
+
     waveInStop(a->wi);
     for (auto& h : a->headers)
     {
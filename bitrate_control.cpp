@@ -0,0 +1,429 @@
+#include "bitrate_control.h"
+#include "options.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// loss above that backs off proportionally, between the thresholds holds
+static const double LOSS_DECREASE = 0.05;
+static const double LOSS_HOLD = 0.02;
+// queue building up, jitter above that many times its baseline (plus margin)
+static const double JITTER_FACTOR = 2.0;
+static const double JITTER_MARGIN_US = 5000.0;
+static const double JITTER_DECREASE = 0.85;
+// growth per second without congestion
+static const double INCREASE_PER_SECOND = 0.08;
+// hysteresis of applied targets, changes are delayed and in larger steps (hardware encoders restart)
+static const double APPLY_DECREASE = 0.95;
+static const double APPLY_INCREASE = 1.10;
+
+struct bitrate_control
+{
+	int fd;
+	int port;
+	int streams;
+	int floor[BITRATE_MAX_STREAMS];
+	int ceiling[BITRATE_MAX_STREAMS];
+	int target[BITRATE_MAX_STREAMS]; //applied
+
+	double total;        //joint target, follows the reports
+	double applied;      //joint target when targets were last applied
+	double jitter_base;  //lowest jitter, slowly rising to follow the link
+	uint32_t since_change_ms;
+	bool decreased;      //last applied change
+
+	//reports combined until there are enough packets to judge loss
+	uint32_t window_packets, window_lost, window_ms;
+	bool window_queuing;
+
+	bool started;
+	uint32_t sequence;
+	uint64_t reports, packets, lost, decreases, increases;
+};
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v & 0xFF; p[1] = v >> 8; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v & 0xFFFF); put16(p + 2, v >> 16); }
+static uint16_t get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static uint32_t get32(const uint8_t *p) { return get16(p) | ((uint32_t)get16(p + 2) << 16); }
+
+int bitrate_feedback_pack(const bitrate_feedback &report, uint8_t *out)
+{
+	out[0] = 'R';
+	out[1] = 'F';
+	out[2] = 'B';
+	out[3] = BITRATE_FEEDBACK_VERSION;
+	put32(out + 4, report.sequence);
+	put32(out + 8, report.interval_ms);
+	put32(out + 12, report.packets);
+	put32(out + 16, report.lost);
+	put32(out + 20, report.jitter_us);
+
+	return BITRATE_FEEDBACK_SIZE;
+}
+
+bool bitrate_feedback_read(const uint8_t *data, int size, bitrate_feedback *report)
+{
+	if(size < BITRATE_FEEDBACK_SIZE || data[0] != 'R' || data[1] != 'F' || data[2] != 'B' ||
+		data[3] != BITRATE_FEEDBACK_VERSION)
+		return false;
+
+	report->sequence = get32(data + 4);
+	report->interval_ms = get32(data + 8);
+	report->packets = get32(data + 12);
+	report->lost = get32(data + 16);
+	report->jitter_us = get32(data + 20);
+
+	return report->lost <= report->packets;
+}
+
+//floors first, the rest in proportion to the range of each stream
+static void split(bitrate_control *c, double total)
+{
+	double floors = 0.0, ranges = 0.0;
+
+	for(int i = 0; i < c->streams; ++i)
+	{
+		floors += c->floor[i];
+		ranges += c->ceiling[i] - c->floor[i];
+	}
+
+	const double share = ranges > 0.0 ? (total - floors) / ranges : 0.0;
+
+	for(int i = 0; i < c->streams; ++i)
+		c->target[i] = c->floor[i] + (int)(share * (c->ceiling[i] - c->floor[i]));
+}
+
+static double clamp_total(const bitrate_control *c, double total)
+{
+	double floors = 0.0, ceilings = 0.0;
+
+	for(int i = 0; i < c->streams; ++i)
+	{
+		floors += c->floor[i];
+		ceilings += c->ceiling[i];
+	}
+
+	return total < floors ? floors : (total > ceilings ? ceilings : total);
+}
+
+struct bitrate_control *bitrate_control_init(const bitrate_control_config &config, const int *bitrates, int streams)
+{
+	if(streams < 1 || streams > BITRATE_MAX_STREAMS)
+	{
+		cerr << "bitrate control: unsupported number of streams " << streams << endl;
+		return NULL;
+	}
+
+	bitrate_control *c = new bitrate_control();
+
+	c->fd = -1;
+	c->streams = streams;
+	c->total = 0.0;
+
+	for(int i = 0; i < streams; ++i)
+	{
+		c->ceiling[i] = config.ceiling[i] ? config.ceiling[i] : bitrates[i];
+		c->floor[i] = config.floor[i] ? config.floor[i] : c->ceiling[i] / 8;
+
+		if(c->ceiling[i] <= 0 || c->floor[i] > c->ceiling[i])
+		{
+			cerr << "bitrate control: stream " << i << " needs bitrate or --abr-ceiling (and floor below ceiling)" << endl;
+			bitrate_control_close(c);
+			return NULL;
+		}
+
+		c->total += bitrates[i] > 0 ? bitrates[i] : c->ceiling[i];
+	}
+
+	c->total = c->applied = clamp_total(c, c->total);
+	split(c, c->total);
+
+#ifdef _WIN32
+	cerr << "bitrate control: feedback socket is not supported on Windows" << endl;
+	bitrate_control_close(c);
+	return NULL;
+#else
+	sockaddr_in address = {};
+	socklen_t length = sizeof(address);
+
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(config.port);
+
+	if( (c->fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ||
+		bind(c->fd, (sockaddr*)&address, sizeof(address)) != 0 ||
+		getsockname(c->fd, (sockaddr*)&address, &length) != 0)
+	{
+		cerr << "bitrate control: unable to listen for feedback on UDP port " << config.port << endl;
+		bitrate_control_close(c);
+		return NULL;
+	}
+
+	c->port = ntohs(address.sin_port);
+#endif
+
+	cout << "bitrate control: feedback on UDP port " << c->port;
+	for(int i = 0; i < streams; ++i)
+		cout << ", stream " << i << " " << c->floor[i] / 1000 << "-" << c->ceiling[i] / 1000 << " kbit/s";
+	cout << endl;
+
+	return c;
+}
+
+void bitrate_control_close(struct bitrate_control *c)
+{
+	if(!c)
+		return;
+#ifndef _WIN32
+	if(c->fd >= 0)
+		close(c->fd);
+#endif
+	delete c;
+}
+
+int bitrate_control_port(const struct bitrate_control *c)
+{
+	return c->port;
+}
+
+bool bitrate_control_update(struct bitrate_control *c, const bitrate_feedback &report)
+{
+	//duplicated or reordered datagrams
+	if(c->started && (int32_t)(report.sequence - c->sequence) <= 0)
+		return false;
+
+	c->started = true;
+	c->sequence = report.sequence;
+	++c->reports;
+	c->packets += report.packets;
+	c->lost += report.lost;
+	c->since_change_ms += report.interval_ms;
+
+	const double jitter = report.jitter_us;
+
+	if(c->reports == 1 || jitter < c->jitter_base)
+		c->jitter_base = jitter;
+
+	const bool queuing = jitter > JITTER_FACTOR * c->jitter_base + JITTER_MARGIN_US;
+
+	//follows slowly rising jitter of the link, but not the queue we are building
+	if(!queuing)
+		c->jitter_base += (jitter - c->jitter_base) * 0.01;
+
+	c->window_packets += report.packets;
+	c->window_lost += report.lost;
+	c->window_ms += report.interval_ms;
+	c->window_queuing |= queuing;
+
+	//at low bitrate or short intervals one lost packet of a report would read as heavy loss
+	if(c->window_packets < BITRATE_LOSS_PACKETS && c->window_ms < BITRATE_LOSS_WINDOW_MS)
+		return false;
+
+	const double loss = c->window_packets ? (double)c->window_lost / c->window_packets : 0.0;
+
+	if(loss > LOSS_DECREASE)
+		c->total *= 1.0 - loss / 2.0;
+	else if(c->window_queuing)
+	{
+		//the queue takes a while to drain after a decrease, don't back off again on the same queue
+		const uint32_t drain_ms = c->decreased ? BITRATE_INCREASE_HOLD_MS : BITRATE_DECREASE_HOLD_MS;
+
+		if(c->since_change_ms >= drain_ms && c->total >= c->applied)
+			c->total *= JITTER_DECREASE;
+	}
+	else if(loss <= LOSS_HOLD)
+		c->total *= 1.0 + INCREASE_PER_SECOND * c->window_ms / 1000.0;
+
+	c->total = clamp_total(c, c->total);
+	c->window_packets = c->window_lost = c->window_ms = 0;
+	c->window_queuing = false;
+
+	//reaching floor or ceiling is worth a change even if the step is small
+	//during the hold the target keeps following reports, applied in one step after it
+	const bool limit = c->total == clamp_total(c, 0.0) || c->total == clamp_total(c, 1e12);
+	const bool decrease = c->total < c->applied && c->since_change_ms >= BITRATE_DECREASE_HOLD_MS &&
+		(limit || c->total < c->applied * APPLY_DECREASE);
+	const bool increase = c->total > c->applied && c->since_change_ms >= BITRATE_INCREASE_HOLD_MS &&
+		(limit || c->total > c->applied * APPLY_INCREASE);
+
+	if(!decrease && !increase)
+		return false;
+
+	c->decreased = c->total < c->applied;
+
+	if(c->decreased)
+		++c->decreases;
+	else
+		++c->increases;
+
+	c->applied = c->total;
+	c->since_change_ms = 0;
+	split(c, c->applied);
+
+	return true;
+}
+
+bool bitrate_control_poll(struct bitrate_control *c)
+{
+	bool changed = false;
+#ifndef _WIN32
+	uint8_t data[256];
+	ssize_t size;
+	bitrate_feedback report;
+
+	while( (size = recv(c->fd, data, sizeof(data), MSG_DONTWAIT)) >= 0 )
+		if(bitrate_feedback_read(data, (int)size, &report))
+			changed |= bitrate_control_update(c, report);
+#endif
+	return changed;
+}
+
+int bitrate_control_target(const struct bitrate_control *c, int stream)
+{
+	return c->target[stream];
+}
+
+void bitrate_control_report(ostream &out, const struct bitrate_control *c)
+{
+	out << "bitrate control: " << c->reports << " reports, loss " <<
+		(c->packets ? 100.0 * c->lost / c->packets : 0.0) << "%, " << c->decreases << " decreases, " <<
+		c->increases << " increases, targets";
+
+	for(int i = 0; i < c->streams; ++i)
+		out << " " << c->target[i] / 1000;
+
+	out << " kbit/s" << endl;
+}
+
+struct bitrate_feedback_sender
+{
+	int fd;
+#ifndef _WIN32
+	sockaddr_in address;
+#endif
+};
+
+struct bitrate_feedback_sender *bitrate_feedback_sender_init(const char *host, int port)
+{
+#ifdef _WIN32
+	cerr << "bitrate feedback: not supported on Windows" << endl;
+	return NULL;
+#else
+	bitrate_feedback_sender *s = new bitrate_feedback_sender();
+
+	s->address.sin_family = AF_INET;
+	s->address.sin_port = htons(port);
+
+	if(inet_pton(AF_INET, host, &s->address.sin_addr) != 1 || (s->fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+	{
+		cerr << "bitrate feedback: unable to send to " << host << ":" << port << endl;
+		delete s;
+		return NULL;
+	}
+
+	return s;
+#endif
+}
+
+void bitrate_feedback_sender_close(struct bitrate_feedback_sender *s)
+{
+	if(!s)
+		return;
+#ifndef _WIN32
+	close(s->fd);
+#endif
+	delete s;
+}
+
+int bitrate_feedback_send(struct bitrate_feedback_sender *s, const bitrate_feedback &report)
+{
+#ifdef _WIN32
+	return -1;
+#else
+	uint8_t data[BITRATE_FEEDBACK_SIZE];
+	const int size = bitrate_feedback_pack(report, data);
+
+	return sendto(s->fd, data, size, 0, (const sockaddr*)&s->address, sizeof(s->address)) == size ? 0 : -1;
+#endif
+}
+
+//one value for all streams or comma separated value of each
+static int parse_rates(const char *value, const char *name, int *rates)
+{
+	const char *p = value;
+
+	for(int i = 0; i < BITRATE_MAX_STREAMS; ++i)
+	{
+		char *end;
+		rates[i] = strtol(p, &end, 10);
+
+		if(end == p || rates[i] <= 0 || (*end != '\0' && *end != ','))
+		{
+			cerr << "invalid --" << name << " '" << value << "', expected bits per second (comma separated for each stream)" << endl;
+			return -1;
+		}
+
+		if(*end == '\0')
+		{
+			for(int j = i + 1; j < BITRATE_MAX_STREAMS; ++j)
+				rates[j] = (i == 0) ? rates[0] : 0;
+			return 0;
+		}
+
+		p = end + 1;
+	}
+
+	cerr << "invalid --" << name << " '" << value << "', at most " << BITRATE_MAX_STREAMS << " streams" << endl;
+	return -1;
+}
+
+int bitrate_control_options(int *argc, char *argv[], bitrate_control_config *config)
+{
+	const char *port = option_value(argc, argv, "abr");
+	const char *floor = option_value(argc, argv, "abr-floor");
+	const char *ceiling = option_value(argc, argv, "abr-ceiling");
+
+	memset(config, 0, sizeof(*config));
+
+	if(port)
+	{
+		char *end;
+		config->port = strtol(port, &end, 10);
+
+		if(*port == '\0' || *end != '\0' || config->port <= 0 || config->port > 65535)
+		{
+			cerr << "invalid --abr '" << port << "', expected UDP port for receiver feedback" << endl;
+			return -1;
+		}
+	}
+
+	if((floor && parse_rates(floor, "abr-floor", config->floor) < 0) ||
+		(ceiling && parse_rates(ceiling, "abr-ceiling", config->ceiling) < 0))
+		return -1;
+
+	if((floor || ceiling) && !port)
+	{
+		cerr << "--abr-floor and --abr-ceiling need --abr" << endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+void bitrate_control_usage(ostream &out)
+{
+	out << "adaptive bitrate options:" << endl
+	    << "       --abr <port> # adapt encoder bitrates to receiver loss/jitter reports on this UDP port" << endl
+	    << "       --abr-floor <bps>[,<bps>] # lowest bitrate of each stream, default ceiling / 8" << endl
+	    << "       --abr-ceiling <bps>[,<bps>] # highest bitrate of each stream, default the configured bitrate" << endl;
+}
@@ -0,0 +1,89 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Adaptive bitrate
+ * - receiver reports loss and arrival jitter over UDP back-channel (small "RFB" datagrams)
+ * - joint target for all the encoders, multiplicative decrease on loss or growing jitter, slow increase otherwise
+ * - split between streams (e.g. depth and color) within separate floor and ceiling of each
+ * - loss judged over at least BITRATE_LOSS_PACKETS (reports combined), a single lost packet of a short report is no congestion
+ * - hysteresis, hardware encoders restart (keyframe) on change, so targets change rarely and in larger steps
+ *   at least BITRATE_DECREASE_HOLD_MS after the previous change for decreases, BITRATE_INCREASE_HOLD_MS for increases
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef BITRATE_CONTROL_H
+#define BITRATE_CONTROL_H
+
+#include <ostream>
+#include <stdint.h>
+
+// report datagram
+// 0-3 'R' 'F' 'B' version, 4-7 report sequence, 8-11 interval covered (ms), 12-15 packets expected in interval,
+// 16-19 packets lost in interval, 20-23 interarrival jitter (us, RFC 3550 style), little endian uint32
+#define BITRATE_FEEDBACK_VERSION 1
+#define BITRATE_FEEDBACK_SIZE 24
+#define BITRATE_MAX_STREAMS 2
+// reports are combined until that many packets (or BITRATE_LOSS_WINDOW_MS of slow stream) before loss is judged
+#define BITRATE_LOSS_PACKETS 100
+#define BITRATE_LOSS_WINDOW_MS 1000
+// the least time between applied changes, the target keeps following reports meanwhile and is applied in one step
+#define BITRATE_DECREASE_HOLD_MS 500
+#define BITRATE_INCREASE_HOLD_MS 2000
+
+struct bitrate_feedback
+{
+	uint32_t sequence;
+	uint32_t interval_ms;
+	uint32_t packets;
+	uint32_t lost;
+	uint32_t jitter_us;
+};
+
+// receiving end, returns BITRATE_FEEDBACK_SIZE
+int bitrate_feedback_pack(const bitrate_feedback &report, uint8_t *out);
+// false if it is not a valid report
+bool bitrate_feedback_read(const uint8_t *data, int size, bitrate_feedback *report);
+
+struct bitrate_control_config
+{
+	int port;                          //UDP port for receiver reports, 0 disables adaptive bitrate
+	int floor[BITRATE_MAX_STREAMS];    //bits per second, 0 for default (ceiling / 8)
+	int ceiling[BITRATE_MAX_STREAMS];  //bits per second, 0 for the configured encoder bitrate
+};
+
+struct bitrate_control;
+
+// bitrates are the configured ones of each stream (start and default ceilings), NULL on failure
+// binds config.port, 0 here binds any free port (see bitrate_control_port)
+struct bitrate_control *bitrate_control_init(const bitrate_control_config &config, const int *bitrates, int streams);
+void bitrate_control_close(struct bitrate_control *c);
+
+// bound UDP port (e.g. when any port was requested)
+int bitrate_control_port(const struct bitrate_control *c);
+
+// reads all pending reports without blocking, true if targets changed (apply them to encoders)
+bool bitrate_control_poll(struct bitrate_control *c);
+
+// single report (e.g. injected), true if targets changed
+bool bitrate_control_update(struct bitrate_control *c, const bitrate_feedback &report);
+
+int bitrate_control_target(const struct bitrate_control *c, int stream);
+
+// reports, loss, changes and current targets
+void bitrate_control_report(std::ostream &out, const struct bitrate_control *c);
+
+// receiver stand-in (loopback tests), sends reports to host:port, NULL on failure
+struct bitrate_feedback_sender;
+struct bitrate_feedback_sender *bitrate_feedback_sender_init(const char *host, int port);
+void bitrate_feedback_sender_close(struct bitrate_feedback_sender *s);
+int bitrate_feedback_send(struct bitrate_feedback_sender *s, const bitrate_feedback &report);
+
+// removes recognized options from argv, -1 on invalid value
+int bitrate_control_options(int *argc, char *argv[], bitrate_control_config *config);
+void bitrate_control_usage(std::ostream &out);
+
+#endif
@@ -0,0 +1,534 @@
+#include "bitstream_recorder.h"
+#include "options.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+
+// each buffer is written with a single call, ~16 MB per channel for the writer to fall behind
+static const size_t BUFFER_BYTES = 2 * 1024 * 1024;
+static const int BUFFERS = 8;
+static const size_t ALIGNMENT = 4096;
+// partially filled buffers are written at least that often
+static const chrono::milliseconds FLUSH_INTERVAL(500);
+
+struct packet_entry
+{
+	uint32_t offset;
+	uint32_t size;
+	int64_t time_us;
+	bool keyframe;
+};
+
+struct record_buffer
+{
+	uint8_t *memory;
+	uint8_t *data; //page aligned
+	size_t used;
+	vector<packet_entry> packets;
+};
+
+struct record_channel
+{
+	recorder_codec codec;
+
+	// guarded by recorder mutex
+	record_buffer *active;            //filled by encoder thread
+	vector<record_buffer*> free;
+	deque<record_buffer*> full;       //waiting for writer
+	bool skip_to_keyframe;            //after a drop the stream resumes decodable
+	uint64_t packets, bytes, dropped;
+
+	// writer thread only
+	FILE *file;
+	int segment;
+	uint64_t segment_bytes;
+	int64_t segment_start_us;
+	vector<uint8_t> parameter_sets;   //from the first keyframe, repeated in segments if missing
+	uint64_t segments;                //guarded by recorder mutex (for reporting)
+};
+
+struct bitstream_recorder
+{
+	bitstream_recorder_config config;
+	vector<record_channel> channels;
+	FILE *index;
+
+	mutable mutex buffers_mutex;
+	condition_variable writer_cv;
+	thread writer_thread;
+	bool quit;
+
+	bitstream_recorder() :
+		index(NULL),
+		quit(false)
+	{}
+};
+
+static void writer_thread(bitstream_recorder *r);
+
+static int64_t now_us()
+{
+	return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static record_buffer *buffer_alloc()
+{
+	record_buffer *b = new record_buffer();
+
+	b->memory = (uint8_t*)malloc(BUFFER_BYTES + ALIGNMENT);
+
+	if(!b->memory)
+	{
+		delete b;
+		return NULL;
+	}
+
+	b->data = (uint8_t*)(((uintptr_t)b->memory + ALIGNMENT - 1) & ~(uintptr_t)(ALIGNMENT - 1));
+	b->used = 0;
+
+	return b;
+}
+
+static void buffer_free(record_buffer *b)
+{
+	if(!b)
+		return;
+
+	free(b->memory);
+	delete b;
+}
+
+struct bitstream_recorder *bitstream_recorder_init(const bitstream_recorder_config &config, const recorder_codec *codecs, int channels)
+{
+	bitstream_recorder *r = new bitstream_recorder();
+	const string index = string(config.prefix) + ".index";
+
+	r->config = config;
+	r->channels.resize(channels);
+
+	for(int i = 0; i < channels; ++i)
+	{
+		record_channel &c = r->channels[i];
+
+		c.codec = codecs[i];
+		c.active = NULL;
+		c.skip_to_keyframe = false;
+		c.packets = c.bytes = c.dropped = 0;
+		c.file = NULL;
+		c.segment = -1;
+		c.segment_bytes = 0;
+		c.segment_start_us = 0;
+		c.segments = 0;
+
+		for(int b = 0; b < BUFFERS; ++b)
+		{
+			record_buffer *buffer = buffer_alloc();
+
+			if(!buffer)
+			{
+				cerr << "recorder: failed to allocate buffers" << endl;
+				bitstream_recorder_close(r);
+				return NULL;
+			}
+
+			c.free.push_back(buffer);
+		}
+	}
+
+	if( (r->index = fopen(index.c_str(), "w")) == NULL )
+	{
+		cerr << "recorder: unable to open " << index << endl;
+		bitstream_recorder_close(r);
+		return NULL;
+	}
+
+	fprintf(r->index, "# channel segment offset size time_us keyframe\n");
+
+	r->writer_thread = thread(writer_thread, r);
+
+	cout << "Recording to " << config.prefix << "_*" << endl;
+
+	return r;
+}
+
+void bitstream_recorder_close(struct bitstream_recorder *r)
+{
+	if(!r)
+		return;
+
+	{
+		lock_guard<mutex> lock(r->buffers_mutex);
+		r->quit = true;
+	}
+	r->writer_cv.notify_one();
+
+	if(r->writer_thread.joinable())
+		r->writer_thread.join();
+
+	for(size_t i = 0; i < r->channels.size(); ++i)
+	{
+		record_channel &c = r->channels[i];
+
+		if(c.file)
+			fclose(c.file);
+
+		buffer_free(c.active);
+
+		for(size_t b = 0; b < c.free.size(); ++b)
+			buffer_free(c.free[b]);
+		for(size_t b = 0; b < c.full.size(); ++b)
+			buffer_free(c.full[b]);
+	}
+
+	if(r->index)
+		fclose(r->index);
+
+	delete r;
+}
+
+bool bitstream_recorder_write(struct bitstream_recorder *r, int channel, const uint8_t *data, int size, bool keyframe)
+{
+	record_channel &c = r->channels[channel];
+	bool notify = false;
+
+	{
+		lock_guard<mutex> lock(r->buffers_mutex);
+
+		//the writer keeps full buffers, nothing to copy to
+		if((c.skip_to_keyframe && !keyframe) || (size_t)size > BUFFER_BYTES)
+		{
+			++c.dropped;
+			return false;
+		}
+
+		if(!c.active || c.active->used + size > BUFFER_BYTES)
+		{
+			if(c.active)
+			{
+				c.full.push_back(c.active);
+				c.active = NULL;
+				notify = true;
+			}
+
+			if(c.free.empty())
+			{
+				++c.dropped;
+				c.skip_to_keyframe = true;
+				return false;
+			}
+
+			c.active = c.free.back();
+			c.free.pop_back();
+			c.active->used = 0;
+			c.active->packets.clear();
+		}
+
+		packet_entry entry = {(uint32_t)c.active->used, (uint32_t)size, now_us(), keyframe};
+
+		memcpy(c.active->data + c.active->used, data, size);
+		c.active->used += size;
+		c.active->packets.push_back(entry);
+		c.skip_to_keyframe = false;
+		++c.packets;
+		c.bytes += size;
+	}
+
+	if(notify)
+		r->writer_cv.notify_one();
+
+	return true;
+}
+
+//Annex B start code (00 00 01, also the tail of 00 00 00 01) at or after p, end if none
+static const uint8_t *find_start_code(const uint8_t *p, const uint8_t *end)
+{
+	for(; end - p >= 3; ++p)
+		if(p[0] == 0 && p[1] == 0 && p[2] == 1)
+			return p;
+
+	return end;
+}
+
+static bool is_parameter_set(recorder_codec codec, uint8_t nal_header)
+{
+	if(codec == RECORDER_H264)
+	{
+		const int type = nal_header & 0x1F;
+		return type == 7 || type == 8; //SPS, PPS
+	}
+
+	const int type = (nal_header >> 1) & 0x3F;
+	return type >= 32 && type <= 34; //VPS, SPS, PPS
+}
+
+//appends parameter set NAL units (with start codes) to out, true if there were any
+static bool parameter_sets(recorder_codec codec, const uint8_t *data, size_t size, vector<uint8_t> *out)
+{
+	const uint8_t *end = data + size;
+	const uint8_t *nal = find_start_code(data, end);
+	bool found = false;
+
+	while(nal < end)
+	{
+		const uint8_t *next = find_start_code(nal + 3, end);
+
+		if(nal + 3 < end && is_parameter_set(codec, nal[3]))
+		{
+			found = true;
+			if(out)
+				out->insert(out->end(), nal, next);
+		}
+
+		nal = next;
+	}
+
+	return found;
+}
+
+static FILE *open_segment(bitstream_recorder *r, int channel)
+{
+	record_channel &c = r->channels[channel];
+	char name[32];
+
+	snprintf(name, sizeof(name), "_%d_%04d.%s", channel, c.segment + 1, c.codec == RECORDER_H264 ? "h264" : "hevc");
+
+	const string file = string(r->config.prefix) + name;
+	FILE *f = fopen(file.c_str(), "wb");
+
+	if(!f)
+	{
+		cerr << "recorder: unable to open " << file << endl;
+		return NULL;
+	}
+
+	//our buffers are large already, write them with single call
+	setvbuf(f, NULL, _IONBF, 0);
+
+	return f;
+}
+
+static bool segment_due(const bitstream_recorder *r, const record_channel &c, const packet_entry &p)
+{
+	const uint64_t max_bytes = (uint64_t)r->config.segment_mb * 1024 * 1024;
+	const int64_t max_us = (int64_t)r->config.segment_seconds * 1000000;
+
+	return !c.file ||
+		(max_bytes && c.segment_bytes >= max_bytes) ||
+		(max_us && p.time_us - c.segment_start_us >= max_us);
+}
+
+static void write_range(record_channel &c, const uint8_t *data, size_t size)
+{
+	if(size && c.file && fwrite(data, 1, size, c.file) != size)
+	{
+		cerr << "recorder: write failed, closing segment" << endl;
+		fclose(c.file);
+		c.file = NULL;
+	}
+}
+
+//contiguous runs of packets in one write, segments start at keyframes
+static void write_buffer(bitstream_recorder *r, int channel, const record_buffer *b)
+{
+	record_channel &c = r->channels[channel];
+	size_t run = 0; //start of not yet written data
+
+	for(size_t i = 0; i < b->packets.size(); ++i)
+	{
+		const packet_entry &p = b->packets[i];
+		const uint8_t *data = b->data + p.offset;
+
+		if(p.keyframe && c.parameter_sets.empty())
+			parameter_sets(c.codec, data, p.size, &c.parameter_sets);
+
+		if(p.keyframe && segment_due(r, c, p))
+		{
+			write_range(c, b->data + run, p.offset - run);
+			run = p.offset;
+
+			if(c.file)
+				fclose(c.file);
+
+			++c.segment;
+			c.segment_bytes = 0;
+			c.segment_start_us = p.time_us;
+
+			if( (c.file = open_segment(r, channel)) != NULL)
+			{
+				lock_guard<mutex> lock(r->buffers_mutex);
+				++c.segments;
+			}
+
+			//e.g. x264/x265 send parameter sets only with the first keyframe
+			if(!parameter_sets(c.codec, data, p.size, NULL))
+			{
+				write_range(c, c.parameter_sets.data(), c.parameter_sets.size());
+				c.segment_bytes += c.parameter_sets.size();
+			}
+		}
+
+		//nothing decodable before the first keyframe
+		if(!c.file)
+		{
+			run = p.offset + p.size;
+			continue;
+		}
+
+		fprintf(r->index, "%d %d %llu %u %lld %d\n", channel, c.segment, (unsigned long long)c.segment_bytes, p.size,
+			(long long)p.time_us, p.keyframe ? 1 : 0);
+
+		c.segment_bytes += p.size;
+	}
+
+	write_range(c, b->data + run, b->used - run);
+}
+
+static void writer_thread(bitstream_recorder *r)
+{
+	vector<pair<int, record_buffer*> > work;
+
+	for(;;)
+	{
+		bool quit;
+
+		{
+			unique_lock<mutex> lock(r->buffers_mutex);
+
+			r->writer_cv.wait_for(lock, FLUSH_INTERVAL, [&] {
+				if(r->quit)
+					return true;
+				for(size_t i = 0; i < r->channels.size(); ++i)
+					if(!r->channels[i].full.empty())
+						return true;
+				return false;
+			});
+
+			quit = r->quit;
+
+			for(size_t i = 0; i < r->channels.size(); ++i)
+			{
+				record_channel &c = r->channels[i];
+
+				//on timeout and at exit partially filled buffers go too
+				if(c.full.empty() && c.active && c.active->used)
+				{
+					c.full.push_back(c.active);
+					c.active = NULL;
+				}
+
+				while(!c.full.empty())
+				{
+					work.push_back(make_pair((int)i, c.full.front()));
+					c.full.pop_front();
+				}
+			}
+		}
+
+		//no lock held while writing, encoders keep filling free buffers
+		for(size_t i = 0; i < work.size(); ++i)
+			write_buffer(r, work[i].first, work[i].second);
+
+		fflush(r->index);
+
+		{
+			lock_guard<mutex> lock(r->buffers_mutex);
+
+			for(size_t i = 0; i < work.size(); ++i)
+				r->channels[work[i].first].free.push_back(work[i].second);
+		}
+
+		if(quit && work.empty())
+			return;
+
+		work.clear();
+	}
+}
+
+void bitstream_recorder_report(ostream &out, const struct bitstream_recorder *r)
+{
+	lock_guard<mutex> lock(r->buffers_mutex);
+
+	for(size_t i = 0; i < r->channels.size(); ++i)
+	{
+		const record_channel &c = r->channels[i];
+
+		out << "recorder channel " << i << ": " << c.packets << " packets, " << c.bytes / (1024.0 * 1024.0) << " MB in " <<
+			c.segments << " segments, dropped " << c.dropped << " (writer behind)" << endl;
+	}
+}
+
+recorder_codec bitstream_recorder_codec(const char *encoder)
+{
+	return strstr(encoder, "264") ? RECORDER_H264 : RECORDER_HEVC;
+}
+
+int bitstream_recorder_options(int *argc, char *argv[], bitstream_recorder_config *config)
+{
+	const char *prefix = option_value(argc, argv, "record");
+	const char *mb = option_value(argc, argv, "record-segment-mb");
+	const char *seconds = option_value(argc, argv, "record-segment-seconds");
+
+	config->prefix = NULL;
+	config->segment_mb = 0;
+	config->segment_seconds = 0;
+
+	if(prefix)
+	{
+		if(*prefix == '\0')
+		{
+			cerr << "invalid --record, expected files prefix e.g. recordings/session" << endl;
+			return -1;
+		}
+		config->prefix = prefix;
+	}
+
+	if(mb)
+	{
+		char *end;
+		config->segment_mb = strtol(mb, &end, 10);
+
+		if(*mb == '\0' || *end != '\0' || config->segment_mb <= 0)
+		{
+			cerr << "invalid --record-segment-mb '" << mb << "', expected positive number of MB" << endl;
+			return -1;
+		}
+	}
+
+	if(seconds)
+	{
+		char *end;
+		config->segment_seconds = strtol(seconds, &end, 10);
+
+		if(*seconds == '\0' || *end != '\0' || config->segment_seconds <= 0)
+		{
+			cerr << "invalid --record-segment-seconds '" << seconds << "', expected positive number of seconds" << endl;
+			return -1;
+		}
+	}
+
+	if((mb || seconds) && !prefix)
+	{
+		cerr << "--record-segment-mb and --record-segment-seconds need --record" << endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+void bitstream_recorder_usage(ostream &out)
+{
+	out << "record options:" << endl
+	    << "       --record <prefix> # archive streamed video as <prefix>_<channel>_<segment>.h264/hevc + <prefix>.index" << endl
+	    << "       --record-segment-mb <MB> # new segment (at keyframe) after that many MB, default no limit" << endl
+	    << "       --record-segment-seconds <s> # new segment (at keyframe) after that many seconds, default no limit" << endl;
+}
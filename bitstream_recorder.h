@@ -0,0 +1,54 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Bitstream recorder
+ * - archives encoded packets as they are streamed, Annex B elementary stream per channel (.h264/.hevc)
+ * - encoder threads only copy packets to large page aligned buffers, dedicated thread writes them
+ * - writer falling behind drops packets (counted) instead of blocking the send path
+ * - segments by size or time, each starting at keyframe with parameter sets
+ * - text index with time, segment and offset of each packet
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef BITSTREAM_RECORDER_H
+#define BITSTREAM_RECORDER_H
+
+#include <ostream>
+#include <stdint.h>
+
+enum recorder_codec { RECORDER_H264, RECORDER_HEVC };
+
+struct bitstream_recorder_config
+{
+	const char *prefix;  //files prefix (may include directory), NULL disables recording
+	int segment_mb;      //new segment after that many MB (at keyframe), 0 for no limit
+	int segment_seconds; //new segment after that many seconds (at keyframe), 0 for no limit
+};
+
+struct bitstream_recorder;
+
+// channel per encoder index, NULL on failure
+struct bitstream_recorder *bitstream_recorder_init(const bitstream_recorder_config &config, const recorder_codec *codecs, int channels);
+
+// writes everything still pending and closes the files, call when nobody records anymore
+void bitstream_recorder_close(struct bitstream_recorder *r);
+
+// from encoder threads, copies the packet and returns immediately
+// false if it was dropped because the writer is behind (then the channel resumes at keyframe)
+bool bitstream_recorder_write(struct bitstream_recorder *r, int channel, const uint8_t *data, int size, bool keyframe);
+
+// packets, bytes, segments and drops of each channel
+void bitstream_recorder_report(std::ostream &out, const struct bitstream_recorder *r);
+
+// codec of FFmpeg encoder name (e.g. h264_vaapi, libx265)
+recorder_codec bitstream_recorder_codec(const char *encoder);
+
+// removes recognized options from argv, -1 on invalid value
+int bitstream_recorder_options(int *argc, char *argv[], bitstream_recorder_config *config);
+void bitstream_recorder_usage(std::ostream &out);
+
+#endif
@@ -0,0 +1,190 @@
+#include "chroma_plane.h"
+
+#include <map>
+#include <mutex>
+#include <utility>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+#define CHROMA_PLANE_TILED
+#endif
+
+using namespace std;
+
+const uint8_t NV12_NEUTRAL = 128;
+const uint16_t P010LE_NEUTRAL = 512 << 6; //middle of 10 bit range in 10 MSB, equals 128 << 8, equals 32768
+
+struct chroma_plane
+{
+	uint8_t *data;
+	size_t size; //of mapping/allocation
+	bool mapped;
+};
+
+typedef pair<int, pair<int, int> > chroma_key; //format, stride, height
+
+static mutex planes_mutex;
+static map<chroma_key, chroma_plane> planes;
+
+static size_t page_size()
+{
+#if defined(_WIN32)
+	return 4096;
+#else
+	return sysconf(_SC_PAGESIZE);
+#endif
+}
+
+static void fill_neutral(uint8_t *data, size_t size, chroma_format format)
+{
+	if(format == CHROMA_NV12)
+	{
+		memset(data, NV12_NEUTRAL, size);
+		return;
+	}
+
+	uint16_t *uv = (uint16_t*)data;
+	for(size_t i = 0; i < size / 2; ++i)
+		uv[i] = P010LE_NEUTRAL;
+}
+
+#ifdef CHROMA_PLANE_TILED
+//the same tile filled with neutral value mapped over and over (each mapping is a VMA),
+//whatever the resolution it costs 64 KB of RAM and cache when encoders read it, e.g. 1080p P010LE plane takes 32 mappings
+static const size_t TILE_SIZE = 64 * 1024;
+
+static bool map_tiles(chroma_plane *plane, chroma_format format)
+{
+	const size_t page = page_size();
+	const size_t tile = plane->size < TILE_SIZE ? plane->size : (TILE_SIZE + page - 1) / page * page;
+	int fd = memfd_create("rnhve-neutral-chroma", MFD_CLOEXEC);
+
+	if(fd < 0)
+		return false;
+
+	uint8_t *base = NULL;
+	void *fill = MAP_FAILED;
+
+	if(ftruncate(fd, tile) != 0 || (fill = mmap(NULL, tile, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+		goto fail;
+
+	fill_neutral((uint8_t*)fill, tile, format);
+	munmap(fill, tile);
+
+	//reserve contiguous address range, then put the tile at each tile of it (once per plane)
+	base = (uint8_t*)mmap(NULL, plane->size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if(base == MAP_FAILED)
+		goto fail;
+
+	for(size_t offset = 0; offset < plane->size; offset += tile)
+	{
+		const size_t size = plane->size - offset < tile ? plane->size - offset : tile;
+
+		if(mmap(base + offset, size, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+		{
+			munmap(base, plane->size);
+			goto fail;
+		}
+	}
+
+	close(fd); //mappings keep the memory
+	plane->data = base;
+	plane->mapped = true;
+	return true;
+
+fail:
+	close(fd);
+	return false;
+}
+#endif
+
+static bool allocate_aligned(chroma_plane *plane, chroma_format format)
+{
+#if defined(_WIN32)
+	plane->data = (uint8_t*)_aligned_malloc(plane->size, page_size());
+#else
+	void *data = NULL;
+	plane->data = posix_memalign(&data, page_size(), plane->size) == 0 ? (uint8_t*)data : NULL;
+#endif
+
+	if(!plane->data)
+		return false;
+
+	fill_neutral(plane->data, plane->size, format);
+	plane->mapped = false;
+
+#if !defined(_WIN32)
+	mprotect(plane->data, plane->size, PROT_READ); //immutable from now on, best effort
+#endif
+	return true;
+}
+
+const uint8_t *neutral_chroma_plane(chroma_format format, int stride, int height)
+{
+	if(stride <= 0 || height <= 0)
+		return NULL;
+
+	lock_guard<mutex> guard(planes_mutex);
+
+	const chroma_key key(format, make_pair(stride, height));
+	map<chroma_key, chroma_plane>::iterator it = planes.find(key);
+
+	if(it != planes.end())
+		return it->second.data;
+
+	//rounded up to whole pages, UV of odd height covers the last luma row too
+	const size_t page = page_size();
+	const size_t size = (size_t)stride * ((height + 1) / 2);
+	chroma_plane plane = {NULL, (size + page - 1) / page * page, false};
+
+#ifdef CHROMA_PLANE_TILED
+	if(!map_tiles(&plane, format))
+#endif
+	if(!allocate_aligned(&plane, format))
+		return NULL;
+
+	planes[key] = plane;
+	return plane.data;
+}
+
+const uint8_t *neutral_chroma_stream_init(neutral_chroma_stream *stream, chroma_format format, int stride, int height)
+{
+	stream->format = format;
+	stream->stride = stride;
+	stream->height = height;
+	stream->data = neutral_chroma_plane(format, stride, height);
+
+	return stream->data;
+}
+
+void neutral_chroma_planes_release()
+{
+	lock_guard<mutex> guard(planes_mutex);
+
+	for(map<chroma_key, chroma_plane>::iterator it = planes.begin(); it != planes.end(); ++it)
+	{
+		chroma_plane &plane = it->second;
+#if defined(_WIN32)
+		_aligned_free(plane.data);
+#else
+		if(plane.mapped)
+			munmap(plane.data, plane.size);
+		else
+		{
+			mprotect(plane.data, plane.size, PROT_READ | PROT_WRITE);
+			free(plane.data);
+		}
+#endif
+	}
+
+	planes.clear();
+}
@@ -0,0 +1,55 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Neutral chroma planes
+ * - dummy interleaved UV planes for NV12 (infrared) and P010LE (depth)
+ * - allocated and filled once per (format, stride, height), shared and immutable
+ * - per stream handle keeps the plane, no lock or lookup per frame
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef CHROMA_PLANE_H
+#define CHROMA_PLANE_H
+
+#include <stdint.h>
+
+enum chroma_format { CHROMA_NV12, CHROMA_P010LE };
+
+// UV plane matching luma plane of given stride (in bytes) and height
+// - NV12 128 for each byte, P010LE 512 << 6 for each 16 bit value
+// - size is stride * (height + 1) / 2 bytes, the strides of Y and UV are equal
+// - page aligned, read only (on Linux writing to it crashes)
+// - where supported backed by a single 64 KB tile mapped over the whole plane
+// thread safe (locks), the first call for a key allocates, use neutral_chroma_stream per frame
+const uint8_t *neutral_chroma_plane(chroma_format format, int stride, int height);
+
+// plane of a single stream, prepared when the stream starts
+struct neutral_chroma_stream
+{
+	chroma_format format;
+	int stride;
+	int height;
+	const uint8_t *data;
+};
+
+// builds (or finds) the plane for the stream, NULL on failure
+const uint8_t *neutral_chroma_stream_init(neutral_chroma_stream *stream, chroma_format format, int stride, int height);
+
+// plane for the frame of the stream, prepared one while stride and height match (no lock)
+// otherwise prepared again (e.g. Realsense stride differs from width * bytes per pixel)
+inline const uint8_t *neutral_chroma_stream_plane(neutral_chroma_stream *stream, int stride, int height)
+{
+	if(stream->data && stride == stream->stride && height == stream->height)
+		return stream->data;
+
+	return neutral_chroma_stream_init(stream, stream->format, stride, height);
+}
+
+// frees all the planes, call when no encoder uses them anymore
+void neutral_chroma_planes_release();
+
+#endif
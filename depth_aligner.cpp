@@ -0,0 +1,488 @@
+#include "depth_aligner.h"
+#include "depth_kernels.h"
+#include "options.h"
+
+// Realsense deprojection and projection helpers
+#include <librealsense2/rsutil.h>
+
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+
+// computed once for each pair of depth and other stream profiles
+struct aligner_lut
+{
+	int depth_id;  //profile unique ids the table was computed for
+	int other_id;
+	rs2_intrinsics depth_intrinsics;
+	rs2_intrinsics other_intrinsics;
+	rs2_extrinsics depth_to_other;
+	bool pinhole; //other camera without distortion, SIMD projection
+	depth_project_params project;
+
+	// (width + 1) x (height + 1) depth pixel corners deprojected at 1 m and rotated to the other camera
+	// top-left corner of pixel (x, y) is at (x, y), bottom-right at (x + 1, y + 1)
+	vector<float> rx, ry, rz;
+
+	rs2::stream_profile aligned; //profile of aligned output frames
+};
+
+static void align_frameset(struct depth_aligner *a, rs2::frame f, rs2::frame_source &source);
+
+struct depth_aligner
+{
+	rs2_stream align_to;
+	depth_aligner_config config;
+	rs2::align librealsense;
+	rs2::filter block; //our processing, output frames from Realsense frame pool
+
+	aligner_lut lut;
+
+	// the frame being aligned, set before each phase
+	const uint16_t *depth;
+	int depth_stride;   //in pixels
+	const uint8_t *other;
+	int other_stride;   //in bytes
+	int bpp;            //other stream bytes per pixel
+	uint8_t *out;
+	int out_stride;     //in bytes
+
+	// projected rectangle in the other image for each depth pixel, x0 -1 if nothing to transfer
+	vector<int32_t> x0, y0, x1, y1;
+	// other image rows touched by each depth row (align to color)
+	vector<int> row_min, row_max;
+
+	// workers for bands 1+, guarded by jobs_mutex
+	vector<thread> workers;
+	mutex jobs_mutex;
+	condition_variable jobs_cv;
+	condition_variable done_cv;
+	int phase;
+	uint64_t job;
+	int pending;
+	bool quit;
+
+	depth_aligner(rs2_stream to, const depth_aligner_config &cfg) :
+		align_to(to),
+		config(cfg),
+		librealsense(to),
+		block([this](rs2::frame f, rs2::frame_source &source) { align_frameset(this, f, source); }),
+		depth(NULL), depth_stride(0),
+		other(NULL), other_stride(0), bpp(0),
+		out(NULL), out_stride(0),
+		phase(0),
+		job(0),
+		pending(0),
+		quit(false)
+	{
+		lut.depth_id = lut.other_id = -1;
+	}
+};
+
+enum aligner_phase { PROJECT, TRANSFER_TO_COLOR };
+
+static void worker_thread(depth_aligner *a, int band);
+
+struct depth_aligner *depth_aligner_init(rs2_stream align_to, const depth_aligner_config &config)
+{
+	if(align_to != RS2_STREAM_COLOR && align_to != RS2_STREAM_DEPTH)
+	{
+		cerr << "depth aligner: can only align to color or depth" << endl;
+		return NULL;
+	}
+
+	depth_aligner *a = new depth_aligner(align_to, config);
+
+	if(config.librealsense)
+		return a;
+
+	int threads = config.threads > 0 ? config.threads : (int)thread::hardware_concurrency();
+
+	for(int i = 1; i < threads; ++i)
+		a->workers.push_back(thread(worker_thread, a, i));
+
+	return a;
+}
+
+void depth_aligner_close(struct depth_aligner *a)
+{
+	if(!a)
+		return;
+
+	{
+		lock_guard<mutex> lock(a->jobs_mutex);
+		a->quit = true;
+	}
+	a->jobs_cv.notify_all();
+
+	for(size_t i = 0; i < a->workers.size(); ++i)
+		a->workers[i].join();
+
+	delete a;
+}
+
+//D4xx color has Inverse Brown-Conrady model with all coefficients 0, the same as pinhole
+static bool is_pinhole(const rs2_intrinsics &i)
+{
+	if(i.model == RS2_DISTORTION_NONE)
+		return true;
+
+	if(i.model != RS2_DISTORTION_BROWN_CONRADY && i.model != RS2_DISTORTION_INVERSE_BROWN_CONRADY)
+		return false;
+
+	for(int c = 0; c < 5; ++c)
+		if(i.coeffs[c] != 0.0f)
+			return false;
+
+	return true;
+}
+
+static void lut_compute(depth_aligner *a, const rs2::video_stream_profile &depth, const rs2::video_stream_profile &other)
+{
+	aligner_lut &l = a->lut;
+
+	l.depth_id = depth.unique_id();
+	l.other_id = other.unique_id();
+	l.depth_intrinsics = depth.get_intrinsics();
+	l.other_intrinsics = other.get_intrinsics();
+	l.depth_to_other = depth.get_extrinsics_to(other);
+	l.pinhole = is_pinhole(l.other_intrinsics);
+
+	const rs2_intrinsics &di = l.depth_intrinsics, &oi = l.other_intrinsics;
+	const float *r = l.depth_to_other.rotation;
+	const int w = di.width, h = di.height;
+
+	l.rx.resize((w + 1) * (h + 1));
+	l.ry.resize((w + 1) * (h + 1));
+	l.rz.resize((w + 1) * (h + 1));
+
+	for(int y = 0; y <= h; ++y)
+		for(int x = 0; x <= w; ++x)
+		{
+			const float pixel[2] = {x - 0.5f, y - 0.5f};
+			float ray[3];
+			rs2_deproject_pixel_to_point(ray, &di, pixel, 1.0f);
+
+			//column major like rs2_transform_point_to_point, translation is added per frame (scales with depth)
+			const int i = y * (w + 1) + x;
+			l.rx[i] = r[0] * ray[0] + r[3] * ray[1] + r[6] * ray[2];
+			l.ry[i] = r[1] * ray[0] + r[4] * ray[1] + r[7] * ray[2];
+			l.rz[i] = r[2] * ray[0] + r[5] * ray[1] + r[8] * ray[2];
+		}
+
+	const float *t = l.depth_to_other.translation;
+	depth_project_params p = {0.0f, t[0], t[1], t[2], oi.fx, oi.fy, oi.ppx, oi.ppy};
+	l.project = p;
+
+	if(a->align_to == RS2_STREAM_COLOR)
+		l.aligned = depth.clone(RS2_STREAM_DEPTH, depth.stream_index(), depth.format(), oi.width, oi.height, oi);
+	else
+		l.aligned = other.clone(other.stream_type(), other.stream_index(), other.format(), di.width, di.height, di);
+
+	a->x0.resize(w * h);
+	a->y0.resize(w * h);
+	a->x1.resize(w * h);
+	a->y1.resize(w * h);
+	a->row_min.resize(h);
+	a->row_max.resize(h);
+
+	cout << "depth aligner: lookup table " << w << "x" << h << " to " << oi.width << "x" << oi.height <<
+		(l.pinhole ? "" : " (distorted, scalar projection)") << endl;
+}
+
+//librealsense projection for the other camera with distortion, the same output as depth_project
+static void project_distorted(const aligner_lut &l, const uint16_t *depth, int count,
+	const float *rx, const float *ry, const float *rz, int32_t *x, int32_t *y)
+{
+	const depth_project_params &p = l.project;
+
+	for(int i = 0; i < count; ++i)
+	{
+		const float z = depth[i] * p.scale;
+		const float point[3] = {z * rx[i] + p.tx, z * ry[i] + p.ty, z * rz[i] + p.tz};
+		float pixel[2];
+
+		if(!(point[2] > 0.0f))
+		{
+			x[i] = y[i] = -1;
+			continue;
+		}
+
+		rs2_project_point_to_pixel(pixel, &l.other_intrinsics, point);
+
+		x[i] = (pixel[0] + 0.5f > -1.0f && pixel[0] + 0.5f < 32767.0f) ? (int32_t)(pixel[0] + 0.5f) : -1;
+		y[i] = (pixel[1] + 0.5f > -1.0f && pixel[1] + 0.5f < 32767.0f) ? (int32_t)(pixel[1] + 0.5f) : -1;
+	}
+}
+
+//projects the corners of depth row pixels, marks pixels with nothing to transfer
+//aligning to depth also transfers the other image pixels (each depth row is written by one band only)
+static void project_row(depth_aligner *a, int y)
+{
+	const aligner_lut &l = a->lut;
+	const int w = l.depth_intrinsics.width;
+	const int ow = l.other_intrinsics.width, oh = l.other_intrinsics.height;
+	const uint16_t *depth = a->depth + y * a->depth_stride;
+	const int top = y * (w + 1), bottom = (y + 1) * (w + 1) + 1;
+
+	int32_t *x0 = &a->x0[y * w], *y0 = &a->y0[y * w], *x1 = &a->x1[y * w], *y1 = &a->y1[y * w];
+
+	if(l.pinhole)
+	{
+		depth_project(depth, w, &l.rx[top], &l.ry[top], &l.rz[top], l.project, x0, y0);
+		depth_project(depth, w, &l.rx[bottom], &l.ry[bottom], &l.rz[bottom], l.project, x1, y1);
+	}
+	else
+	{
+		project_distorted(l, depth, w, &l.rx[top], &l.ry[top], &l.rz[top], x0, y0);
+		project_distorted(l, depth, w, &l.rx[bottom], &l.ry[bottom], &l.rz[bottom], x1, y1);
+	}
+
+	int lo = INT_MAX, hi = -1;
+
+	//the same conditions as librealsense align, no depth or rectangle not fully inside the other image
+	for(int x = 0; x < w; ++x)
+	{
+		if(depth[x] == 0 || x0[x] < 0 || y0[x] < 0 || x1[x] >= ow || y1[x] >= oh || x0[x] > x1[x] || y0[x] > y1[x])
+		{
+			x0[x] = -1;
+			continue;
+		}
+
+		lo = y0[x] < lo ? y0[x] : lo;
+		hi = y1[x] > hi ? y1[x] : hi;
+	}
+
+	a->row_min[y] = lo;
+	a->row_max[y] = hi;
+
+	if(a->align_to != RS2_STREAM_DEPTH)
+		return;
+
+	//librealsense copies every pixel of the rectangle, the last one (bottom-right) wins
+	uint8_t *out = a->out + y * a->out_stride;
+	const int bpp = a->bpp;
+
+	if(bpp == 4)
+		for(int x = 0; x < w; ++x)
+		{
+			uint32_t pixel = 0;
+			if(x0[x] >= 0)
+				memcpy(&pixel, a->other + y1[x] * a->other_stride + x1[x] * 4, 4);
+			memcpy(out + x * 4, &pixel, 4);
+		}
+	else
+		for(int x = 0; x < w; ++x)
+		{
+			if(x0[x] >= 0)
+				memcpy(out + x * bpp, a->other + y1[x] * a->other_stride + x1[x] * bpp, bpp);
+			else
+				memset(out + x * bpp, 0, bpp);
+		}
+}
+
+//writes depth to color image rows [r0, r1), nearest depth wins where rectangles overlap
+static void transfer_to_color(depth_aligner *a, int r0, int r1)
+{
+	const int w = a->lut.depth_intrinsics.width, h = a->lut.depth_intrinsics.height;
+
+	for(int r = r0; r < r1; ++r)
+		memset(a->out + r * a->out_stride, 0, a->out_stride);
+
+	for(int y = 0; y < h; ++y)
+	{
+		if(a->row_max[y] < r0 || a->row_min[y] >= r1)
+			continue;
+
+		const uint16_t *depth = a->depth + y * a->depth_stride;
+		const int32_t *x0 = &a->x0[y * w], *y0 = &a->y0[y * w], *x1 = &a->x1[y * w], *y1 = &a->y1[y * w];
+
+		for(int x = 0; x < w; ++x)
+		{
+			if(x0[x] < 0)
+				continue;
+
+			const uint16_t d = depth[x];
+			const int ya = y0[x] > r0 ? y0[x] : r0;
+			const int yb = y1[x] < r1 - 1 ? y1[x] : r1 - 1;
+
+			for(int oy = ya; oy <= yb; ++oy)
+			{
+				uint16_t *row = (uint16_t*)(a->out + oy * a->out_stride);
+
+				for(int ox = x0[x]; ox <= x1[x]; ++ox)
+					row[ox] = (row[ox] && row[ox] < d) ? row[ox] : d;
+			}
+		}
+	}
+}
+
+//depth rows for projection, other image rows for transfer to color
+static void run_band(depth_aligner *a, int phase, int band, int bands)
+{
+	if(phase == PROJECT)
+	{
+		const int h = a->lut.depth_intrinsics.height;
+		for(int y = h * band / bands; y < h * (band + 1) / bands; ++y)
+			project_row(a, y);
+		return;
+	}
+
+	const int oh = a->lut.other_intrinsics.height;
+	transfer_to_color(a, oh * band / bands, oh * (band + 1) / bands);
+}
+
+//all the bands of the phase, calling thread does band 0, returns when all are done
+static void run_phase(depth_aligner *a, int phase)
+{
+	const int bands = (int)a->workers.size() + 1;
+
+	{  // hand bands 1+ to the workers
+		lock_guard<mutex> lock(a->jobs_mutex);
+		a->phase = phase;
+		a->pending = (int)a->workers.size();
+		++a->job;
+	}
+	a->jobs_cv.notify_all();
+
+	run_band(a, phase, 0, bands);
+
+	unique_lock<mutex> lock(a->jobs_mutex);
+	a->done_cv.wait(lock, [&] { return a->pending == 0; });
+}
+
+static void worker_thread(depth_aligner *a, int band)
+{
+	uint64_t job = 0;
+
+	for(;;)
+	{
+		int phase;
+
+		{
+			unique_lock<mutex> lock(a->jobs_mutex);
+			a->jobs_cv.wait(lock, [&] { return a->quit || a->job != job; });
+
+			if(a->quit)
+				return;
+
+			job = a->job;
+			phase = a->phase;
+		}
+
+		run_band(a, phase, band, (int)a->workers.size() + 1);
+
+		{
+			lock_guard<mutex> lock(a->jobs_mutex);
+			--a->pending;
+		}
+		a->done_cv.notify_all();
+	}
+}
+
+//called by Realsense processing block from depth_aligner_process thread
+static void align_frameset(depth_aligner *a, rs2::frame f, rs2::frame_source &source)
+{
+	rs2::frameset frameset(f);
+	rs2::depth_frame depth = frameset.get_depth_frame();
+	rs2::video_frame other = frameset.get_color_frame();
+	aligner_lut &l = a->lut;
+
+	const rs2::video_stream_profile depth_profile(depth.get_profile());
+	const rs2::video_stream_profile other_profile(other.get_profile());
+
+	if(depth_profile.unique_id() != l.depth_id || other_profile.unique_id() != l.other_id)
+		lut_compute(a, depth_profile, other_profile);
+
+	const rs2_intrinsics &di = l.depth_intrinsics, &oi = l.other_intrinsics;
+
+	a->depth = (const uint16_t*)depth.get_data();
+	a->depth_stride = depth.get_stride_in_bytes() / 2;
+	a->other = (const uint8_t*)other.get_data();
+	a->other_stride = other.get_stride_in_bytes();
+	a->bpp = other.get_bytes_per_pixel();
+	l.project.scale = depth.get_units();
+
+	rs2::frame aligned;
+
+	if(a->align_to == RS2_STREAM_COLOR)
+		aligned = source.allocate_video_frame(l.aligned, depth, 2, oi.width, oi.height, oi.width * 2, RS2_EXTENSION_DEPTH_FRAME);
+	else
+		aligned = source.allocate_video_frame(l.aligned, other, a->bpp, di.width, di.height, di.width * a->bpp, RS2_EXTENSION_VIDEO_FRAME);
+
+	a->out = (uint8_t*)aligned.get_data();
+	a->out_stride = rs2::video_frame(aligned).get_stride_in_bytes();
+
+	run_phase(a, PROJECT);
+
+	if(a->align_to == RS2_STREAM_COLOR)
+		run_phase(a, TRANSFER_TO_COLOR);
+
+	//the same frames as input with the aligned one replaced
+	const int replaced = (a->align_to == RS2_STREAM_COLOR) ? depth_profile.unique_id() : other_profile.unique_id();
+	vector<rs2::frame> frames;
+
+	for(size_t i = 0; i < frameset.size(); ++i)
+	{
+		rs2::frame frame = frameset[i];
+		frames.push_back(frame.get_profile().unique_id() == replaced ? aligned : frame);
+	}
+
+	source.frame_ready(source.allocate_composite_frame(frames));
+}
+
+//both streams present and the other one has whole pixels (not YUYV/UYVY macropixels)
+static bool can_align(const rs2::frameset &frameset)
+{
+	rs2::video_frame other = frameset.get_color_frame();
+
+	if(!frameset.get_depth_frame() || !other)
+		return false;
+
+	const rs2_format format = other.get_profile().format();
+
+	return format != RS2_FORMAT_YUYV && format != RS2_FORMAT_UYVY;
+}
+
+rs2::frameset depth_aligner_process(struct depth_aligner *a, const rs2::frameset &frameset)
+{
+	if(a->config.librealsense || !can_align(frameset))
+		return a->librealsense.process(frameset);
+
+	return a->block.process(frameset);
+}
+
+int depth_aligner_options(int *argc, char *argv[], depth_aligner_config *config)
+{
+	config->librealsense = option_flag(argc, argv, "align-rs2");
+
+	const char *threads = option_value(argc, argv, "align-threads");
+
+	if(!threads)
+		return 0;
+
+	char *end;
+	config->threads = strtol(threads, &end, 10);
+
+	if(*threads == '\0' || *end != '\0' || config->threads <= 0)
+	{
+		cerr << "invalid --align-threads '" << threads << "', expected positive number of threads" << endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+void depth_aligner_usage(ostream &out)
+{
+	out << "align options:" << endl
+	    << "       --align-threads <threads> # threads aligning each frame, default one per CPU core" << endl
+	    << "       --align-rs2 # librealsense rs2::align instead of lookup table aligner" << endl;
+}
@@ -0,0 +1,45 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Depth aligner
+ * - drop-in replacement for rs2::align (depth to color or color to depth)
+ * - deprojection lookup table computed once per stream configuration
+ * - SIMD projection (depth kernels) with frame rows split across worker threads
+ * - output frames come from Realsense frame pool, frameset works like rs2::align output
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef DEPTH_ALIGNER_H
+#define DEPTH_ALIGNER_H
+
+// Realsense API
+#include <librealsense2/rs.hpp>
+
+#include <ostream>
+
+struct depth_aligner_config
+{
+	int threads;       //0 for one per CPU core
+	bool librealsense; //use rs2::align instead
+};
+
+struct depth_aligner;
+
+// align_to RS2_STREAM_COLOR or RS2_STREAM_DEPTH, NULL on failure
+struct depth_aligner *depth_aligner_init(rs2_stream align_to, const depth_aligner_config &config);
+
+// frameset with the other stream aligned, the same as rs2::align::process
+// frames which can't be aligned (e.g. YUYV color to depth) go through rs2::align
+rs2::frameset depth_aligner_process(struct depth_aligner *a, const rs2::frameset &frameset);
+
+void depth_aligner_close(struct depth_aligner *a);
+
+// removes recognized options from argv, -1 on invalid value
+int depth_aligner_options(int *argc, char *argv[], depth_aligner_config *config);
+void depth_aligner_usage(std::ostream &out);
+
+#endif
@@ -0,0 +1,151 @@
+#include "depth_chroma.h"
+#include "options.h"
+
+#include <iostream>
+#include <stdlib.h>
+
+using namespace std;
+
+//10 bit chroma, 1023 at the top of the triangle, phases of the period are twice that
+static const int PHASES = 2048;
+static const int HALF = PHASES / 2;
+static const int QUARTER = PHASES / 4; //V is U shifted by a quarter period
+
+//block means are in half depth units, that many of them per phase
+static const int HALF_UNITS_PER_PHASE = DEPTH_CHROMA_PERIOD * 2 / PHASES;
+static_assert(DEPTH_CHROMA_PERIOD >= 1024 && (DEPTH_CHROMA_PERIOD & (DEPTH_CHROMA_PERIOD - 1)) == 0, "period is power of two, at least 1024");
+
+//luma quantization step (10 MSB) and its center
+static const int STEP = 64;
+static const int CENTER = STEP / 2;
+
+static int triangle(int phase)
+{
+	phase &= PHASES - 1;
+	return phase < HALF ? phase : PHASES - 1 - phase;
+}
+
+//the half of the waves away from their peaks is linear, the other one tells rising or falling there
+static int phase_of(int u, int v)
+{
+	if(abs(2 * u - (HALF - 1)) <= abs(2 * v - (HALF - 1)))
+		return v >= HALF / 2 ? u : PHASES - 1 - u;
+
+	const int shifted = u < HALF / 2 ? v : PHASES - 1 - v;
+	return (shifted - QUARTER) & (PHASES - 1);
+}
+
+void depth_chroma_pack(const uint16_t *depth, int width, int height, int stride, uint16_t *uv, int uv_stride)
+{
+	const int pitch = stride / sizeof(uint16_t), uv_pitch = uv_stride / sizeof(uint16_t);
+
+	for(int y = 0; y < height; y += 2)
+	{
+		const uint16_t *top = depth + y * pitch;
+		const uint16_t *bottom = (y + 1 < height) ? top + pitch : top;
+		uint16_t *out = uv + y / 2 * uv_pitch;
+
+		for(int x = 0; x < width; x += 2)
+		{
+			const int right = (x + 1 < width) ? x + 1 : x;
+			const int d[4] = {top[x], top[right], bottom[x], bottom[right]};
+			int sum = 0, count = 0;
+
+			for(int i = 0; i < 4; ++i)
+				if(d[i])
+				{
+					sum += d[i];
+					++count;
+				}
+
+			//mean in half units, edge blocks repeat pixels which doesn't change it
+			const int mean = count ? (2 * sum + count / 2) / count : 0;
+			const int phase = (mean + HALF_UNITS_PER_PHASE / 2) / HALF_UNITS_PER_PHASE;
+
+			out[x] = triangle(phase) << 6;
+			out[x + 1] = triangle(phase + QUARTER) << 6;
+		}
+	}
+}
+
+void depth_chroma_unpack(const uint16_t *y, const uint16_t *uv, int width, int height, int stride, int uv_stride,
+	uint16_t *depth, int depth_stride)
+{
+	const int pitch = stride / sizeof(uint16_t), uv_pitch = uv_stride / sizeof(uint16_t);
+	const int depth_pitch = depth_stride / sizeof(uint16_t);
+
+	for(int r = 0; r < height; r += 2)
+	{
+		const int rows = (r + 1 < height) ? 2 : 1;
+		const uint16_t *chroma = uv + r / 2 * uv_pitch;
+
+		for(int x = 0; x < width; x += 2)
+		{
+			const int columns = (x + 1 < width) ? 2 : 1;
+			int sum = 0, count = 0;
+
+			//coarse block mean of decoded luma (centers of quantization steps)
+			for(int j = 0; j < rows; ++j)
+				for(int i = 0; i < columns; ++i)
+				{
+					const int code = y[(r + j) * pitch + x + i] >> 6;
+
+					if(code)
+					{
+						sum += (code << 6) + CENTER;
+						++count;
+					}
+				}
+
+			int offset = 0;
+
+			if(count)
+			{
+				const int coarse = (2 * sum + count / 2) / count;
+				const int phase = phase_of(chroma[x] >> 6, chroma[x + 1] >> 6) * HALF_UNITS_PER_PHASE;
+
+				//nearest mean with that phase, the fine one
+				int diff = (phase - coarse) & (2 * DEPTH_CHROMA_PERIOD - 1);
+				if(diff >= DEPTH_CHROMA_PERIOD)
+					diff -= 2 * DEPTH_CHROMA_PERIOD;
+
+				//pixels stay within their luma step, more is a wrong unwrap (luma error over half period)
+				offset = diff / 2;
+				offset = offset < -CENTER ? -CENTER : (offset > CENTER - 1 ? CENTER - 1 : offset);
+			}
+
+			for(int j = 0; j < rows; ++j)
+				for(int i = 0; i < columns; ++i)
+				{
+					const int code = y[(r + j) * pitch + x + i] >> 6;
+					const int value = code ? (code << 6) + CENTER + offset : 0;
+
+					depth[(r + j) * depth_pitch + x + i] = value < UINT16_MAX ? value : UINT16_MAX;
+				}
+		}
+	}
+}
+
+void depth_chroma_unpack_luma(const uint16_t *y, int width, int height, int stride, uint16_t *depth, int depth_stride)
+{
+	const int pitch = stride / sizeof(uint16_t), depth_pitch = depth_stride / sizeof(uint16_t);
+
+	for(int r = 0; r < height; ++r)
+		for(int x = 0; x < width; ++x)
+		{
+			const int code = y[r * pitch + x] >> 6;
+			depth[r * depth_pitch + x] = code ? (code << 6) + CENTER : 0;
+		}
+}
+
+int depth_chroma_options(int *argc, char *argv[], bool *enabled)
+{
+	*enabled = option_flag(argc, argv, "depth-chroma");
+	return 0;
+}
+
+void depth_chroma_usage(ostream &out)
+{
+	out << "depth chroma options:" << endl
+	    << "       --depth-chroma # depth refinement in P010LE chroma instead of neutral UV, see depth_chroma_unpack" << endl;
+}
@@ -0,0 +1,47 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Depth precision in P010LE chroma
+ * - luma keeps 10 MSB of depth as before, chroma (instead of constant neutral UV) refines it
+ * - each 2x2 block mean at 4 depth units as two phase shifted triangle waves (U, V)
+ * - triangle waves are smooth, compression noise moves them a little instead of wrapping
+ * - receiver unwraps the period against block mean of decoded luma, then offsets the block pixels
+ * - reference unpacker and luma only unpacker for comparison
+ * - one offset per 2x2 block, pixels of the block differing by more than a luma step (steep surfaces, edges)
+ *   gain little, e.g. rms error 18.5 -> 17.4 units there against 18.5 -> 6.8 on smooth surfaces
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef DEPTH_CHROMA_H
+#define DEPTH_CHROMA_H
+
+#include <ostream>
+#include <stdint.h>
+
+// triangle wave period in depth units, luma error of the block mean up to half of it is unwrapped correctly
+// 10 bit chroma over half period gives period / 1024 unit steps
+// shorter period is finer but costs more bits (steeper chroma), within block variation of depth limits the gain anyway
+#define DEPTH_CHROMA_PERIOD 4096
+
+// interleaved UV plane (P010LE, 10 MSB) of (width + 1) / 2 pairs by (height + 1) / 2 rows for Z16/P010LE depth
+// U, V - triangle waves of block mean (valid pixels, 0 for blocks without any), strides in bytes
+// uv_stride (e.g. the same as depth stride) has room for (width + 1) / 2 pairs, i.e. at least 4 * ((width + 1) / 2) bytes
+// for odd width that is more than tight depth stride (2 * width), the last pair is past it
+void depth_chroma_pack(const uint16_t *depth, int width, int height, int stride, uint16_t *uv, int uv_stride);
+
+// receiving end, decoded P010LE planes to depth units, luma 0 is no depth
+void depth_chroma_unpack(const uint16_t *y, const uint16_t *uv, int width, int height, int stride, int uv_stride,
+	uint16_t *depth, int depth_stride);
+
+// the same without chroma (neutral UV), center of luma quantization step
+void depth_chroma_unpack_luma(const uint16_t *y, int width, int height, int stride, uint16_t *depth, int depth_stride);
+
+// removes recognized options from argv, -1 on invalid value
+int depth_chroma_options(int *argc, char *argv[], bool *enabled);
+void depth_chroma_usage(std::ostream &out);
+
+#endif
@@ -0,0 +1,143 @@
+#include "depth_conditioning.h"
+#include "options.h"
+
+#include <iostream>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace std;
+
+static const uint16_t P010LE_MAX = 0xFFC0; //in binary 10 ones followed by 6 zeroes
+
+//limits of the bounding volume around center pixel
+static const float BOUNDING_MIN_DISTANCE = 0.15f;
+static const float BOUNDING_MAX_DISTANCE = 2.0f;
+
+bool depth_conditioning_needed(const depth_conditioning_config &config, bool needs_postprocessing)
+{
+	return needs_postprocessing || config.min_distance > 0.0f || config.max_distance > 0.0f ||
+		config.bounding_depth > 0.0f || config.slice_shift > 0;
+}
+
+//distance in meters to depth units, saturated to 16 bit range
+//tolerance so that float error doesn't move exact distances (e.g. 0.6f / 0.0001f) by a unit
+static int distance_to_units(float distance, float depth_units, bool round_up)
+{
+	float units = distance / depth_units;
+	units = round_up ? ceilf(units - 0.01f) : floorf(units + 0.01f);
+	return units < UINT16_MAX ? (int)units : UINT16_MAX;
+}
+
+depth_condition_params depth_conditioning_params(const depth_conditioning_config &config,
+	float depth_units_set, float depth_units, bool needs_postprocessing, float center_distance)
+{
+	depth_condition_params p = {1.0f, 0, UINT16_MAX, 0, 0};
+
+	//L515 doesn't support setting depth units and clamping
+	if(needs_postprocessing)
+	{
+		p.multiplier = depth_units_set / depth_units;
+		p.hi = P010LE_MAX;
+	}
+
+	//thresholds are compared after unit conversion
+	const float units = needs_postprocessing ? depth_units : depth_units_set;
+	float min_distance = config.min_distance;
+	float max_distance = config.max_distance;
+
+	// put a bounding volume around the object in the center of the frame
+	if(config.bounding_depth > 0.0f)
+	{
+		min_distance = fmaxf(min_distance, fmaxf(center_distance - config.bounding_depth, BOUNDING_MIN_DISTANCE));
+		max_distance = fminf(max_distance > 0.0f ? max_distance : BOUNDING_MAX_DISTANCE,
+			fminf(center_distance + config.bounding_depth, BOUNDING_MAX_DISTANCE));
+	}
+
+	if(min_distance > 0.0f)
+		p.lo = distance_to_units(min_distance, units, true);
+	if(max_distance > 0.0f)
+	{
+		const int hi = distance_to_units(max_distance, units, false);
+		p.hi = hi < p.hi ? hi : p.hi;
+	}
+
+	if(config.slice_shift > 0)
+	{
+		const int first = config.slice_offset + 1;
+		const int last = config.slice_offset + (1 << (16 - config.slice_shift)) - 1;
+
+		p.lo = first > p.lo ? first : p.lo;
+		p.hi = last < p.hi ? last : p.hi;
+		p.offset = config.slice_offset;
+		p.shift = config.slice_shift;
+	}
+
+	return p;
+}
+
+void depth_conditioning_process(const depth_conditioning_config &config, uint16_t *data, int width, int height, int stride,
+	float depth_units_set, float depth_units, bool needs_postprocessing)
+{
+	const int half_stride = stride / 2;
+	float center_distance = 0.0f;
+
+	if(config.bounding_depth > 0.0f)
+		center_distance = data[height / 2 * half_stride + width / 2] * depth_units_set;
+
+	depth_condition_params p = depth_conditioning_params(config, depth_units_set, depth_units, needs_postprocessing, center_distance);
+
+	depth_condition(data, half_stride * height, p);
+}
+
+static int parse_distance(const char *value, const char *name, float *distance)
+{
+	if(!value)
+		return 0;
+
+	char *end;
+	*distance = strtof(value, &end);
+
+	if(*value == '\0' || *end != '\0' || *distance < 0.0f)
+	{
+		cerr << "invalid --" << name << " '" << value << "', expected distance in meters" << endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+int depth_conditioning_options(int *argc, char *argv[], depth_conditioning_config *config)
+{
+	if(parse_distance(option_value(argc, argv, "min-distance"), "min-distance", &config->min_distance) < 0 ||
+		parse_distance(option_value(argc, argv, "max-distance"), "max-distance", &config->max_distance) < 0 ||
+		parse_distance(option_value(argc, argv, "bounding-depth"), "bounding-depth", &config->bounding_depth) < 0)
+		return -1;
+
+	const char *slice = option_value(argc, argv, "slice");
+
+	if(slice)
+	{
+		int offset, shift;
+		char end;
+
+		if(sscanf(slice, "%d:%d%c", &offset, &shift, &end) != 2 || offset < 0 || offset > UINT16_MAX || shift < 0 || shift > 6)
+		{
+			cerr << "invalid --slice '" << slice << "', expected <offset>:<shift> e.g. 2048:4 (shift 0-6, 0 disables)" << endl;
+			return -1;
+		}
+
+		config->slice_offset = offset;
+		config->slice_shift = shift;
+	}
+
+	return 0;
+}
+
+void depth_conditioning_usage(ostream &out)
+{
+	out << "depth options:" << endl
+	    << "       --min-distance <m> --max-distance <m> # fixed depth thresholds" << endl
+	    << "       --bounding-depth <m> # thresholds +- around the center pixel depth, 0 disables" << endl
+	    << "       --slice <offset>:<shift> # 2^(16-shift) units deep 10 bit slice, e.g. 2048:4, 0:0 disables" << endl;
+}
@@ -0,0 +1,57 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Depth conditioning
+ * - unit conversion, P010LE clamping, thresholding and 10 bit slicing
+ * - all of them applied in a single pass over the frame
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef DEPTH_CONDITIONING_H
+#define DEPTH_CONDITIONING_H
+
+#include "depth_kernels.h"
+
+#include <ostream>
+
+// optional conditioning stages, all disabled when zeroed
+struct depth_conditioning_config
+{
+	float min_distance;   //fixed thresholds (m), 0 to disable
+	float max_distance;
+	float bounding_depth; //thresholds +- around the center pixel depth (m), 0 to disable
+	int slice_offset;     //slice start in depth units, see below
+	int slice_shift;      //slice is 2^(16-shift) depth units deep, 0 to disable slicing
+};
+
+// We can only send 10 bits of "grayscale" for depth, packed into the 10 MSB of the 16-bit depth value
+// but we can choose which 10 bits to send - highest-precision 10 bits (and only 1024 depth units deep)
+// or 1/4 the depth precision but 4096 depth units deep etc.
+// Slicing takes 2^(16-shift) units of depth starting at slice_offset,
+// translates it back to 0 and shifts it up towards MSB, e.g. offset 2048 with shift 4
+// takes 4096 units (1.024m with 0.00025m L515 units) starting at 51.2cm.
+// Everything outside the slice goes to 0.
+
+// true if frame has to be processed on the host at all
+// needs_postprocessing - device can't set depth units or clamp (e.g. L515)
+bool depth_conditioning_needed(const depth_conditioning_config &config, bool needs_postprocessing);
+
+// kernel parameters for a frame
+// depth_units_set - units of the frame, depth_units - units wanted
+// center_distance - depth of the center pixel in meters (used with bounding_depth)
+depth_condition_params depth_conditioning_params(const depth_conditioning_config &config,
+	float depth_units_set, float depth_units, bool needs_postprocessing, float center_distance);
+
+// in place, single pass over Z16 frame data
+void depth_conditioning_process(const depth_conditioning_config &config, uint16_t *data, int width, int height, int stride,
+	float depth_units_set, float depth_units, bool needs_postprocessing);
+
+// removes recognized options from argv, -1 on invalid value
+int depth_conditioning_options(int *argc, char *argv[], depth_conditioning_config *config);
+void depth_conditioning_usage(std::ostream &out);
+
+#endif
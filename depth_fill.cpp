@@ -0,0 +1,190 @@
+#include "depth_fill.h"
+#include "depth_kernels.h"
+#include "options.h"
+
+#include <iostream>
+#include <string.h>
+
+using namespace std;
+
+//after the column passes, columns still 0 in the first row have no valid pixel at all (the same in every row)
+//interpolated between the filled columns at their ends, extended at frame edges
+static void fill_empty_columns(uint16_t *data, int width, int height, int pitch)
+{
+	for(int begin = 0; begin < width; )
+	{
+		if(data[begin])
+		{
+			++begin;
+			continue;
+		}
+
+		int end = begin;
+		while(end < width && !data[end])
+			++end;
+
+		//nothing valid in the whole frame
+		if(begin == 0 && end == width)
+			return;
+
+		for(int y = 0; y < height; ++y)
+		{
+			uint16_t *row = data + y * pitch;
+			const int left = begin > 0 ? row[begin - 1] : row[end];
+			const int right = end < width ? row[end] : row[begin - 1];
+			const int span = end - begin + 1;
+
+			for(int x = begin; x < end; ++x)
+				row[x] = left + (right - left) * (x - begin + 1) / span;
+		}
+
+		begin = end;
+	}
+}
+
+void depth_fill(uint16_t *data, int width, int height, int stride)
+{
+	const int pitch = stride / sizeof(uint16_t);
+
+	//down the columns from the first valid pixel, then up above it
+	for(int y = 1; y < height; ++y)
+		depth_fill_row(data + y * pitch, data + (y - 1) * pitch, width);
+
+	for(int y = height - 2; y >= 0; --y)
+		depth_fill_row(data + y * pitch, data + (y + 1) * pitch, width);
+
+	fill_empty_columns(data, width, height, pitch);
+}
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v & 0xFF; p[1] = v >> 8; }
+static uint16_t get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v & 0xFFFF); put16(p + 2, v >> 16); }
+static uint32_t get32(const uint8_t *p) { return get16(p) | ((uint32_t)get16(p + 2) << 16); }
+
+static uint8_t *put_run(uint8_t *p, int run)
+{
+	while(run >= 0x80)
+	{
+		*p++ = (run & 0x7F) | 0x80;
+		run >>= 7;
+	}
+	*p++ = run;
+
+	return p;
+}
+
+//NULL past the end or on run longer than 16 bits
+static const uint8_t *get_run(const uint8_t *p, const uint8_t *end, int *run)
+{
+	*run = 0;
+
+	for(int shift = 0; p < end && shift < 21; shift += 7)
+	{
+		*run |= (*p & 0x7F) << shift;
+
+		if(!(*p++ & 0x80))
+			return *run <= UINT16_MAX ? p : NULL;
+	}
+
+	return NULL;
+}
+
+int depth_fill_mask_pack(uint32_t framenumber, const uint16_t *data, int width, int height, int stride, uint8_t *out)
+{
+	const int pitch = stride / sizeof(uint16_t);
+	uint8_t *p = out + DEPTH_FILL_MASK_HEADER;
+
+	for(int y = 0; y < height; ++y)
+	{
+		const uint16_t *row = data + y * pitch;
+		bool valid = false;
+		int run = 0;
+
+		for(int x = 0; x < width; ++x)
+		{
+			if((row[x] != 0) != valid)
+			{
+				p = put_run(p, run);
+				valid = !valid;
+				run = 0;
+			}
+			++run;
+		}
+
+		p = put_run(p, run);
+	}
+
+	out[0] = 'R';
+	out[1] = 'V';
+	out[2] = 'M';
+	out[3] = DEPTH_FILL_MASK_VERSION;
+	put32(out + 4, framenumber);
+	put16(out + 8, width);
+	put16(out + 10, height);
+	put32(out + 12, p - out - DEPTH_FILL_MASK_HEADER);
+
+	return p - out;
+}
+
+bool depth_fill_mask_read(const uint8_t *data, int size, uint32_t *framenumber, int *width, int *height, int *record_size)
+{
+	if(size < DEPTH_FILL_MASK_HEADER || data[0] != 'R' || data[1] != 'V' || data[2] != 'M' || data[3] != DEPTH_FILL_MASK_VERSION)
+		return false;
+
+	const uint32_t runs = get32(data + 12);
+
+	if(runs > (uint32_t)(size - DEPTH_FILL_MASK_HEADER))
+		return false;
+
+	*framenumber = get32(data + 4);
+	*width = get16(data + 8);
+	*height = get16(data + 10);
+	*record_size = DEPTH_FILL_MASK_HEADER + runs;
+
+	return true;
+}
+
+bool depth_fill_mask_apply(const uint8_t *data, int size, uint16_t *depth, int stride)
+{
+	uint32_t framenumber;
+	int width, height, record_size;
+
+	if(!depth_fill_mask_read(data, size, &framenumber, &width, &height, &record_size))
+		return false;
+
+	const int pitch = stride / sizeof(uint16_t);
+	const uint8_t *p = data + DEPTH_FILL_MASK_HEADER;
+	const uint8_t *end = data + record_size;
+
+	for(int y = 0; y < height; ++y)
+	{
+		uint16_t *row = depth + y * pitch;
+		bool valid = false;
+
+		for(int x = 0, run; x < width; x += run, valid = !valid)
+		{
+			if( (p = get_run(p, end, &run)) == NULL || run > width - x)
+				return false;
+
+			if(!valid)
+				memset(row + x, 0, run * sizeof(uint16_t));
+		}
+	}
+
+	return true;
+}
+
+int depth_fill_options(int *argc, char *argv[], depth_fill_config *config)
+{
+	config->mask = option_flag(argc, argv, "fill-mask");
+	config->fill = option_flag(argc, argv, "fill") || config->mask;
+
+	return 0;
+}
+
+void depth_fill_usage(ostream &out)
+{
+	out << "hole filling options:" << endl
+	    << "       --fill # fill invalid depth with values cheap to encode (smooth continuation of neighbours)" << endl
+	    << "       --fill-mask # fill and send validity mask in aux channel, receiver restores the zeros" << endl;
+}
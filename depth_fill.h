@@ -0,0 +1,55 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Depth hole filling
+ * - invalid (0) depth after conditioning makes hard edges the encoder spends bits on
+ * - holes filled down and up the columns from the neighbour row, smoothed on the way (see depth_fill_row)
+ * - columns without any valid pixel interpolated along the rows
+ * - validity mask (run length coded) so that receiver restores the zeros exactly
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef DEPTH_FILL_H
+#define DEPTH_FILL_H
+
+#include <ostream>
+#include <stdint.h>
+
+struct depth_fill_config
+{
+	bool fill; //fill holes before encoding (--fill)
+	bool mask; //also send validity mask (--fill-mask), implies fill
+};
+
+// in place on conditioned Z16/P010LE depth (stride in bytes), frame without any valid pixel stays 0
+void depth_fill(uint16_t *data, int width, int height, int stride);
+
+// validity mask record
+// 0-3 'R' 'V' 'M' version, 4-7 frame number, 8-9 width, 10-11 height, 12-15 size of runs, little endian
+// then for each row alternating invalid and valid run lengths starting with invalid (may be 0), up to width
+// each run as unsigned LEB128 (7 bits per byte, low first, high bit set if more bytes follow)
+#define DEPTH_FILL_MASK_VERSION 1
+#define DEPTH_FILL_MASK_HEADER 16
+// worst case (each run takes at most its length in bytes, plus leading empty run)
+#define DEPTH_FILL_MASK_MAX_SIZE(width, height) (DEPTH_FILL_MASK_HEADER + (height) * ((width) + 1))
+
+// mask of depth before filling, out has DEPTH_FILL_MASK_MAX_SIZE, returns record size
+// data may point into a larger frame (e.g. crop window), record width and height are what is masked
+int depth_fill_mask_pack(uint32_t framenumber, const uint16_t *data, int width, int height, int stride, uint8_t *out);
+
+// false if it is not a valid record header, record_size - header and runs (next record follows)
+bool depth_fill_mask_read(const uint8_t *data, int size, uint32_t *framenumber, int *width, int *height, int *record_size);
+
+// receiving end, zeroes invalid pixels of decoded depth of record width and height
+// false on invalid record (depth may be partially restored then)
+bool depth_fill_mask_apply(const uint8_t *data, int size, uint16_t *depth, int stride);
+
+// removes recognized options from argv, -1 on invalid value
+int depth_fill_options(int *argc, char *argv[], depth_fill_config *config);
+void depth_fill_usage(std::ostream &out);
+
+#endif
@@ -0,0 +1,688 @@
+#include "depth_kernels.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define DEPTH_KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define DEPTH_KERNELS_ARM_NEON
+#include <arm_neon.h>
+#endif
+
+//GCC and clang need per function target to emit SSE4.1/AVX2 without global -m flags
+//MSVC emits any intrinsic regardless of /arch
+#if defined(__GNUC__)
+#define DEPTH_KERNELS_TARGET(isa) __attribute__((target(isa)))
+#else
+#define DEPTH_KERNELS_TARGET(isa)
+#endif
+
+typedef void (*condition_fn)(uint16_t *data, int count, const depth_condition_params &params, int lo, int hi);
+typedef void (*project_fn)(const uint16_t *depth, int count, const float *rx, const float *ry, const float *rz,
+	const depth_project_params &params, int32_t *x, int32_t *y);
+typedef void (*histogram_fn)(const uint16_t *data, int count, float multiplier, int bin_shift, uint32_t *bins);
+typedef void (*fill_fn)(uint16_t *row, const uint16_t *from, int count);
+
+struct depth_kernels
+{
+	depth_kernels_isa isa;
+	condition_fn condition;
+	project_fn project;
+	histogram_fn histogram;
+	fill_fn fill;
+};
+
+//projected pixels are clamped to this range before conversion, -1 is outside of any image
+static const float PROJECT_MIN = -1.0f;
+static const float PROJECT_MAX = 32767.0f;
+
+//the valid range after clamping to what can be represented in the output
+//false if nothing can survive
+static bool condition_bounds(const depth_condition_params &p, int *lo, int *hi)
+{
+	const int top = p.offset + (UINT16_MAX >> p.shift);
+
+	*lo = p.lo > p.offset ? p.lo : p.offset;
+	*hi = p.hi < top ? p.hi : top;
+
+	if(*hi > UINT16_MAX)
+		*hi = UINT16_MAX;
+
+	return *lo <= *hi;
+}
+
+static void condition_scalar(uint16_t *data, int count, const depth_condition_params &p, int lo, int hi)
+{
+	if(p.multiplier == 1.0f)
+	{
+		for(int i = 0; i < count; ++i)
+		{
+			const int d = data[i];
+			data[i] = (d >= lo && d <= hi) ? (d - p.offset) << p.shift : 0;
+		}
+		return;
+	}
+
+	for(int i = 0; i < count; ++i)
+	{
+		uint32_t val = data[i] * p.multiplier;
+		data[i] = (val >= (uint32_t)lo && val <= (uint32_t)hi) ? (val - p.offset) << p.shift : 0;
+	}
+}
+
+static void project_scalar(const uint16_t *depth, int count, const float *rx, const float *ry, const float *rz,
+	const depth_project_params &p, int32_t *x, int32_t *y)
+{
+	for(int i = 0; i < count; ++i)
+	{
+		const float z = depth[i] * p.scale;
+		const float px = z * rx[i] + p.tx;
+		const float py = z * ry[i] + p.ty;
+		const float pz = z * rz[i] + p.tz;
+
+		if(!(pz > 0.0f))
+		{
+			x[i] = y[i] = -1;
+			continue;
+		}
+
+		//the negated comparisons also catch NaN
+		float u = px / pz * p.fx + p.ppx + 0.5f;
+		float v = py / pz * p.fy + p.ppy + 0.5f;
+		u = !(u > PROJECT_MIN) ? PROJECT_MIN : (u < PROJECT_MAX ? u : PROJECT_MAX);
+		v = !(v > PROJECT_MIN) ? PROJECT_MIN : (v < PROJECT_MAX ? v : PROJECT_MAX);
+
+		x[i] = (int32_t)u;
+		y[i] = (int32_t)v;
+	}
+}
+
+static void histogram_scalar(const uint16_t *data, int count, float multiplier, int bin_shift, uint32_t *bins)
+{
+	if(multiplier == 1.0f)
+	{
+		for(int i = 0; i < count; ++i)
+			++bins[data[i] >> bin_shift];
+		return;
+	}
+
+	for(int i = 0; i < count; ++i)
+	{
+		uint32_t val = data[i] * multiplier;
+		++bins[(val < UINT16_MAX ? val : UINT16_MAX) >> bin_shift];
+	}
+}
+
+//pixels [begin, end) of the row, vector versions do the first and the last pixels here
+static void fill_scalar_range(uint16_t *row, const uint16_t *from, int count, int begin, int end)
+{
+	for(int i = begin; i < end; ++i)
+	{
+		if(row[i])
+			continue;
+
+		const int c = from[i];
+		const int l = (i > 0 && from[i - 1]) ? from[i - 1] : c;
+		const int r = (i + 1 < count && from[i + 1]) ? from[i + 1] : c;
+
+		row[i] = c ? (((l + r + 1) >> 1) + c + 1) >> 1 : 0;
+	}
+}
+
+static void fill_scalar(uint16_t *row, const uint16_t *from, int count)
+{
+	fill_scalar_range(row, from, count, 0, count);
+}
+
+#ifdef DEPTH_KERNELS_X86
+
+//vector unit conversion and binning, scalar increments (there is no vector scatter worth using)
+DEPTH_KERNELS_TARGET("sse4.1")
+static void depth_histogram_sse41(const uint16_t *data, int count, float multiplier, int bin_shift, uint32_t *bins)
+{
+	const __m128 mul = _mm_set1_ps(multiplier);
+	const __m128i vshift = _mm_cvtsi32_si128(bin_shift);
+	uint16_t b[8];
+	int i = 0;
+
+	for(; i + 8 <= count; i += 8)
+	{
+		__m128i d = _mm_loadu_si128((const __m128i*)(data + i));
+
+		if(multiplier != 1.0f)
+		{  //unsigned saturation of the pack is the clamp to 0xFFFF
+			__m128i l = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu16_epi32(d)), mul));
+			__m128i h = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_srli_si128(d, 8))), mul));
+			d = _mm_packus_epi32(l, h);
+		}
+
+		_mm_storeu_si128((__m128i*)b, _mm_srl_epi16(d, vshift));
+
+		for(int j = 0; j < 8; ++j)
+			++bins[b[j]];
+	}
+
+	histogram_scalar(data + i, count - i, multiplier, bin_shift, bins);
+}
+
+DEPTH_KERNELS_TARGET("avx2")
+static void depth_histogram_avx2(const uint16_t *data, int count, float multiplier, int bin_shift, uint32_t *bins)
+{
+	const __m256 mul = _mm256_set1_ps(multiplier);
+	const __m128i vshift = _mm_cvtsi32_si128(bin_shift);
+	uint16_t b[16];
+	int i = 0;
+
+	for(; i + 16 <= count; i += 16)
+	{
+		__m256i d = _mm256_loadu_si256((const __m256i*)(data + i));
+
+		if(multiplier != 1.0f)
+		{  //pack works within 128 bit lanes, permute puts the halves back in order
+			__m256i l = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(d))), mul));
+			__m256i h = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(d, 1))), mul));
+			d = _mm256_permute4x64_epi64(_mm256_packus_epi32(l, h), 0xD8);
+		}
+
+		_mm256_storeu_si256((__m256i*)b, _mm256_srl_epi16(d, vshift));
+
+		for(int j = 0; j < 16; ++j)
+			++bins[b[j]];
+	}
+
+	depth_histogram_sse41(data + i, count - i, multiplier, bin_shift, bins);
+}
+
+DEPTH_KERNELS_TARGET("sse4.1")
+static void depth_project_sse41(const uint16_t *depth, int count, const float *rx, const float *ry, const float *rz,
+	const depth_project_params &p, int32_t *x, int32_t *y)
+{
+	const __m128 scale = _mm_set1_ps(p.scale);
+	const __m128 tx = _mm_set1_ps(p.tx), ty = _mm_set1_ps(p.ty), tz = _mm_set1_ps(p.tz);
+	const __m128 fx = _mm_set1_ps(p.fx), fy = _mm_set1_ps(p.fy);
+	const __m128 ppx = _mm_set1_ps(p.ppx), ppy = _mm_set1_ps(p.ppy);
+	const __m128 half = _mm_set1_ps(0.5f), zero = _mm_setzero_ps();
+	const __m128 lo = _mm_set1_ps(PROJECT_MIN), hi = _mm_set1_ps(PROJECT_MAX);
+	const __m128i invalid = _mm_set1_epi32(-1);
+	int i = 0;
+
+	for(; i + 4 <= count; i += 4)
+	{
+		__m128i d = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)(depth + i)));
+		__m128 z = _mm_mul_ps(_mm_cvtepi32_ps(d), scale);
+		__m128 px = _mm_add_ps(_mm_mul_ps(z, _mm_loadu_ps(rx + i)), tx);
+		__m128 py = _mm_add_ps(_mm_mul_ps(z, _mm_loadu_ps(ry + i)), ty);
+		__m128 pz = _mm_add_ps(_mm_mul_ps(z, _mm_loadu_ps(rz + i)), tz);
+		__m128i front = _mm_castps_si128(_mm_cmpgt_ps(pz, zero));
+
+		__m128 u = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_div_ps(px, pz), fx), ppx), half);
+		__m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_div_ps(py, pz), fy), ppy), half);
+		//max returns the second operand for NaN, same as scalar
+		u = _mm_min_ps(_mm_max_ps(u, lo), hi);
+		v = _mm_min_ps(_mm_max_ps(v, lo), hi);
+
+		_mm_storeu_si128((__m128i*)(x + i), _mm_blendv_epi8(invalid, _mm_cvttps_epi32(u), front));
+		_mm_storeu_si128((__m128i*)(y + i), _mm_blendv_epi8(invalid, _mm_cvttps_epi32(v), front));
+	}
+
+	project_scalar(depth + i, count - i, rx + i, ry + i, rz + i, p, x + i, y + i);
+}
+
+DEPTH_KERNELS_TARGET("avx2")
+static void depth_project_avx2(const uint16_t *depth, int count, const float *rx, const float *ry, const float *rz,
+	const depth_project_params &p, int32_t *x, int32_t *y)
+{
+	const __m256 scale = _mm256_set1_ps(p.scale);
+	const __m256 tx = _mm256_set1_ps(p.tx), ty = _mm256_set1_ps(p.ty), tz = _mm256_set1_ps(p.tz);
+	const __m256 fx = _mm256_set1_ps(p.fx), fy = _mm256_set1_ps(p.fy);
+	const __m256 ppx = _mm256_set1_ps(p.ppx), ppy = _mm256_set1_ps(p.ppy);
+	const __m256 half = _mm256_set1_ps(0.5f), zero = _mm256_setzero_ps();
+	const __m256 lo = _mm256_set1_ps(PROJECT_MIN), hi = _mm256_set1_ps(PROJECT_MAX);
+	const __m256i invalid = _mm256_set1_epi32(-1);
+	int i = 0;
+
+	for(; i + 8 <= count; i += 8)
+	{
+		__m256i d = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(depth + i)));
+		__m256 z = _mm256_mul_ps(_mm256_cvtepi32_ps(d), scale);
+		__m256 px = _mm256_add_ps(_mm256_mul_ps(z, _mm256_loadu_ps(rx + i)), tx);
+		__m256 py = _mm256_add_ps(_mm256_mul_ps(z, _mm256_loadu_ps(ry + i)), ty);
+		__m256 pz = _mm256_add_ps(_mm256_mul_ps(z, _mm256_loadu_ps(rz + i)), tz);
+		__m256i front = _mm256_castps_si256(_mm256_cmp_ps(pz, zero, _CMP_GT_OQ));
+
+		__m256 u = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_div_ps(px, pz), fx), ppx), half);
+		__m256 v = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_div_ps(py, pz), fy), ppy), half);
+		u = _mm256_min_ps(_mm256_max_ps(u, lo), hi);
+		v = _mm256_min_ps(_mm256_max_ps(v, lo), hi);
+
+		_mm256_storeu_si256((__m256i*)(x + i), _mm256_blendv_epi8(invalid, _mm256_cvttps_epi32(u), front));
+		_mm256_storeu_si256((__m256i*)(y + i), _mm256_blendv_epi8(invalid, _mm256_cvttps_epi32(v), front));
+	}
+
+	depth_project_sse41(depth + i, count - i, rx + i, ry + i, rz + i, p, x + i, y + i);
+}
+
+DEPTH_KERNELS_TARGET("sse4.1")
+static void depth_condition_sse41(uint16_t *data, int count, const depth_condition_params &p, int lo, int hi)
+{
+	const __m128i vshift = _mm_cvtsi32_si128(p.shift);
+	int i = 0;
+
+	if(p.multiplier == 1.0f)
+	{  //stay in 16 bits, twice the pixels per instruction
+		const __m128i vlo = _mm_set1_epi16(lo);
+		const __m128i vhi = _mm_set1_epi16(hi);
+		const __m128i voffset = _mm_set1_epi16(p.offset);
+
+		for(; i + 8 <= count; i += 8)
+		{
+			__m128i d = _mm_loadu_si128((const __m128i*)(data + i));
+			__m128i keep = _mm_and_si128(_mm_cmpeq_epi16(_mm_max_epu16(d, vlo), d), _mm_cmpeq_epi16(_mm_min_epu16(d, vhi), d));
+			__m128i out = _mm_sll_epi16(_mm_sub_epi16(d, voffset), vshift);
+			_mm_storeu_si128((__m128i*)(data + i), _mm_and_si128(out, keep));
+		}
+	}
+	else
+	{
+		const __m128 mul = _mm_set1_ps(p.multiplier);
+		const __m128i below = _mm_set1_epi32(lo - 1);
+		const __m128i above = _mm_set1_epi32(hi + 1);
+		const __m128i voffset = _mm_set1_epi32(p.offset);
+
+		for(; i + 8 <= count; i += 8)
+		{
+			__m128i d = _mm_loadu_si128((const __m128i*)(data + i));
+			//conversion out of int32 range gives INT_MIN which fails the >= lo test, same as scalar > hi
+			__m128i l = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu16_epi32(d)), mul));
+			__m128i h = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_srli_si128(d, 8))), mul));
+
+			__m128i keep_l = _mm_and_si128(_mm_cmpgt_epi32(l, below), _mm_cmplt_epi32(l, above));
+			__m128i keep_h = _mm_and_si128(_mm_cmpgt_epi32(h, below), _mm_cmplt_epi32(h, above));
+
+			l = _mm_and_si128(_mm_sll_epi32(_mm_sub_epi32(l, voffset), vshift), keep_l);
+			h = _mm_and_si128(_mm_sll_epi32(_mm_sub_epi32(h, voffset), vshift), keep_h);
+
+			_mm_storeu_si128((__m128i*)(data + i), _mm_packus_epi32(l, h));
+		}
+	}
+
+	condition_scalar(data + i, count - i, p, lo, hi);
+}
+
+DEPTH_KERNELS_TARGET("avx2")
+static void depth_condition_avx2(uint16_t *data, int count, const depth_condition_params &p, int lo, int hi)
+{
+	const __m128i vshift = _mm_cvtsi32_si128(p.shift);
+	int i = 0;
+
+	if(p.multiplier == 1.0f)
+	{  //stay in 16 bits, twice the pixels per instruction
+		const __m256i vlo = _mm256_set1_epi16(lo);
+		const __m256i vhi = _mm256_set1_epi16(hi);
+		const __m256i voffset = _mm256_set1_epi16(p.offset);
+
+		for(; i + 16 <= count; i += 16)
+		{
+			__m256i d = _mm256_loadu_si256((const __m256i*)(data + i));
+			__m256i keep = _mm256_and_si256(_mm256_cmpeq_epi16(_mm256_max_epu16(d, vlo), d), _mm256_cmpeq_epi16(_mm256_min_epu16(d, vhi), d));
+			__m256i out = _mm256_sll_epi16(_mm256_sub_epi16(d, voffset), vshift);
+			_mm256_storeu_si256((__m256i*)(data + i), _mm256_and_si256(out, keep));
+		}
+	}
+	else
+	{
+		const __m256 mul = _mm256_set1_ps(p.multiplier);
+		const __m256i below = _mm256_set1_epi32(lo - 1);
+		const __m256i above = _mm256_set1_epi32(hi + 1);
+		const __m256i voffset = _mm256_set1_epi32(p.offset);
+
+		for(; i + 16 <= count; i += 16)
+		{
+			__m256i l = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(data + i)));
+			__m256i h = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(data + i + 8)));
+
+			l = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(l), mul));
+			h = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(h), mul));
+
+			__m256i keep_l = _mm256_and_si256(_mm256_cmpgt_epi32(l, below), _mm256_cmpgt_epi32(above, l));
+			__m256i keep_h = _mm256_and_si256(_mm256_cmpgt_epi32(h, below), _mm256_cmpgt_epi32(above, h));
+
+			l = _mm256_and_si256(_mm256_sll_epi32(_mm256_sub_epi32(l, voffset), vshift), keep_l);
+			h = _mm256_and_si256(_mm256_sll_epi32(_mm256_sub_epi32(h, voffset), vshift), keep_h);
+
+			//pack works within 128 bit lanes, restore the order afterwards
+			__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(l, h), 0xD8);
+			_mm256_storeu_si256((__m256i*)(data + i), packed);
+		}
+	}
+
+	depth_condition_sse41(data + i, count - i, p, lo, hi);
+}
+
+//neighbours are unaligned loads one pixel to each side, first and last pixel in scalar
+DEPTH_KERNELS_TARGET("sse4.1")
+static void depth_fill_sse41(uint16_t *row, const uint16_t *from, int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	int i = 1;
+
+	fill_scalar_range(row, from, count, 0, count ? 1 : 0);
+
+	for(; i + 9 <= count; i += 8)
+	{
+		__m128i d = _mm_loadu_si128((const __m128i*)(row + i));
+		__m128i c = _mm_loadu_si128((const __m128i*)(from + i));
+		__m128i l = _mm_loadu_si128((const __m128i*)(from + i - 1));
+		__m128i r = _mm_loadu_si128((const __m128i*)(from + i + 1));
+
+		l = _mm_blendv_epi8(l, c, _mm_cmpeq_epi16(l, zero));
+		r = _mm_blendv_epi8(r, c, _mm_cmpeq_epi16(r, zero));
+
+		__m128i fill = _mm_andnot_si128(_mm_cmpeq_epi16(c, zero), _mm_avg_epu16(_mm_avg_epu16(l, r), c));
+		_mm_storeu_si128((__m128i*)(row + i), _mm_blendv_epi8(d, fill, _mm_cmpeq_epi16(d, zero)));
+	}
+
+	fill_scalar_range(row, from, count, i, count);
+}
+
+DEPTH_KERNELS_TARGET("avx2")
+static void depth_fill_avx2(uint16_t *row, const uint16_t *from, int count)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	int i = 1;
+
+	fill_scalar_range(row, from, count, 0, count ? 1 : 0);
+
+	for(; i + 17 <= count; i += 16)
+	{
+		__m256i d = _mm256_loadu_si256((const __m256i*)(row + i));
+		__m256i c = _mm256_loadu_si256((const __m256i*)(from + i));
+		__m256i l = _mm256_loadu_si256((const __m256i*)(from + i - 1));
+		__m256i r = _mm256_loadu_si256((const __m256i*)(from + i + 1));
+
+		l = _mm256_blendv_epi8(l, c, _mm256_cmpeq_epi16(l, zero));
+		r = _mm256_blendv_epi8(r, c, _mm256_cmpeq_epi16(r, zero));
+
+		__m256i fill = _mm256_andnot_si256(_mm256_cmpeq_epi16(c, zero), _mm256_avg_epu16(_mm256_avg_epu16(l, r), c));
+		_mm256_storeu_si256((__m256i*)(row + i), _mm256_blendv_epi8(d, fill, _mm256_cmpeq_epi16(d, zero)));
+	}
+
+	fill_scalar_range(row, from, count, i, count);
+}
+
+static bool cpu_supports(depth_kernels_isa isa)
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	const bool sse41 = (info[2] & (1 << 19)) != 0;
+	//AVX2 also needs the OS to save ymm registers (OSXSAVE + XCR0 bits 1 and 2)
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx2 = false;
+	if(osxsave && (_xgetbv(0) & 6) == 6)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	const bool sse41 = __builtin_cpu_supports("sse4.1");
+	const bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+	if(isa == DEPTH_KERNELS_SSE41)
+		return sse41;
+	if(isa == DEPTH_KERNELS_AVX2)
+		return avx2;
+
+	return isa == DEPTH_KERNELS_SCALAR;
+}
+
+#endif //DEPTH_KERNELS_X86
+
+#ifdef DEPTH_KERNELS_ARM_NEON
+
+static void depth_condition_neon(uint16_t *data, int count, const depth_condition_params &p, int lo, int hi)
+{
+	int i = 0;
+
+	if(p.multiplier == 1.0f)
+	{  //stay in 16 bits, twice the pixels per instruction
+		const uint16x8_t vlo = vdupq_n_u16(lo);
+		const uint16x8_t vhi = vdupq_n_u16(hi);
+		const uint16x8_t voffset = vdupq_n_u16(p.offset);
+		const int16x8_t vshift = vdupq_n_s16(p.shift);
+
+		for(; i + 8 <= count; i += 8)
+		{
+			uint16x8_t d = vld1q_u16(data + i);
+			uint16x8_t keep = vandq_u16(vcgeq_u16(d, vlo), vcleq_u16(d, vhi));
+			uint16x8_t out = vshlq_u16(vsubq_u16(d, voffset), vshift);
+			vst1q_u16(data + i, vandq_u16(out, keep));
+		}
+	}
+	else
+	{
+		const uint32x4_t vlo = vdupq_n_u32(lo);
+		const uint32x4_t vhi = vdupq_n_u32(hi);
+		const uint32x4_t voffset = vdupq_n_u32(p.offset);
+		const int32x4_t vshift = vdupq_n_s32(p.shift);
+
+		for(; i + 8 <= count; i += 8)
+		{
+			uint16x8_t d = vld1q_u16(data + i);
+			//unsigned conversion saturates out of range values which then fail the <= hi test
+			uint32x4_t l = vcvtq_u32_f32(vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(d))), p.multiplier));
+			uint32x4_t h = vcvtq_u32_f32(vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(d))), p.multiplier));
+
+			uint32x4_t keep_l = vandq_u32(vcgeq_u32(l, vlo), vcleq_u32(l, vhi));
+			uint32x4_t keep_h = vandq_u32(vcgeq_u32(h, vlo), vcleq_u32(h, vhi));
+
+			l = vandq_u32(vshlq_u32(vsubq_u32(l, voffset), vshift), keep_l);
+			h = vandq_u32(vshlq_u32(vsubq_u32(h, voffset), vshift), keep_h);
+
+			vst1q_u16(data + i, vcombine_u16(vmovn_u32(l), vmovn_u32(h)));
+		}
+	}
+
+	condition_scalar(data + i, count - i, p, lo, hi);
+}
+
+static void depth_fill_neon(uint16_t *row, const uint16_t *from, int count)
+{
+	const uint16x8_t zero = vdupq_n_u16(0);
+	int i = 1;
+
+	fill_scalar_range(row, from, count, 0, count ? 1 : 0);
+
+	for(; i + 9 <= count; i += 8)
+	{
+		uint16x8_t d = vld1q_u16(row + i);
+		uint16x8_t c = vld1q_u16(from + i);
+		uint16x8_t l = vld1q_u16(from + i - 1);
+		uint16x8_t r = vld1q_u16(from + i + 1);
+
+		l = vbslq_u16(vceqq_u16(l, zero), c, l);
+		r = vbslq_u16(vceqq_u16(r, zero), c, r);
+
+		//rounding halving add is avg rounding up
+		uint16x8_t fill = vbicq_u16(vrhaddq_u16(vrhaddq_u16(l, r), c), vceqq_u16(c, zero));
+		vst1q_u16(row + i, vbslq_u16(vceqq_u16(d, zero), fill, d));
+	}
+
+	fill_scalar_range(row, from, count, i, count);
+}
+
+#endif //DEPTH_KERNELS_ARM_NEON
+
+bool depth_kernels_supported(depth_kernels_isa isa)
+{
+	if(isa == DEPTH_KERNELS_SCALAR)
+		return true;
+#ifdef DEPTH_KERNELS_X86
+	if(isa == DEPTH_KERNELS_SSE41 || isa == DEPTH_KERNELS_AVX2)
+		return cpu_supports(isa);
+#endif
+#ifdef DEPTH_KERNELS_ARM_NEON
+	if(isa == DEPTH_KERNELS_NEON)
+		return true;
+#endif
+	return false;
+}
+
+depth_kernels_isa depth_kernels_best_isa()
+{
+	if(depth_kernels_supported(DEPTH_KERNELS_AVX2))
+		return DEPTH_KERNELS_AVX2;
+	if(depth_kernels_supported(DEPTH_KERNELS_SSE41))
+		return DEPTH_KERNELS_SSE41;
+	if(depth_kernels_supported(DEPTH_KERNELS_NEON))
+		return DEPTH_KERNELS_NEON;
+	return DEPTH_KERNELS_SCALAR;
+}
+
+static depth_kernels make_kernels(depth_kernels_isa isa)
+{
+	depth_kernels k = {DEPTH_KERNELS_SCALAR, condition_scalar, project_scalar, histogram_scalar, fill_scalar};
+
+#ifdef DEPTH_KERNELS_X86
+	if(isa == DEPTH_KERNELS_SSE41)
+		k = {isa, depth_condition_sse41, depth_project_sse41, depth_histogram_sse41, depth_fill_sse41};
+	else if(isa == DEPTH_KERNELS_AVX2)
+		k = {isa, depth_condition_avx2, depth_project_avx2, depth_histogram_avx2, depth_fill_avx2};
+#endif
+#ifdef DEPTH_KERNELS_ARM_NEON
+	//projection (32-bit ARM has no vector division) and histogram stay scalar
+	if(isa == DEPTH_KERNELS_NEON)
+		k = {isa, depth_condition_neon, project_scalar, histogram_scalar, depth_fill_neon};
+#endif
+
+	return k;
+}
+
+//selected once on first use, may be overriden with depth_kernels_select
+static depth_kernels &kernels()
+{
+	static depth_kernels k = make_kernels(depth_kernels_best_isa());
+	return k;
+}
+
+bool depth_kernels_select(depth_kernels_isa isa)
+{
+	if(!depth_kernels_supported(isa))
+		return false;
+
+	kernels() = make_kernels(isa);
+	return true;
+}
+
+depth_kernels_isa depth_kernels_selected()
+{
+	return kernels().isa;
+}
+
+const char *depth_kernels_isa_name(depth_kernels_isa isa)
+{
+	static const char *names[] = {"scalar", "sse4.1", "avx2", "neon"};
+	return (isa >= 0 && isa < DEPTH_KERNELS_ISA_COUNT) ? names[isa] : "unknown";
+}
+
+void depth_condition(uint16_t *data, int count, const depth_condition_params &params)
+{
+	int lo, hi;
+
+	if(!condition_bounds(params, &lo, &hi))
+	{
+		memset(data, 0, count * sizeof(uint16_t));
+		return;
+	}
+
+	kernels().condition(data, count, params, lo, hi);
+}
+
+void depth_condition_scalar(uint16_t *data, int count, const depth_condition_params &params)
+{
+	int lo, hi;
+
+	if(!condition_bounds(params, &lo, &hi))
+	{
+		memset(data, 0, count * sizeof(uint16_t));
+		return;
+	}
+
+	condition_scalar(data, count, params, lo, hi);
+}
+
+void depth_project(const uint16_t *depth, int count, const float *rx, const float *ry, const float *rz,
+	const depth_project_params &params, int32_t *x, int32_t *y)
+{
+	kernels().project(depth, count, rx, ry, rz, params, x, y);
+}
+
+void depth_project_scalar(const uint16_t *depth, int count, const float *rx, const float *ry, const float *rz,
+	const depth_project_params &params, int32_t *x, int32_t *y)
+{
+	project_scalar(depth, count, rx, ry, rz, params, x, y);
+}
+
+void depth_histogram(const uint16_t *data, int count, float multiplier, int bin_shift, uint32_t *bins)
+{
+	kernels().histogram(data, count, multiplier, bin_shift, bins);
+}
+
+void depth_histogram_scalar(const uint16_t *data, int count, float multiplier, int bin_shift, uint32_t *bins)
+{
+	histogram_scalar(data, count, multiplier, bin_shift, bins);
+}
+
+void depth_fill_row(uint16_t *row, const uint16_t *from, int count)
+{
+	kernels().fill(row, from, count);
+}
+
+void depth_fill_row_scalar(uint16_t *row, const uint16_t *from, int count)
+{
+	fill_scalar(row, from, count);
+}
+
+void depth_rescale_units(uint16_t *data, int count, float multiplier, uint16_t max_value)
+{
+	depth_condition_params params = {multiplier, 0, max_value, 0, 0};
+	depth_condition(data, count, params);
+}
+
+void depth_rescale_slice(uint16_t *data, int count, uint16_t min_units, int shift)
+{
+	const int window = 1 << (16 - shift);
+	depth_condition_params params = {1.0f, min_units + 1, min_units + window - 1, min_units, shift};
+	depth_condition(data, count, params);
+}
+
+//the original per pixel loops, kept as they were to compare against
+
+void depth_rescale_units_scalar(uint16_t *data, int count, float multiplier, uint16_t max_value)
+{
+	for(int i = 0; i < count; ++i)
+	{
+		uint32_t val = data[i] * multiplier;
+		data[i] = val <= max_value ? val : 0;
+	}
+}
+
+void depth_rescale_slice_scalar(uint16_t *data, int count, uint16_t min_units, int shift)
+{
+	const int min = min_units;
+	const int window = 1 << (16 - shift);
+
+	for(int i = 0; i < count; ++i)
+	{
+		const int d = data[i];
+		data[i] = (d > min && d < min + window) ? (d - min) << shift : 0;
+	}
+}
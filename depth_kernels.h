@@ -0,0 +1,93 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Depth kernels
+ * - per pixel Z16 depth processing with SSE4.1/AVX2/NEON implementations
+ * - unit conversion, thresholding, slicing and P010LE shift fused in single pass
+ * - projection of depth pixels to the other camera for alignment
+ * - depth histogram for choosing the slice
+ * - hole filling rows from their (filled) neighbour row
+ * - implementation selected at runtime, scalar reference kept for comparison
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef DEPTH_KERNELS_H
+#define DEPTH_KERNELS_H
+
+#include <stdint.h>
+
+enum depth_kernels_isa { DEPTH_KERNELS_SCALAR, DEPTH_KERNELS_SSE41, DEPTH_KERNELS_AVX2, DEPTH_KERNELS_NEON, DEPTH_KERNELS_ISA_COUNT };
+
+// best implementation supported by the CPU we are running on
+depth_kernels_isa depth_kernels_best_isa();
+// false if the CPU (or the build) doesn't support requested implementation
+bool depth_kernels_supported(depth_kernels_isa isa);
+// use requested implementation from now on, false if not supported
+bool depth_kernels_select(depth_kernels_isa isa);
+depth_kernels_isa depth_kernels_selected();
+const char *depth_kernels_isa_name(depth_kernels_isa isa);
+
+// fused single pass depth conditioning, see depth_condition
+struct depth_condition_params
+{
+	float multiplier; //depth units set / depth units wanted, 1.0f skips the conversion
+	int lo;           //inclusive range of valid values (after conversion)
+	int hi;
+	uint16_t offset;  //subtracted from valid values
+	int shift;        //valid values are shifted up towards MSB by that much
+};
+
+// in place, for each value:
+// - converts units (value * multiplier, truncated)
+// - keeps values in [max(lo, offset), min(hi, offset + (0xFFFF >> shift))] as (value - offset) << shift
+// - everything else becomes 0
+void depth_condition(uint16_t *data, int count, const depth_condition_params &params);
+
+// in place depth unit conversion (multiplier = units set / units wanted)
+// values above max_value are invalidated to 0
+void depth_rescale_units(uint16_t *data, int count, float multiplier, uint16_t max_value);
+
+// in place depth slice for 10 bit P010LE encoding
+// keeps values in (min_units, min_units + 2^(16-shift)) as (value - min_units) << shift
+// everything else becomes 0
+void depth_rescale_slice(uint16_t *data, int count, uint16_t min_units, int shift);
+
+// projection of depth pixel corners to the other camera, see depth_aligner
+struct depth_project_params
+{
+	float scale;            //depth units in meters
+	float tx, ty, tz;       //translation to the other camera (m)
+	float fx, fy, ppx, ppy; //other camera pinhole intrinsics
+};
+
+// for each depth value and ray (deprojected at 1 m and rotated to the other camera):
+// - point = value * scale * ray + t
+// - x = point.x / point.z * fx + ppx, y the same way
+// - stored as (int)(x + 0.5f) like librealsense align
+// - -1 when the point is not in front of the camera or the pixel is far outside
+void depth_project(const uint16_t *depth, int count, const float *rx, const float *ry, const float *rz,
+	const depth_project_params &params, int32_t *x, int32_t *y);
+
+// adds count values to bins after unit conversion (value * multiplier, truncated, saturated to 0xFFFF)
+// bin of a value is value >> bin_shift, bins has (0x10000 >> bin_shift) entries
+void depth_histogram(const uint16_t *data, int count, float multiplier, int bin_shift, uint32_t *bins);
+
+// in place, fills invalid (0) values of row from the neighbour row (above or below, already filled)
+// value is [1 2 1] / 4 of from[i - 1], from[i], from[i + 1] (invalid or missing neighbours replaced by from[i])
+// as avg(avg(left, right), center), avg rounding up, 0 stays 0 where from[i] is 0
+void depth_fill_row(uint16_t *row, const uint16_t *from, int count);
+
+// scalar reference implementations, bit-exact with the above
+void depth_histogram_scalar(const uint16_t *data, int count, float multiplier, int bin_shift, uint32_t *bins);
+void depth_condition_scalar(uint16_t *data, int count, const depth_condition_params &params);
+void depth_project_scalar(const uint16_t *depth, int count, const float *rx, const float *ry, const float *rz,
+	const depth_project_params &params, int32_t *x, int32_t *y);
+void depth_rescale_units_scalar(uint16_t *data, int count, float multiplier, uint16_t max_value);
+void depth_rescale_slice_scalar(uint16_t *data, int count, uint16_t min_units, int shift);
+void depth_fill_row_scalar(uint16_t *row, const uint16_t *from, int count);
+
+#endif
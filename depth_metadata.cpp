@@ -0,0 +1,165 @@
+#include "depth_metadata.h"
+#include "options.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+
+//the record is host memory order, all supported hosts (x86, ARM) are little endian
+template <typename T>
+static uint8_t *put(uint8_t *p, const T &value)
+{
+	memcpy(p, &value, sizeof(T));
+	return p + sizeof(T);
+}
+
+template <typename T>
+static const uint8_t *get(const uint8_t *p, T *value)
+{
+	memcpy(value, p, sizeof(T));
+	return p + sizeof(T);
+}
+
+void depth_metadata_sender_init(depth_metadata_sender *s, int interval)
+{
+	memset(s, 0, sizeof(*s));
+	s->interval = interval;
+}
+
+//anything but frame number and timestamp
+static bool changed(const depth_metadata &a, const depth_metadata &b)
+{
+	return a.depth_units != b.depth_units || a.slice_offset != b.slice_offset || a.slice_shift != b.slice_shift ||
+		memcmp(&a.intrinsics, &b.intrinsics, sizeof(a.intrinsics)) != 0 ||
+		memcmp(&a.depth_to_color, &b.depth_to_color, sizeof(a.depth_to_color)) != 0;
+}
+
+static int write_record(const depth_metadata &m, uint8_t *buffer)
+{
+	uint8_t *p = buffer;
+	const rs2_intrinsics &i = m.intrinsics;
+
+	*p++ = 'R';
+	*p++ = 'D';
+	*p++ = 'M';
+	*p++ = DEPTH_METADATA_VERSION;
+
+	p = put(p, m.framenumber);
+	p = put(p, m.timestamp);
+	p = put(p, m.depth_units);
+	p = put(p, m.slice_offset);
+	p = put(p, m.slice_shift);
+	p = put(p, (uint8_t)0); //reserved
+
+	p = put(p, (uint16_t)i.width);
+	p = put(p, (uint16_t)i.height);
+	p = put(p, i.ppx);
+	p = put(p, i.ppy);
+	p = put(p, i.fx);
+	p = put(p, i.fy);
+	p = put(p, (int32_t)i.model);
+	for(int c = 0; c < 5; ++c)
+		p = put(p, i.coeffs[c]);
+
+	for(int r = 0; r < 9; ++r)
+		p = put(p, m.depth_to_color.rotation[r]);
+	for(int t = 0; t < 3; ++t)
+		p = put(p, m.depth_to_color.translation[t]);
+
+	return (int)(p - buffer);
+}
+
+int depth_metadata_pack(depth_metadata_sender *s, const depth_metadata &m, uint8_t *buffer)
+{
+	if(s->interval <= 0)
+		return 0;
+
+	const bool due = !s->sent || ++s->frames >= s->interval || changed(m, s->last);
+
+	if(!due)
+		return 0;
+
+	s->last = m;
+	s->sent = true;
+	s->frames = 0;
+
+	return write_record(m, buffer);
+}
+
+int depth_metadata_read(const uint8_t *buffer, int size, depth_metadata *m)
+{
+	if(size < DEPTH_METADATA_SIZE || buffer[0] != 'R' || buffer[1] != 'D' || buffer[2] != 'M' || buffer[3] != DEPTH_METADATA_VERSION)
+		return -1;
+
+	const uint8_t *p = buffer + 4;
+	rs2_intrinsics &i = m->intrinsics;
+	uint8_t reserved;
+	uint16_t width, height;
+	int32_t model;
+
+	p = get(p, &m->framenumber);
+	p = get(p, &m->timestamp);
+	p = get(p, &m->depth_units);
+	p = get(p, &m->slice_offset);
+	p = get(p, &m->slice_shift);
+	p = get(p, &reserved);
+
+	p = get(p, &width);
+	p = get(p, &height);
+	p = get(p, &i.ppx);
+	p = get(p, &i.ppy);
+	p = get(p, &i.fx);
+	p = get(p, &i.fy);
+	p = get(p, &model);
+	for(int c = 0; c < 5; ++c)
+		p = get(p, &i.coeffs[c]);
+
+	for(int r = 0; r < 9; ++r)
+		p = get(p, &m->depth_to_color.rotation[r]);
+	for(int t = 0; t < 3; ++t)
+		p = get(p, &m->depth_to_color.translation[t]);
+
+	i.width = width;
+	i.height = height;
+	i.model = (rs2_distortion)model;
+
+	return (int)(p - buffer);
+}
+
+float depth_metadata_to_meters(const depth_metadata &m, uint16_t p010le)
+{
+	if(p010le == 0)
+		return 0.0f; //no depth or outside slice
+
+	if(m.slice_shift == 0)
+		return p010le * m.depth_units;
+
+	return ((p010le >> m.slice_shift) + m.slice_offset) * m.depth_units;
+}
+
+int depth_metadata_options(int *argc, char *argv[], int *interval)
+{
+	const char *frames = option_value(argc, argv, "metadata");
+
+	if(!frames)
+		return 0;
+
+	char *end;
+	*interval = strtol(frames, &end, 10);
+
+	if(*frames == '\0' || *end != '\0' || *interval <= 0)
+	{
+		cerr << "invalid --metadata '" << frames << "', expected positive number of frames" << endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+void depth_metadata_usage(ostream &out)
+{
+	out << "metadata options:" << endl
+	    << "       --metadata <frames> # depth metadata record in aux subframe every n frames and on change" << endl;
+}
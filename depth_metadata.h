@@ -0,0 +1,64 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Depth metadata
+ * - what the receiver needs to reconstruct metric depth from decoded 10 bit slice
+ * - frame number, device timestamp, depth units, slice offset/shift, intrinsics, extrinsics
+ * - compact binary record (little endian) for NHVE aux channel
+ * - sent every N frames and whenever anything but frame number/timestamp changes
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef DEPTH_METADATA_H
+#define DEPTH_METADATA_H
+
+// Realsense API (intrinsics, extrinsics)
+#include <librealsense2/rs.hpp>
+
+#include <ostream>
+#include <stdint.h>
+
+// record starts with "RDM" and version byte
+#define DEPTH_METADATA_VERSION 1
+#define DEPTH_METADATA_SIZE 120
+
+struct depth_metadata
+{
+	uint64_t framenumber;
+	double timestamp;             //device timestamp in ms
+	float depth_units;            //meters per depth unit of encoded data (before slicing)
+	uint16_t slice_offset;        //depth units subtracted before encoding
+	uint8_t slice_shift;          //slice is 2^(16-shift) units deep, 0 without slicing
+	rs2_intrinsics intrinsics;    //encoded depth (alignment target)
+	rs2_extrinsics depth_to_color;
+};
+
+struct depth_metadata_sender
+{
+	int interval;                 //frames between records, 0 disables metadata
+	int frames;                   //since last record
+	depth_metadata last;
+	bool sent;                    //last is valid
+};
+
+void depth_metadata_sender_init(depth_metadata_sender *s, int interval);
+
+// writes record to buffer (DEPTH_METADATA_SIZE) if due for the frame
+// returns record size or 0 if it is not time to send it
+int depth_metadata_pack(depth_metadata_sender *s, const depth_metadata &m, uint8_t *buffer);
+
+// record size on success, -1 on unknown or truncated record (receiving end)
+int depth_metadata_read(const uint8_t *buffer, int size, depth_metadata *m);
+
+// metric depth of decoded 10 bit P010LE sample
+float depth_metadata_to_meters(const depth_metadata &m, uint16_t p010le);
+
+// removes "--metadata <frames>" from argv, -1 on invalid value
+int depth_metadata_options(int *argc, char *argv[], int *interval);
+void depth_metadata_usage(std::ostream &out);
+
+#endif
@@ -0,0 +1,126 @@
+#include "depth_slicer.h"
+#include "depth_kernels.h"
+
+#include <iostream>
+#include <vector>
+#include <math.h>
+
+using namespace std;
+
+//histogram resolution, the window is placed with 1/16 of its depth precision
+static const int BINS_PER_WINDOW = 16;
+//every other row of the center half of the frame
+static const int ROW_STEP = 2;
+//subject has to cover at least that much of the sampled pixels to follow it
+static const float MIN_SUBJECT = 0.01f;
+//offset doesn't move while the subject stays that close to the window center (fraction of window)
+static const float DEAD_BAND = 1.0f / 16.0f;
+//how fast the offset approaches the subject and the limit for single frame (fraction of window)
+static const float SMOOTHING = 0.5f;
+static const float MAX_STEP = 1.0f / 8.0f;
+
+struct depth_slicer
+{
+	int window;      //slice depth in units
+	int bin_shift;
+	vector<uint32_t> bins;
+	float offset;
+	bool first;
+};
+
+struct depth_slicer *depth_slicer_init(int shift, int offset)
+{
+	if(shift < 1 || shift > 6 || offset < 0 || offset > UINT16_MAX)
+	{
+		cerr << "depth slicer: invalid slice " << offset << ":" << shift << ", adaptive slice needs --slice shift 1-6" << endl;
+		return NULL;
+	}
+
+	depth_slicer *s = new depth_slicer();
+
+	s->window = 1 << (16 - shift);
+	s->bin_shift = 16 - shift - 4; //log2(BINS_PER_WINDOW)
+	s->bins.resize(0x10000 >> s->bin_shift);
+	s->offset = offset;
+	s->first = true;
+
+	return s;
+}
+
+void depth_slicer_close(struct depth_slicer *s)
+{
+	delete s;
+}
+
+//target offset centering the window with the most pixels on their mean, -1 if there is no subject
+static int subject_offset(depth_slicer *s, uint32_t sampled)
+{
+	vector<uint32_t> &bins = s->bins;
+	const int n = (int)bins.size();
+	const int bin_width = 1 << s->bin_shift;
+
+	bins[0] = 0; //no depth (and anything closer than one bin)
+
+	uint32_t sum = 0, best_sum = 0;
+	int best = 0;
+
+	//sliding window, nearest one wins ties
+	for(int b = 0; b < n; ++b)
+	{
+		sum += bins[b];
+		if(b >= BINS_PER_WINDOW)
+			sum -= bins[b - BINS_PER_WINDOW];
+
+		if(sum > best_sum)
+		{
+			best_sum = sum;
+			best = b - BINS_PER_WINDOW + 1;
+		}
+	}
+
+	if(best_sum == 0 || best_sum < MIN_SUBJECT * sampled)
+		return -1;
+
+	uint64_t weighted = 0;
+
+	for(int b = best < 0 ? 0 : best; b < best + BINS_PER_WINDOW && b < n; ++b)
+		weighted += (uint64_t)bins[b] * (b * bin_width + bin_width / 2);
+
+	const int target = (int)(weighted / best_sum) - s->window / 2;
+	const int last = UINT16_MAX - s->window + 1;
+
+	return target < 0 ? 0 : (target > last ? last : target);
+}
+
+int depth_slicer_update(struct depth_slicer *s, const uint16_t *data, int width, int height, int stride, float multiplier)
+{
+	const int x0 = width / 4, x1 = width * 3 / 4;
+	const int y0 = height / 4, y1 = height * 3 / 4;
+	uint32_t sampled = 0;
+
+	fill(s->bins.begin(), s->bins.end(), 0);
+
+	for(int y = y0; y < y1; y += ROW_STEP, sampled += x1 - x0)
+		depth_histogram(data + y * (stride / 2) + x0, x1 - x0, multiplier, s->bin_shift, &s->bins[0]);
+
+	const int target = subject_offset(s, sampled);
+
+	//nothing to follow, keep the slice where it is
+	if(target < 0)
+		return (int)lroundf(s->offset);
+
+	const float delta = target - s->offset;
+
+	if(s->first)
+		s->offset = target;
+	else if(fabsf(delta) > DEAD_BAND * s->window)
+	{
+		const float max_step = MAX_STEP * s->window;
+		const float step = delta * SMOOTHING;
+		s->offset += step > max_step ? max_step : (step < -max_step ? -max_step : step);
+	}
+
+	s->first = false;
+
+	return (int)lroundf(s->offset);
+}
@@ -0,0 +1,31 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Adaptive depth slicer
+ * - picks the 10 bit slice offset covering the dominant subject each frame
+ * - subsampled histogram of the center of the frame (depth kernels)
+ * - offset follows the subject smoothly (dead band, limited step per frame)
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef DEPTH_SLICER_H
+#define DEPTH_SLICER_H
+
+#include <stdint.h>
+
+struct depth_slicer;
+
+// slice 2^(16-shift) depth units deep (shift as in --slice, 1-6), starting at offset until the first frame
+// NULL on failure
+struct depth_slicer *depth_slicer_init(int shift, int offset);
+void depth_slicer_close(struct depth_slicer *s);
+
+// slice offset for the frame in wanted depth units
+// Z16 data (stride in bytes) in units set, multiplier - depth units set / depth units wanted
+int depth_slicer_update(struct depth_slicer *s, const uint16_t *data, int width, int height, int stride, float multiplier);
+
+#endif
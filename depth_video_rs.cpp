@@ -1,4 +1,8 @@
 #include "depth_video_rs.h"
+#include "options.h"
+
+#include <stdlib.h>
+#include <string.h>
 
 #ifndef M_PI
 #define M_PI           3.14159265358979323846  /* pi */
@@ -6,13 +10,44 @@
 
 using namespace std;
 
+static void realsense_worker_thread(depth_video* dv, depth_video_state& dv_state, input_args& input);
+
 depth_video* depth_video_init(depth_video_state& dv_state, input_args& user_input)
 {
 	depth_video* dv = new depth_video();
 
 	dv->keep_working = true;
-	dv->realsense = new rs2::pipeline();
-	init_realsense(*dv->realsense, user_input);
+	dv->frames = new depth_video_ring(user_input.frame_queue > 0 ? user_input.frame_queue : FRAME_QUEUE_SIZE, user_input.frame_drop);
+	dv_state.frames = dv->frames;
+
+	if (user_input.adaptive_slice &&
+		(dv->slicer = depth_slicer_init(user_input.conditioning.slice_shift, user_input.conditioning.slice_offset)) == NULL)
+	{
+		depth_video_close(dv);
+		return NULL;
+	}
+
+	if ((dv->realsense = frame_source_init(&user_input.source)) == NULL ||
+		init_realsense(dv->realsense, user_input) < 0)
+	{
+		depth_video_close(dv);
+		return NULL;
+	}
+
+	init_metadata(dv->realsense, user_input, &dv->metadata);
+
+	//prepare dummy color plane for P010LE before the first frame, output dimensions match alignment target
+	//Realsense Z16 stride is width * 2, worker looks it up again only if Realsense stride differs
+	const bool color = user_input.align_to == Color;
+
+	if (!neutral_chroma_stream_init(&dv->depth_uv, CHROMA_P010LE, (color ? user_input.color_width : user_input.depth_width) * 2,
+		color ? user_input.color_height : user_input.depth_height))
+	{
+		cerr << "failed to prepare neutral chroma plane" << endl;
+		depth_video_close(dv);
+		return NULL;
+	}
+
 	dv->worker_thread = thread(realsense_worker_thread, dv, ref(dv_state), ref(user_input));
 
 	return dv;
@@ -27,6 +62,12 @@ void depth_video_close(depth_video* dv)
 	if (dv->worker_thread.joinable())
 		dv->worker_thread.join();
 
+	cout << "depth video frames queued " << dv->frames->pushed() << ", dropped oldest " << dv->frames->dropped_oldest() <<
+		", dropped newest " << dv->frames->dropped_newest() << endl;
+
+	delete dv->frames; //releases the frames still waiting
+	frame_source_close(dv->realsense);
+	depth_slicer_close(dv->slicer);
 	delete dv;
 }
 
@@ -38,30 +79,28 @@ void depth_video_close(depth_video* dv)
 /// <param name="input"></param>
 static void realsense_worker_thread(depth_video* dv,  depth_video_state & dv_state, input_args& input)
 {
-	rs2::align aligner((input.align_to == Color) ? RS2_STREAM_COLOR : RS2_STREAM_DEPTH);
-	rs2::threshold_filter thresh_filter;
+	depth_aligner* aligner = depth_aligner_init((input.align_to == Color) ? RS2_STREAM_COLOR : RS2_STREAM_DEPTH, input.aligner);
 
-	while (dv->keep_working)
+	while (aligner && dv->keep_working)
 	{
-		rs2::frameset frameset = dv->realsense->wait_for_frames();
-		frameset = aligner.process(frameset);
+		depth_video_frame frame;
+		rs2::frameset frameset = frame_source_wait(dv->realsense, &frame.latency);
+		frame.pts[0] = frame_source_pts(dv->realsense, frameset.get_depth_frame(), &frame.latency);
+		frame.pts[1] = frame_source_pts(dv->realsense, frameset.get_color_frame(), &frame.latency);
 
-		rs2::depth_frame depth = frameset.get_depth_frame();
-		rs2::video_frame color = frameset.get_color_frame();
+		frame.frameset = depth_aligner_process(aligner, frameset);
+		frame_latency_stamp(&frame.latency, LATENCY_ALIGNED);
 
-		// put a bounding volume around the object in the center of the frame, +-0.5m
-		//float center_depth = depth.get_distance(depth.get_width() / 2, depth.get_height() / 2);
+		rs2::depth_frame depth = frame.frameset.get_depth_frame();
 
-		//update_thresholds(thresh_filter, center_depth);
-		//depth = thresh_filter.process(depth);
+		frame.metadata = dv->metadata;
+		frame.metadata.framenumber = depth.get_frame_number();
+		frame.metadata.timestamp = depth.get_timestamp();
+		frame.metadata.depth_units = input.needs_postprocessing ? input.depth_units : depth.get_units();
 
-		const int h = depth.get_height();
-		int local_depth_stride = depth.get_stride_in_bytes();
-
-		//L515 doesn't support setting depth units and clamping
-		// comment out for now because it's just going to go over the whole depth image and multiply by 1
-		//if (input.needs_postprocessing)
-		//	process_depth_data(input, depth);
+		// put a bounding volume around the object in the center of the frame (--bounding-depth)
+		// L515 doesn't support setting depth units and clamping
+		// all of that and the 10 bit slice below are done in a single pass over the frame
 
 		// What I actually want to do here is find the 25.6cm depth slice (or 51.2cm, or 1.024m) that I care about the most
 		// and shift it forwards (e.g. subtract (depth.get_distance(depth.get_width() / 2, depth.get_height() / 2) from
@@ -76,100 +115,133 @@ static void realsense_worker_thread(depth_video* dv,  depth_video_state & dv_sta
 		// Or, if I don't need 0.25mm precision, I can coarse-grain to .5mm or 1mm and get a 516mm or 1024mm slice (right-shift 1, 2)
 		// shift those 10 bits to MSB, encode
 		// decode, shift back to LSB, add offset (2048 units = 51.6cm?), deproject etc.
-		rescale_depth_slice_for_tenbit(depth, 2048); // 2048 depth units = 51.6cm displacement, minimum distance from camera
-
-		if (!dv_state.depth_uv)
-		{  //prepare dummy color plane for P010LE format, half the size of Y
-			//we can't alloc it in advance, this is the first time we know realsense stride
-			//the stride will be at least width * 2 (Realsense Z16, VAAPI P010LE)
-			dv_state.depth_uv = new uint16_t[local_depth_stride / 2 * h / 2];
-
-			for (int i = 0; i < local_depth_stride / 2 * h / 2; ++i)
-				dv_state.depth_uv[i] = UINT16_MAX / 2; //dummy middle value for U/V, equals 128 << 8, equals 32768
+		// 2048 depth units = 51.2cm displacement, minimum distance from camera by default (--slice 2048:4)
+		if (depth_conditioning_needed(input.conditioning, input.needs_postprocessing))
+		{
+			frame.metadata.slice_offset = process_depth_data(input, depth, dv->slicer);
+			frame_latency_stamp(&frame.latency, LATENCY_CONDITIONED);
 		}
 
-		{
-			// use a mutex to make sure the main thread doesn't read these
-			// while we're updating all of them
-			// TODO not sure how long these data pointers will last after the frames go out of scope...
-			{  // use the scope operator to release the lock before notify()
-				std::lock_guard<std::mutex> guard(*dv_state.data_mutex);
-				dv_state.depth_stride = local_depth_stride;
-				dv_state.depth_data = (uint8_t*)depth.get_data();
-				dv_state.color_stride = color.get_stride_in_bytes();
-				dv_state.color_data = (uint8_t*)color.get_data();
-				dv_state.depth_video_data_ready = true;
-				*dv_state.data_ready = true;
-			}
-			dv_state.cv->notify_one();
+		frame.depth_uv = neutral_chroma_stream_plane(&dv->depth_uv, depth.get_stride_in_bytes(), depth.get_height());
+
+		// the ring keeps the frameset (and its data) alive until main thread is done with it
+		// when main thread doesn't keep up the ring drops frames according to policy (--frame-drop)
+		if (!dv->frames->push(std::move(frame)))
+			continue;
 
+		{  // use the scope operator to release the lock before notify()
+			std::lock_guard<std::mutex> guard(*dv_state.data_mutex);
+			*dv_state.data_ready = true;
 		}
+		dv_state.cv->notify_one();
 	}
 
-	dv->realsense->stop();
+	depth_aligner_close(aligner);
 }
 
-void process_depth_data(const input_args& input, rs2::depth_frame& depth)
+int depth_video_options(int* argc, char* argv[], input_args* input)
 {
-	const int half_stride = depth.get_stride_in_bytes() / 2;
-	const int height = depth.get_height();
+	if (frame_source_options(argc, argv, &input->source) < 0 ||
+		depth_aligner_options(argc, argv, &input->aligner) < 0)
+		return -1;
 
-	const float depth_units_set = depth.get_units();
-	const float multiplier = depth_units_set / input.depth_units;
+	input->adaptive_slice = option_flag(argc, argv, "adaptive-slice");
 
-	//note - we process data in place rather than making a copy
-	uint16_t* data = (uint16_t*)depth.get_data();
+	const char* queue = option_value(argc, argv, "frame-queue");
+	const char* drop = option_value(argc, argv, "frame-drop");
 
-	for (int i = 0; i < half_stride * height; ++i)
+	if (queue)
 	{
-		uint32_t val = data[i] * multiplier;
-		data[i] = val <= P010LE_MAX ? val : 0;
+		char* end;
+		input->frame_queue = strtol(queue, &end, 10);
+
+		if (*queue == '\0' || *end != '\0' || input->frame_queue <= 0)
+		{
+			cerr << "invalid --frame-queue '" << queue << "', expected positive number of frames" << endl;
+			return -1;
+		}
 	}
+
+	if (drop)
+	{
+		if (strcmp(drop, "oldest") == 0)
+			input->frame_drop = FRAME_RING_DROP_OLDEST;
+		else if (strcmp(drop, "newest") == 0)
+			input->frame_drop = FRAME_RING_DROP_NEWEST;
+		else
+		{
+			cerr << "invalid --frame-drop '" << drop << "', expected oldest or newest" << endl;
+			return -1;
+		}
+	}
+
+	return 0;
 }
 
-/// <summary>
-/// We can only send 10 bits of "grayscale" for depth, packed into the 10 MSB of the 16-bit depth value
-/// but we can choose which 10 bits to send - highest-precision 10 bits (and only 1024 depth units deep)
-/// or 1/4 the depth precision but 4096 depth units deep etc.
-/// Let's take a 2^12 unit sample of depth (4096 * 0.00025m = 1.024m on L515)
-/// starting at depth==min units offset (e.g. 2048 or 51.2cm on L515)
-/// and translate it back to min==0 to occupy depth 0-1.024m (12 LSB), then shift up 4 to 12 MSB (and discard the last two bits)
-/// Coarse-graining to 0.5mm to get 51.2cm slice (LSB 2-11) (or try 1mm to get 1.024m slice - LSB 3-12)
-/// </summary>
-/// <param name="depth"></param>
-/// <param name="min"></param>
-void rescale_depth_slice_for_tenbit(rs2::depth_frame& depth, int16_t minInUnits)
+void depth_video_usage(ostream& out)
 {
-	const int half_stride = depth.get_stride_in_bytes() / 2;
-	const int height = depth.get_height();
+	depth_aligner_usage(out);
+	frame_source_usage(out);
+	out << "frame queue options:" << endl
+	    << "       --frame-queue <frames> # frames waiting for encoder, default " << FRAME_QUEUE_SIZE << endl
+	    << "       --frame-drop <oldest/newest> # which frame to drop when encoder doesn't keep up, default oldest" << endl;
+	out << "slice options:" << endl
+	    << "       --adaptive-slice # slice follows the subject in the center of the frame, starts at --slice offset" << endl;
+}
 
+//returns slice offset used for the frame, with slicer picked from the frame histogram
+int process_depth_data(const input_args& input, rs2::depth_frame& depth, depth_slicer* slicer)
+{
 	//note - we process data in place rather than making a copy
 	uint16_t* data = (uint16_t*)depth.get_data();
+	depth_conditioning_config config = input.conditioning;
 
-	for (int i = 0; i < half_stride * height; ++i)
+	if (slicer)
 	{
-		// using 1mm resolution rather than 1/4mm for a 4096 unit (1.024m) range
-		// for depth values between minInUnits and minInUnits + 2048
-		// subtract the min, shift values up towards MSB by (6-2)
-		data[i] = (data[i] > minInUnits && data[i] < (minInUnits + 4096)) ? (data[i] - minInUnits) << 4 : 0;
+		//the slice is in wanted units, the same conversion as in depth conditioning
+		const float multiplier = input.needs_postprocessing ? depth.get_units() / input.depth_units : 1.0f;
+		config.slice_offset = depth_slicer_update(slicer, data, depth.get_width(), depth.get_height(), depth.get_stride_in_bytes(), multiplier);
 	}
+
+	depth_conditioning_process(config, data, depth.get_width(), depth.get_height(), depth.get_stride_in_bytes(),
+		depth.get_units(), input.depth_units, input.needs_postprocessing);
+
+	return config.slice_offset;
 }
 
-void init_realsense(rs2::pipeline& pipe, input_args& input)
+//0 on success, -1 on failure
+int init_realsense(frame_source* source, input_args& input)
 {
-	rs2::config cfg;
 	//use RGBA when aligning to color/depth (Realsense YUYV doesn't match any of my hevc_nvenc input formats)
-	cfg.enable_stream(RS2_STREAM_DEPTH, input.depth_width, input.depth_height, RS2_FORMAT_Z16, input.framerate);
-	cfg.enable_stream(RS2_STREAM_COLOR, input.color_width, input.color_height, RS2_FORMAT_RGBA8, input.framerate);
-
-	rs2::pipeline_profile profile = pipe.start(cfg);
+	frame_source_enable_stream(source, RS2_STREAM_DEPTH, input.depth_width, input.depth_height, RS2_FORMAT_Z16, input.framerate);
+	frame_source_enable_stream(source, RS2_STREAM_COLOR, input.color_width, input.color_height, RS2_FORMAT_RGBA8, input.framerate);
 
-	init_realsense_depth(pipe, cfg, input);
+	if (frame_source_start(source, input.depth_units) < 0)
+		return -1;
 
-	if (input.align_to == Color)
-		print_intrinsics(profile, RS2_STREAM_COLOR);
+	//recorded or generated depth can't be set up on device, convert units and clamp in software
+	if (frame_source_live(source))
+		init_realsense_depth(frame_source_pipeline(source), frame_source_rs2_config(source), input);
 	else
-		print_intrinsics(profile, RS2_STREAM_DEPTH);
+		input.needs_postprocessing = true;
+
+	print_intrinsics(frame_source_profile(source, (input.align_to == Color) ? RS2_STREAM_COLOR : RS2_STREAM_DEPTH));
+
+	return 0;
+}
+
+//per stream configuration part of depth metadata, encoded depth has alignment target intrinsics
+void init_metadata(frame_source* source, const input_args& input, depth_metadata* metadata)
+{
+	rs2::stream_profile depth = frame_source_profile(source, RS2_STREAM_DEPTH);
+	rs2::stream_profile color = frame_source_profile(source, RS2_STREAM_COLOR);
+	rs2::stream_profile target = (input.align_to == Color) ? color : depth;
+
+	metadata->intrinsics = target.as<rs2::video_stream_profile>().get_intrinsics();
+	metadata->depth_to_color = depth.get_extrinsics_to(color);
+	metadata->depth_units = input.depth_units;
+	metadata->slice_offset = input.conditioning.slice_shift ? input.conditioning.slice_offset : 0;
+	metadata->slice_shift = input.conditioning.slice_shift;
 }
 
 void init_realsense_depth(rs2::pipeline& pipe, const rs2::config& cfg, input_args& input)
@@ -217,6 +289,7 @@ void init_realsense_depth(rs2::pipeline& pipe, const rs2::config& cfg, input_arg
 	cout << "This will result in:" << endl;
 	cout << "-range " << input.depth_units * P010LE_MAX << " m" << endl;
 	cout << "-precision " << input.depth_units * 64.0f << " m (" << input.depth_units * 64.0f * 1000 << " mm)" << endl;
+	cout << "-depth processing with " << depth_kernels_isa_name(depth_kernels_selected()) << " kernels" << endl;
 
 	bool supports_advanced_mode = depth_sensor.supports(RS2_CAMERA_INFO_ADVANCED_MODE);
 
@@ -244,10 +317,11 @@ void init_realsense_depth(rs2::pipeline& pipe, const rs2::config& cfg, input_arg
 	}
 }
 
-void print_intrinsics(const rs2::pipeline_profile& profile, rs2_stream stream)
+void print_intrinsics(const rs2::stream_profile& profile)
 {
-	rs2::video_stream_profile stream_profile = profile.get_stream(stream).as<rs2::video_stream_profile>();
+	rs2::video_stream_profile stream_profile = profile.as<rs2::video_stream_profile>();
 	rs2_intrinsics i = stream_profile.get_intrinsics();
+	rs2_stream stream = profile.stream_type();
 
 	const float rad2deg = 180.0f / M_PI;
 	float hfov = 2 * atan(i.width / (2 * i.fx)) * rad2deg;
@@ -5,11 +5,34 @@
 #include <librealsense2/rs.hpp>
 #include <librealsense2/rs_advanced_mode.hpp>
 
+// Depth conditioning (unit conversion, thresholds, slicing)
+#include "depth_conditioning.h"
+
+// Depth to color or color to depth alignment
+#include "depth_aligner.h"
+
+// Slice following the subject
+#include "depth_slicer.h"
+
+// What receiver needs to reconstruct metric depth
+#include "depth_metadata.h"
+
+// Dummy color planes for P010LE
+#include "chroma_plane.h"
+
+// Lock free handoff of frames to the main thread
+#include "frame_ring.h"
+
+// Live camera, .bag playback or synthetic frames
+#include "frame_source.h"
+
+#include <condition_variable>
 #include <iostream>
 #include <mutex>
 #include <thread>
 
 #define BOUNDING_DEPTH 0.5f
+#define FRAME_QUEUE_SIZE 2
 
 using namespace std;
 
@@ -30,55 +53,81 @@ struct input_args
 	Stream align_to;
 	std::string json;
 	bool needs_postprocessing;
+	depth_conditioning_config conditioning;
+	depth_aligner_config aligner;
+	bool adaptive_slice; //slice offset follows the subject, starts at conditioning.slice_offset
+	int metadata_interval; //depth metadata record every n frames (and on change), 0 disables
+	bool timestamps; //presentation timestamps record for each frame
+	int frame_queue; //frames waiting for encoder, 0 for default
+	frame_ring_policy frame_drop;
+	frame_source_config source;
 };
 
+// processed frameset waiting for encoder, holding it keeps Realsense frame data alive
+struct depth_video_frame
+{
+	rs2::frameset frameset;
+	const uint8_t* depth_uv; //data of dummy color plane for P010LE, shared, don't free
+	depth_metadata metadata; //frame number, timestamp, units, slice used (changes with adaptive slice), intrinsics
+	frame_latency latency; //stamped by worker (capture, align, conditioning) then main thread (encode)
+	int64_t pts[2]; //depth and color presentation timestamps (host timeline)
+
+	depth_video_frame() :
+		depth_uv(NULL),
+		metadata()
+	{
+		pts[0] = pts[1] = 0;
+		frame_latency_clear(&latency);
+	}
+};
+
+typedef frame_ring<depth_video_frame> depth_video_ring;
+
 struct depth_video
 {
-	rs2::pipeline* realsense;
+	frame_source* realsense;
+	depth_video_ring* frames;
+	depth_slicer* slicer; //NULL without adaptive slice, used by worker thread only
+	depth_metadata metadata; //per stream configuration part, worker adds per frame values
+	neutral_chroma_stream depth_uv; //dummy color plane for P010LE, used by worker thread only
 	thread worker_thread;
 	bool volatile keep_working;
 
 	depth_video() :
 		realsense(NULL),
+		frames(NULL),
+		slicer(NULL),
+		metadata(),
+		depth_uv(),
 		keep_working(true)
 	{}
 };
 
-// need to synchronise access to the realsense frame data between the worker_thread thread and the main thread
+// frames go from the worker_thread thread to the main thread through lock free ring
+// the mutex and condition variable only wake up the main thread (audio has its own)
 struct depth_video_state
 {
-	// guards the rest of depth_video_state
-	mutex* data_mutex;
+	depth_video_ring* frames; // set by depth_video_init, pop from main thread only
+	mutex* data_mutex; // guards data_ready
 	condition_variable* cv;
-	uint16_t* depth_uv; //data of dummy color plane for P010LE
-	int depth_stride;
-	uint8_t* depth_data;
-	int color_stride;
-	uint8_t* color_data;
-	bool depth_video_data_ready;
 	bool* data_ready;
 
 	depth_video_state() :
+		frames(NULL),
 		data_mutex(NULL),
 		cv(NULL),
-		depth_uv(NULL),
-		depth_stride(0),
-		depth_data(NULL),
-		color_stride(0),
-		color_data(NULL),
-		depth_video_data_ready(false),
 		data_ready(NULL)
 	{}
 };
-// end protected by data_mutex
 
 depth_video* depth_video_init(depth_video_state& dv_state, input_args& user_input);
 void depth_video_close(depth_video* dv);
-void init_realsense(rs2::pipeline& pipe, input_args& input);
+int depth_video_options(int* argc, char* argv[], input_args* input);
+void depth_video_usage(ostream& out);
+int init_realsense(frame_source* source, input_args& input);
+void init_metadata(frame_source* source, const input_args& input, depth_metadata* metadata);
 void init_realsense_depth(rs2::pipeline& pipe, const rs2::config& cfg, input_args& input);
-void print_intrinsics(const rs2::pipeline_profile& profile, rs2_stream stream);
-void rescale_depth_slice_for_tenbit(rs2::depth_frame& depth, int16_t minInUnits);
-void process_depth_data(const input_args& input, rs2::depth_frame& depth);
-static void realsense_worker_thread(depth_video* dv, depth_video_state& dv_state, input_args& input);
+void print_intrinsics(const rs2::stream_profile& profile);
+int process_depth_data(const input_args& input, rs2::depth_frame& depth, depth_slicer* slicer);
 
 #endif
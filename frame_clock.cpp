@@ -0,0 +1,181 @@
+#include "frame_clock.h"
+#include "options.h"
+
+#include <iomanip>
+#include <string.h>
+
+using namespace std;
+
+// the lowest arrival delay in each window is taken as the clock offset (the least delayed sample)
+static const int64_t WINDOW_US = 1000000;
+// offset jump larger than that is a step (device clock wrap, playback loop, lost samples)
+static const int64_t STEP_US = 500000;
+// drift is estimated only over longer spans, short ones are dominated by arrival jitter
+static const int64_t DRIFT_SPAN_US = 5000000;
+
+enum {FIT_N, FIT_X, FIT_Y, FIT_XX, FIT_XY};
+
+void clock_sync_init(clock_sync *c, const char *name)
+{
+	memset(c, 0, sizeof(*c));
+	c->name = name;
+}
+
+//the new offset starts both the window and the drift span, drift estimate so far is kept
+static void synchronize(clock_sync *c, int64_t offset, int64_t source_us, int64_t host_us)
+{
+	c->window_end = host_us + WINDOW_US;
+	c->window_offset = c->anchor_offset = c->offset = offset;
+	c->window_source = c->anchor_source = c->offset_source = source_us;
+	c->windows = 0;
+	memset(c->fit, 0, sizeof(c->fit));
+	c->resync = false;
+}
+
+//least squares line through window minima, relative to the first one for precision
+static void fit_drift(clock_sync *c)
+{
+	if(c->windows++ == 0)
+	{
+		c->anchor_offset = c->offset;
+		c->anchor_source = c->offset_source;
+	}
+
+	const double x = (c->offset_source - c->anchor_source) / 1e6; //seconds
+	const double y = (double)(c->offset - c->anchor_offset);     //us
+	double *f = c->fit;
+
+	f[FIT_N] += 1.0;
+	f[FIT_X] += x;
+	f[FIT_Y] += y;
+	f[FIT_XX] += x * x;
+	f[FIT_XY] += x * y;
+
+	const double d = f[FIT_N] * f[FIT_XX] - f[FIT_X] * f[FIT_X];
+
+	//offset (host - source) growing means source runs slower, slope in us per second is ppm
+	if(c->offset_source - c->anchor_source >= DRIFT_SPAN_US && d > 0.0)
+		c->drift_ppm = -(f[FIT_N] * f[FIT_XY] - f[FIT_X] * f[FIT_Y]) / d;
+}
+
+int64_t clock_sync_map(clock_sync *c, int64_t source_us, int64_t host_us)
+{
+	const int64_t offset = host_us - source_us;
+
+	//offset predicted from the last window and drift
+	int64_t predicted = c->offset - (int64_t)(c->drift_ppm * 1e-6 * (source_us - c->offset_source));
+
+	if(!c->started || c->resync || offset < predicted - STEP_US || offset > predicted + STEP_US)
+	{
+		if(c->started)
+			++c->steps;
+
+		synchronize(c, offset, source_us, host_us);
+		c->started = true;
+		predicted = offset;
+	}
+
+	if(offset < c->window_offset)
+	{
+		c->window_offset = offset;
+		c->window_source = source_us;
+	}
+
+	if(host_us >= c->window_end)
+	{
+		c->offset = c->window_offset;
+		c->offset_source = c->window_source;
+
+		fit_drift(c);
+
+		c->window_offset = offset;
+		c->window_source = source_us;
+		c->window_end = host_us + WINDOW_US;
+	}
+
+	//less delayed than ever, the lower envelope moves down
+	if(offset < predicted)
+		predicted = offset;
+
+	int64_t pts = source_us + predicted;
+
+	if(c->frames && pts <= c->last_pts)
+		pts = c->last_pts + 1;
+
+	c->last_pts = pts;
+	++c->frames;
+
+	const int64_t delay = host_us - pts;
+	c->delay_us += delay;
+
+	if(delay > c->max_delay_us)
+		c->max_delay_us = delay;
+
+	return pts;
+}
+
+void clock_sync_report(ostream &out, const clock_sync &c)
+{
+	if(!c.frames)
+		return;
+
+	out << fixed << setprecision(2);
+	out << "clock " << c.name << ": drift " << c.drift_ppm << " ppm against host, arrival after presentation avg " <<
+		c.delay_us / c.frames / 1000.0 << " ms, max " << c.max_delay_us / 1000.0 << " ms, steps " << c.steps << endl;
+}
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v & 0xFF; p[1] = v >> 8; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v & 0xFFFF); put16(p + 2, v >> 16); }
+static void put64(uint8_t *p, uint64_t v) { put32(p, v & 0xFFFFFFFF); put32(p + 4, v >> 32); }
+static uint16_t get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static uint32_t get32(const uint8_t *p) { return get16(p) | ((uint32_t)get16(p + 2) << 16); }
+static uint64_t get64(const uint8_t *p) { return get32(p) | ((uint64_t)get32(p + 4) << 32); }
+
+int frame_timestamps_pack(uint32_t framenumber, const int64_t *pts_us, int subframes, uint8_t *out)
+{
+	if(subframes <= 0 || subframes > FRAME_TIMESTAMPS_MAX)
+		return 0;
+
+	out[0] = 'R';
+	out[1] = 'T';
+	out[2] = 'S';
+	out[3] = FRAME_TIMESTAMPS_VERSION;
+	put32(out + 4, framenumber);
+	out[8] = subframes;
+	out[9] = out[10] = out[11] = 0; //reserved
+
+	for(int i = 0; i < subframes; ++i)
+		put64(out + 12 + 8 * i, (uint64_t)pts_us[i]);
+
+	return FRAME_TIMESTAMPS_SIZE(subframes);
+}
+
+int frame_timestamps_read(const uint8_t *data, int size, uint32_t *framenumber, int64_t *pts_us, int max_subframes)
+{
+	if(size < FRAME_TIMESTAMPS_SIZE(0) || data[0] != 'R' || data[1] != 'T' || data[2] != 'S' ||
+		data[3] != FRAME_TIMESTAMPS_VERSION)
+		return -1;
+
+	const int subframes = data[8];
+
+	if(size < FRAME_TIMESTAMPS_SIZE(subframes))
+		return -1;
+
+	*framenumber = get32(data + 4);
+
+	for(int i = 0; i < subframes && i < max_subframes; ++i)
+		pts_us[i] = (int64_t)get64(data + 12 + 8 * i);
+
+	return subframes;
+}
+
+void frame_clock_options(int *argc, char *argv[], bool *timestamps)
+{
+	*timestamps = option_flag(argc, argv, "timestamps");
+}
+
+void frame_clock_usage(ostream &out)
+{
+	out << "timestamp options:" << endl
+	    << "       --timestamps # presentation timestamps of each frame in aux channel (device clock on host timeline)" << endl;
+}
@@ -0,0 +1,75 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Frame clock
+ * - presentation timestamps of video and audio on a common timeline (host steady clock, microseconds)
+ * - device and audio sample clocks mapped by the lower envelope of host arrival minus source time
+ * - drift fitted to the least delayed arrival of each second
+ * - drift of each clock against the host measured and reported, steps (wrap, overrun, seek) resynchronize
+ * - compact binary record with per subframe timestamps for NHVE aux channel
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef FRAME_CLOCK_H
+#define FRAME_CLOCK_H
+
+#include <ostream>
+#include <stdint.h>
+
+// record starts with "RTS" and version byte
+// 0-3 'R' 'T' 'S' version, 4-7 video frame number (uint32), 8 subframes, 9-11 reserved
+// then presentation timestamp of each subframe (int64 microseconds, 0 if none), little endian
+#define FRAME_TIMESTAMPS_VERSION 1
+#define FRAME_TIMESTAMPS_MAX 3
+#define FRAME_TIMESTAMPS_SIZE(subframes) (12 + 8 * (subframes))
+
+// one source clock (e.g. depth sensor, audio samples) mapped to host clock, single thread
+struct clock_sync
+{
+	const char *name;
+	bool started;
+	bool resync;           //step on the next sample (e.g. audio overrun lost samples)
+
+	int64_t window_end;    //host us when the current window closes
+	int64_t window_offset; //lowest host - source in the current window
+	int64_t window_source;
+
+	int64_t anchor_offset; //origin of drift fit, the first window after (re)synchronization
+	int64_t anchor_source;
+	int windows;           //closed since (re)synchronization
+	double fit[5];         //least squares sums of window minima (n, x, y, xx, xy)
+	int64_t offset;        //the last window
+	int64_t offset_source;
+	double drift_ppm;      //source clock against host, positive if source runs faster
+
+	int64_t last_pts;
+	uint64_t frames;
+	uint64_t steps;
+	double delay_us;       //sum of host arrival - presentation time
+	int64_t max_delay_us;
+};
+
+void clock_sync_init(clock_sync *c, const char *name);
+
+// source time (any epoch) and host steady clock us when it arrived
+// returns presentation time on host timeline, monotonic, never after arrival
+int64_t clock_sync_map(clock_sync *c, int64_t source_us, int64_t host_us);
+
+// drift, arrival delay and steps of the clock
+void clock_sync_report(std::ostream &out, const clock_sync &c);
+
+// returns record size written to out (FRAME_TIMESTAMPS_SIZE), 0 if there are too many subframes
+int frame_timestamps_pack(uint32_t framenumber, const int64_t *pts_us, int subframes, uint8_t *out);
+
+// parses record, returns number of subframes (at most max_subframes stored), -1 if it is not a valid record
+int frame_timestamps_read(const uint8_t *data, int size, uint32_t *framenumber, int64_t *pts_us, int max_subframes);
+
+// removes "--timestamps" from argv
+void frame_clock_options(int *argc, char *argv[], bool *timestamps);
+void frame_clock_usage(std::ostream &out);
+
+#endif
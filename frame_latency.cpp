@@ -0,0 +1,249 @@
+#include "frame_latency.h"
+#include "options.h"
+
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <stdlib.h>
+
+using namespace std;
+
+//log-linear histogram of microseconds, 32 buckets per power of 2 (~3% precision)
+//exact below 64 us, up to ~2^27 us (2 minutes), larger values go to the last bucket
+static const int SUB_BITS = 5;
+static const int SUB_BUCKETS = 1 << SUB_BITS;
+static const int BUCKETS = 24 * SUB_BUCKETS;
+
+static const char *INTERVAL_NAMES[LATENCY_POINTS + 1] =
+	{"-", "sensor", "align", "conditioning", "queue", "encode", "total"};
+static const int TOTAL = LATENCY_POINTS;
+
+//written only by the owning thread, read by reporting thread
+struct latency_histograms
+{
+	atomic<uint32_t> buckets[LATENCY_POINTS + 1][BUCKETS];
+	atomic<uint64_t> max_us[LATENCY_POINTS + 1];
+
+	latency_histograms()
+	{
+		for(int i = 0; i < LATENCY_POINTS + 1; ++i)
+		{
+			for(int b = 0; b < BUCKETS; ++b)
+				buckets[i][b].store(0, memory_order_relaxed);
+			max_us[i].store(0, memory_order_relaxed);
+		}
+	}
+};
+
+//threads register once, histograms outlive threads for the final report
+static mutex registry_mutex;
+static vector<unique_ptr<latency_histograms>> registry;
+static thread_local latency_histograms *local = NULL;
+
+static atomic<int64_t> report_period_us(0);
+static atomic<int64_t> next_report_us(0);
+
+static int64_t now_us()
+{
+	return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int bucket_index(uint64_t us)
+{
+	if(us < 2 * SUB_BUCKETS)
+		return (int)us;
+
+	int msb = 63;
+	while(!(us >> msb))
+		--msb;
+
+	const int shift = msb - SUB_BITS;
+	const int index = (shift + 1) * SUB_BUCKETS + (int)((us >> shift) & (SUB_BUCKETS - 1));
+
+	return index < BUCKETS ? index : BUCKETS - 1;
+}
+
+//middle of the bucket
+static double bucket_us(int index)
+{
+	if(index < 2 * SUB_BUCKETS)
+		return index;
+
+	const int shift = index / SUB_BUCKETS - 1;
+	const uint64_t low = (uint64_t)(SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+
+	return low + ((1 << shift) - 1) / 2.0;
+}
+
+static latency_histograms *thread_histograms()
+{
+	if(local)
+		return local;
+
+	lock_guard<mutex> lock(registry_mutex);
+	registry.push_back(unique_ptr<latency_histograms>(new latency_histograms()));
+
+	return local = registry.back().get();
+}
+
+static void add(latency_histograms *h, int interval, int64_t us)
+{
+	if(us < 0)
+		us = 0; //device and host clocks may disagree slightly
+
+	atomic<uint32_t> &bucket = h->buckets[interval][bucket_index(us)];
+	//single writer, no need for read-modify-write
+	bucket.store(bucket.load(memory_order_relaxed) + 1, memory_order_relaxed);
+
+	if((uint64_t)us > h->max_us[interval].load(memory_order_relaxed))
+		h->max_us[interval].store(us, memory_order_relaxed);
+}
+
+void frame_latency_clear(frame_latency *l)
+{
+	for(int i = 0; i < LATENCY_POINTS; ++i)
+		l->us[i] = 0;
+}
+
+void frame_latency_stamp(frame_latency *l, latency_point point)
+{
+	l->us[point] = now_us();
+}
+
+void frame_latency_stamp_sensor(frame_latency *l, double timestamp_ms, bool system_clock)
+{
+	if(!system_clock)
+	{
+		l->us[LATENCY_SENSOR] = 0;
+		return;
+	}
+
+	//device time is system clock, host stamps are steady clock
+	const double system_ms = chrono::duration<double, milli>(chrono::system_clock::now().time_since_epoch()).count();
+	l->us[LATENCY_SENSOR] = now_us() - (int64_t)((system_ms - timestamp_ms) * 1000.0);
+}
+
+void frame_latency_record(const frame_latency *l)
+{
+	latency_histograms *h = thread_histograms();
+	int previous = -1, first = -1;
+
+	for(int i = 0; i < LATENCY_POINTS; ++i)
+	{
+		if(!l->us[i])
+			continue;
+
+		if(previous >= 0)
+			add(h, i, l->us[i] - l->us[previous]);
+		else
+			first = i;
+
+		previous = i;
+	}
+
+	if(first >= 0 && previous > first)
+		add(h, TOTAL, l->us[previous] - l->us[first]);
+
+	const int64_t period = report_period_us.load(memory_order_relaxed);
+
+	if(!period)
+		return;
+
+	int64_t next = next_report_us.load(memory_order_relaxed);
+	const int64_t now = now_us();
+
+	//only one thread wins and reports
+	if(now >= next && next_report_us.compare_exchange_strong(next, now + period))
+		frame_latency_report(cout);
+}
+
+void frame_latency_periodic(double seconds)
+{
+	report_period_us = (int64_t)(seconds * 1000000.0);
+	next_report_us = now_us() + report_period_us;
+}
+
+void frame_latency_report(ostream &out)
+{
+	vector<uint64_t> merged(BUCKETS);
+
+	lock_guard<mutex> lock(registry_mutex);
+
+	out << fixed << setprecision(2);
+	out << "latency ms (p50 p95 p99 max):" << endl;
+
+	for(int i = LATENCY_CAPTURED; i <= TOTAL; ++i)
+	{
+		uint64_t count = 0, max_us = 0;
+
+		for(int b = 0; b < BUCKETS; ++b)
+			merged[b] = 0;
+
+		for(size_t t = 0; t < registry.size(); ++t)
+		{
+			for(int b = 0; b < BUCKETS; ++b)
+				merged[b] += registry[t]->buckets[i][b].load(memory_order_relaxed);
+
+			const uint64_t m = registry[t]->max_us[i].load(memory_order_relaxed);
+			max_us = m > max_us ? m : max_us;
+		}
+
+		for(int b = 0; b < BUCKETS; ++b)
+			count += merged[b];
+
+		if(!count)
+			continue;
+
+		const double percentiles[] = {0.50, 0.95, 0.99};
+		out << "-" << setw(12) << left << INTERVAL_NAMES[i] << right;
+
+		for(int p = 0; p < 3; ++p)
+		{
+			const uint64_t rank = (uint64_t)(percentiles[p] * (count - 1)) + 1;
+			uint64_t seen = 0;
+			int b = 0;
+
+			while((seen += merged[b]) < rank)
+				++b;
+
+			const double us = bucket_us(b) < max_us ? bucket_us(b) : max_us;
+			out << " " << setw(8) << us / 1000.0;
+		}
+
+		out << " " << setw(8) << max_us / 1000.0 << " (" << count << " frames)" << endl;
+	}
+
+	out.unsetf(ios::floatfield);
+	out << setprecision(6);
+}
+
+int frame_latency_options(int *argc, char *argv[])
+{
+	const char *report = option_value(argc, argv, "latency-report");
+
+	if(!report)
+		return 0;
+
+	char *end;
+	const double seconds = strtod(report, &end);
+
+	if(*report == '\0' || *end != '\0' || seconds <= 0.0)
+	{
+		cerr << "invalid --latency-report '" << report << "', expected positive number of seconds" << endl;
+		return -1;
+	}
+
+	frame_latency_periodic(seconds);
+
+	return 0;
+}
+
+void frame_latency_usage(ostream &out)
+{
+	out << "latency options:" << endl
+	    << "       --latency-report <seconds> # print per stage latency periodically, always printed at exit" << endl;
+}
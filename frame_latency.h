@@ -0,0 +1,62 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Frame latency
+ * - timestamps travel with the frame through the stages (sensor, capture, align, conditioning, encode)
+ * - per thread histograms, lock free, cheap enough to be always on
+ * - p50/p95/p99 per stage, reported periodically and at exit
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef FRAME_LATENCY_H
+#define FRAME_LATENCY_H
+
+#include <ostream>
+#include <stdint.h>
+
+enum latency_point
+{
+	LATENCY_SENSOR = 0,    //device timestamp (if in host clock domain)
+	LATENCY_CAPTURED,      //wait_for_frames returned
+	LATENCY_ALIGNED,       //after rs2::align
+	LATENCY_CONDITIONED,   //after depth conditioning
+	LATENCY_SUBMITTED,     //handed to the encoder
+	LATENCY_ENCODED,       //encoded and sent
+	LATENCY_POINTS
+};
+
+// steady clock microseconds for each point, 0 if not stamped
+struct frame_latency
+{
+	int64_t us[LATENCY_POINTS];
+};
+
+void frame_latency_clear(frame_latency *l);
+
+// now
+void frame_latency_stamp(frame_latency *l, latency_point point);
+
+// device timestamp in ms, only used when system_clock (Realsense global or system time domain)
+// hardware clock timestamps can't be compared with host time and are skipped
+void frame_latency_stamp_sensor(frame_latency *l, double timestamp_ms, bool system_clock);
+
+// adds stage intervals of the frame to the calling thread histograms (no locks)
+// each stamped point is timed from the previous stamped point
+// also prints report if periodic reporting is due
+void frame_latency_record(const frame_latency *l);
+
+// report every seconds from the recording thread, 0 (default) only on frame_latency_report
+void frame_latency_periodic(double seconds);
+
+// p50/p95/p99/max of all the threads so far
+void frame_latency_report(std::ostream &out);
+
+// removes "--latency-report <seconds>" from argv, -1 on invalid value
+int frame_latency_options(int *argc, char *argv[]);
+void frame_latency_usage(std::ostream &out);
+
+#endif
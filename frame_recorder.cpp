@@ -0,0 +1,411 @@
+#include "frame_recorder.h"
+#include "options.h"
+
+#include <atomic>
+#include <iostream>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const char MAGIC[4] = {'R', 'N', 'R', 'F'};
+static const uint32_t VERSION = 1;
+// header and each record start at page boundary
+static const size_t PAGE = 4096;
+static const size_t RECORD_HEADER_SIZE = 64;
+static const size_t PLANE_ALIGNMENT = 64;
+
+struct file_header
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t streams;
+	uint32_t record_size;
+	uint64_t frames;
+	frame_recording_stream stream[FRAME_RECORDER_MAX_STREAMS];
+};
+
+struct record_header
+{
+	uint32_t number;
+	uint8_t recorded[FRAME_RECORDER_MAX_STREAMS];
+	int64_t pts_us[FRAME_RECORDER_MAX_STREAMS];
+};
+
+static_assert(sizeof(file_header) <= PAGE && sizeof(record_header) <= RECORD_HEADER_SIZE, "headers don't fit");
+
+// plane offsets within record, the same for all records
+struct record_layout
+{
+	size_t offset[FRAME_RECORDER_MAX_STREAMS][NHVE_NUM_DATA_POINTERS];
+	size_t size;
+};
+
+struct frame_recorder
+{
+	int fd;
+	uint8_t *map;
+	size_t map_size;
+	file_header *header;
+	record_layout layout;
+	uint32_t max_frames;
+	atomic<uint32_t> frames; //one past the last frame written
+
+	frame_recorder() : fd(-1), map(NULL), map_size(0), header(NULL), max_frames(0), frames(0) {}
+};
+
+struct frame_replay
+{
+	int fd;
+	uint8_t *map;
+	size_t map_size;
+	const file_header *header;
+	record_layout layout;
+	int frames;
+
+	frame_replay() : fd(-1), map(NULL), map_size(0), header(NULL), frames(0) {}
+};
+
+static size_t align_up(size_t value, size_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+//plane sizes as stored in stream headers, replay lays out records of older files the way they were written
+static void layout_records(const frame_recording_stream *streams, int count, record_layout *layout)
+{
+	size_t offset = RECORD_HEADER_SIZE;
+
+	for(int s = 0; s < count; ++s)
+		for(int p = 0; p < streams[s].planes; ++p)
+		{
+			layout->offset[s][p] = offset;
+			offset = align_up(offset + (size_t)streams[s].linesize[p] * streams[s].plane_height[p], PLANE_ALIGNMENT);
+		}
+
+	layout->size = align_up(offset, PAGE);
+}
+
+//bytes per pixel of the first plane and whether there is interleaved half height UV plane
+static bool pixel_format_planes(const char *pixel_format, int *bpp, bool *uv)
+{
+	const struct { const char *name; int bpp; bool uv; } formats[] =
+	{
+		{"p010le", 2, true}, {"nv12", 1, true},
+		{"rgb0", 4, false}, {"bgr0", 4, false}, {"yuyv422", 2, false}, {"uyvy422", 2, false}
+	};
+
+	for(size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i)
+		if(strcmp(pixel_format, formats[i].name) == 0)
+		{
+			*bpp = formats[i].bpp;
+			*uv = formats[i].uv;
+			return true;
+		}
+
+	return false;
+}
+
+int frame_recording_stream_init(frame_recording_stream *s, const nhve_hw_config &hw, const rs2_intrinsics *intrinsics, float depth_units)
+{
+	int bpp;
+	bool uv;
+
+	memset(s, 0, sizeof(*s));
+
+	if(!hw.pixel_format || !pixel_format_planes(hw.pixel_format, &bpp, &uv))
+	{
+		cerr << "frame recorder: unsupported pixel format " << (hw.pixel_format ? hw.pixel_format : "(none)") << endl;
+		return -1;
+	}
+
+	s->width = hw.width;
+	s->height = hw.height;
+	s->framerate = hw.framerate;
+	strncpy(s->pixel_format, hw.pixel_format, sizeof(s->pixel_format) - 1);
+	strncpy(s->encoder, hw.encoder ? hw.encoder : "", sizeof(s->encoder) - 1);
+	s->profile = hw.profile;
+	s->bit_rate = hw.bit_rate;
+	s->compression_level = hw.compression_level;
+
+	//P010LE and NV12 chroma has a pair of samples for each 2x2 block, odd sizes have a partial block at the edge
+	s->planes = uv ? 2 : 1;
+	s->linesize[0] = hw.width * bpp;
+	s->linesize[1] = uv ? (hw.width + 1) / 2 * 2 * bpp : 0;
+	s->plane_height[0] = hw.height;
+	s->plane_height[1] = uv ? (hw.height + 1) / 2 : 0;
+
+	if(intrinsics)
+		s->intrinsics = *intrinsics;
+	s->depth_units = depth_units;
+
+	return 0;
+}
+
+#ifdef _WIN32
+
+struct frame_recorder *frame_recorder_init(const char *file, const frame_recording_stream *streams, int count, int max_frames)
+{
+	cerr << "frame recorder: memory mapped recording is not supported on Windows" << endl;
+	return NULL;
+}
+
+void frame_recorder_close(struct frame_recorder *r) {}
+
+int frame_recorder_write(struct frame_recorder *r, uint32_t frame, int subframe, const nhve_frame *data, int64_t pts_us)
+{
+	return -1;
+}
+
+struct frame_replay *frame_replay_init(const char *file, bool preload)
+{
+	cerr << "frame replay: memory mapped replay is not supported on Windows" << endl;
+	return NULL;
+}
+
+void frame_replay_close(struct frame_replay *r) {}
+
+#else
+
+struct frame_recorder *frame_recorder_init(const char *file, const frame_recording_stream *streams, int count, int max_frames)
+{
+	if(count < 1 || count > FRAME_RECORDER_MAX_STREAMS || max_frames < 1)
+	{
+		cerr << "frame recorder: invalid streams " << count << " or frames " << max_frames << endl;
+		return NULL;
+	}
+
+	frame_recorder *r = new frame_recorder();
+
+	layout_records(streams, count, &r->layout);
+	r->max_frames = max_frames;
+	r->map_size = PAGE + r->layout.size * max_frames;
+
+	//sparse file, only the pages we write take disk space
+	if( (r->fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0 ||
+		ftruncate(r->fd, r->map_size) != 0)
+	{
+		cerr << "frame recorder: unable to create " << file << " (" << r->map_size / (1024 * 1024) << " MB)" << endl;
+		frame_recorder_close(r);
+		return NULL;
+	}
+
+	if( (r->map = (uint8_t*)mmap(NULL, r->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0)) == MAP_FAILED )
+	{
+		cerr << "frame recorder: unable to map " << file << endl;
+		r->map = NULL;
+		frame_recorder_close(r);
+		return NULL;
+	}
+
+	madvise(r->map, r->map_size, MADV_SEQUENTIAL);
+
+	r->header = (file_header*)r->map;
+	memcpy(r->header->magic, MAGIC, sizeof(MAGIC));
+	r->header->version = VERSION;
+	r->header->streams = count;
+	r->header->record_size = r->layout.size;
+	memcpy(r->header->stream, streams, count * sizeof(frame_recording_stream));
+
+	cout << "Recording frames to " << file << ", " << r->layout.size / 1024 << " KB per frame" << endl;
+
+	return r;
+}
+
+void frame_recorder_close(struct frame_recorder *r)
+{
+	if(!r)
+		return;
+
+	const size_t size = PAGE + r->layout.size * r->frames;
+
+	if(r->map)
+	{
+		r->header->frames = r->frames;
+		munmap(r->map, r->map_size);
+	}
+
+	if(r->fd >= 0)
+	{
+		if(r->map && ftruncate(r->fd, size) != 0)
+			cerr << "frame recorder: failed to truncate recording" << endl;
+		close(r->fd);
+	}
+
+	delete r;
+}
+
+int frame_recorder_write(struct frame_recorder *r, uint32_t frame, int subframe, const nhve_frame *data, int64_t pts_us)
+{
+	if(frame >= r->max_frames || subframe < 0 || subframe >= (int)r->header->streams)
+	{
+		cerr << "frame recorder: frame " << frame << " subframe " << subframe << " out of recording" << endl;
+		return -1;
+	}
+
+	const frame_recording_stream &s = r->header->stream[subframe];
+	uint8_t *record = r->map + PAGE + (size_t)frame * r->layout.size;
+	record_header *header = (record_header*)record;
+
+	//source may have padding, recorded planes are tight
+	for(int p = 0; p < s.planes; ++p)
+	{
+		uint8_t *dst = record + r->layout.offset[subframe][p];
+		const int line = data->linesize[p] < s.linesize[p] ? data->linesize[p] : s.linesize[p];
+
+		if(data->linesize[p] == s.linesize[p])
+		{
+			memcpy(dst, data->data[p], (size_t)line * s.plane_height[p]);
+			continue;
+		}
+
+		for(int y = 0; y < s.plane_height[p]; ++y)
+			memcpy(dst + y * s.linesize[p], data->data[p] + y * data->linesize[p], line);
+	}
+
+	//the other subframe of this frame may be written concurrently, its fields are separate
+	header->number = frame;
+	header->pts_us[subframe] = pts_us;
+	header->recorded[subframe] = 1;
+
+	uint32_t frames = r->frames.load();
+
+	while(frame + 1 > frames && !r->frames.compare_exchange_weak(frames, frame + 1))
+		;
+
+	return 0;
+}
+
+struct frame_replay *frame_replay_init(const char *file, bool preload)
+{
+	frame_replay *r = new frame_replay();
+	struct stat st;
+
+	if( (r->fd = open(file, O_RDONLY)) < 0 || fstat(r->fd, &st) != 0 || (size_t)st.st_size < PAGE )
+	{
+		cerr << "frame replay: unable to open " << file << endl;
+		frame_replay_close(r);
+		return NULL;
+	}
+
+	r->map_size = st.st_size;
+
+	//populated mapping doesn't page fault during replay, timing depends only on encoder
+	if( (r->map = (uint8_t*)mmap(NULL, r->map_size, PROT_READ, MAP_PRIVATE | (preload ? MAP_POPULATE : 0), r->fd, 0)) == MAP_FAILED )
+	{
+		cerr << "frame replay: unable to map " << file << endl;
+		r->map = NULL;
+		frame_replay_close(r);
+		return NULL;
+	}
+
+	madvise(r->map, r->map_size, MADV_SEQUENTIAL);
+
+	r->header = (const file_header*)r->map;
+
+	if(memcmp(r->header->magic, MAGIC, sizeof(MAGIC)) != 0 || r->header->version != VERSION ||
+		r->header->streams < 1 || r->header->streams > FRAME_RECORDER_MAX_STREAMS)
+	{
+		cerr << "frame replay: " << file << " is not a frame recording (version " << VERSION << ")" << endl;
+		frame_replay_close(r);
+		return NULL;
+	}
+
+	layout_records(r->header->stream, r->header->streams, &r->layout);
+
+	//frames is written at close, a crashed recording has only the preallocated size
+	const uint64_t records = (r->map_size - PAGE) / r->layout.size;
+	r->frames = r->header->frames && r->header->frames <= records ? r->header->frames : records;
+
+	if(r->layout.size != r->header->record_size || r->frames == 0)
+	{
+		cerr << "frame replay: " << file << " has no frames or inconsistent record size" << endl;
+		frame_replay_close(r);
+		return NULL;
+	}
+
+	cout << "Replaying " << r->frames << " frames from " << file << (preload ? " (preloaded)" : "") << endl;
+
+	return r;
+}
+
+void frame_replay_close(struct frame_replay *r)
+{
+	if(!r)
+		return;
+
+	if(r->map)
+		munmap(r->map, r->map_size);
+	if(r->fd >= 0)
+		close(r->fd);
+
+	delete r;
+}
+
+#endif
+
+int frame_replay_frames(const struct frame_replay *r)
+{
+	return r->frames;
+}
+
+int frame_replay_streams(const struct frame_replay *r)
+{
+	return r->header->streams;
+}
+
+const frame_recording_stream &frame_replay_stream(const struct frame_replay *r, int subframe)
+{
+	return r->header->stream[subframe];
+}
+
+int frame_replay_frame(const struct frame_replay *r, int frame, int subframe, nhve_frame *data, int64_t *pts_us)
+{
+	if(frame < 0 || frame >= r->frames || subframe < 0 || subframe >= (int)r->header->streams)
+		return -1;
+
+	const uint8_t *record = r->map + PAGE + (size_t)frame * r->layout.size;
+	const record_header *header = (const record_header*)record;
+	const frame_recording_stream &s = r->header->stream[subframe];
+
+	if(!header->recorded[subframe])
+		return -1;
+
+	memset(data, 0, sizeof(*data));
+
+	for(int p = 0; p < s.planes; ++p)
+	{
+		data->data[p] = (uint8_t*)record + r->layout.offset[subframe][p];
+		data->linesize[p] = s.linesize[p];
+	}
+
+	if(pts_us)
+		*pts_us = header->pts_us[subframe];
+
+	return 0;
+}
+
+int frame_recorder_options(int *argc, char *argv[], const char **file)
+{
+	*file = option_value(argc, argv, "record-frames");
+
+	if(*file && **file == '\0')
+	{
+		cerr << "invalid --record-frames, expected file e.g. frames.rnrf" << endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+void frame_recorder_usage(ostream &out)
+{
+	out << "frame recording options:" << endl
+	    << "       --record-frames <file> # record encoder input (conditioned frames) for realsense-nhve-replay" << endl;
+}
@@ -0,0 +1,82 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Raw frame recorder and replay
+ * - records encoder input (conditioned P010LE depth, color/infrared) of each subframe
+ * - memory mapped file, header with stream profiles, intrinsics and encoder settings, then fixed size records
+ * - replay maps the file and returns frames pointing into it, no copies or parsing
+ * - for reproducing issues with exact frames and deterministic encoder benchmarks
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef FRAME_RECORDER_H
+#define FRAME_RECORDER_H
+
+// Network Hardware Video Encoder (frame and encoder config)
+#include "nhve.h"
+
+// Realsense intrinsics (C struct only)
+#include <librealsense2/h/rs_types.h>
+
+#include <ostream>
+#include <stdint.h>
+
+// video subframes of all the programs (MLSP limit with aux channel)
+#define FRAME_RECORDER_MAX_STREAMS 2
+
+// encoder input of one subframe, stored as is in file header (host byte order)
+struct frame_recording_stream
+{
+	int width;
+	int height;
+	int framerate;
+	char pixel_format[16]; //FFmpeg name, p010le, nv12, rgb0, yuyv422, uyvy422
+	char encoder[32];      //recorded with, default for replay
+	int profile;
+	int bit_rate;
+	int compression_level;
+	int planes;
+	int linesize[NHVE_NUM_DATA_POINTERS]; //recorded planes are tight, width * bytes per pixel (chroma rounded up to pairs)
+	int plane_height[NHVE_NUM_DATA_POINTERS];
+	rs2_intrinsics intrinsics; //camera stream (alignment target if aligned), zero if unknown
+	float depth_units;         //of conditioned depth, 0 for other streams
+};
+
+// fills stream from encoder config, intrinsics may be NULL, -1 on unsupported pixel format
+int frame_recording_stream_init(frame_recording_stream *s, const nhve_hw_config &hw, const rs2_intrinsics *intrinsics, float depth_units);
+
+struct frame_recorder;
+
+// file is preallocated (sparse) for max_frames, NULL on failure
+struct frame_recorder *frame_recorder_init(const char *file, const frame_recording_stream *streams, int count, int max_frames);
+
+// truncates the file to the frames written
+void frame_recorder_close(struct frame_recorder *r);
+
+// copies subframe into its slot of frame record, -1 if frame is out of file capacity
+// subframes of the same frame may be written from different threads
+int frame_recorder_write(struct frame_recorder *r, uint32_t frame, int subframe, const nhve_frame *data, int64_t pts_us);
+
+struct frame_replay;
+
+// maps recorded file, preload - read it all into memory now, NULL on failure
+struct frame_replay *frame_replay_init(const char *file, bool preload);
+void frame_replay_close(struct frame_replay *r);
+
+int frame_replay_frames(const struct frame_replay *r);
+int frame_replay_streams(const struct frame_replay *r);
+const frame_recording_stream &frame_replay_stream(const struct frame_replay *r, int subframe);
+
+// points data into the mapping (valid until close), pts_us may be NULL
+// -1 if subframe was not recorded for that frame
+int frame_replay_frame(const struct frame_replay *r, int frame, int subframe, nhve_frame *data, int64_t *pts_us);
+
+// removes recognized options from argv, file is NULL without --record-frames
+int frame_recorder_options(int *argc, char *argv[], const char **file);
+void frame_recorder_usage(std::ostream &out);
+
+#endif
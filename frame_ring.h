@@ -0,0 +1,164 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Frame ring
+ * - bounded single producer, single consumer queue of frame slots
+ * - slots own the frames (e.g. ref-counted rs2::frameset) until the consumer takes them
+ * - drop oldest or drop newest when full, with counters
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <atomic>
+#include <utility>
+#include <stddef.h>
+#include <stdint.h>
+
+enum frame_ring_policy { FRAME_RING_DROP_OLDEST, FRAME_RING_DROP_NEWEST };
+
+// Lock free, each cell has a sequence number telling whose turn it is (D. Vyukov bounded queue).
+// Dequeue is safe for more than one thread, with DROP_OLDEST the producer
+// takes the oldest slot itself when the consumer doesn't keep up.
+template<class T>
+class frame_ring
+{
+public:
+	// capacity is rounded up to power of 2, at least 2 (sequence numbers need it)
+	frame_ring(size_t capacity, frame_ring_policy policy) :
+		policy(policy),
+		enqueue_pos(0),
+		dequeue_pos(0),
+		pushed_count(0),
+		dropped_oldest_count(0),
+		dropped_newest_count(0)
+	{
+		size_t size = 2;
+
+		while(size < capacity)
+			size <<= 1;
+
+		cells = new cell[size];
+		mask = size - 1;
+
+		for(size_t i = 0; i < size; ++i)
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	~frame_ring()
+	{
+		delete [] cells;
+	}
+
+	// producer only
+	// false if the ring was full and the item was dropped (DROP_NEWEST), caller still owns it
+	bool push(T &&item)
+	{
+		size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+
+		for(;;)
+		{
+			cell &c = cells[pos & mask];
+			const intptr_t diff = (intptr_t)c.sequence.load(std::memory_order_acquire) - (intptr_t)pos;
+
+			if(diff == 0)
+			{
+				c.item = std::move(item);
+				c.sequence.store(pos + 1, std::memory_order_release);
+				enqueue_pos.store(pos + 1, std::memory_order_relaxed);
+				pushed_count.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			}
+
+			//full
+			if(policy == FRAME_RING_DROP_NEWEST)
+			{
+				dropped_newest_count.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+
+			{  //the oldest frame is released at the end of scope
+				T oldest;
+				if(pop(oldest))
+					dropped_oldest_count.fetch_add(1, std::memory_order_relaxed);
+			}
+			//if consumer was faster it freed the cell itself, try again
+		}
+	}
+
+	// consumer, false if empty
+	// the previous content of item is released
+	bool pop(T &item)
+	{
+		size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+
+		for(;;)
+		{
+			cell &c = cells[pos & mask];
+			const intptr_t diff = (intptr_t)c.sequence.load(std::memory_order_acquire) - (intptr_t)(pos + 1);
+
+			if(diff == 0)
+			{
+				if(dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					item = std::move(c.item);
+					c.item = T(); //don't keep moved-from resources in the ring
+					c.sequence.store(pos + mask + 1, std::memory_order_release);
+					return true;
+				}
+				//pos was reloaded by compare_exchange
+			}
+			else if(diff < 0)
+				return false;
+			else
+				pos = dequeue_pos.load(std::memory_order_relaxed);
+		}
+	}
+
+	// approximate when called concurrently with push/pop
+	size_t size() const
+	{
+		const size_t head = dequeue_pos.load(std::memory_order_relaxed);
+		const size_t tail = enqueue_pos.load(std::memory_order_relaxed);
+		return tail > head ? tail - head : 0;
+	}
+
+	bool empty() const { return size() == 0; }
+	size_t capacity() const { return mask + 1; }
+
+	uint64_t pushed() const { return pushed_count.load(std::memory_order_relaxed); }
+	uint64_t dropped_oldest() const { return dropped_oldest_count.load(std::memory_order_relaxed); }
+	uint64_t dropped_newest() const { return dropped_newest_count.load(std::memory_order_relaxed); }
+
+private:
+	frame_ring(const frame_ring&);
+	frame_ring& operator=(const frame_ring&);
+
+	struct cell
+	{
+		std::atomic<size_t> sequence;
+		T item;
+	};
+
+	cell *cells;
+	size_t mask;
+	const frame_ring_policy policy;
+
+	//producer and consumer positions on separate cache lines
+	char pad0[64];
+	std::atomic<size_t> enqueue_pos;
+	char pad1[64];
+	std::atomic<size_t> dequeue_pos;
+	char pad2[64];
+
+	std::atomic<uint64_t> pushed_count;
+	std::atomic<uint64_t> dropped_oldest_count;
+	std::atomic<uint64_t> dropped_newest_count;
+};
+
+#endif
@@ -0,0 +1,218 @@
+#include "frame_source.h"
+
+#include "synthetic_source.h"
+#include "options.h"
+
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+struct frame_source
+{
+	frame_source_config config;
+
+	//live and playback
+	rs2::pipeline pipe;
+	rs2::config cfg;
+
+	//synthetic
+	vector<synthetic_stream> streams;
+	synthetic_source *synthetic;
+
+	//device clock of each stream type
+	clock_sync clocks[RS2_STREAM_COUNT];
+
+	frame_source() : synthetic(NULL)
+	{
+		for(int i = 0; i < RS2_STREAM_COUNT; ++i)
+			clock_sync_init(&clocks[i], rs2_stream_to_string((rs2_stream)i));
+	}
+};
+
+struct frame_source *frame_source_init(const frame_source_config *config)
+{
+	if(config->type == FRAME_SOURCE_PLAYBACK && (!config->file || !*config->file))
+	{
+		cerr << "frame source: playback needs .bag file" << endl;
+		return NULL;
+	}
+
+	frame_source *s = new frame_source();
+	s->config = *config;
+
+	return s;
+}
+
+void frame_source_close(struct frame_source *s)
+{
+	if(!s)
+		return;
+
+	if(s->synthetic)
+		synthetic_source_close(s->synthetic);
+	else
+	{
+		try
+		{
+			s->pipe.stop();
+		}
+		catch(const rs2::error &)
+		{
+			//not started or already stopped
+		}
+	}
+
+	delete s;
+}
+
+void frame_source_enable_stream(struct frame_source *s, rs2_stream stream, int width, int height, rs2_format format, int framerate)
+{
+	if(s->config.type == FRAME_SOURCE_SYNTHETIC)
+	{
+		synthetic_stream ss = {stream, width, height, format, framerate};
+		s->streams.push_back(ss);
+	}
+	else if(s->config.type == FRAME_SOURCE_LIVE)
+		s->cfg.enable_stream(stream, width, height, format, framerate);
+}
+
+int frame_source_start(struct frame_source *s, float depth_units)
+{
+	if(s->config.type == FRAME_SOURCE_SYNTHETIC)
+	{
+		s->synthetic = synthetic_source_init(s->streams.data(), (int)s->streams.size(), depth_units, !s->config.fast);
+		return s->synthetic ? 0 : -1;
+	}
+
+	try
+	{
+		if(s->config.type == FRAME_SOURCE_LIVE)
+		{
+			s->pipe.start(s->cfg);
+			return 0;
+		}
+
+		//repeat the recording if it is shorter than requested
+		s->cfg.enable_device_from_file(s->config.file, true);
+
+		rs2::pipeline_profile profile = s->pipe.start(s->cfg);
+		rs2::playback playback = profile.get_device().as<rs2::playback>();
+		//not real time playback waits for us instead of dropping frames
+		playback.set_real_time(!s->config.fast);
+
+		cout << "Playing back " << s->config.file << (s->config.fast ? " as fast as possible" : " at recorded rate") << endl;
+	}
+	catch(const rs2::error &e)
+	{
+		cerr << "frame source: failed to start " << (s->config.type == FRAME_SOURCE_LIVE ? "camera" : s->config.file)
+		     << ": " << e.what() << endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+rs2::frameset frame_source_wait(struct frame_source *s, frame_latency *latency)
+{
+	rs2::frameset frameset = s->synthetic ? synthetic_source_wait(s->synthetic) : s->pipe.wait_for_frames();
+
+	if(latency)
+	{
+		frame_latency_clear(latency);
+		frame_latency_stamp(latency, LATENCY_CAPTURED);
+		//global time and system time domains are host clock, hardware clock is camera clock
+		frame_latency_stamp_sensor(latency, frameset.get_timestamp(),
+			frameset.get_frame_timestamp_domain() != RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK);
+	}
+
+	return frameset;
+}
+
+int64_t frame_source_pts(struct frame_source *s, const rs2::frame &frame, const frame_latency *latency)
+{
+	const rs2_stream stream = frame.get_profile().stream_type();
+	clock_sync *c = &s->clocks[stream < RS2_STREAM_COUNT ? stream : RS2_STREAM_ANY];
+
+	return clock_sync_map(c, (int64_t)(frame.get_timestamp() * 1000.0), latency->us[LATENCY_CAPTURED]);
+}
+
+void frame_source_clock_report(ostream &out, const struct frame_source *s)
+{
+	for(int i = 0; i < RS2_STREAM_COUNT; ++i)
+		clock_sync_report(out, s->clocks[i]);
+}
+
+const clock_sync &frame_source_clock(const struct frame_source *s, rs2_stream stream)
+{
+	return s->clocks[stream < RS2_STREAM_COUNT ? stream : RS2_STREAM_ANY];
+}
+
+rs2::stream_profile frame_source_profile(struct frame_source *s, rs2_stream stream)
+{
+	if(s->synthetic)
+		return synthetic_source_profile(s->synthetic, stream);
+
+	return s->pipe.get_active_profile().get_stream(stream);
+}
+
+bool frame_source_live(const struct frame_source *s)
+{
+	return s->config.type == FRAME_SOURCE_LIVE;
+}
+
+rs2::pipeline &frame_source_pipeline(struct frame_source *s)
+{
+	return s->pipe;
+}
+
+const rs2::config &frame_source_rs2_config(const struct frame_source *s)
+{
+	return s->cfg;
+}
+
+int frame_source_options(int *argc, char *argv[], frame_source_config *config)
+{
+	const char *playback = option_value(argc, argv, "playback");
+	const bool synthetic = option_flag(argc, argv, "synthetic");
+
+	config->fast = option_flag(argc, argv, "fast");
+	config->type = FRAME_SOURCE_LIVE;
+	config->file = NULL;
+
+	if(playback && synthetic)
+	{
+		cerr << "--playback and --synthetic are mutually exclusive" << endl;
+		return -1;
+	}
+
+	if(playback)
+	{
+		if(*playback == '\0')
+		{
+			cerr << "invalid --playback, expected .bag file" << endl;
+			return -1;
+		}
+
+		config->type = FRAME_SOURCE_PLAYBACK;
+		config->file = playback;
+	}
+	else if(synthetic)
+		config->type = FRAME_SOURCE_SYNTHETIC;
+
+	if(config->fast && config->type == FRAME_SOURCE_LIVE)
+	{
+		cerr << "--fast needs --playback or --synthetic" << endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+void frame_source_usage(ostream &out)
+{
+	out << "source options:" << endl
+	    << "       --playback <file.bag> # recorded frames instead of camera, repeated if too short" << endl
+	    << "       --synthetic # generated frames instead of camera (moving plane, depth ramp, noise)" << endl
+	    << "       --fast # playback or synthetic as fast as possible instead of at framerate" << endl;
+}
@@ -0,0 +1,75 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Frame source
+ * - live Realsense camera
+ * - librealsense .bag playback, at recorded rate or as fast as possible
+ * - synthetic frames, any resolution and framerate, no camera needed
+ * - the same rs2::frameset for all of them, main loops don't care where frames come from
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+// Realsense API
+#include <librealsense2/rs.hpp>
+
+// Capture and sensor timestamps
+#include "frame_latency.h"
+
+// Device clocks on host timeline
+#include "frame_clock.h"
+
+#include <ostream>
+
+enum frame_source_type {FRAME_SOURCE_LIVE, FRAME_SOURCE_PLAYBACK, FRAME_SOURCE_SYNTHETIC};
+
+struct frame_source_config
+{
+	frame_source_type type;
+	const char *file; //.bag for playback
+	bool fast;        //playback and synthetic as fast as possible instead of at framerate
+};
+
+struct frame_source;
+
+struct frame_source *frame_source_init(const frame_source_config *config);
+void frame_source_close(struct frame_source *s);
+
+// call for each stream before frame_source_start
+// playback ignores it (uses what was recorded), infrared is the left imager
+void frame_source_enable_stream(struct frame_source *s, rs2_stream stream, int width, int height, rs2_format format, int framerate);
+
+// depth_units are only used by synthetic source, 0 on success, -1 on failure
+int frame_source_start(struct frame_source *s, float depth_units);
+
+// next frameset with all the enabled streams, throws rs2::error
+// latency (may be NULL) is cleared and stamped with capture and sensor time
+rs2::frameset frame_source_wait(struct frame_source *s, frame_latency *latency);
+
+// presentation timestamp of frame from frame_source_wait (host steady clock us), each stream has its own clock
+// device timestamp (get_timestamp, any domain) mapped with latency capture time, call from the waiting thread
+int64_t frame_source_pts(struct frame_source *s, const rs2::frame &frame, const frame_latency *latency);
+
+// drift of the stream clocks against host
+void frame_source_clock_report(std::ostream &out, const struct frame_source *s);
+const clock_sync &frame_source_clock(const struct frame_source *s, rs2_stream stream);
+
+// profile of started stream (e.g. for intrinsics)
+rs2::stream_profile frame_source_profile(struct frame_source *s, rs2_stream stream);
+
+// live camera only, device settings (depth units, json, advanced mode) need pipeline and config
+bool frame_source_live(const struct frame_source *s);
+rs2::pipeline &frame_source_pipeline(struct frame_source *s);
+const rs2::config &frame_source_rs2_config(const struct frame_source *s);
+
+// removes recognized options from argv, -1 on invalid value
+int frame_source_options(int *argc, char *argv[], frame_source_config *config);
+void frame_source_usage(std::ostream &out);
+
+#endif
@@ -0,0 +1,46 @@
+#include "options.h"
+
+#include <string.h>
+
+static void remove_args(int *argc, char *argv[], int index, int count)
+{
+	for(int i = index; i + count <= *argc; ++i)
+		argv[i] = argv[i + count]; //also moves the terminating NULL
+
+	*argc -= count;
+}
+
+const char *option_value(int *argc, char *argv[], const char *name)
+{
+	for(int i = 1; i < *argc; ++i)
+	{
+		if(strncmp(argv[i], "--", 2) || strcmp(argv[i] + 2, name))
+			continue;
+
+		if(i + 1 >= *argc)
+		{
+			remove_args(argc, argv, i, 1);
+			return "";
+		}
+
+		const char *value = argv[i + 1];
+		remove_args(argc, argv, i, 2);
+		return value;
+	}
+
+	return NULL;
+}
+
+bool option_flag(int *argc, char *argv[], const char *name)
+{
+	for(int i = 1; i < *argc; ++i)
+	{
+		if(strncmp(argv[i], "--", 2) || strcmp(argv[i] + 2, name))
+			continue;
+
+		remove_args(argc, argv, i, 1);
+		return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,23 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Optional "--name value" command line arguments
+ * - may appear anywhere, are removed from argv before positional arguments are parsed
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+// removes "--name value" from argv keeping it NULL terminated
+// returns value, "" if option is present without value, NULL if not present
+const char *option_value(int *argc, char *argv[], const char *name);
+
+// removes "--name" from argv keeping it NULL terminated, true if it was present
+bool option_flag(int *argc, char *argv[], const char *name);
+
+#endif
@@ -0,0 +1,420 @@
+#include "parallel_encoder.h"
+
+// FFmpeg software encoders when there is no hardware
+#include "software_encoder.h"
+
+// Hardware Video Encoder and Minimal Latency Streaming Protocol (NHVE dependencies)
+#include "hve.h"
+#include "mlsp.h"
+
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// either hardware (HVE) or software encoder
+struct subframe_encoder
+{
+	hve *hardware;
+	software_encoder *software;
+};
+
+struct parallel_encoder
+{
+	vector<subframe_encoder> encoders;
+	vector<nhve_hw_config> configs; // for restarting encoders with new bitrate
+	struct mlsp *network;
+	struct bitstream_recorder *recorder;
+
+	// frame number barrier state, guarded by barrier_mutex
+	mutex barrier_mutex;
+	condition_variable barrier_cv;
+	vector<uint64_t> sent;  // frames sent so far for each encoder index
+	vector<int> bit_rate;   // requested bitrate of each encoder index, applied with its next frame
+	vector<frame_region> roi; // region of interest of each encoder index, used with roi_qoffset > 0
+	vector<float> roi_qoffset;
+	bool failed;
+
+	// MLSP shares single socket and state between subframes
+	mutex network_mutex;
+	int aux_size;
+
+	// workers for subframes 1+ in parallel_encoder_send_frames, guarded by jobs_mutex
+	vector<thread> workers;
+	mutex jobs_mutex;
+	condition_variable jobs_cv;
+	condition_variable done_cv;
+	const nhve_frame *frames;
+	uint64_t job;
+	int pending;
+	bool quit;
+
+	parallel_encoder() :
+		network(NULL),
+		recorder(NULL),
+		failed(false),
+		aux_size(0),
+		frames(NULL),
+		job(0),
+		pending(0),
+		quit(false)
+	{}
+};
+
+static void worker_thread(parallel_encoder *pe, int subframe);
+
+//software if configured encoder is not hardware, 0 on success, -1 on failure
+static int encoder_init(const nhve_hw_config &config, subframe_encoder *encoder)
+{
+	if(software_encoder_is_software(config.encoder))
+		return (encoder->software = software_encoder_init(&config)) ? 0 : -1;
+
+	hve_config hve_cfg = {0};
+
+	hve_cfg.width = config.width;
+	hve_cfg.height = config.height;
+	hve_cfg.framerate = config.framerate;
+	hve_cfg.device = config.device;
+	hve_cfg.encoder = config.encoder;
+	hve_cfg.pixel_format = config.pixel_format;
+	hve_cfg.profile = config.profile;
+	hve_cfg.max_b_frames = config.max_b_frames;
+	hve_cfg.bit_rate = config.bit_rate;
+	hve_cfg.qp = config.qp;
+	hve_cfg.gop_size = config.gop_size;
+	hve_cfg.compression_level = config.compression_level;
+	hve_cfg.low_power = config.low_power;
+
+	return (encoder->hardware = hve_init(&hve_cfg)) ? 0 : -1;
+}
+
+static void encoder_close(subframe_encoder *encoder)
+{
+	if(encoder->hardware)
+		hve_close(encoder->hardware);
+	software_encoder_close(encoder->software);
+
+	encoder->hardware = NULL;
+	encoder->software = NULL;
+}
+
+struct parallel_encoder *parallel_encoder_init(const struct nhve_net_config *net_config,
+	const struct nhve_hw_config *hw_config, int hw_size, int aux_size)
+{
+	if(hw_size < 0 || aux_size < 0 || hw_size + aux_size <= 0 || hw_size + aux_size > MLSP_MAX_SUBFRAMES)
+	{
+		cerr << "parallel encoder: unsupported number of subframes" << endl;
+		return NULL;
+	}
+
+	parallel_encoder *pe = new parallel_encoder();
+
+	mlsp_config mlsp_cfg = {0};
+	mlsp_cfg.ip = net_config->ip;
+	mlsp_cfg.port = net_config->port;
+	mlsp_cfg.subframes = hw_size + aux_size;
+
+	if( (pe->network = mlsp_init_server(&mlsp_cfg)) == NULL )
+	{
+		cerr << "parallel encoder: failed to initialize network server" << endl;
+		parallel_encoder_close(pe);
+		return NULL;
+	}
+
+	for(int i = 0; i < hw_size; ++i)
+	{
+		subframe_encoder encoder = {NULL, NULL};
+
+		if(encoder_init(hw_config[i], &encoder) != 0)
+		{
+			cerr << "parallel encoder: failed to initialize encoder " << i << endl;
+			parallel_encoder_close(pe);
+			return NULL;
+		}
+
+		pe->encoders.push_back(encoder);
+		pe->configs.push_back(hw_config[i]);
+		pe->bit_rate.push_back(hw_config[i].bit_rate);
+		pe->roi.push_back(frame_region());
+		pe->roi_qoffset.push_back(0.0f);
+	}
+
+	pe->sent.resize(hw_size, 0);
+	pe->aux_size = aux_size;
+
+	for(int i = 1; i < hw_size; ++i)
+		pe->workers.push_back(thread(worker_thread, pe, i));
+
+	return pe;
+}
+
+void parallel_encoder_close(struct parallel_encoder *pe)
+{
+	if(!pe)
+		return;
+
+	{
+		lock_guard<mutex> lock(pe->jobs_mutex);
+		pe->quit = true;
+	}
+	pe->jobs_cv.notify_all();
+
+	for(size_t i = 0; i < pe->workers.size(); ++i)
+		pe->workers[i].join();
+
+	for(size_t i = 0; i < pe->encoders.size(); ++i)
+		encoder_close(&pe->encoders[i]);
+
+	if(pe->network)
+		mlsp_close(pe->network);
+
+	delete pe;
+}
+
+void parallel_encoder_record(struct parallel_encoder *pe, struct bitstream_recorder *recorder)
+{
+	pe->recorder = recorder;
+}
+
+void parallel_encoder_set_bitrate(struct parallel_encoder *pe, int subframe, int bit_rate)
+{
+	lock_guard<mutex> lock(pe->barrier_mutex);
+	pe->bit_rate[subframe] = bit_rate;
+}
+
+//new bitrate before encoding the next frame
+//x264 reconfigures in place, other encoders (HVE has no reconfiguration) restart and start with a keyframe
+//the restarted encoder drops whatever it still held, latency tuned encoders hold no frames
+static int encoder_set_bitrate(parallel_encoder *pe, int subframe, int bit_rate)
+{
+	subframe_encoder &encoder = pe->encoders[subframe];
+	nhve_hw_config &config = pe->configs[subframe];
+
+	config.bit_rate = bit_rate;
+
+	if(encoder.software && software_encoder_set_bitrate(encoder.software, bit_rate))
+		return 0;
+
+	encoder_close(&encoder);
+
+	return encoder_init(config, &encoder);
+}
+
+void parallel_encoder_set_roi(struct parallel_encoder *pe, int subframe, const frame_region *subject, float qoffset)
+{
+	lock_guard<mutex> lock(pe->barrier_mutex);
+
+	//hardware encoders only take frame data through HVE
+	if(subject && qoffset > 0.0f && pe->roi_qoffset[subframe] <= 0.0f && !software_encoder_is_software(pe->configs[subframe].encoder))
+		cerr << "parallel encoder: region of interest needs software encoder, ignored by encoder " << subframe << endl;
+
+	pe->roi_qoffset[subframe] = subject ? qoffset : 0.0f;
+
+	if(subject)
+		pe->roi[subframe] = *subject;
+}
+
+static int encoder_send_frame(subframe_encoder &encoder, const struct nhve_frame *frame)
+{
+	if(encoder.software)
+		return software_encoder_send_frame(encoder.software, frame) == 0 ? HVE_OK : HVE_ERROR;
+
+	hve_frame video_frame = { {0}, {0} };
+
+	if(frame)
+		for(int i = 0; i < NHVE_NUM_DATA_POINTERS && i < AV_NUM_DATA_POINTERS; ++i)
+		{
+			video_frame.data[i] = frame->data[i];
+			video_frame.linesize[i] = frame->linesize[i];
+		}
+
+	return hve_send_frame(encoder.hardware, frame ? &video_frame : NULL);
+}
+
+static AVPacket *encoder_receive_packet(subframe_encoder &encoder, int *failed)
+{
+	if(!encoder.software)
+		return hve_receive_packet(encoder.hardware, failed);
+
+	AVPacket *packet = software_encoder_receive_packet(encoder.software, failed);
+	*failed = (*failed == 0) ? HVE_OK : HVE_ERROR;
+	return packet;
+}
+
+static void fail(parallel_encoder *pe)
+{
+	{
+		lock_guard<mutex> lock(pe->barrier_mutex);
+		pe->failed = true;
+	}
+	pe->barrier_cv.notify_all();
+}
+
+int parallel_encoder_send(struct parallel_encoder *pe, const struct nhve_frame *frame, int subframe)
+{
+	uint64_t framenumber;
+	int bit_rate;
+	frame_region roi;
+	float roi_qoffset;
+
+	{  // wait until every encoder is done with the previous frame
+		unique_lock<mutex> lock(pe->barrier_mutex);
+		framenumber = pe->sent[subframe];
+
+		pe->barrier_cv.wait(lock, [&] {
+			if(pe->failed)
+				return true;
+			for(size_t i = 0; i < pe->sent.size(); ++i)
+				if(pe->sent[i] < framenumber)
+					return false;
+			return true;
+		});
+
+		if(pe->failed)
+			return NHVE_ERROR;
+
+		bit_rate = pe->bit_rate[subframe];
+		roi = pe->roi[subframe];
+		roi_qoffset = pe->roi_qoffset[subframe];
+	}
+
+	if(frame && bit_rate != pe->configs[subframe].bit_rate)
+		if(encoder_set_bitrate(pe, subframe, bit_rate) != 0)
+		{
+			cerr << "parallel encoder: failed to set bitrate " << bit_rate << " of encoder " << subframe << endl;
+			fail(pe);
+			return NHVE_ERROR;
+		}
+
+	subframe_encoder &encoder = pe->encoders[subframe];
+
+	if(encoder.software)
+		software_encoder_set_roi(encoder.software, &roi, roi_qoffset);
+
+	if(encoder_send_frame(encoder, frame) != HVE_OK)
+	{
+		cerr << "parallel encoder: failed to send frame to encoder " << subframe << endl;
+		fail(pe);
+		return NHVE_ERROR;
+	}
+
+	AVPacket *packet;
+	int failed;
+
+	while( (packet = encoder_receive_packet(encoder, &failed)) )
+	{
+		mlsp_frame network_frame = {0};
+		network_frame.framenumber = (uint16_t)framenumber;
+		network_frame.data[subframe] = packet->data;
+		network_frame.size[subframe] = packet->size;
+
+		{
+			lock_guard<mutex> lock(pe->network_mutex);
+
+			if(mlsp_send(pe->network, &network_frame, subframe) != MLSP_OK)
+			{
+				cerr << "parallel encoder: failed to send subframe " << subframe << endl;
+				fail(pe);
+				return NHVE_ERROR;
+			}
+		}
+
+		//only copied, drops (counted by recorder) rather than waits for disk
+		if(pe->recorder)
+			bitstream_recorder_write(pe->recorder, subframe, packet->data, packet->size, (packet->flags & AV_PKT_FLAG_KEY) != 0);
+	}
+
+	if(failed != HVE_OK)
+	{
+		cerr << "parallel encoder: failed to encode subframe " << subframe << endl;
+		fail(pe);
+		return NHVE_ERROR;
+	}
+
+	{
+		lock_guard<mutex> lock(pe->barrier_mutex);
+		pe->sent[subframe] = framenumber + 1;
+	}
+	pe->barrier_cv.notify_all();
+
+	return NHVE_OK;
+}
+
+int parallel_encoder_send_aux(struct parallel_encoder *pe, const uint8_t *data, int size, int subframe, uint32_t framenumber)
+{
+	const int aux = subframe - (int)pe->encoders.size();
+
+	if(aux < 0 || aux >= pe->aux_size)
+	{
+		cerr << "parallel encoder: " << subframe << " is not an aux subframe" << endl;
+		return NHVE_ERROR;
+	}
+
+	lock_guard<mutex> lock(pe->network_mutex);
+
+	mlsp_frame network_frame = {0};
+	network_frame.framenumber = (uint16_t)framenumber;
+	network_frame.data[subframe] = (uint8_t*)data;
+	network_frame.size[subframe] = size;
+
+	if(mlsp_send(pe->network, &network_frame, subframe) != MLSP_OK)
+	{
+		cerr << "parallel encoder: failed to send aux subframe " << subframe << endl;
+		return NHVE_ERROR;
+	}
+
+	return NHVE_OK;
+}
+
+int parallel_encoder_send_frames(struct parallel_encoder *pe, const struct nhve_frame *frames)
+{
+	{  // hand subframes 1+ to the workers
+		lock_guard<mutex> lock(pe->jobs_mutex);
+		pe->frames = frames;
+		pe->pending = (int)pe->workers.size();
+		++pe->job;
+	}
+	pe->jobs_cv.notify_all();
+
+	int status = parallel_encoder_send(pe, frames ? &frames[0] : NULL, 0);
+
+	{  // frames data has to stay valid until workers are done
+		unique_lock<mutex> lock(pe->jobs_mutex);
+		pe->done_cv.wait(lock, [&] { return pe->pending == 0; });
+	}
+
+	lock_guard<mutex> lock(pe->barrier_mutex);
+	return pe->failed ? NHVE_ERROR : status;
+}
+
+static void worker_thread(parallel_encoder *pe, int subframe)
+{
+	uint64_t job = 0;
+
+	for(;;)
+	{
+		const nhve_frame *frame;
+
+		{
+			unique_lock<mutex> lock(pe->jobs_mutex);
+			pe->jobs_cv.wait(lock, [&] { return pe->quit || pe->job != job; });
+
+			if(pe->quit)
+				return;
+
+			job = pe->job;
+			frame = pe->frames ? &pe->frames[subframe] : NULL;
+		}
+
+		parallel_encoder_send(pe, frame, subframe);
+
+		{
+			lock_guard<mutex> lock(pe->jobs_mutex);
+			--pe->pending;
+		}
+		pe->done_cv.notify_all();
+	}
+}
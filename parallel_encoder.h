@@ -0,0 +1,74 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Parallel encoder
+ * - the same hardware encoders and network protocol as NHVE (HVE + MLSP)
+ * - or FFmpeg software encoders (e.g. libx265) when configured encoder is not hardware
+ * - each encoder index encodes in its own thread, e.g. depth and color at the same time
+ * - frame number barrier keeps subframes in lockstep for the receiver
+ * - auxiliary subframes (e.g. timestamps, metadata) sent on their own, stamped with the video frame they belong to
+ * - aux only stream (no video encoders) e.g. audio on its own port
+ * - optional tee of encoded packets to bitstream recorder, after they went to the network
+ * - bitrate of each encoder can change at runtime (e.g. adaptive bitrate)
+ * - region of interest of each frame (software encoders, HVE doesn't pass it to hardware)
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef PARALLEL_ENCODER_H
+#define PARALLEL_ENCODER_H
+
+// Network Hardware Video Encoder configuration and frames
+#include "nhve.h"
+
+// Archiving encoded packets
+#include "bitstream_recorder.h"
+
+// Region of interest
+#include "subject_region.h"
+
+struct parallel_encoder;
+
+// the same arguments as nhve_init, NULL on failure
+// hw_size may be 0 for aux only stream (then only parallel_encoder_send_aux)
+struct parallel_encoder *parallel_encoder_init(const struct nhve_net_config *net_config,
+	const struct nhve_hw_config *hw_config, int hw_size, int aux_size);
+
+void parallel_encoder_close(struct parallel_encoder *pe);
+
+// packets of each encoder index go also to recorder channel of the same index (NULL stops)
+// set before sending, recorder has to outlive the encoder use
+void parallel_encoder_record(struct parallel_encoder *pe, struct bitstream_recorder *recorder);
+
+// bitrate of encoder index for the next frames (bits per second), safe to call from any thread
+// applied with the next frame of that encoder, hardware encoders restart (next frame is keyframe)
+void parallel_encoder_set_bitrate(struct parallel_encoder *pe, int subframe, int bit_rate);
+
+// region of interest of encoder index for the next frames, NULL subject disables, see software_encoder_set_roi
+// safe to call from any thread, call from the thread sending that subframe to apply it to the frame sent next
+// only software encoders, ignored (with a warning) for hardware encoders
+void parallel_encoder_set_roi(struct parallel_encoder *pe, int subframe, const frame_region *subject, float qoffset);
+
+// all the hardware subframes of the next frame (hw_size of them), NULL frames to flush
+// encodes them in parallel (calling thread does subframe 0), returns when all are sent
+// NHVE_OK on success, NHVE_ERROR on failure
+int parallel_encoder_send_frames(struct parallel_encoder *pe, const struct nhve_frame *frames);
+
+// single subframe of the next frame, NULL frame to flush
+// for callers that drive each encoder index from their own thread
+// blocks until all the subframes of the previous frame are sent (frame number barrier)
+// NHVE_OK on success, NHVE_ERROR on failure (any subframe failing fails all of them)
+int parallel_encoder_send(struct parallel_encoder *pe, const struct nhve_frame *frame, int subframe);
+
+// auxiliary subframe (hw_size and above) data as is (size may be 0), never touches the video encoders
+// framenumber - of the video frame the data belongs to (frames sent before it), receiver pairs subframes by it
+// send it for each video frame, MLSP frame is complete only with all of its subframes
+// in aux only stream the caller numbers the frames, all subframes of a frame with the same number
+// doesn't wait for video (safe to call from any thread)
+// NHVE_OK on success, NHVE_ERROR on failure
+int parallel_encoder_send_aux(struct parallel_encoder *pe, const uint8_t *data, int size, int subframe, uint32_t framenumber);
+
+#endif
@@ -0,0 +1,1292 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Benchmarks on synthetic data, no camera needed
+ * - depth kernels (all implementations supported by the CPU, rnhve-test checks them against scalar reference)
+ * - fused depth conditioning against the separate passes it replaces
+ * - neutral UV plane preparation, frame handoff between threads
+ * - depth aligner against rs2::align (time and matching pixels)
+ * - full synthetic source to null sink pipeline at 480p/720p/1080p
+ * - audio codec loopback (delay, bitrate, quality, loss concealment, timestamps)
+ * - clock mapping of a drifting, jittery device clock to host timeline
+ * - adaptive bitrate over loopback feedback with simulated link (loss, queuing, capacity changes)
+ * - subject region (ROI) of thresholded depth, found box against the drawn one
+ * - depth hole filling (all implementations), validity mask round trip, prediction entropy before/after
+ * - depth precision in P010LE chroma, unpacked error against luma only, with simulated compression noise
+ * - results optionally written as JSON for tracking regressions
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include "audio_codec.h"
+#include "bitrate_control.h"
+#include "depth_chroma.h"
+#include "depth_conditioning.h"
+#include "depth_fill.h"
+#include "depth_aligner.h"
+#include "chroma_plane.h"
+#include "frame_clock.h"
+#include "frame_ring.h"
+#include "frame_source.h"
+#include "options.h"
+#include "subject_region.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+
+struct bench_args
+{
+	int width;
+	int height;
+	int iterations;
+	int frames;       //per resolution for align and pipeline benchmarks
+	const char *json; //results file or NULL
+};
+
+//single measurement, average per iteration/frame
+struct bench_result
+{
+	string group;
+	string name;
+	int width;
+	int height;
+	double ms;
+};
+
+static vector<bench_result> results;
+
+static void record(const string& group, const string& name, int width, int height, double ms)
+{
+	bench_result r = {group, name, width, height, ms};
+	results.push_back(r);
+}
+
+//the resolutions of align and pipeline benchmarks, depth and color the same
+static const int RESOLUTIONS[][2] = { {848, 480}, {1280, 720}, {1920, 1080} };
+
+const uint16_t P010LE_MAX = 0xFFC0; //in binary 10 ones followed by 6 zeroes
+
+int process_user_input(int argc, char* argv[], bench_args* input);
+void synthetic_z16(vector<uint16_t>& data, int width, int height, uint32_t seed);
+void bench_depth_kernels(const bench_args& input);
+bool bench_depth_conditioning(const bench_args& input);
+void bench_chroma_plane(const bench_args& input);
+void bench_frame_handoff(const bench_args& input);
+bool bench_align(const bench_args& input, bool *status);
+bool bench_pipeline(const bench_args& input);
+void bench_audio_codec(const bench_args& input, bool *status);
+void bench_frame_clock(bool *status);
+void bench_bitrate_control(bool *status);
+void bench_bitrate_control(uint32_t interval_ms, bool *status);
+void bench_subject_region(const bench_args& input, bool *status);
+void bench_subject_crop(const bench_args& input, bool *status);
+void bench_depth_fill(const bench_args& input, bool *status);
+void bench_depth_chroma(const bench_args& input, bool *status);
+int write_json(const bench_args& input, const char *file);
+
+int main(int argc, char* argv[])
+{
+	bench_args input = {0};
+
+	if(process_user_input(argc, argv, &input) < 0)
+		return 1;
+
+	bench_depth_kernels(input);
+	bool status = bench_depth_conditioning(input);
+
+	bench_chroma_plane(input);
+	bench_frame_handoff(input);
+	bench_audio_codec(input, &status);
+	bench_frame_clock(&status);
+	bench_bitrate_control(&status);
+	bench_subject_region(input, &status);
+	bench_subject_crop(input, &status);
+	bench_depth_fill(input, &status);
+	bench_depth_chroma(input, &status);
+
+	bool realsense = bench_align(input, &status) && bench_pipeline(input);
+
+	neutral_chroma_planes_release();
+
+	if(input.json && write_json(input, input.json) < 0)
+		return 3;
+
+	if(!status)
+	{
+		cerr << "Mismatch against scalar reference." << endl;
+		return 2;
+	}
+
+	if(!realsense)
+		return 4;
+
+	cout << "Finished successfully." << endl;
+	return 0;
+}
+
+//depth ramp with a moving plane, noise and invalid (0) pixels like Realsense Z16
+void synthetic_z16(vector<uint16_t>& data, int width, int height, uint32_t seed)
+{
+	data.resize(width * height);
+
+	for(int y = 0; y < height; ++y)
+		for(int x = 0; x < width; ++x)
+		{
+			seed = seed * 1664525u + 1013904223u; //LCG, reproducible across platforms
+			uint16_t d = 500 + x * 40000 / width + y * 20000 / height + (seed >> 28);
+
+			if((seed >> 16) % 37 == 0)
+				d = 0;
+			else if((seed >> 16) % 101 == 0)
+				d = UINT16_MAX - (seed >> 24);
+
+			data[y * width + x] = d;
+		}
+}
+
+template<class F>
+static double time_ms(int iterations, const vector<uint16_t>& input, vector<uint16_t>& work, F kernel)
+{
+	double total = 0.0;
+
+	for(int i = 0; i < iterations; ++i)
+	{
+		work = input; //kernels work in place, restore input each time (not timed)
+		auto start = chrono::steady_clock::now();
+		kernel(work);
+		total += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	}
+
+	return total / iterations;
+}
+
+//only timed, rnhve-test checks the implementations against scalar reference
+void bench_depth_kernels(const bench_args& input)
+{
+	vector<uint16_t> source, work;
+	synthetic_z16(source, input.width, input.height, 1);
+
+	const int count = input.width * input.height;
+	const float multiplier = 0.25f / 0.1f; //e.g. L515 0.25 mm units to 0.1 mm units
+
+	//rays of 87 degree camera slightly rotated, projected to 69 degree camera 15 mm to the side
+	vector<float> rx(count), ry(count), rz(count);
+	vector<int32_t> px(count), py(count);
+	vector<uint32_t> bins(256); //histogram for 4096 units deep slice
+	const float f = input.width / 1.9f, fo = input.width / 1.37f;
+	depth_project_params project = {0.0001f, 0.015f, 0.0f, 0.0f, fo, fo, input.width / 2.0f, input.height / 2.0f};
+
+	for(int i = 0; i < count; ++i)
+	{
+		rx[i] = (i % input.width - input.width / 2.0f) / f;
+		ry[i] = (i / input.width - input.height / 2.0f) / f;
+		rz[i] = 1.0f - 0.01f * rx[i];
+	}
+
+	cout << "depth kernels " << input.width << "x" << input.height << ", " << input.iterations << " iterations" << endl;
+
+	for(int isa = DEPTH_KERNELS_SCALAR; isa < DEPTH_KERNELS_ISA_COUNT; ++isa)
+	{
+		if(!depth_kernels_select((depth_kernels_isa)isa))
+			continue;
+
+		double units = time_ms(input.iterations, source, work,
+			[&](vector<uint16_t>& d) { depth_rescale_units(&d[0], count, multiplier, P010LE_MAX); });
+		double slice = time_ms(input.iterations, source, work,
+			[&](vector<uint16_t>& d) { depth_rescale_slice(&d[0], count, 2048, 4); });
+		double hist = time_ms(input.iterations, source, work,
+			[&](vector<uint16_t>& d) { depth_histogram(&d[0], count, multiplier, 8, &bins[0]); });
+		double proj = time_ms(input.iterations, source, work,
+			[&](vector<uint16_t>& d) { depth_project(&d[0], count, &rx[0], &ry[0], &rz[0], project, &px[0], &py[0]); });
+
+		cout << "-" << depth_kernels_isa_name((depth_kernels_isa)isa) <<
+			" rescale_units " << units << " ms" << " rescale_slice " << slice << " ms" << " project " << proj << " ms" <<
+			" histogram " << hist << " ms" << endl;
+
+		record("depth_kernels", string("rescale_units_") + depth_kernels_isa_name((depth_kernels_isa)isa), input.width, input.height, units);
+		record("depth_kernels", string("rescale_slice_") + depth_kernels_isa_name((depth_kernels_isa)isa), input.width, input.height, slice);
+		record("depth_kernels", string("project_") + depth_kernels_isa_name((depth_kernels_isa)isa), input.width, input.height, proj);
+		record("depth_kernels", string("histogram_") + depth_kernels_isa_name((depth_kernels_isa)isa), input.width, input.height, hist);
+	}
+
+	depth_kernels_select(depth_kernels_best_isa());
+}
+
+//units, thresholds and slice one after another, each one a pass over the frame, what we did before fusing
+static void depth_multi_pass(uint16_t *data, int count, float multiplier, int lo, int hi, uint16_t slice_offset, int slice_shift)
+{
+	depth_rescale_units_scalar(data, count, multiplier, P010LE_MAX);
+
+	for(int i = 0; i < count; ++i)
+		data[i] = (data[i] >= lo && data[i] <= hi) ? data[i] : 0;
+
+	depth_rescale_slice_scalar(data, count, slice_offset, slice_shift);
+}
+
+bool bench_depth_conditioning(const bench_args& input)
+{
+	vector<uint16_t> source, reference, work;
+	synthetic_z16(source, input.width, input.height, 2);
+
+	const int count = input.width * input.height;
+	//L515 0.25 mm units to 0.1 mm, 0.6-1.5 m thresholds, 2^12 units slice from 0.5 m
+	const float depth_units_set = 0.00025f, depth_units = 0.0001f;
+	depth_conditioning_config config = {0.6f, 1.5f, 0.0f, 5000, 4};
+	depth_condition_params p = depth_conditioning_params(config, depth_units_set, depth_units, true, 0.0f);
+	bool status = true;
+
+	reference = source;
+	depth_multi_pass(&reference[0], count, p.multiplier, 6000, 15000, 5000, 4);
+
+	double multi = time_ms(input.iterations, source, work,
+		[&](vector<uint16_t>& d) { depth_multi_pass(&d[0], count, p.multiplier, 6000, 15000, 5000, 4); });
+
+	cout << "depth conditioning " << input.width << "x" << input.height << ", " << input.iterations << " iterations" << endl;
+	cout << "-multi pass scalar " << multi << " ms" << endl;
+	record("depth_conditioning", "multi_pass_scalar", input.width, input.height, multi);
+
+	for(int isa = DEPTH_KERNELS_SCALAR; isa < DEPTH_KERNELS_ISA_COUNT; ++isa)
+	{
+		if(!depth_kernels_select((depth_kernels_isa)isa))
+			continue;
+
+		work = source;
+		depth_condition(&work[0], count, p);
+		const bool match = work == reference;
+		status &= match;
+
+		double fused = time_ms(input.iterations, source, work,
+			[&](vector<uint16_t>& d) { depth_condition(&d[0], count, p); });
+
+		cout << "-fused " << depth_kernels_isa_name((depth_kernels_isa)isa) << " " << fused << " ms" <<
+			(match ? "" : " MISMATCH") << endl;
+
+		record("depth_conditioning", string("fused_") + depth_kernels_isa_name((depth_kernels_isa)isa), input.width, input.height, fused);
+	}
+
+	depth_kernels_select(depth_kernels_best_isa());
+
+	//what process_depth_data does for each frame with rnhve_depth_color defaults (bounding depth, L515 units)
+	depth_conditioning_config defaults = {0.0f, 0.0f, 0.5f, 0, 0};
+	double process = time_ms(input.iterations, source, work,
+		[&](vector<uint16_t>& d) { depth_conditioning_process(defaults, &d[0], input.width, input.height, input.width * 2,
+			depth_units_set, depth_units, true); });
+
+	cout << "-process_depth_data " << depth_kernels_isa_name(depth_kernels_selected()) << " " << process << " ms" << endl;
+	record("depth_conditioning", "process_depth_data", input.width, input.height, process);
+
+	return status;
+}
+
+void bench_chroma_plane(const bench_args& input)
+{
+	const int stride = input.width * 2, height = input.height;
+	const int iterations = input.iterations;
+	double create = 0.0, lookup = 0.0, stream = 0.0, fill = 0.0;
+
+	//first use allocates and fills (startup cost)
+	for(int i = 0; i < iterations; ++i)
+	{
+		neutral_chroma_planes_release();
+		auto start = chrono::steady_clock::now();
+		neutral_chroma_plane(CHROMA_P010LE, stride, height);
+		create += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	}
+
+	//looking the plane up (locked) every frame, what the programs did before stream handles
+	auto start = chrono::steady_clock::now();
+	for(int i = 0; i < iterations; ++i)
+		neutral_chroma_plane(CHROMA_P010LE, stride, height);
+	lookup = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+	//plane prepared when the stream starts, every frame only compares stride and height
+	neutral_chroma_stream uv;
+	neutral_chroma_stream_init(&uv, CHROMA_P010LE, stride, height);
+	const uint8_t * volatile plane_data = NULL; //not optimized out
+
+	start = chrono::steady_clock::now();
+	for(int i = 0; i < iterations; ++i)
+		plane_data = neutral_chroma_stream_plane(&uv, stride, height);
+	stream = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	(void)plane_data;
+
+	//what filling the plane for each frame would cost
+	vector<uint16_t> plane(stride / 2 * ((height + 1) / 2));
+	for(int i = 0; i < iterations; ++i)
+	{
+		auto start = chrono::steady_clock::now();
+		std::fill(plane.begin(), plane.end(), (uint16_t)(i | 0x8000)); //value changes so that it is not optimized out
+		fill += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	}
+
+	cout << "neutral P010LE UV plane " << input.width << "x" << input.height << ", " << iterations << " iterations" << endl;
+	cout << "-create " << create / iterations << " ms lookup " << lookup / iterations << " ms stream " << stream / iterations <<
+		" ms fill " << fill / iterations << " ms" << endl;
+
+	record("chroma_plane", "create", input.width, input.height, create / iterations);
+	record("chroma_plane", "lookup", input.width, input.height, lookup / iterations);
+	record("chroma_plane", "stream", input.width, input.height, stream / iterations);
+	record("chroma_plane", "fill_per_frame", input.width, input.height, fill / iterations);
+}
+
+//stands in for depth_video_frame, ref-counted frame data like rs2::frameset
+struct handoff_frame
+{
+	shared_ptr<vector<uint16_t>> data;
+	chrono::steady_clock::time_point pushed;
+};
+
+//the same handoff as depth_video_state, lock free ring + condition variable to wake up the consumer
+void bench_frame_handoff(const bench_args& input)
+{
+	const int frames = input.iterations * 10;
+	frame_ring<handoff_frame> ring(2, FRAME_RING_DROP_OLDEST);
+	mutex data_mutex;
+	condition_variable cv;
+	bool data_ready = false, done = false;
+	double latency_ms = 0.0;
+	int popped = 0;
+
+	auto data = make_shared<vector<uint16_t>>(input.width * input.height);
+	auto start = chrono::steady_clock::now();
+
+	thread consumer([&] {
+		handoff_frame frame;
+
+		for(;;)
+		{
+			unique_lock<mutex> lock(data_mutex);
+			cv.wait(lock, [&] { return data_ready || done; });
+			data_ready = false;
+
+			if(!ring.pop(frame))
+			{
+				if(done)
+					return;
+				continue;
+			}
+
+			data_ready = !ring.empty();
+			lock.unlock();
+
+			latency_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - frame.pushed).count();
+			++popped;
+		}
+	});
+
+	for(int i = 0; i < frames; ++i)
+	{
+		//like the camera, next frame after the consumer took the previous one, measures wake up latency
+		while(!ring.empty())
+			this_thread::yield();
+
+		handoff_frame frame = {data, chrono::steady_clock::now()};
+
+		if(!ring.push(std::move(frame)))
+			continue;
+
+		{
+			lock_guard<mutex> lock(data_mutex);
+			data_ready = true;
+		}
+		cv.notify_one();
+	}
+
+	{
+		lock_guard<mutex> lock(data_mutex);
+		done = data_ready = true;
+	}
+	cv.notify_one();
+	consumer.join();
+
+	const double wall_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+	cout << "frame handoff (ring of 2, drop oldest), " << frames << " frames" << endl;
+	cout << "-round trip " << wall_ms / frames << " ms per frame, pop latency " << (popped ? latency_ms / popped : 0.0) <<
+		" ms, consumed " << popped << " dropped " << ring.dropped_oldest() << endl;
+
+	record("frame_handoff", "round_trip", 0, 0, wall_ms / frames);
+	record("frame_handoff", "pop_latency", 0, 0, popped ? latency_ms / popped : 0.0);
+}
+
+//speech band tones with slow amplitude changes, 16 bit mono at SAMPLE_RATE
+static void synthetic_audio(vector<int16_t>& samples, int count)
+{
+	samples.resize(count);
+
+	for(int i = 0; i < count; ++i)
+	{
+		const double t = (double)i / SAMPLE_RATE;
+		const double envelope = 0.6 + 0.4 * sin(2 * M_PI * 3 * t);
+		samples[i] = (int16_t)(envelope * (6000 * sin(2 * M_PI * 440 * t) + 3000 * sin(2 * M_PI * 1320 * t) + 1000 * sin(2 * M_PI * 2900 * t)));
+	}
+}
+
+//lag (samples) with the highest correlation of decoded against original
+static int audio_lag(const vector<int16_t>& in, const vector<int16_t>& out, int max_lag)
+{
+	double best = -1e300;
+	int lag = 0;
+
+	for(int l = 0; l <= max_lag; ++l)
+	{
+		double sum = 0.0;
+		for(size_t i = SAMPLE_RATE / 10; i + l < out.size() && i < in.size(); ++i)
+			sum += (double)in[i] * out[i + l];
+
+		if(sum > best)
+			best = sum, lag = l;
+	}
+
+	return lag;
+}
+
+//SNR in dB of decoded (delayed by lag) against original, skipping the first 100 ms
+static double audio_snr(const vector<int16_t>& in, const vector<int16_t>& out, int lag, size_t end)
+{
+	double signal = 0.0, noise = 0.0;
+
+	for(size_t i = SAMPLE_RATE / 10; i < end && i + lag < out.size(); ++i)
+	{
+		const double d = (double)in[i] - out[i + lag];
+		signal += (double)in[i] * in[i];
+		noise += d * d;
+	}
+
+	return 10.0 * log10(signal / (noise > 0.0 ? noise : 1.0));
+}
+
+//encodes capture sized chunks, decodes aux frames like the receiver
+//status false on wrong delay, poor quality or broken loss concealment
+void bench_audio_codec(const bench_args& input, bool *status)
+{
+	const float frames_ms[] = {20.0f, 10.0f, 2.5f};
+	const char *names[] = {"opus_20ms", "opus_10ms", "opus_2.5ms"};
+	const int chunks = 4 * SAMPLE_RATE / AUDIO_BUFFER_SAMPLES; //~4 s
+	const int lost_chunk = chunks / 2;
+	vector<int16_t> in;
+
+	synthetic_audio(in, chunks * AUDIO_BUFFER_SAMPLES);
+
+	for(int f = 0; f < 3; ++f)
+	{
+		const float frame_ms = frames_ms[f];
+		audio_codec_config config = {AUDIO_CODEC_OPUS, frame_ms, 0};
+		audio_encoder *encoder = audio_encoder_init(config);
+		audio_decoder *decoder = encoder ? audio_decoder_init() : NULL;
+
+		if(!encoder || !decoder)
+		{
+			cout << "audio codec skipped" << endl;
+			audio_encoder_close(encoder);
+			audio_decoder_close(decoder);
+			return;
+		}
+
+		const int frame = audio_encoder_frame_samples(encoder);
+		vector<int16_t> out, decoded(AUDIO_QUEUE_SIZE * AUDIO_BUFFER_SAMPLES + frame);
+		size_t bytes = 0, lost_at = 0;
+		double held = 0.0, codec_ms = 0.0;
+		bool ok = true, pts_ok = true;
+
+		for(int c = 0; c < chunks && ok; ++c)
+		{
+			const uint8_t *aux;
+			auto start = chrono::steady_clock::now();
+			const int64_t pts = (int64_t)c * AUDIO_BUFFER_SAMPLES * 1000000 / SAMPLE_RATE;
+			int size = audio_encoder_encode(encoder, &in[c * AUDIO_BUFFER_SAMPLES], AUDIO_BUFFER_SAMPLES, pts, &aux);
+			int count = 0;
+			int64_t out_pts = 0;
+
+			//one aux frame lost on the network, the next one conceals it
+			if(size > 0 && c == lost_chunk)
+				lost_at = out.size();
+			else if(size > 0)
+				count = audio_decoder_decode(decoder, aux, size, &decoded[0], (int)decoded.size(), &out_pts);
+
+			//decoded samples are where their timestamp says (within rounding)
+			if(count > 0)
+				pts_ok &= llabs(out_pts - (int64_t)out.size() * 1000000 / SAMPLE_RATE) <= 1;
+
+			codec_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+			if(size < 0 || count < 0)
+				ok = false;
+			else
+			{
+				bytes += size;
+				out.insert(out.end(), decoded.begin(), decoded.begin() + count);
+				held += (c + 1) * AUDIO_BUFFER_SAMPLES - (double)out.size();
+			}
+		}
+
+		const int delay = audio_encoder_delay(encoder);
+		const int lag = audio_lag(in, out, delay + frame);
+		const double snr = audio_snr(in, out, lag, lost_at ? lost_at : out.size());
+		const double seconds = (double)chunks * AUDIO_BUFFER_SAMPLES / SAMPLE_RATE;
+		//waiting for a whole frame + codec delay + encode/decode time
+		const double latency_ms = 1000.0 * (held / chunks + lag) / SAMPLE_RATE + codec_ms / chunks;
+
+		//concealed samples keep the stream in time, lost without them
+		ok &= out.size() + frame > in.size() && lag <= delay + SAMPLE_RATE / 1000 && snr >= 6.0 && pts_ok;
+		*status &= ok;
+
+		cout << "audio codec opus " << frame_ms << " ms frames, " << chunks << " chunks of " << AUDIO_BUFFER_SAMPLES << " samples" << endl;
+		cout << "-bitrate " << bytes * 8 / seconds / 1000 << " kbit/s (pcm " << SAMPLE_RATE * CHANNELS * BYTES_PER_SAMPLE * 8 / 1000 <<
+			"), round trip " << latency_ms << " ms (codec delay " << 1000.0 * lag / SAMPLE_RATE << " ms), snr " << snr << " dB" <<
+			(pts_ok ? "" : ", timestamps off") << (ok ? "" : " MISMATCH") << endl;
+
+		record("audio_codec", string(names[f]) + "_chunk", 0, 0, codec_ms / chunks);
+		record("audio_codec", string(names[f]) + "_latency", 0, 0, latency_ms);
+
+		audio_encoder_close(encoder);
+		audio_decoder_close(decoder);
+	}
+}
+
+//device clock 50 ppm fast with up to 8 ms arrival jitter (30 fps, 60 s), then a step (clock wrap)
+//status false if drift estimate is off, timestamps go back in time or come after arrival
+void bench_frame_clock(bool *status)
+{
+	const double ppm = 50.0;
+	const int frames = 30 * 60;
+	clock_sync c;
+	int64_t last = 0, max_error = 0;
+	bool ok = true;
+
+	clock_sync_init(&c, "synthetic");
+	srand(1);
+
+	for(int f = 0; f < frames + 30; ++f)
+	{
+		const int64_t host = 1000000000 + (int64_t)f * 33333;
+		int64_t device = (int64_t)((host - 1000000000) * (1.0 + ppm * 1e-6)) + 5000000;
+
+		if(f >= frames)
+			device -= 4000000000LL; //32 bit microsecond counter wrapped
+
+		const int64_t arrival = host + 2000 + rand() % 8000;
+		const int64_t pts = clock_sync_map(&c, device, arrival);
+
+		ok &= (f == 0 || pts > last) && pts <= arrival;
+		last = pts;
+
+		//exposure at host, presented within the fixed minimal delay + jitter of the least delayed frames
+		if(f > 30 * 10 && f < frames && llabs(pts - host - 2000) > max_error)
+			max_error = llabs(pts - host - 2000);
+	}
+
+	ok &= fabs(c.drift_ppm - ppm) < 5.0 && c.steps == 1 && max_error < 2000;
+	*status &= ok;
+
+	cout << "frame clock " << frames << " frames, device " << ppm << " ppm fast, jitter 8 ms" << endl;
+	cout << "-drift estimate " << c.drift_ppm << " ppm, max timestamp error " << max_error / 1000.0 << " ms, steps " << c.steps <<
+		(ok ? "" : " MISMATCH") << endl;
+}
+
+//thresholded depth, subject box in the center quarter with holes, speckles left in the background
+//status false if the found region misses the subject or grows with the speckles
+void bench_subject_region(const bench_args& input, bool *status)
+{
+	const int width = input.width, height = input.height, iterations = input.iterations;
+	const frame_region drawn = {width * 3 / 8 + 1, height / 4 + 3, width * 5 / 8 - 1, height * 3 / 4 - 3};
+	vector<uint16_t> depth(width * height, 0);
+	frame_region found = {0, 0, 0, 0};
+	bool ok = true;
+
+	srand(2);
+
+	for(int y = drawn.top; y < drawn.bottom; ++y)
+		for(int x = drawn.left; x < drawn.right; ++x)
+			depth[y * width + x] = (rand() % 8) ? 0x8000 : 0; //invalid pixels of the subject
+
+	for(int i = 0; i < width * height / 1000; ++i)
+		depth[rand() % (width * height)] = 0x4000;
+
+	auto start = chrono::steady_clock::now();
+	for(int i = 0; i < iterations; ++i)
+		ok &= subject_region_find(depth.data(), width, height, width * 2, &found);
+	const double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / iterations;
+
+	//covers the subject, at most a sampling step (2 pixels) more on each side
+	ok &= found.left <= drawn.left && found.top <= drawn.top && found.right >= drawn.right && found.bottom >= drawn.bottom;
+	ok &= found.left >= drawn.left - 2 && found.top >= drawn.top - 2 && found.right <= drawn.right + 2 && found.bottom <= drawn.bottom + 2;
+
+	//nothing left by thresholds
+	std::fill(depth.begin(), depth.end(), 0);
+	ok &= !subject_region_find(depth.data(), width, height, width * 2, &found);
+
+	*status &= ok;
+
+	cout << "subject region " << width << "x" << height << ", " << iterations << " iterations" << endl;
+	cout << "-find " << ms << " ms, subject " << drawn.left << "," << drawn.top << "-" << drawn.right << "," << drawn.bottom <<
+		" found " << found.left << "," << found.top << "-" << found.right << "," << found.bottom <<
+		(ok ? "" : " MISMATCH") << endl;
+
+	record("subject_region", "find", width, height, ms);
+}
+
+//subject walking across the frame and back with jitter, then lost for a while
+//status false if window leaves the frame, isn't aligned, doesn't hold the subject, moves every frame or record doesn't round trip
+void bench_subject_crop(const bench_args& input, bool *status)
+{
+	const int width = input.width, height = input.height;
+	const int crop_width = width / 2 / SUBJECT_CROP_ALIGN * SUBJECT_CROP_ALIGN;
+	const int crop_height = height / 2 / SUBJECT_CROP_ALIGN * SUBJECT_CROP_ALIGN;
+	const int size = crop_width / 4, frames = 600;
+	subject_crop *c = subject_crop_init(width, height, crop_width, crop_height);
+	bool ok = c != NULL;
+	int missed = 0;
+
+	srand(3);
+
+	for(int i = 0; c && i < frames; ++i)
+	{
+		//triangle wave over the frame, 2 pixels of jitter, lost every 100th frame for 10 frames
+		const int phase = i % 300 < 150 ? i % 300 : 300 - i % 300;
+		const int x = phase * (width - size) / 150 + rand() % 5 - 2;
+		const int y = height / 2 - size / 2 + rand() % 5 - 2;
+		frame_region subject = {max(x, 0), y, min(x + size, width), y + size};
+		const bool lost = i % 100 >= 90;
+
+		const frame_region w = subject_crop_update(c, lost ? NULL : &subject);
+
+		ok &= w.left >= 0 && w.top >= 0 && w.right <= width && w.bottom <= height;
+		ok &= w.right - w.left == crop_width && w.bottom - w.top == crop_height;
+		ok &= (w.left % 2) == 0 && (w.top % 2) == 0;
+
+		if(!lost)
+			missed += subject.left < w.left || subject.right > w.right || subject.top < w.top || subject.bottom > w.bottom;
+
+		uint8_t data[SUBJECT_CROP_SIZE];
+		frame_region read;
+		uint32_t number;
+		int read_width, read_height;
+
+		ok &= subject_crop_pack(i, w, width, height, data) == SUBJECT_CROP_SIZE &&
+			subject_crop_read(data, SUBJECT_CROP_SIZE, &number, &read, &read_width, &read_height) &&
+			number == (uint32_t)i && read_width == width && read_height == height &&
+			read.left == w.left && read.top == w.top && read.right == w.right && read.bottom == w.bottom;
+	}
+
+	const int moves = c ? subject_crop_moves(c) : 0;
+
+	//each move keeps the subject for at least margin pixels of walk
+	ok &= missed == 0 && moves > 0 && moves < frames / 10;
+	ok &= subject_crop_init(width, height, crop_width + 1, crop_height) == NULL;
+
+	subject_crop_close(c);
+	*status &= ok;
+
+	cout << "subject crop " << crop_width << "x" << crop_height << " in " << width << "x" << height << ", " << frames << " frames" << endl;
+	cout << "-window moves " << moves << ", subject outside window " << missed << (ok ? "" : " MISMATCH") << endl;
+}
+
+//zeroth order entropy (bits per pixel) of 10 bit values (P010LE MSB) after median edge (LOCO-I) prediction
+//rough stand-in for what the encoder pays for the picture at fixed quality, hard edges cost, smooth areas don't
+static double prediction_entropy(const vector<uint16_t>& data, int width, int height)
+{
+	vector<uint32_t> histogram(2048, 0);
+
+	for(int y = 0; y < height; ++y)
+		for(int x = 0; x < width; ++x)
+		{
+			const int a = x ? data[y * width + x - 1] >> 6 : 0;
+			const int b = y ? data[(y - 1) * width + x] >> 6 : 0;
+			const int c = (x && y) ? data[(y - 1) * width + x - 1] >> 6 : 0;
+			const int predicted = c >= max(a, b) ? min(a, b) : (c <= min(a, b) ? max(a, b) : a + b - c);
+
+			++histogram[(data[y * width + x] >> 6) - predicted + 1024];
+		}
+
+	double bits = 0.0;
+	const double count = width * height;
+
+	for(uint32_t h : histogram)
+		if(h)
+			bits -= h * log2(h / count);
+
+	return bits / count;
+}
+
+//synthetic depth thresholded (diagonal band of 3-6 m with invalid pixels, the rest 0 like outside bounding volume), then filled
+//status false if mask doesn't restore the zeros or filled frame isn't cheaper, rnhve-test checks the implementations
+void bench_depth_fill(const bench_args& input, bool *status)
+{
+	const int width = input.width, height = input.height, count = width * height;
+	depth_conditioning_config thresholds = {3.0f, 6.0f, 0.0f, 0, 0};
+	vector<uint16_t> conditioned, reference, work;
+	vector<uint8_t> mask(DEPTH_FILL_MASK_MAX_SIZE(width, height));
+	bool ok = true;
+
+	synthetic_z16(conditioned, width, height, 3);
+	depth_conditioning_process(thresholds, &conditioned[0], width, height, width * 2, 0.00025f, 0.0001f, true);
+
+	cout << "depth fill " << width << "x" << height << ", " << input.iterations << " iterations" << endl;
+
+	for(int isa = DEPTH_KERNELS_SCALAR; isa < DEPTH_KERNELS_ISA_COUNT; ++isa)
+	{
+		if(!depth_kernels_select((depth_kernels_isa)isa))
+			continue;
+
+		double fill = time_ms(input.iterations, conditioned, work,
+			[&](vector<uint16_t>& d) { depth_fill(&d[0], width, height, width * 2); });
+
+		cout << "-" << depth_kernels_isa_name((depth_kernels_isa)isa) << " fill " << fill << " ms" << endl;
+		record("depth_fill", string("fill_") + depth_kernels_isa_name((depth_kernels_isa)isa), width, height, fill);
+	}
+
+	depth_kernels_select(depth_kernels_best_isa());
+
+	reference = conditioned;
+	depth_fill(&reference[0], width, height, width * 2);
+
+	int size = 0, invalid = 0;
+
+	for(uint16_t d : conditioned)
+		invalid += !d;
+
+	double pack = time_ms(input.iterations, conditioned, work,
+		[&](vector<uint16_t>& d) { size = depth_fill_mask_pack(0, &d[0], width, height, width * 2, &mask[0]); });
+
+	//the receiver side, filled frame with mask back to conditioned one
+	work = reference;
+	ok &= depth_fill_mask_apply(&mask[0], size, &work[0], width * 2) && work == conditioned;
+	ok &= !depth_fill_mask_apply(&mask[0], size - 1, &work[0], width * 2);
+
+	const double before = prediction_entropy(conditioned, width, height);
+	const double after = prediction_entropy(reference, width, height);
+
+	//nothing left by thresholds stays nothing
+	work.assign(count, 0);
+	depth_fill(&work[0], width, height, width * 2);
+
+	for(uint16_t d : work)
+		ok &= d == 0;
+
+	ok &= invalid > 0 && after < before;
+	*status &= ok;
+
+	cout << "-mask pack " << pack << " ms, " << size << " bytes (" << invalid * 100 / count << "% invalid)" <<
+		", prediction entropy " << before << " -> " << after << " bits per pixel" << (ok ? "" : " MISMATCH") << endl;
+	record("depth_fill", "mask_pack", width, height, pack);
+}
+
+//root mean square and max error of valid pixels, -1 if validity differs
+static double depth_error(const vector<uint16_t>& truth, const vector<uint16_t>& unpacked, int *max_error)
+{
+	double sum = 0.0;
+	int count = 0;
+
+	*max_error = 0;
+
+	for(size_t i = 0; i < truth.size(); ++i)
+	{
+		if(!truth[i] != !unpacked[i])
+			return -1.0;
+		if(!truth[i])
+			continue;
+
+		const int e = abs(truth[i] - unpacked[i]);
+		*max_error = max(*max_error, e);
+		sum += e * e;
+		++count;
+	}
+
+	return count ? sqrt(sum / count) : 0.0;
+}
+
+//smooth surface (gentle slope with bumps) with invalid pixels, optionally sensor noise
+static void smooth_depth(vector<uint16_t>& data, int width, int height, int noise)
+{
+	data.resize(width * height);
+
+	for(int y = 0; y < height; ++y)
+		for(int x = 0; x < width; ++x)
+		{
+			const int d = 8000 + x * 3 + y * 2 + (int)(200 * sin(x / 50.0) * cos(y / 40.0)) + (noise ? rand() % (2 * noise + 1) - noise : 0);
+			data[y * width + x] = (rand() % 37) ? d : 0;
+		}
+}
+
+//decoded planes, luma codes off by one on some pixels, chroma codes off by a few (never invalidating)
+static void compression_noise(vector<uint16_t>& y, vector<uint16_t>& uv)
+{
+	for(uint16_t& v : y)
+		if(v >= (2 << 6) && v < (1022 << 6) && rand() % 10 == 0)
+			v += (rand() % 2 ? 1 : -1) << 6;
+
+	for(uint16_t& v : uv)
+	{
+		const int code = (v >> 6) + rand() % 7 - 3;
+		v = (code < 0 ? 0 : (code > 1023 ? 1023 : code)) << 6;
+	}
+}
+
+//status false if unpacked depth isn't better than luma only on smooth surfaces or validity changes
+void bench_depth_chroma(const bench_args& input, bool *status)
+{
+	const int width = input.width & ~1, height = input.height & ~1, stride = width * 2;
+	vector<uint16_t> truth, luma(width * height), uv(width * height / 2), unpacked(width * height), reference(width * height);
+	const char *scenes[] = {"smooth", "noisy", "compressed"};
+	bool ok = true;
+
+	srand(4);
+
+	cout << "depth chroma " << width << "x" << height << ", " << input.iterations << " iterations" << endl;
+
+	for(int scene = 0; scene < 3; ++scene)
+	{
+		smooth_depth(truth, width, height, scene ? 4 : 0);
+
+		//what the encoder gets, P010LE keeps 10 MSB of luma
+		for(int i = 0; i < width * height; ++i)
+			luma[i] = truth[i] & 0xFFC0;
+
+		//valid pixels below the first luma step are lost the same way without chroma
+		for(int i = 0; i < width * height; ++i)
+			if(!luma[i])
+				truth[i] = 0;
+
+		auto start = chrono::steady_clock::now();
+		for(int i = 0; i < input.iterations; ++i)
+			depth_chroma_pack(&truth[0], width, height, stride, &uv[0], stride);
+		const double pack = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / input.iterations;
+
+		if(scene == 2)
+			compression_noise(luma, uv);
+
+		start = chrono::steady_clock::now();
+		for(int i = 0; i < input.iterations; ++i)
+			depth_chroma_unpack(&luma[0], &uv[0], width, height, stride, stride, &unpacked[0], stride);
+		const double unpack = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / input.iterations;
+
+		depth_chroma_unpack_luma(&luma[0], width, height, stride, &reference[0], stride);
+
+		int max_chroma, max_luma;
+		const double chroma = depth_error(truth, unpacked, &max_chroma);
+		const double plain = depth_error(truth, reference, &max_luma);
+		const bool better = chroma >= 0.0 && plain >= 0.0 && chroma < plain;
+
+		//what the encoder pays for U instead of constant plane, rough proxy like for hole filling
+		vector<uint16_t> u(width * height / 4);
+		for(size_t i = 0; i < u.size(); ++i)
+			u[i] = uv[2 * i];
+
+		ok &= better;
+
+		cout << "-" << scenes[scene] << " pack " << pack << " ms, unpack " << unpack << " ms" <<
+			", rms error " << plain << " -> " << chroma << " units, max " << max_luma << " -> " << max_chroma <<
+			", U prediction entropy " << prediction_entropy(u, width / 2, height / 2) << " bits per sample" <<
+			(better ? "" : " MISMATCH") << endl;
+
+		if(scene == 0)
+		{
+			record("depth_chroma", "pack", width, height, pack);
+			record("depth_chroma", "unpack", width, height, unpack);
+		}
+	}
+
+	*status &= ok;
+}
+
+//simulated link, 1% random loss, queue of 100 ms (arrival jitter grows with it), beyond that excess is lost
+struct simulated_link
+{
+	double capacity; //bits per second
+	double queue_ms;
+};
+
+static bitrate_feedback simulated_report(simulated_link *link, double bitrate, uint32_t sequence, uint32_t interval_ms)
+{
+	const double packet_bits = 1200 * 8;
+	const double packets = bitrate * interval_ms / 1000.0 / packet_bits;
+	const double queue_max_ms = 100.0;
+
+	link->queue_ms += (bitrate - link->capacity) / link->capacity * interval_ms;
+
+	double excess = 0.0;
+
+	if(link->queue_ms > queue_max_ms)
+	{
+		excess = (link->queue_ms - queue_max_ms) / interval_ms * link->capacity / bitrate;
+		link->queue_ms = queue_max_ms;
+	}
+	if(link->queue_ms < 0.0)
+		link->queue_ms = 0.0;
+
+	bitrate_feedback report;
+	report.sequence = sequence;
+	report.interval_ms = interval_ms;
+	report.packets = (uint32_t)packets;
+	//random rounding, expected loss is the same for any report interval
+	report.lost = (uint32_t)(packets * (0.01 + excess) + rand() / (RAND_MAX + 1.0));
+	report.jitter_us = 1000 + rand() % 500 + (uint32_t)(link->queue_ms * 100.0);
+
+	if(report.lost > report.packets)
+		report.lost = report.packets;
+
+	return report;
+}
+
+//depth and color controlled jointly over loopback feedback, 60 s at each link capacity
+//short report intervals have a few packets each at low bitrate, a single loss must not read as congestion
+//status false if floors/ceilings are violated, it doesn't settle near capacity, reacts slowly to a drop
+//or applies changes (encoder restarts) more often than the hold allows
+void bench_bitrate_control(bool *status)
+{
+	const uint32_t intervals_ms[] = {200, 100, 50};
+
+	for(uint32_t interval_ms : intervals_ms)
+		bench_bitrate_control(interval_ms, status);
+}
+
+void bench_bitrate_control(uint32_t interval_ms, bool *status)
+{
+	const int bitrates[2] = {8000000, 4000000};
+	const double capacity[] = {6000000, 3000000, 20000000};
+	const int phases = sizeof(capacity) / sizeof(capacity[0]);
+	const int reports = 60 * 1000 / interval_ms;
+	bitrate_control_config config = { 0, {1000000, 500000}, {0, 0} };
+	bitrate_control *c = bitrate_control_init(config, bitrates, 2);
+	bitrate_feedback_sender *s = c ? bitrate_feedback_sender_init("127.0.0.1", bitrate_control_port(c)) : NULL;
+
+	if(!c || !s)
+	{
+		cerr << "bitrate control: unable to set up loopback feedback" << endl;
+		bitrate_feedback_sender_close(s);
+		bitrate_control_close(c);
+		*status = false;
+		return;
+	}
+
+	simulated_link link = {capacity[0], 0.0};
+	uint32_t sequence = 0;
+	int changes = 0, early_changes = 0;
+	int64_t now_ms = 0, change_ms = -BITRATE_INCREASE_HOLD_MS;
+	bool ok = true;
+
+	cout << "bitrate control " << interval_ms << " ms reports" << endl;
+
+	srand(1);
+
+	for(int p = 0; p < phases; ++p)
+	{
+		double settled = 0.0, lost = 0.0, packets = 0.0;
+		int settled_reports = 0, reaction_ms = -1;
+
+		link.capacity = capacity[p];
+
+		for(int r = 0; r < reports; ++r)
+		{
+			const double bitrate = bitrate_control_target(c, 0) + bitrate_control_target(c, 1);
+			const bitrate_feedback report = simulated_report(&link, bitrate, ++sequence, interval_ms);
+
+			bitrate_feedback_send(s, report);
+
+			//loopback datagram is queued by the time send returns
+			now_ms += interval_ms;
+
+			if(bitrate_control_poll(c))
+			{
+				early_changes += now_ms - change_ms < BITRATE_DECREASE_HOLD_MS;
+				change_ms = now_ms;
+				++changes;
+			}
+
+			for(int i = 0; i < 2; ++i)
+				ok &= bitrate_control_target(c, i) >= config.floor[i] && bitrate_control_target(c, i) <= bitrates[i];
+
+			if(reaction_ms < 0 && bitrate_control_target(c, 0) + bitrate_control_target(c, 1) <= 1.1 * link.capacity)
+				reaction_ms = r * interval_ms;
+
+			//the last 20 s
+			if(r >= reports * 2 / 3)
+			{
+				settled += bitrate;
+				++settled_reports;
+				packets += report.packets;
+				lost += report.lost;
+			}
+		}
+
+		settled /= settled_reports;
+
+		const double ceilings = bitrates[0] + bitrates[1];
+		const double expected = capacity[p] < ceilings ? capacity[p] : ceilings;
+
+		//AIMD saws below capacity, after a drop it has to back off within seconds
+		const bool phase_ok = settled > 0.6 * expected && settled < 1.05 * expected && reaction_ms >= 0 && reaction_ms <= 3000;
+		ok &= phase_ok;
+
+		cout << "-link " << capacity[p] / 1000 << " kbit/s, settled at " << settled / 1000 << " kbit/s (" <<
+			100.0 * settled / expected << "%), loss " << 100.0 * lost / packets << "%, below capacity after " << reaction_ms << " ms" <<
+			(phase_ok ? "" : " MISMATCH") << endl;
+	}
+
+	ok &= early_changes == 0;
+	*status &= ok;
+
+	cout << "-" << changes << " bitrate changes in " << phases * reports * interval_ms / 1000 << " s (" << early_changes <<
+		" within " << BITRATE_DECREASE_HOLD_MS << " ms of the previous), final targets " <<
+		bitrate_control_target(c, 0) / 1000 << " + " << bitrate_control_target(c, 1) / 1000 << " kbit/s" << (ok ? "" : " MISMATCH") << endl;
+
+	bitrate_feedback_sender_close(s);
+	bitrate_control_close(c);
+}
+
+static frame_source *synthetic_depth_color(int width, int height)
+{
+	frame_source_config config = {FRAME_SOURCE_SYNTHETIC, NULL, true};
+	frame_source *source = frame_source_init(&config);
+
+	frame_source_enable_stream(source, RS2_STREAM_DEPTH, width, height, RS2_FORMAT_Z16, 30);
+	frame_source_enable_stream(source, RS2_STREAM_COLOR, width, height, RS2_FORMAT_RGBA8, 30);
+
+	if(frame_source_start(source, 0.0001f) < 0)
+	{
+		frame_source_close(source);
+		return NULL;
+	}
+
+	return source;
+}
+
+//percent of the same pixels in the aligned frames
+static double aligned_match(const rs2::video_frame &a, const rs2::video_frame &b)
+{
+	const int bpp = a.get_bytes_per_pixel();
+	int same = 0;
+
+	for(int y = 0; y < a.get_height(); ++y)
+	{
+		const uint8_t *ra = (const uint8_t*)a.get_data() + y * a.get_stride_in_bytes();
+		const uint8_t *rb = (const uint8_t*)b.get_data() + y * b.get_stride_in_bytes();
+
+		for(int x = 0; x < a.get_width(); ++x)
+			same += memcmp(ra + x * bpp, rb + x * bpp, bpp) == 0;
+	}
+
+	return 100.0 * same / (a.get_width() * a.get_height());
+}
+
+//depth aligner against rs2::align on synthetic depth + color framesets, both directions
+//false on Realsense failure, status false if aligned frames don't match
+bool bench_align(const bench_args& input, bool *status)
+{
+	depth_aligner_config config = {0, false};
+
+	cout << "align synthetic depth + color, " << input.frames << " frames, depth aligner " <<
+		depth_kernels_isa_name(depth_kernels_selected()) << endl;
+
+	for(const int *r : RESOLUTIONS)
+	{
+		frame_source *source = synthetic_depth_color(r[0], r[1]);
+
+		if(!source)
+			return false;
+
+		const rs2_stream targets[] = {RS2_STREAM_COLOR, RS2_STREAM_DEPTH};
+
+		for(rs2_stream target : targets)
+		{
+			rs2::align librealsense(target);
+			depth_aligner *aligner = depth_aligner_init(target, config);
+			double rs2_ms = 0.0, lut_ms = 0.0, match = 0.0;
+
+			for(int f = 0; f < input.frames; ++f)
+			{
+				rs2::frameset frameset = frame_source_wait(source, NULL); //not timed
+
+				auto t0 = chrono::steady_clock::now();
+				rs2::frameset expected = librealsense.process(frameset);
+				auto t1 = chrono::steady_clock::now();
+				rs2::frameset aligned = depth_aligner_process(aligner, frameset);
+				auto t2 = chrono::steady_clock::now();
+
+				rs2_ms += chrono::duration<double, milli>(t1 - t0).count();
+				lut_ms += chrono::duration<double, milli>(t2 - t1).count();
+
+				if(target == RS2_STREAM_COLOR)
+					match += aligned_match(expected.get_depth_frame(), aligned.get_depth_frame());
+				else
+					match += aligned_match(expected.get_color_frame(), aligned.get_color_frame());
+			}
+
+			depth_aligner_close(aligner);
+
+			const int n = input.frames;
+			const string name = (target == RS2_STREAM_COLOR) ? "to_color" : "to_depth";
+			//float rounding order differs from librealsense, rectangle edges may move by a pixel
+			const bool matches = match / n >= 99.0;
+			*status &= matches;
+
+			cout << "-" << r[0] << "x" << r[1] << " " << name << " rs2::align " << rs2_ms / n << " ms depth aligner " <<
+				lut_ms / n << " ms, " << match / n << "% pixels match" << (matches ? "" : " MISMATCH") << endl;
+
+			record("align", "rs2_" + name, r[0], r[1], rs2_ms / n);
+			record("align", "lut_" + name, r[0], r[1], lut_ms / n);
+		}
+
+		frame_source_close(source);
+	}
+
+	return true;
+}
+
+//synthetic source -> align -> depth conditioning -> null sink, like rnhve_depth_color without encoding
+bool bench_pipeline(const bench_args& input)
+{
+	depth_conditioning_config config = {0.0f, 0.0f, 0.5f, 0, 0}; //rnhve_depth_color defaults
+
+	cout << "synthetic pipeline to null sink, " << input.frames << " frames" << endl;
+
+	for(const int *r : RESOLUTIONS)
+	{
+		frame_source *source = synthetic_depth_color(r[0], r[1]);
+
+		if(!source)
+			return false;
+
+		depth_aligner_config aligner_config = {0, false};
+		depth_aligner *aligner = depth_aligner_init(RS2_STREAM_COLOR, aligner_config);
+		neutral_chroma_stream uv;
+		double capture = 0.0, align = 0.0, condition = 0.0;
+
+		neutral_chroma_stream_init(&uv, CHROMA_P010LE, r[0] * 2, r[1]);
+		auto start = chrono::steady_clock::now();
+
+		for(int f = 0; f < input.frames; ++f)
+		{
+			auto t0 = chrono::steady_clock::now();
+			rs2::frameset frameset = frame_source_wait(source, NULL);
+			auto t1 = chrono::steady_clock::now();
+			frameset = depth_aligner_process(aligner, frameset);
+			auto t2 = chrono::steady_clock::now();
+
+			rs2::depth_frame depth = frameset.get_depth_frame();
+			depth_conditioning_process(config, (uint16_t*)depth.get_data(), depth.get_width(), depth.get_height(),
+				depth.get_stride_in_bytes(), depth.get_units(), 0.0001f, true);
+			neutral_chroma_stream_plane(&uv, depth.get_stride_in_bytes(), depth.get_height());
+			auto t3 = chrono::steady_clock::now();
+
+			capture += chrono::duration<double, milli>(t1 - t0).count();
+			align += chrono::duration<double, milli>(t2 - t1).count();
+			condition += chrono::duration<double, milli>(t3 - t2).count();
+		}
+
+		const double wall_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		const int n = input.frames;
+
+		cout << "-" << r[0] << "x" << r[1] << " " << n * 1000.0 / wall_ms << " fps, per frame: generate " << capture / n <<
+			" ms align " << align / n << " ms conditioning " << condition / n << " ms" << endl;
+
+		record("pipeline", "frame", r[0], r[1], wall_ms / n);
+		record("pipeline", "generate", r[0], r[1], capture / n);
+		record("pipeline", "align", r[0], r[1], align / n);
+		record("pipeline", "conditioning", r[0], r[1], condition / n);
+
+		depth_aligner_close(aligner);
+		frame_source_close(source);
+	}
+
+	return true;
+}
+
+int write_json(const bench_args& input, const char *file)
+{
+	ofstream out(file);
+
+	if(!out)
+	{
+		cerr << "unable to open file " << file << endl;
+		return -1;
+	}
+
+	//names are plain identifiers, nothing to escape
+	out << "{" << endl;
+	out << "  \"benchmark\": \"rnhve-bench\"," << endl;
+	out << "  \"isa\": \"" << depth_kernels_isa_name(depth_kernels_selected()) << "\"," << endl;
+	out << "  \"width\": " << input.width << ", \"height\": " << input.height <<
+		", \"iterations\": " << input.iterations << ", \"frames\": " << input.frames << "," << endl;
+	out << "  \"results\": [" << endl;
+
+	for(size_t i = 0; i < results.size(); ++i)
+	{
+		const bench_result &r = results[i];
+		out << "    {\"group\": \"" << r.group << "\", \"name\": \"" << r.name << "\", \"width\": " << r.width <<
+			", \"height\": " << r.height << ", \"ms\": " << r.ms << "}" << (i + 1 < results.size() ? "," : "") << endl;
+	}
+
+	out << "  ]" << endl << "}" << endl;
+
+	if(!out)
+	{
+		cerr << "failed to write " << file << endl;
+		return -1;
+	}
+
+	cout << "Results written to " << file << endl;
+
+	return 0;
+}
+
+int process_user_input(int argc, char* argv[], bench_args* input)
+{
+	input->width = 1280;
+	input->height = 720;
+	input->iterations = 200;
+	input->frames = 100;
+	input->json = option_value(&argc, argv, "json");
+
+	const char *frames = option_value(&argc, argv, "frames");
+
+	if(frames)
+		input->frames = atoi(frames);
+
+	if((argc > 1 && (argc < 3 || argv[1][0] == '-')) || (input->json && !*input->json))
+	{
+		cerr << "Usage: " << argv[0] << " [width] [height] [iterations]" << endl;
+		cerr << endl << "examples: " << endl;
+		cerr << argv[0] << endl;
+		cerr << argv[0] << " 848 480" << endl;
+		cerr << argv[0] << " 1280 720 1000" << endl;
+		cerr << argv[0] << " 1280 720 1000 --frames 300 --json results.json" << endl;
+		cerr << endl << "options:" << endl
+		     << "       --frames <n> # frames per resolution for align and pipeline benchmarks, default 100" << endl
+		     << "       --json <file> # write results as JSON" << endl;
+		return -1;
+	}
+
+	if(argc > 2)
+	{
+		input->width = atoi(argv[1]);
+		input->height = atoi(argv[2]);
+	}
+
+	if(argc > 3)
+		input->iterations = atoi(argv[3]);
+
+	if(input->width <= 0 || input->height <= 0 || input->iterations <= 0 || input->frames <= 0)
+	{
+		cerr << "width, height, iterations and frames have to be positive" << endl;
+		return -1;
+	}
+
+	return 0;
+}
@@ -3,6 +3,7 @@
  *
  * Realsense hardware encoded UDP HEVC aligned multi-streaming
  * - depth (Main10) + color (Main)
+ * - optionally as pipeline of concurrent stages (capture, align, depth encode, color encode)
  *
  * Copyright 2020 (C) Bartosz Meglicki <meglickib@gmail.com>
  *
@@ -15,16 +16,59 @@
 // Network Hardware Video Encoder
 #include "nhve.h"
 
+// Depth and color encoded at the same time
+#include "parallel_encoder.h"
+
+// Software encoders when there is no hardware
+#include "software_encoder.h"
+
+// Encoder input recording for replay
+#include "frame_recorder.h"
+
+// Adaptive bitrate from receiver feedback
+#include "bitrate_control.h"
+
+// Region of interest and crop window (subject in bounding volume)
+#include "subject_region.h"
+
+// Depth conditioning (unit conversion, thresholds, slicing)
+#include "depth_conditioning.h"
+
+// Hole filling and validity mask
+#include "depth_fill.h"
+
+// Depth precision in chroma planes
+#include "depth_chroma.h"
+
+// Depth to color or color to depth alignment
+#include "depth_aligner.h"
+
+// Dummy color planes for NV12/P010LE
+#include "chroma_plane.h"
+
+// Pipeline mode
+#include "stage_queue.h"
+#include "stage_timing.h"
+
+// Live camera, .bag playback or synthetic frames
+#include "frame_source.h"
+
+#include "options.h"
+
 // Realsense API
 #include <librealsense2/rs.hpp>
 #include <librealsense2/rs_advanced_mode.hpp>
 
+#include <atomic>
 #include <fstream>
 #include <streambuf> //loading json config
 #include <iostream>
+#include <thread>
+#include <vector>
 #include <math.h>
 
 #define BOUNDING_DEPTH 0.5f
+#define PIPELINE_QUEUE_SIZE 2
 
 using namespace std;
 
@@ -46,14 +90,88 @@ struct input_args
 	Stream align_to;
 	std::string json;
 	bool needs_postprocessing;
+	depth_conditioning_config conditioning;
+	depth_aligner_config aligner;
+	bool pipeline;  //concurrent stages instead of single loop
+	bool parallel_encoders; //each encoder in its own thread
+	frame_source_config source;
+	bool timestamps; //presentation timestamps in aux channel
+	bitstream_recorder_config record;
+	const char *record_frames; //encoder input to file (--record-frames)
+	bitrate_control_config abr; //adaptive bitrate (--abr)
+	float roi; //region of interest quality offset (--roi), 0 disables
+	int crop_width;  //encoded window following the subject (--crop), 0 encodes whole frames
+	int crop_height;
+	depth_fill_config fill; //hole filling (--fill, --fill-mask)
+	bool depth_chroma; //depth refinement in chroma instead of neutral plane (--depth-chroma)
 };
 
-bool main_loop(const input_args& input, rs2::pipeline& realsense, nhve *streamer);
-void process_depth_data(const input_args &input, rs2::depth_frame &depth);
+//pipeline stages, each one runs in its own thread
+enum Stage {Capture = 0, Process = 1, EncodeDepth = 2, EncodeColor = 3, StageCount = 4};
 
-void init_realsense(rs2::pipeline& pipe, input_args& input);
+//frame passed between pipeline stages, holding the frameset keeps its data alive
+struct pipeline_frame
+{
+	rs2::frameset frameset;
+	const uint8_t *depth_uv;
+	frame_latency latency;
+	uint32_t number;  //frames captured before this one
+	int64_t pts[2];   //depth and color presentation timestamps
+	frame_region subject; //in depth frame, with --roi or --crop
+	bool has_subject;
+	frame_region window;  //encoded part of the frames
+	vector<uint8_t> mask; //validity mask record with --fill-mask, sent by color encode stage
+};
+
+struct pipeline_state
+{
+	stage_queue<pipeline_frame> captured;
+	stage_queue<pipeline_frame> depth;
+	stage_queue<pipeline_frame> color;
+
+	//encoders share NHVE (and its network streamer), they take turns
+	//depth then color for each frame, the same order as in main_loop
+	//(not needed with parallel encoder, it has its own frame number barrier)
+	mutex send_mutex;
+	condition_variable send_cv;
+	int send_subframe;
+	atomic<bool> failed;
+
+	frame_recorder *recording; //NULL if not recording
+	bitrate_control *abr;      //NULL without adaptive bitrate, polled by color encode stage
+	subject_crop *crop;        //NULL without --crop, updated by process stage
+	neutral_chroma_stream depth_uv; //prepared before the stages start, used by process stage
+
+	stage_timing timing[StageCount];
+
+	pipeline_state() :
+		captured(PIPELINE_QUEUE_SIZE),
+		depth(PIPELINE_QUEUE_SIZE),
+		color(PIPELINE_QUEUE_SIZE),
+		send_subframe(Depth),
+		failed(false),
+		recording(NULL),
+		abr(NULL),
+		crop(NULL)
+	{}
+};
+
+bool main_loop(const input_args& input, frame_source *realsense, nhve *streamer, parallel_encoder *pe, frame_recorder *recording, bitrate_control *abr, subject_crop *crop);
+bool main_loop_pipeline(const input_args& input, frame_source *realsense, nhve *streamer, parallel_encoder *pe, frame_recorder *recording, bitrate_control *abr, subject_crop *crop);
+int send_frames(nhve *streamer, parallel_encoder *pe, const nhve_frame *frames);
+int send_frame_info(nhve *streamer, parallel_encoder *pe, const input_args& input, uint32_t framenumber, const int64_t *pts_us, const frame_region &window,
+	const uint8_t *mask, int mask_size);
+void process_depth_data(const input_args &input, rs2::depth_frame &depth);
+int fill_depth(const input_args &input, rs2::depth_frame &depth, uint32_t framenumber, const frame_region &window, vector<uint8_t> &mask);
+uint8_t *pack_depth_chroma(const rs2::depth_frame &depth, vector<uint16_t> &uv, int *uv_stride);
+bool find_subject(const rs2::depth_frame &depth, frame_region *subject);
+void set_roi(const input_args &input, parallel_encoder *pe, int subframe, const frame_region *subject, const rs2::depth_frame &depth, const rs2::video_frame &frame, const frame_region &window);
+frame_region frame_window(const input_args& input, subject_crop *crop, const frame_region *subject);
+void crop_frame(nhve_frame *frame, int bytes_per_pixel, const frame_region &window);
+
+int init_realsense(frame_source *source, input_args& input);
 void init_realsense_depth(rs2::pipeline& pipe, const rs2::config &cfg, input_args& input);
-void print_intrinsics(const rs2::pipeline_profile& profile, rs2_stream stream);
+void print_intrinsics(const rs2::stream_profile& profile);
 
 int process_user_input(int argc, char* argv[], input_args* input, nhve_net_config *net_config, nhve_hw_config *hw_config);
 
@@ -64,24 +182,127 @@ int main(int argc, char* argv[])
 	//prepare NHVE Network Hardware Video Encoder
 	struct nhve_net_config net_config = {0};
 	struct nhve_hw_config hw_configs[2] = { {0}, {0} };
-	struct nhve *streamer;
+	struct nhve *streamer = NULL;
+	struct parallel_encoder *pe = NULL;
+	struct bitstream_recorder *recorder = NULL;
+	struct frame_recorder *recording = NULL;
+	struct bitrate_control *abr = NULL;
+	struct subject_crop *crop = NULL;
 
 	struct input_args user_input = {0};
 	user_input.depth_units=0.0001f; //optionally override with user input
+	user_input.conditioning.bounding_depth = BOUNDING_DEPTH; //optionally override with --bounding-depth
 
-	rs2::pipeline realsense;
+	struct frame_source *realsense = NULL;
 
 	if(process_user_input(argc, argv, &user_input, &net_config, hw_configs) < 0)
 		return 1;
 
-	init_realsense(realsense, user_input);
+	//encoders take the window, frames are aligned to alignment target
+	if(user_input.crop_width && (crop = subject_crop_init(
+		(user_input.align_to == Color) ? user_input.color_width : user_input.depth_width,
+		(user_input.align_to == Color) ? user_input.color_height : user_input.depth_height,
+		user_input.crop_width, user_input.crop_height)) == NULL)
+		return 1;
+
+	if( (realsense = frame_source_init(&user_input.source)) == NULL ||
+		init_realsense(realsense, user_input) < 0)
+	{
+		frame_source_close(realsense);
+		subject_crop_close(crop);
+		return 1;
+	}
+
+	if(user_input.record_frames)
+	{
+		//after alignment both streams have the intrinsics of alignment target
+		const rs2_intrinsics intrinsics = frame_source_profile(realsense,
+			(user_input.align_to == Color) ? RS2_STREAM_COLOR : RS2_STREAM_DEPTH).as<rs2::video_stream_profile>().get_intrinsics();
+		frame_recording_stream streams[2];
+
+		if(frame_recording_stream_init(&streams[Depth], hw_configs[Depth], &intrinsics, user_input.depth_units) < 0 ||
+			frame_recording_stream_init(&streams[Color], hw_configs[Color], &intrinsics, 0.0f) < 0)
+		{
+			frame_source_close(realsense);
+			subject_crop_close(crop);
+			return 1;
+		}
 
-	if( (streamer = nhve_init(&net_config, hw_configs, 2, 0)) == NULL )
+		if( (recording = frame_recorder_init(user_input.record_frames, streams, 2, user_input.seconds * user_input.framerate)) == NULL )
+		{
+			frame_source_close(realsense);
+			subject_crop_close(crop);
+			return 1;
+		}
+	}
+
+	//software encoders, recording (encoded packets), adaptive bitrate and ROI are not supported by NHVE, go through parallel encoder
+	if(user_input.parallel_encoders || software_encoder_is_software(hw_configs[Depth].encoder) || user_input.record.prefix || user_input.abr.port || user_input.roi > 0.0f)
+		pe = parallel_encoder_init(&net_config, hw_configs, 2, (user_input.timestamps || crop || user_input.fill.mask) ? 1 : 0);
+	else
+		streamer = nhve_init(&net_config, hw_configs, 2, (user_input.timestamps || crop || user_input.fill.mask) ? 1 : 0);
+
+	if(!pe && !streamer)
+	{
+		frame_recorder_close(recording);
+		frame_source_close(realsense);
+		subject_crop_close(crop);
 		return hint_user_on_failure(argv);
+	}
+
+	if(user_input.record.prefix)
+	{
+		const recorder_codec codecs[2] = { bitstream_recorder_codec(hw_configs[0].encoder), bitstream_recorder_codec(hw_configs[1].encoder) };
+
+		if( (recorder = bitstream_recorder_init(user_input.record, codecs, 2)) == NULL )
+		{
+			parallel_encoder_close(pe);
+			frame_recorder_close(recording);
+			frame_source_close(realsense);
+			subject_crop_close(crop);
+			return 1;
+		}
+
+		parallel_encoder_record(pe, recorder);
+	}
 
-	bool status = main_loop(user_input, realsense, streamer);
+	if(user_input.abr.port)
+	{
+		const int bitrates[2] = { hw_configs[0].bit_rate, hw_configs[1].bit_rate };
+
+		if( (abr = bitrate_control_init(user_input.abr, bitrates, 2)) == NULL )
+		{
+			parallel_encoder_close(pe);
+			bitstream_recorder_close(recorder);
+			frame_recorder_close(recording);
+			frame_source_close(realsense);
+			subject_crop_close(crop);
+			return 1;
+		}
+	}
 
-	nhve_close(streamer);
+	bool status = user_input.pipeline ?
+		main_loop_pipeline(user_input, realsense, streamer, pe, recording, abr, crop) :
+		main_loop(user_input, realsense, streamer, pe, recording, abr, crop);
+
+	frame_latency_report(cout);
+	frame_source_clock_report(cout, realsense);
+	if(recorder)
+		bitstream_recorder_report(cout, recorder);
+	if(abr)
+		bitrate_control_report(cout, abr);
+	if(crop)
+		cout << "subject crop: " << subject_crop_moves(crop) << " window moves" << endl;
+
+	if(streamer)
+		nhve_close(streamer);
+	parallel_encoder_close(pe);
+	bitstream_recorder_close(recorder);
+	bitrate_control_close(abr);
+	subject_crop_close(crop);
+	frame_recorder_close(recording);
+	frame_source_close(realsense);
+	neutral_chroma_planes_release();
 
 	if(status)
 		cout << "Finished successfully." << endl;
@@ -89,120 +310,521 @@ int main(int argc, char* argv[])
 	return 0;
 }
 
-inline void update_thresholds(rs2::threshold_filter& filter, float center)
+//dummy color plane for P010LE, Realsense Z16 stride is width * 2, output dimensions match alignment target
+//prepared before the first frame, looked up again only if Realsense stride differs
+static bool prepare_depth_uv(const input_args& input, neutral_chroma_stream *uv)
+{
+	const bool color = input.align_to == Color;
+
+	if(neutral_chroma_stream_init(uv, CHROMA_P010LE, (color ? input.color_width : input.depth_width) * 2,
+		color ? input.color_height : input.depth_height))
+		return true;
+
+	cerr << "failed to prepare neutral chroma plane" << endl;
+	return false;
+}
+
+//depth and color of the same frame, NULL to flush
+//with parallel encoder both are encoded at the same time
+int send_frames(nhve *streamer, parallel_encoder *pe, const nhve_frame *frames)
+{
+	if(pe)
+		return parallel_encoder_send_frames(pe, frames);
+
+	if(nhve_send(streamer, frames ? &frames[Depth] : NULL, Depth) != NHVE_OK)
+		return NHVE_ERROR;
+
+	return nhve_send(streamer, frames ? &frames[Color] : NULL, Color);
+}
+
+//aux subframe after the video ones, records one after another
+//presentation timestamps of the frame (--timestamps), window of the frames (--crop), then validity mask (--fill-mask)
+int send_frame_info(nhve *streamer, parallel_encoder *pe, const input_args& input, uint32_t framenumber, const int64_t *pts_us, const frame_region &window,
+	const uint8_t *mask, int mask_size)
 {
-	filter.set_option(RS2_OPTION_MIN_DISTANCE, fmaxf(center - BOUNDING_DEPTH, 0.15f));
-	filter.set_option(RS2_OPTION_MAX_DISTANCE, fminf(center + BOUNDING_DEPTH, 2.0f));
+	uint8_t record[FRAME_TIMESTAMPS_SIZE(2) + SUBJECT_CROP_SIZE];
+	vector<uint8_t> payload;
+	uint8_t *data = record;
+	int size = 0;
+
+	if(input.timestamps)
+		size += frame_timestamps_pack(framenumber, pts_us, 2, record);
+
+	if(input.crop_width)
+		size += subject_crop_pack(framenumber, window,
+			(input.align_to == Color) ? input.color_width : input.depth_width,
+			(input.align_to == Color) ? input.color_height : input.depth_height, record + size);
+
+	//mask is a few KB (more with many invalid speckles), copied once after the small records
+	if(mask_size)
+	{
+		payload.reserve(size + mask_size);
+		payload.assign(record, record + size);
+		payload.insert(payload.end(), mask, mask + mask_size);
+		data = payload.data();
+		size += mask_size;
+	}
+
+	if(pe)
+		return parallel_encoder_send_aux(pe, data, size, 2, framenumber);
+
+	nhve_frame frame = {0};
+	frame.data[0] = data;
+	frame.linesize[0] = size;
+
+	return nhve_send(streamer, &frame, 2);
 }
 
 //true on success, false on failure
-bool main_loop(const input_args& input, rs2::pipeline& realsense, nhve *streamer)
+bool main_loop(const input_args& input, frame_source *realsense, nhve *streamer, parallel_encoder *pe, frame_recorder *recording, bitrate_control *abr, subject_crop *crop)
 {
 	const int frames = input.seconds * input.framerate;
 	int f;
 	nhve_frame frame[2] = { {0}, {0} };
+	frame_latency latency;
+	vector<uint8_t> mask;
+	vector<uint16_t> depth_uv; //with --depth-chroma
+	neutral_chroma_stream neutral_uv;
 
-	uint16_t *depth_uv = NULL; //data of dummy color plane for P010LE
+	if(!prepare_depth_uv(input, &neutral_uv))
+		return false;
 
-	rs2::align aligner( (input.align_to == Color) ? RS2_STREAM_COLOR : RS2_STREAM_DEPTH);
-	rs2::threshold_filter thresh_filter;
+	depth_aligner *aligner = depth_aligner_init( (input.align_to == Color) ? RS2_STREAM_COLOR : RS2_STREAM_DEPTH, input.aligner);
+
+	if(!aligner)
+		return false;
 
 	for(f = 0; f < frames; ++f)
 	{
-		rs2::frameset frameset = realsense.wait_for_frames();
-		frameset = aligner.process(frameset);
+		rs2::frameset frameset = frame_source_wait(realsense, &latency);
+		const int64_t pts[2] = { frame_source_pts(realsense, frameset.get_depth_frame(), &latency),
+			frame_source_pts(realsense, frameset.get_color_frame(), &latency) };
+
+		frameset = depth_aligner_process(aligner, frameset);
+		frame_latency_stamp(&latency, LATENCY_ALIGNED);
 
 		rs2::depth_frame depth = frameset.get_depth_frame();
-		// put a bounding volume around the object in the center of the frame, +-0.5m
-		update_thresholds(thresh_filter, depth.get_distance(depth.get_width() / 2, depth.get_height() / 2));
-		depth = thresh_filter.process(depth);
 		rs2::video_frame color = frameset.get_color_frame();
 
 		// TODO do I need to set all color frame pixels to black whose depth=0 in the depth frame?
-		// can the threshold_filter tell me which pixels it changed? Or is it easier for me to
-		// implement the threshold filter manually and set both depth and color together?
 
 		const int h = depth.get_height();
 		const int depth_stride=depth.get_stride_in_bytes();
 
-		//L515 doesn't support setting depth units and clamping
-		if(input.needs_postprocessing)
+		// put a bounding volume around the object in the center of the frame (--bounding-depth)
+		// L515 doesn't support setting depth units and clamping
+		// all of that (and optional slicing) in single pass over the frame
+		if(depth_conditioning_needed(input.conditioning, input.needs_postprocessing))
+		{
 			process_depth_data(input, depth);
-
-		if(!depth_uv)
-		{  //prepare dummy color plane for P010LE format, half the size of Y
-			//we can't alloc it in advance, this is the first time we know realsense stride
-			//the stride will be at least width * 2 (Realsense Z16, VAAPI P010LE)
-			depth_uv = new uint16_t[depth_stride/2*h/2];
-
-			for(int i=0;i<depth_stride/2*h/2;++i)
-				depth_uv[i] = UINT16_MAX / 2; //dummy middle value for U/V, equals 128 << 8, equals 32768
+			frame_latency_stamp(&latency, LATENCY_CONDITIONED);
 		}
 
 		//supply realsense frame data as ffmpeg frame data
 		frame[0].linesize[0] = frame[0].linesize[1] =  depth_stride; //the strides of Y and UV are equal
 		frame[0].data[0] = (uint8_t*) depth.get_data();
-		frame[0].data[1] = (uint8_t*) depth_uv;
+		frame[0].data[1] = (uint8_t*) neutral_chroma_stream_plane(&neutral_uv, depth_stride, h);
 
 		frame[1].linesize[0] = color.get_stride_in_bytes();
 		frame[1].data[0] = (uint8_t*) color.get_data();
 
-		if(nhve_send(streamer, &frame[0], 0) != NHVE_OK)
+		frame_region subject;
+		const bool found = (input.roi > 0.0f || crop) && find_subject(depth, &subject);
+		const frame_region window = frame_window(input, crop, found ? &subject : NULL);
+
+		// holes filled only after the subject is found in the zeros (and mask is made of them)
+		const int mask_size = input.fill.fill ? fill_depth(input, depth, f, window, mask) : 0;
+
+		// chroma made of depth as it is encoded (after filling)
+		if(input.depth_chroma)
+			frame[0].data[1] = pack_depth_chroma(depth, depth_uv, &frame[0].linesize[1]);
+
+		// only the window following the subject (--crop), zero copy
+		if(crop)
+		{
+			crop_frame(&frame[0], depth.get_bytes_per_pixel(), window);
+			crop_frame(&frame[1], color.get_bytes_per_pixel(), window);
+		}
+
+		// more bits for the subject than for the background, in depth and color
+		if(input.roi > 0.0f)
+		{
+			set_roi(input, pe, Depth, found ? &subject : NULL, depth, depth, window);
+			set_roi(input, pe, Color, found ? &subject : NULL, depth, color, window);
+		}
+
+		if(recording && (frame_recorder_write(recording, f, 0, &frame[0], pts[0]) < 0 ||
+			frame_recorder_write(recording, f, 1, &frame[1], pts[1]) < 0))
+			break;
+
+		frame_latency_stamp(&latency, LATENCY_SUBMITTED);
+
+		if(send_frames(streamer, pe, frame) != NHVE_OK)
 		{
 			cerr << "failed to send" << endl;
 			break;
 		}
 
-		if(nhve_send(streamer, &frame[1], 1) != NHVE_OK)
+		frame_latency_stamp(&latency, LATENCY_ENCODED);
+		frame_latency_record(&latency);
+
+		if(abr && bitrate_control_poll(abr))
+			for(int i = 0; i < 2; ++i)
+				parallel_encoder_set_bitrate(pe, i, bitrate_control_target(abr, i));
+
+		if((input.timestamps || crop || input.fill.mask) && send_frame_info(streamer, pe, input, f, pts, window, mask.data(), mask_size) != NHVE_OK)
+		{
+			cerr << "failed to send timestamps/crop window/validity mask" << endl;
+			break;
+		}
+	}
+
+	//flush the streamer by sending NULL frame
+	send_frames(streamer, pe, NULL);
+	depth_aligner_close(aligner);
+
+	//all the requested frames processed?
+	return f==frames;
+}
+
+//stop all the stages, e.g. when one of them failed
+static void pipeline_fail(pipeline_state& s)
+{
+	{
+		lock_guard<mutex> lock(s.send_mutex);
+		s.failed = true;
+	}
+	s.send_cv.notify_all();
+
+	s.captured.close();
+	s.depth.close();
+	s.color.close();
+}
+
+static void capture_stage(const input_args& input, frame_source *realsense, pipeline_state& s)
+{
+	const int frames = input.seconds * input.framerate;
+	stage_timing *t = &s.timing[Capture];
+
+	try
+	{
+		for(int f = 0; f < frames && !s.failed; ++f)
+		{
+			pipeline_frame frame;
+			frame.frameset = frame_source_wait(realsense, &frame.latency); //includes waiting for camera
+			frame.number = f;
+			frame.pts[Depth] = frame_source_pts(realsense, frame.frameset.get_depth_frame(), &frame.latency);
+			frame.pts[Color] = frame_source_pts(realsense, frame.frameset.get_color_frame(), &frame.latency);
+			stage_timing_worked(t);
+
+			if(!s.captured.push(std::move(frame)))
+				break;
+
+			stage_timing_waited(t);
+		}
+	}
+	catch(const rs2::error &e)
+	{
+		cerr << "failed to capture: " << e.what() << endl;
+		pipeline_fail(s);
+	}
+
+	s.captured.close();
+}
+
+static void process_stage(const input_args& input, pipeline_state& s)
+{
+	depth_aligner *aligner = depth_aligner_init( (input.align_to == Color) ? RS2_STREAM_COLOR : RS2_STREAM_DEPTH, input.aligner);
+	stage_timing *t = &s.timing[Process];
+	pipeline_frame frame;
+	vector<uint8_t> mask;
+
+	if(!aligner)
+		pipeline_fail(s);
+
+	while(aligner && s.captured.pop(frame))
+	{
+		stage_timing_waited(t);
+
+		frame.frameset = depth_aligner_process(aligner, frame.frameset);
+		frame_latency_stamp(&frame.latency, LATENCY_ALIGNED);
+
+		rs2::depth_frame depth = frame.frameset.get_depth_frame();
+
+		if(depth_conditioning_needed(input.conditioning, input.needs_postprocessing))
+		{
+			process_depth_data(input, depth);
+			frame_latency_stamp(&frame.latency, LATENCY_CONDITIONED);
+		}
+
+		frame.depth_uv = neutral_chroma_stream_plane(&s.depth_uv, depth.get_stride_in_bytes(), depth.get_height());
+
+		//crop window follows the subject frame by frame, only this stage updates it
+		frame.has_subject = (input.roi > 0.0f || s.crop) && find_subject(depth, &frame.subject);
+		frame.window = frame_window(input, s.crop, frame.has_subject ? &frame.subject : NULL);
+
+		if(input.fill.fill)
+		{
+			const int mask_size = fill_depth(input, depth, frame.number, frame.window, mask);
+			frame.mask.assign(mask.begin(), mask.begin() + mask_size);
+		}
+
+		stage_timing_worked(t);
+
+		//both encoders get a reference to the same frameset
+		pipeline_frame color = frame;
+
+		if(!s.depth.push(std::move(frame)) || !s.color.push(std::move(color)))
+			break;
+	}
+
+	s.depth.close();
+	s.color.close();
+	depth_aligner_close(aligner);
+}
+
+static void encode_stage(const input_args& input, nhve *streamer, parallel_encoder *pe, int subframe, pipeline_state& s)
+{
+	stage_queue<pipeline_frame> &in = (subframe == Depth) ? s.depth : s.color;
+	stage_timing *t = &s.timing[(subframe == Depth) ? EncodeDepth : EncodeColor];
+	pipeline_frame frame;
+	nhve_frame nf = {0};
+	vector<uint16_t> depth_uv; //with --depth-chroma, encoder is done with it when sending returns
+
+	while(in.pop(frame))
+	{
+		{  // wait for our turn, the other encoder may still be sending previous subframe
+			unique_lock<mutex> lock(s.send_mutex);
+			s.send_cv.wait(lock, [&] { return s.failed || pe || s.send_subframe == subframe; });
+
+			if(s.failed)
+				break;
+		}
+
+		stage_timing_waited(t);
+		frame_latency_stamp(&frame.latency, LATENCY_SUBMITTED);
+
+		if(subframe == Depth)
+		{
+			rs2::depth_frame depth = frame.frameset.get_depth_frame();
+			nf.linesize[0] = nf.linesize[1] = depth.get_stride_in_bytes(); //the strides of Y and UV are equal
+			nf.data[0] = (uint8_t*) depth.get_data();
+			nf.data[1] = input.depth_chroma ? pack_depth_chroma(depth, depth_uv, &nf.linesize[1]) : (uint8_t*) frame.depth_uv;
+
+			if(s.crop)
+				crop_frame(&nf, depth.get_bytes_per_pixel(), frame.window);
+		}
+		else
+		{
+			rs2::video_frame color = frame.frameset.get_color_frame();
+			nf.linesize[0] = color.get_stride_in_bytes();
+			nf.data[0] = (uint8_t*) color.get_data();
+
+			if(s.crop)
+				crop_frame(&nf, color.get_bytes_per_pixel(), frame.window);
+		}
+
+		if(s.recording && frame_recorder_write(s.recording, frame.number, subframe, &nf, frame.pts[subframe]) < 0)
+		{
+			pipeline_fail(s);
+			break;
+		}
+
+		//each encode stage sets region of interest of its own encoder for the frame it sends
+		if(input.roi > 0.0f)
+		{
+			const rs2::depth_frame depth = frame.frameset.get_depth_frame();
+			const rs2::video_frame encoded = (subframe == Depth) ? rs2::video_frame(depth) : frame.frameset.get_color_frame();
+
+			set_roi(input, pe, subframe, frame.has_subject ? &frame.subject : NULL, depth, encoded, frame.window);
+		}
+
+		bool sent = (pe ? parallel_encoder_send(pe, &nf, subframe) : nhve_send(streamer, &nf, subframe)) == NHVE_OK;
+
+		//timestamps, crop window and mask follow the last subframe, still our turn
+		if(sent && subframe == Color && (input.timestamps || s.crop || input.fill.mask))
+			sent = send_frame_info(streamer, pe, input, frame.number, frame.pts, frame.window, frame.mask.data(), frame.mask.size()) == NHVE_OK;
+
+		stage_timing_worked(t);
+
+		if(!sent)
 		{
 			cerr << "failed to send" << endl;
+			pipeline_fail(s);
 			break;
 		}
+
+		//color is the second subframe, its encoder finishes the frame (only approximately with parallel encoders)
+		if(subframe == Color)
+		{
+			frame_latency_stamp(&frame.latency, LATENCY_ENCODED);
+			frame_latency_record(&frame.latency);
+
+			if(s.abr && bitrate_control_poll(s.abr))
+				for(int i = 0; i < 2; ++i)
+					parallel_encoder_set_bitrate(pe, i, bitrate_control_target(s.abr, i));
+		}
+
+		{
+			lock_guard<mutex> lock(s.send_mutex);
+			s.send_subframe = (subframe == Depth) ? Color : Depth;
+		}
+		s.send_cv.notify_all();
 	}
+}
+
+//capture, align/conditioning, depth encode and color encode in separate threads
+//connected with bounded queues, throughput is bound by the slowest stage instead of the sum
+//true on success, false on failure
+bool main_loop_pipeline(const input_args& input, frame_source *realsense, nhve *streamer, parallel_encoder *pe, frame_recorder *recording, bitrate_control *abr, subject_crop *crop)
+{
+	const int frames = input.seconds * input.framerate;
+	pipeline_state s;
+
+	s.recording = recording;
+	s.abr = abr;
+	s.crop = crop;
+
+	if(!prepare_depth_uv(input, &s.depth_uv))
+		return false;
+
+	stage_timing_init(&s.timing[Capture], "capture");
+	stage_timing_init(&s.timing[Process], "align");
+	stage_timing_init(&s.timing[EncodeDepth], "encode depth");
+	stage_timing_init(&s.timing[EncodeColor], "encode color");
+
+	auto start = chrono::steady_clock::now();
+
+	thread encode_color(encode_stage, cref(input), streamer, pe, (int)Color, ref(s));
+	thread encode_depth(encode_stage, cref(input), streamer, pe, (int)Depth, ref(s));
+	thread process(process_stage, cref(input), ref(s));
+	thread capture(capture_stage, cref(input), realsense, ref(s));
+
+	capture.join();
+	process.join();
+	encode_depth.join();
+	encode_color.join();
+
+	const double wall_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
 
 	//flush the streamer by sending NULL frame
-	nhve_send(streamer, NULL, 0);
-	nhve_send(streamer, NULL, 1);
+	send_frames(streamer, pe, NULL);
 
-	delete [] depth_uv;
+	stage_timing_report(cout, s.timing, StageCount, wall_ms);
 
 	//all the requested frames processed?
-	return f==frames;
+	return !s.failed && s.timing[EncodeColor].frames == (uint64_t)frames;
 }
 
 void process_depth_data(const input_args &input, rs2::depth_frame &depth)
 {
-	const int half_stride = depth.get_stride_in_bytes()/2;
-	const int height = depth.get_height();
+	//note - we process data in place rather than making a copy
+	uint16_t* data = (uint16_t*)depth.get_data();
 
-	const float depth_units_set = depth.get_units();
-	const float multiplier = depth_units_set / input.depth_units;
+	depth_conditioning_process(input.conditioning, data, depth.get_width(), depth.get_height(), depth.get_stride_in_bytes(),
+		depth.get_units(), input.depth_units, input.needs_postprocessing);
+}
 
-	//note - we process data in place rather than making a copy
+//in place, validity mask record (--fill-mask) of the window (encoded part) packed into mask first
+//returns its size (0 without mask)
+int fill_depth(const input_args &input, rs2::depth_frame &depth, uint32_t framenumber, const frame_region &window, vector<uint8_t> &mask)
+{
 	uint16_t* data = (uint16_t*)depth.get_data();
+	const int w = depth.get_width(), h = depth.get_height(), stride = depth.get_stride_in_bytes();
+	int size = 0;
 
-	for(int i = 0;i < half_stride * height; ++i)
+	if(input.fill.mask)
 	{
-		uint32_t val = data[i] * multiplier;
-		data[i] = val <= P010LE_MAX ? val : 0;
+		const uint16_t *window_data = data + window.top * (stride / sizeof(uint16_t)) + window.left;
+
+		mask.resize(DEPTH_FILL_MASK_MAX_SIZE(w, h)); //once, the window is never larger than the frame
+		size = depth_fill_mask_pack(framenumber, window_data, window.right - window.left, window.bottom - window.top, stride, mask.data());
 	}
+
+	depth_fill(data, w, h, stride);
+
+	return size;
 }
 
-void init_realsense(rs2::pipeline& pipe, input_args& input)
+//P010LE chroma plane refining depth (--depth-chroma), uv reused between frames
+//uv_stride is depth stride, unless odd width needs room for the last U/V pair
+uint8_t *pack_depth_chroma(const rs2::depth_frame &depth, vector<uint16_t> &uv, int *uv_stride)
 {
-	rs2::config cfg;
-	//use RGBA when aligning to color/depth (Realsense YUYV doesn't match any of my hevc_nvenc input formats)
-	cfg.enable_stream(RS2_STREAM_DEPTH, input.depth_width, input.depth_height, RS2_FORMAT_Z16, input.framerate);
-	cfg.enable_stream(RS2_STREAM_COLOR, input.color_width, input.color_height, RS2_FORMAT_RGBA8, input.framerate);
+	const int w = depth.get_width(), h = depth.get_height(), stride = depth.get_stride_in_bytes();
+	const int pairs_stride = (w + 1) / 2 * 2 * sizeof(uint16_t);
+
+	*uv_stride = stride > pairs_stride ? stride : pairs_stride;
+	uv.resize(*uv_stride / sizeof(uint16_t) * ((h + 1) / 2)); //once, the same frame size
+	depth_chroma_pack((const uint16_t*)depth.get_data(), w, h, stride, uv.data(), *uv_stride);
+
+	return (uint8_t*) uv.data();
+}
+
+//pixels left in the bounding volume (or thresholds) by conditioning, false if there are none
+bool find_subject(const rs2::depth_frame &depth, frame_region *subject)
+{
+	return subject_region_find((const uint16_t*)depth.get_data(), depth.get_width(), depth.get_height(),
+		depth.get_stride_in_bytes(), subject);
+}
+
+//region of interest for the next frame of the encoder, NULL subject encodes the frame uniformly
+//aligned frames share geometry, subject is scaled only if sizes differ, then placed in encoded window
+void set_roi(const input_args &input, parallel_encoder *pe, int subframe, const frame_region *subject, const rs2::depth_frame &depth, const rs2::video_frame &frame, const frame_region &window)
+{
+	if(!subject)
+	{
+		parallel_encoder_set_roi(pe, subframe, NULL, 0.0f);
+		return;
+	}
+
+	const frame_region scaled = subject_region_scale(*subject, depth.get_width(), depth.get_height(), frame.get_width(), frame.get_height());
+	const frame_region region = subject_region_clip(scaled, window);
+
+	parallel_encoder_set_roi(pe, subframe, &region, input.roi);
+}
+
+//encoded part of the frames, whole frames without crop
+frame_region frame_window(const input_args& input, subject_crop *crop, const frame_region *subject)
+{
+	if(crop)
+		return subject_crop_update(crop, subject);
+
+	frame_region whole = {0, 0,
+		(input.align_to == Color) ? input.color_width : input.depth_width,
+		(input.align_to == Color) ? input.color_height : input.depth_height};
+
+	return whole;
+}
+
+//points frame data at the window, encoder reads it with the frame strides
+//window is even (chroma subsampling), interleaved UV plane has half the rows and the same bytes per column
+void crop_frame(nhve_frame *frame, int bytes_per_pixel, const frame_region &window)
+{
+	frame->data[0] += window.top * frame->linesize[0] + window.left * bytes_per_pixel;
+
+	if(frame->data[1])
+		frame->data[1] += window.top / 2 * frame->linesize[1] + window.left * bytes_per_pixel;
+}
 
-	rs2::pipeline_profile profile = pipe.start(cfg);
+//0 on success, -1 on failure
+int init_realsense(frame_source *source, input_args& input)
+{
+	//use RGBA when aligning to color/depth (Realsense YUYV doesn't match any of my hevc_nvenc input formats)
+	frame_source_enable_stream(source, RS2_STREAM_DEPTH, input.depth_width, input.depth_height, RS2_FORMAT_Z16, input.framerate);
+	frame_source_enable_stream(source, RS2_STREAM_COLOR, input.color_width, input.color_height, RS2_FORMAT_RGBA8, input.framerate);
 
-	init_realsense_depth(pipe, cfg, input);
+	if(frame_source_start(source, input.depth_units) < 0)
+		return -1;
 
-	if(input.align_to == Color)
-		print_intrinsics(profile, RS2_STREAM_COLOR);
+	//recorded or generated depth can't be set up on device, convert units and clamp in software
+	if(frame_source_live(source))
+		init_realsense_depth(frame_source_pipeline(source), frame_source_rs2_config(source), input);
 	else
-		print_intrinsics(profile, RS2_STREAM_DEPTH);
+		input.needs_postprocessing = true;
+
+	print_intrinsics(frame_source_profile(source, (input.align_to == Color) ? RS2_STREAM_COLOR : RS2_STREAM_DEPTH));
+
+	return 0;
 }
 
 void init_realsense_depth(rs2::pipeline& pipe, const rs2::config &cfg, input_args& input)
@@ -250,6 +872,7 @@ void init_realsense_depth(rs2::pipeline& pipe, const rs2::config &cfg, input_arg
 	cout << "This will result in:" << endl;
 	cout << "-range " << input.depth_units * P010LE_MAX << " m" << endl;
 	cout << "-precision " << input.depth_units*64.0f << " m (" << input.depth_units*64.0f*1000 << " mm)" << endl;
+	cout << "-depth processing with " << depth_kernels_isa_name(depth_kernels_selected()) << " kernels" << endl;
 
 	bool supports_advanced_mode = depth_sensor.supports(RS2_CAMERA_INFO_ADVANCED_MODE);
 
@@ -271,10 +894,11 @@ void init_realsense_depth(rs2::pipeline& pipe, const rs2::config &cfg, input_arg
 	" range at " << input.depth_units * P010LE_MAX << " m" << endl;
 }
 
-void print_intrinsics(const rs2::pipeline_profile& profile, rs2_stream stream)
+void print_intrinsics(const rs2::stream_profile& profile)
 {
-	rs2::video_stream_profile stream_profile = profile.get_stream(stream).as<rs2::video_stream_profile>();
+	rs2::video_stream_profile stream_profile = profile.as<rs2::video_stream_profile>();
 	rs2_intrinsics i = stream_profile.get_intrinsics();
+	rs2_stream stream = profile.stream_type();
 
 	const float rad2deg = 180.0f / M_PI;
 	float hfov = 2 * atan(i.width / (2*i.fx)) * rad2deg;
@@ -289,6 +913,39 @@ void print_intrinsics(const rs2::pipeline_profile& profile, rs2_stream stream)
 
 int process_user_input(int argc, char* argv[], input_args* input, nhve_net_config *net_config, nhve_hw_config *hw_config)
 {
+	if(depth_conditioning_options(&argc, argv, &input->conditioning) < 0 ||
+		depth_aligner_options(&argc, argv, &input->aligner) < 0 ||
+		frame_source_options(&argc, argv, &input->source) < 0 ||
+		frame_latency_options(&argc, argv) < 0)
+		return -1;
+
+	frame_clock_options(&argc, argv, &input->timestamps);
+
+	if(bitstream_recorder_options(&argc, argv, &input->record) < 0 ||
+		frame_recorder_options(&argc, argv, &input->record_frames) < 0 ||
+		bitrate_control_options(&argc, argv, &input->abr) < 0 ||
+		subject_region_options(&argc, argv, &input->roi, &input->crop_width, &input->crop_height) < 0 ||
+		depth_fill_options(&argc, argv, &input->fill) < 0 ||
+		depth_chroma_options(&argc, argv, &input->depth_chroma) < 0)
+		return -1;
+
+	if(input->crop_width && input->record_frames)
+	{
+		cerr << "--crop can't be combined with --record-frames (recording has fixed frames and intrinsics)" << endl;
+		return -1;
+	}
+
+	input->pipeline = option_flag(&argc, argv, "pipeline");
+	input->parallel_encoders = option_flag(&argc, argv, "parallel-encoders");
+
+	const char *encoder = option_value(&argc, argv, "encoder");
+
+	if(encoder && !*encoder)
+	{
+		cerr << "invalid --encoder, expected FFmpeg encoder name e.g. hevc_vaapi, libx265" << endl;
+		return -1;
+	}
+
 	if(argc < 10)
 	{
 		cerr << "Usage: " << argv[0] << endl
@@ -311,6 +968,37 @@ int process_user_input(int argc, char* argv[], input_args* input, nhve_net_confi
 		cerr << argv[0] << " 192.168.0.100 9768 depth 848 480 1280 720 30 500 /dev/dri/renderD128 8000000 1000000 0.00003125" << endl;
 		cerr << argv[0] << " 192.168.0.100 9768 depth 640 480 1280 720 30 500 /dev/dri/renderD128 8000000 1000000 0.0000390625 my_config.json" << endl;
 		cerr << argv[0] << " 192.168.0.100 9768 color 640 480 1280 720 30 500 /dev/dri/renderD128 8000000 1000000 0.0000390625 my_config.json" << endl;
+		cerr << argv[0] << " 192.168.0.100 9768 color 848 480 848 480 30 500 /dev/dri/renderD128 --bounding-depth 0" << endl;
+		cerr << argv[0] << " 192.168.0.100 9768 color 848 480 848 480 30 500 /dev/dri/renderD128 --slice 2048:4" << endl;
+		cerr << argv[0] << " 192.168.0.100 9768 color 848 480 848 480 30 500 --encoder libx265 --roi 0.2" << endl;
+		cerr << argv[0] << " 192.168.0.100 9768 depth 848 480 1280 720 30 500 /dev/dri/renderD128 --crop 512x384" << endl;
+		cerr << argv[0] << " 192.168.0.100 9768 color 848 480 848 480 30 500 /dev/dri/renderD128 --fill-mask" << endl;
+		cerr << argv[0] << " 192.168.0.100 9768 color 848 480 848 480 30 500 /dev/dri/renderD128 --fill --depth-chroma" << endl;
+		cerr << argv[0] << " 192.168.0.100 9768 color 848 480 848 480 30 500 /dev/dri/renderD128 --pipeline" << endl;
+		cerr << argv[0] << " 127.0.0.1 9766 color 848 480 848 480 30 10 /dev/dri/renderD128 --pipeline --synthetic" << endl;
+		cerr << argv[0] << " 127.0.0.1 9766 color 848 480 848 480 30 10 /dev/dri/renderD128 --pipeline --synthetic --fast" << endl;
+		cerr << argv[0] << " 127.0.0.1 9766 color 848 480 848 480 30 10 /dev/dri/renderD128 --playback recording.bag" << endl;
+		cerr << argv[0] << " 192.168.0.100 9768 color 848 480 848 480 30 500 /dev/dri/renderD128 --pipeline --parallel-encoders" << endl;
+		cerr << argv[0] << " 127.0.0.1 9766 color 848 480 848 480 30 10 --pipeline --synthetic --fast --encoder libx265" << endl;
+		cerr << argv[0] << " 192.168.0.100 9768 color 848 480 1280 720 30 500 /dev/dri/renderD128 --align-threads 2" << endl;
+
+		cerr << endl;
+		depth_conditioning_usage(cerr);
+		depth_aligner_usage(cerr);
+		frame_source_usage(cerr);
+		frame_latency_usage(cerr);
+		frame_clock_usage(cerr);
+		bitstream_recorder_usage(cerr);
+		frame_recorder_usage(cerr);
+		bitrate_control_usage(cerr);
+		subject_region_usage(cerr);
+		depth_fill_usage(cerr);
+		depth_chroma_usage(cerr);
+		cerr << "pipeline options:" << endl
+		     << "       --pipeline # capture, align, depth encode and color encode in concurrent stages" << endl;
+		cerr << "encoder options:" << endl
+		     << "       --parallel-encoders # depth and color encoded at the same time, each in its own thread" << endl
+		     << "       --encoder <name> # FFmpeg encoder for both streams, default hevc_nvenc, software (e.g. libx265) without GPU" << endl;
 
 		return -1;
 	}
@@ -352,7 +1040,7 @@ int process_user_input(int argc, char* argv[], input_args* input, nhve_net_confi
 	//DEPTH hardware encoding configuration
 	hw_config[Depth].profile = FF_PROFILE_HEVC_MAIN_10;
 	hw_config[Depth].pixel_format = "p010le";
-	hw_config[Depth].encoder = "hevc_nvenc";
+	hw_config[Depth].encoder = encoder ? encoder : "hevc_nvenc";
 
 	//output dimensions will match alignment target
 	hw_config[Depth].width = (input->align_to == Color) ? input->color_width : input->depth_width;
@@ -371,7 +1059,7 @@ int process_user_input(int argc, char* argv[], input_args* input, nhve_net_confi
 	hw_config[Color].profile = FF_PROFILE_HEVC_MAIN;
 	//use RGBA when aligning to color or depth (realsense YUYV doesn't match any of my hevc_nvenc input formats)
 	hw_config[Color].pixel_format = "rgb0";
-	hw_config[Color].encoder = "hevc_nvenc";
+	hw_config[Color].encoder = encoder ? encoder : "hevc_nvenc";
 
 	//output dimensions will match alignment target
 	hw_config[Color].width = (input->align_to == Color) ? input->color_width : input->depth_width;
@@ -396,6 +1084,13 @@ int process_user_input(int argc, char* argv[], input_args* input, nhve_net_confi
 	//optionally set gop_size (determines keyframes period)
 	//hw_config[].gop_size = ...;
 
+	//encoders take only the window following the subject
+	if(input->crop_width)
+	{
+		hw_config[Depth].width = hw_config[Color].width = input->crop_width;
+		hw_config[Depth].height = hw_config[Color].height = input->crop_height;
+	}
+
 	if(argc > 13)
 		input->depth_units = strtof(argv[13], NULL);
 
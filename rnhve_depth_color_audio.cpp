@@ -2,7 +2,9 @@
  * Realsense Network Hardware Video Encoder with Audio
  *
  * Realsense hardware encoded UDP HEVC aligned multi-streaming
- * - depth (Main10) + color (Main) + audio (raw signed 16-bit mono PCM in aux nhve channel)
+ * - depth (Main10) + color (Main), optional timestamps/metadata in aux subframe
+ * - audio (raw signed 16-bit mono PCM or Opus) as its own stream on the next port
+ * - audio from WinMM (Windows), ALSA (Linux), .wav file or synthetic tone
  *
  * Copyright 2020 (C) Bartosz Meglicki <meglickib@gmail.com>
  * Audio added by CitizenOne
@@ -13,17 +15,30 @@
  *
  */
 
-// Network Hardware Video Encoder
+// Network Hardware Video Encoder configuration
 #include "nhve.h"
 
+// encoders and network sending each channel on its own
+#include "parallel_encoder.h"
+
+#include <atomic>
 #include <fstream>
 #include <streambuf> //loading json config
 #include <iostream>
-#include <Windows.h> // check for Escape press
 #include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#include <Windows.h> // check for Escape press
+#else
+#include <signal.h> // Ctrl+C
+#endif
+
+// audio capture (WinMM, ALSA) or file/tone
+#include "audio.h"
 
-// audio source for Windows
-#include "audio_winmm.h"
+// optional Opus encoding of audio
+#include "audio_codec.h"
 
 // depth_video source
 #include "depth_video_rs.h"
@@ -31,48 +46,147 @@
 using namespace std;
 
 int hint_user_on_failure(char *argv[]);
-bool main_loop(nhve *streamer, depth_video_state& dv_state, audio_state& a_state, mutex* data_ready_mutex, condition_variable* cv, bool* data_ready);
-int process_user_input(int argc, char* argv[], input_args* input, nhve_net_config *net_config, nhve_hw_config *hw_config);
+bool video_loop(parallel_encoder *streamer, depth_video_state& dv_state, const input_args& input);
+bool audio_loop(parallel_encoder *streamer, audio_state& a_state, audio_encoder* encoder, bool timestamps);
+int process_user_input(int argc, char* argv[], input_args* input, audio_config* audio, audio_codec_config* codec, nhve_net_config *net_config, nhve_hw_config *hw_config);
+
+#ifdef _WIN32
+static bool keep_running()
+{
+	return !(GetAsyncKeyState(VK_ESCAPE) & 0x8000);
+}
+#else
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int)
+{
+	stop_requested = 1;
+}
+
+static bool keep_running()
+{
+	return !stop_requested;
+}
+#endif
+
+// either sender failing stops the other one too
+static atomic<bool> send_failed(false);
+
+static bool keep_sending()
+{
+	return keep_running() && !send_failed;
+}
 
 int main(int argc, char* argv[])
 {
 	//prepare NHVE Network Hardware Video Encoder
 	struct nhve_net_config net_config = {0};
 	struct nhve_hw_config hw_configs[2] = { {0}, {0} };
-	struct nhve *streamer;
+	struct parallel_encoder *streamer, *audio_streamer = NULL;
 
 	struct input_args user_input = {0};
+	struct audio_config audio_cfg = {AUDIO_CAPTURE};
+	struct audio_codec_config codec_cfg = {AUDIO_CODEC_PCM};
 	user_input.depth_units = 0.00025f; //1.6cm resolution(!)
 	//user_input.depth_units = 0.000015625; //1mm resolution, 1.024m range - optionally override with user input
+	user_input.conditioning.slice_offset = 2048; //51.2cm minimum distance, optionally override with --slice
+	user_input.conditioning.slice_shift = 4; //1.024m deep slice
 	
 
-	if(process_user_input(argc, argv, &user_input, &net_config, hw_configs) < 0)
+	if(process_user_input(argc, argv, &user_input, &audio_cfg, &codec_cfg, &net_config, hw_configs) < 0)
+		return 1;
+
+	//NULL for raw PCM
+	audio_encoder* encoder = NULL;
+
+	if(codec_cfg.type != AUDIO_CODEC_PCM && (encoder = audio_encoder_init(codec_cfg)) == NULL)
 		return 1;
 
-	mutex data_ready_mutex;
-	condition_variable cv;
-	bool data_ready = false;
+#ifndef _WIN32
+	signal(SIGINT, request_stop);
+#endif
+
+	// depth/color and audio wake up their own senders
+	mutex audio_mutex, video_mutex;
+	condition_variable audio_cv, video_cv;
+	bool audio_ready = false, video_ready = false;
 
 	audio_state a_state;
-	a_state.data_mutex = &data_ready_mutex;
-	a_state.data_ready = &data_ready;
-	a_state.cv = &cv;
-	audio* a = audio_init(a_state);
+	a_state.data_mutex = &audio_mutex;
+	a_state.data_ready = &audio_ready;
+	a_state.cv = &audio_cv;
+	audio* a = NULL;
+
+	if(audio_cfg.backend != AUDIO_NONE && (a = audio_init(a_state, audio_cfg)) == NULL)
+	{
+		audio_encoder_close(encoder);
+		return 1;
+	}
 
 	depth_video_state dv_state;
-	dv_state.data_mutex = &data_ready_mutex;
-	dv_state.data_ready = &data_ready;
-	dv_state.cv = &cv;
+	dv_state.data_mutex = &video_mutex;
+	dv_state.data_ready = &video_ready;
+	dv_state.cv = &video_cv;
 	depth_video* dv = depth_video_init(dv_state, user_input);
 
-	if( (streamer = nhve_init(&net_config, hw_configs, 2, 1)) == NULL )
+	if(dv == NULL)
+	{
+		audio_close(a);
+		audio_encoder_close(encoder);
+		return 1;
+	}
+
+	//depth, color and optional timestamps/metadata in aux subframe 2
+	if( (streamer = parallel_encoder_init(&net_config, hw_configs, 2, (user_input.timestamps || user_input.metadata_interval) ? 1 : 0)) == NULL )
+	{
+		depth_video_close(dv);
+		audio_close(a);
+		audio_encoder_close(encoder);
+		return hint_user_on_failure(argv);
+	}
+
+	//audio stream on the next port, own frame numbers, raw PCM timestamps in subframe 1 (Opus frames carry them)
+	const bool audio_timestamps = user_input.timestamps && encoder == NULL;
+	nhve_net_config audio_net_config = net_config;
+	audio_net_config.port = net_config.port + 1;
+
+	if(a && (audio_streamer = parallel_encoder_init(&audio_net_config, NULL, 0, audio_timestamps ? 2 : 1)) == NULL )
+	{
+		parallel_encoder_close(streamer);
+		depth_video_close(dv);
+		audio_close(a);
+		audio_encoder_close(encoder);
 		return hint_user_on_failure(argv);
+	}
+
+	// audio goes out as soon as captured, never waiting for video encoders
+	bool audio_status = true;
+	thread audio_sender;
+
+	if(a)
+		audio_sender = thread([&] { audio_status = audio_loop(audio_streamer, a_state, encoder, audio_timestamps); });
+
+	bool status = video_loop(streamer, dv_state, user_input);
 
-	bool status = main_loop(streamer, dv_state, a_state, &data_ready_mutex, &cv, &data_ready);
+	if(audio_sender.joinable())
+		audio_sender.join();
+	status = status && audio_status;
 
-	nhve_close(streamer);
+	frame_latency_report(cout);
+	if(a)
+		audio_report(cout, a_state);
+	frame_source_clock_report(cout, dv->realsense);
+
+	if(a && a_state.clock.frames && frame_source_clock(dv->realsense, RS2_STREAM_DEPTH).frames)
+		cout << "clock audio against depth: drift " <<
+			a_state.clock.drift_ppm - frame_source_clock(dv->realsense, RS2_STREAM_DEPTH).drift_ppm << " ppm" << endl;
+
+	parallel_encoder_close(audio_streamer);
+	parallel_encoder_close(streamer);
 	depth_video_close(dv);
 	audio_close(a);
+	audio_encoder_close(encoder);
+	neutral_chroma_planes_release();
 
 	if(status)
 		cout << "Finished successfully." << endl;
@@ -81,103 +195,164 @@ int main(int argc, char* argv[])
 }
 
 //true on success, false on failure
-bool main_loop(nhve *streamer, depth_video_state& dv_state, audio_state& a_state, mutex* data_ready_mutex, condition_variable* cv, bool* data_ready)
+bool video_loop(parallel_encoder *streamer, depth_video_state& dv_state, const input_args& input)
 {
-	nhve_frame frame[3] = { {0}, {0}, {0} };
-	bool frame_ready = false;
-
-	// keep looping until the user hits escape
-	while (!(GetAsyncKeyState(VK_ESCAPE) & 0x8000))
+	nhve_frame frame[2] = { {0}, {0} };
+	depth_video_frame video; // holds the frameset until we are done encoding it
+	uint32_t framenumber = 0;
+	bool status = true;
+
+	//timestamps and metadata records one after another, aux subframe sent with each video frame (empty if nothing is due)
+	const bool aux = input.timestamps || input.metadata_interval;
+	depth_metadata_sender metadata;
+	uint8_t record[FRAME_TIMESTAMPS_SIZE(2) + DEPTH_METADATA_SIZE];
+	depth_metadata_sender_init(&metadata, input.metadata_interval);
+
+	// keep looping until the user hits escape (Windows) or Ctrl+C
+	while (keep_sending())
 	{
-		// wait for notification rather than run hot
+		// wait for notification rather than run hot, but check for stop request now and then
 		{  // scope here to manage the lifetime of the mutex
-			unique_lock<mutex> lk(*data_ready_mutex);
-			cv->wait(lk, [&] { return *data_ready; });
+			unique_lock<mutex> lk(*dv_state.data_mutex);
+			if (!dv_state.cv->wait_for(lk, chrono::milliseconds(100), [&] { return *dv_state.data_ready; }))
+				continue;
+			*dv_state.data_ready = false;
+		} // don't need the mutex anymore
 
-			if (dv_state.depth_video_data_ready)
-			{
-				//supply realsense frame data as ffmpeg frame data
-				frame[0].data[0] = dv_state.depth_data;
-				frame[0].data[1] = (uint8_t*)dv_state.depth_uv;
-				frame[0].linesize[0] = frame[0].linesize[1] = dv_state.depth_stride; //the strides of Y and UV are equal
+		// the previous frameset is released here, all the waiting ones are sent before sleeping again
+		while (dv_state.frames->pop(video))
+		{
+			rs2::depth_frame depth = video.frameset.get_depth_frame();
+			rs2::video_frame color = video.frameset.get_color_frame();
 
-				frame[1].data[0] = dv_state.color_data;
-				frame[1].linesize[0] = dv_state.color_stride;
+			//supply realsense frame data as ffmpeg frame data
+			frame[0].data[0] = (uint8_t*)depth.get_data();
+			frame[0].data[1] = (uint8_t*)video.depth_uv;
+			frame[0].linesize[0] = frame[0].linesize[1] = depth.get_stride_in_bytes(); //the strides of Y and UV are equal
 
-				dv_state.depth_video_data_ready = false;
-				*dv_state.data_ready = false;
-				frame_ready = true;
-			}
-			else
-			{
-				// zero out subframes 0 and 1 if there's no depth/color frame this time
-				frame[0].data[0] = 0;
-				frame[0].data[1] = 0;
-				frame[0].linesize[0] = 0;
-				frame[0].linesize[1] = 0;
-
-				frame[1].data[0] = 0;
-				frame[1].linesize[0] = 0;
-			}
+			frame[1].data[0] = (uint8_t*)color.get_data();
+			frame[1].linesize[0] = color.get_stride_in_bytes();
+
+			frame_latency_stamp(&video.latency, LATENCY_SUBMITTED);
 
-			if (a_state.audio_data_ready)
+			// depth and color encoded in parallel
+			if (parallel_encoder_send_frames(streamer, frame) != NHVE_OK)
 			{
-				// pass on the audio in subframe 2
-				frame[2].data[0] = (uint8_t*)a_state.audio_buffer;
-				frame[2].linesize[0] = a_state.audio_data_length_written;
-				a_state.audio_data_ready = false;
-				*a_state.data_ready = false;
-				frame_ready = true;
+				cerr << "failed to send depth/color frame" << endl;
+				status = false;
+				break;
 			}
-			else
+
+			frame_latency_stamp(&video.latency, LATENCY_ENCODED);
+			frame_latency_record(&video.latency);
+
+			// depth and color presentation timestamps, depth metadata every n frames and when it changes
+			int size = 0;
+
+			if (input.timestamps)
+				size += frame_timestamps_pack(framenumber, video.pts, 2, record);
+
+			if (input.metadata_interval)
+				size += depth_metadata_pack(&metadata, video.metadata, record + size);
+
+			if (aux && parallel_encoder_send_aux(streamer, record, size, 2, framenumber) != NHVE_OK)
 			{
-				// set subframe 2 to empty if there's no audio this time
-				frame[2].data[0] = NULL;
-				frame[2].linesize[0] = 0;
+				cerr << "failed to send timestamps/metadata frame" << endl;
+				status = false;
+				break;
 			}
-		} // don't need the mutex anymore
 
-		// only send a frame if at least one of the subframes had data
-		if (frame_ready)
+			++framenumber;
+		}
+
+		if (!status)
+			break;
+	}
+
+	send_failed = send_failed || !status;
+
+	//flush the encoders by sending NULL frames
+	parallel_encoder_send_frames(streamer, NULL);
+
+	return status;
+}
+
+//true on success, false on failure
+bool audio_loop(parallel_encoder *streamer, audio_state& a_state, audio_encoder* encoder, bool timestamps)
+{
+	audio_batch audio; // all the chunks pending since the last wakeup
+	uint8_t record[FRAME_TIMESTAMPS_SIZE(1)];
+	uint32_t framenumber = 0;
+	bool status = true;
+
+	while (keep_sending())
+	{
+		{  // scope here to manage the lifetime of the mutex
+			unique_lock<mutex> lk(*a_state.data_mutex);
+			if (!a_state.cv->wait_for(lk, chrono::milliseconds(100), [&] { return *a_state.data_ready; }))
+				continue;
+			*a_state.data_ready = false;
+		}
+
+		// more than a batch may be waiting, don't sleep until the queue is empty
+		while (audio_drain(a_state, &audio))
 		{
-			if (nhve_send(streamer, &frame[0], 0) != NHVE_OK)
+			const uint8_t* data = (uint8_t*)audio.samples;
+			int size = audio.bytes;
+
+			// Opus frames completed with this batch, the remainder waits for the next one
+			if (encoder && (size = audio_encoder_encode(encoder, audio.samples, audio.bytes / (CHANNELS * BYTES_PER_SAMPLE), audio.pts_us, &data)) < 0)
 			{
-				cerr << "failed to send depth frame" << endl;
+				status = false;
 				break;
 			}
 
-			if (nhve_send(streamer, &frame[1], 1) != NHVE_OK)
+			if (size && parallel_encoder_send_aux(streamer, data, size, 0, framenumber) != NHVE_OK)
 			{
-				cerr << "failed to send color frame" << endl;
+				cerr << "failed to send audio frame" << endl;
+				status = false;
 				break;
 			}
 
-			if (nhve_send(streamer, &frame[2], 2) != NHVE_OK)
+			// raw PCM presentation timestamp of the first sample in subframe 1 of the same frame
+			if (size && timestamps && parallel_encoder_send_aux(streamer, record, frame_timestamps_pack(framenumber, &audio.pts_us, 1, record), 1, framenumber) != NHVE_OK)
 			{
-				cerr << "failed to send aux frame" << endl;
+				cerr << "failed to send audio timestamps frame" << endl;
+				status = false;
 				break;
 			}
 
-			frame_ready = false;
+			if (size)
+				++framenumber;
+
+			audio_sent(a_state, audio);
 		}
-	}
 
-	//flush the streamer by sending NULL frame
-	nhve_send(streamer, NULL, 0);
-	nhve_send(streamer, NULL, 1);
-	nhve_send(streamer, NULL, 2);
+		if (!status)
+			break;
+	}
 
-	delete [] dv_state.depth_uv;
+	send_failed = send_failed || !status;
 
-	return true;
+	return status;
 }
 
-int process_user_input(int argc, char* argv[], input_args* input, nhve_net_config *net_config, nhve_hw_config *hw_config)
+int process_user_input(int argc, char* argv[], input_args* input, audio_config* audio, audio_codec_config* codec, nhve_net_config *net_config, nhve_hw_config *hw_config)
 {
+	if(depth_conditioning_options(&argc, argv, &input->conditioning) < 0 ||
+		depth_video_options(&argc, argv, input) < 0 ||
+		audio_options(&argc, argv, audio) < 0 ||
+		audio_codec_options(&argc, argv, codec) < 0 ||
+		depth_metadata_options(&argc, argv, &input->metadata_interval) < 0 ||
+		frame_latency_options(&argc, argv) < 0)
+		return -1;
+
+	frame_clock_options(&argc, argv, &input->timestamps);
+
 	if(argc < 9)
 	{
 		cerr << "Usage: " << argv[0] << endl
-		     << "       <host> <port>" << endl //1, 2
+		     << "       <host> <port> # audio on port + 1" << endl //1, 2
 		     << "       <color/depth> # alignment direction" << endl //3
 		     << "       <width_depth> <height_depth> <width_color> <height_color>" << endl //4, 5, 6, 7
 			  << "       <framerate>" << endl //8
@@ -196,6 +371,25 @@ int process_user_input(int argc, char* argv[], input_args* input, nhve_net_confi
 		cerr << argv[0] << " 192.168.0.100 9768 depth 848 480 1280 720 30 /dev/dri/renderD128 8000000 1000000 0.00003125" << endl;
 		cerr << argv[0] << " 192.168.0.100 9768 depth 640 480 1280 720 30 /dev/dri/renderD128 8000000 1000000 0.0000390625 my_config.json" << endl;
 		cerr << argv[0] << " 192.168.0.100 9768 color 640 480 1280 720 30 /dev/dri/renderD128 8000000 1000000 0.0000390625 my_config.json" << endl;
+		cerr << argv[0] << " 192.168.0.100 9768 color 848 480 848 480 30 /dev/dri/renderD128 --slice 1024:4" << endl;
+		cerr << argv[0] << " 192.168.0.100 9768 color 848 480 848 480 30 /dev/dri/renderD128 --slice 2048:4 --adaptive-slice" << endl;
+		cerr << argv[0] << " 192.168.0.100 9768 color 848 480 848 480 30 /dev/dri/renderD128 --adaptive-slice --metadata 30" << endl;
+		cerr << argv[0] << " 127.0.0.1 9766 color 848 480 848 480 30 /dev/dri/renderD128 --playback recording.bag" << endl;
+		cerr << argv[0] << " 127.0.0.1 9766 color 848 480 848 480 30 /dev/dri/renderD128 --synthetic" << endl;
+		cerr << argv[0] << " 127.0.0.1 9766 color 848 480 848 480 30 /dev/dri/renderD128 --audio-device hw:1,0" << endl;
+		cerr << argv[0] << " 127.0.0.1 9766 color 848 480 848 480 30 /dev/dri/renderD128 --synthetic --audio-tone 440" << endl;
+		cerr << argv[0] << " 192.168.0.100 9768 color 848 480 848 480 30 /dev/dri/renderD128 --audio-codec opus --audio-bitrate 32000" << endl;
+		cerr << argv[0] << " 192.168.0.100 9768 color 848 480 848 480 30 /dev/dri/renderD128 --audio-codec opus --timestamps" << endl;
+		cerr << argv[0] << " 192.168.0.100 9768 color 848 480 848 480 30 /dev/dri/renderD128 --no-audio --metadata 30 --timestamps" << endl;
+
+		cerr << endl;
+		depth_conditioning_usage(cerr);
+		depth_video_usage(cerr);
+		depth_metadata_usage(cerr);
+		audio_usage(cerr);
+		audio_codec_usage(cerr);
+		frame_latency_usage(cerr);
+		frame_clock_usage(cerr);
 
 		return -1;
 	}
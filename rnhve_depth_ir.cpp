@@ -16,6 +16,29 @@
 // Network Hardware Video Encoder
 #include "nhve.h"
 
+// Depth and infrared encoded at the same time
+#include "parallel_encoder.h"
+
+// Software encoders when there is no hardware
+#include "software_encoder.h"
+
+// Encoder input recording for replay
+#include "frame_recorder.h"
+
+// Adaptive bitrate from receiver feedback
+#include "bitrate_control.h"
+
+// Depth conditioning (unit conversion, thresholds, slicing)
+#include "depth_conditioning.h"
+
+// Dummy color planes for NV12/P010LE
+#include "chroma_plane.h"
+
+// Live camera, .bag playback or synthetic frames
+#include "frame_source.h"
+
+#include "options.h"
+
 // Realsense API
 #include <librealsense2/rs.hpp>
 #include <librealsense2/rs_advanced_mode.hpp>
@@ -42,14 +65,23 @@ struct input_args
 	StreamType stream;
 	std::string json;
 	bool needs_postprocessing;
+	depth_conditioning_config conditioning;
+	bool parallel_encoders; //each encoder in its own thread
+	frame_source_config source;
+	bool timestamps; //presentation timestamps in aux channel
+	bitstream_recorder_config record;
+	const char *record_frames; //encoder input to file (--record-frames)
+	bitrate_control_config abr; //adaptive bitrate (--abr)
 };
 
-bool main_loop(const input_args& input, rs2::pipeline& realsense, nhve *streamer);
+bool main_loop(const input_args& input, frame_source *realsense, nhve *streamer, parallel_encoder *pe, frame_recorder *recording, bitrate_control *abr);
+int send_frames(nhve *streamer, parallel_encoder *pe, const nhve_frame *frames);
+int send_timestamps(nhve *streamer, parallel_encoder *pe, uint32_t framenumber, const int64_t *pts_us, int subframes);
 void process_depth_data(const input_args &input, rs2::depth_frame &depth);
 
-void init_realsense(rs2::pipeline& pipe, input_args& input);
+int init_realsense(frame_source *source, input_args& input);
 void init_realsense_depth(rs2::pipeline& pipe, const rs2::config &cfg, input_args& input);
-void print_intrinsics(const rs2::pipeline_profile& profile, rs2_stream stream);
+void print_intrinsics(const rs2::stream_profile& profile);
 
 int process_user_input(int argc, char* argv[], input_args* input, nhve_net_config *net_config, nhve_hw_config *hw_config);
 
@@ -63,24 +95,106 @@ int main(int argc, char* argv[])
 	//prepare NHVE Network Hardware Video Encoder
 	struct nhve_net_config net_config = {0};
 	struct nhve_hw_config hw_configs[2] = { {0}, {0} };
-	struct nhve *streamer;
+	struct nhve *streamer = NULL;
+	struct parallel_encoder *pe = NULL;
+	struct bitstream_recorder *recorder = NULL;
+	struct frame_recorder *recording = NULL;
+	struct bitrate_control *abr = NULL;
 
 	struct input_args user_input = {0};
 	user_input.depth_units=0.0001f; //optionally override with user input
 
-	rs2::pipeline realsense;
+	struct frame_source *realsense = NULL;
 
 	if(process_user_input(argc, argv, &user_input, &net_config, hw_configs) < 0)
 		return 1;
 
-	init_realsense(realsense, user_input);
+	if( (realsense = frame_source_init(&user_input.source)) == NULL ||
+		init_realsense(realsense, user_input) < 0)
+	{
+		frame_source_close(realsense);
+		return 1;
+	}
+
+	if(user_input.record_frames)
+	{
+		const rs2_intrinsics depth_intrinsics = frame_source_profile(realsense, RS2_STREAM_DEPTH).as<rs2::video_stream_profile>().get_intrinsics();
+		const rs2_intrinsics ir_intrinsics = frame_source_profile(realsense, RS2_STREAM_INFRARED).as<rs2::video_stream_profile>().get_intrinsics();
+		frame_recording_stream streams[2];
+
+		if(frame_recording_stream_init(&streams[DEPTH], hw_configs[DEPTH], &depth_intrinsics, user_input.depth_units) < 0 ||
+			frame_recording_stream_init(&streams[IR], hw_configs[IR], &ir_intrinsics, 0.0f) < 0)
+		{
+			frame_source_close(realsense);
+			return 1;
+		}
+
+		if( (recording = frame_recorder_init(user_input.record_frames, streams, 2, user_input.seconds * user_input.framerate)) == NULL )
+		{
+			frame_source_close(realsense);
+			return 1;
+		}
+	}
+
+	//software encoders, recording (encoded packets) and adaptive bitrate are not supported by NHVE, go through parallel encoder
+	if(user_input.parallel_encoders || software_encoder_is_software(hw_configs[DEPTH].encoder) || user_input.record.prefix || user_input.abr.port)
+		pe = parallel_encoder_init(&net_config, hw_configs, 2, user_input.timestamps ? 1 : 0);
+	else
+		streamer = nhve_init(&net_config, hw_configs, 2, user_input.timestamps ? 1 : 0);
 
-	if( (streamer = nhve_init(&net_config, hw_configs, 2, 0)) == NULL )
+	if(!pe && !streamer)
+	{
+		frame_recorder_close(recording);
+		frame_source_close(realsense);
 		return hint_user_on_failure(argv);
+	}
 
-	bool status = main_loop(user_input, realsense, streamer);
+	if(user_input.record.prefix)
+	{
+		const recorder_codec codecs[2] = { bitstream_recorder_codec(hw_configs[0].encoder), bitstream_recorder_codec(hw_configs[1].encoder) };
+
+		if( (recorder = bitstream_recorder_init(user_input.record, codecs, 2)) == NULL )
+		{
+			parallel_encoder_close(pe);
+			frame_recorder_close(recording);
+			frame_source_close(realsense);
+			return 1;
+		}
+
+		parallel_encoder_record(pe, recorder);
+	}
+
+	if(user_input.abr.port)
+	{
+		const int bitrates[2] = { hw_configs[0].bit_rate, hw_configs[1].bit_rate };
+
+		if( (abr = bitrate_control_init(user_input.abr, bitrates, 2)) == NULL )
+		{
+			parallel_encoder_close(pe);
+			bitstream_recorder_close(recorder);
+			frame_recorder_close(recording);
+			frame_source_close(realsense);
+			return 1;
+		}
+	}
 
-	nhve_close(streamer);
+	bool status = main_loop(user_input, realsense, streamer, pe, recording, abr);
+
+	frame_latency_report(cout);
+	frame_source_clock_report(cout, realsense);
+	if(recorder)
+		bitstream_recorder_report(cout, recorder);
+	if(abr)
+		bitrate_control_report(cout, abr);
+
+	if(streamer)
+		nhve_close(streamer);
+	parallel_encoder_close(pe);
+	bitstream_recorder_close(recorder);
+	bitrate_control_close(abr);
+	frame_recorder_close(recording);
+	frame_source_close(realsense);
+	neutral_chroma_planes_release();
 
 	if(status)
 		cout << "Finished successfully." << endl;
@@ -88,79 +202,114 @@ int main(int argc, char* argv[])
 	return 0;
 }
 
+//depth and infrared of the same frame, NULL to flush
+//with parallel encoder both are encoded at the same time
+int send_frames(nhve *streamer, parallel_encoder *pe, const nhve_frame *frames)
+{
+	if(pe)
+		return parallel_encoder_send_frames(pe, frames);
+
+	if(nhve_send(streamer, frames ? &frames[DEPTH] : NULL, DEPTH) != NHVE_OK)
+		return NHVE_ERROR;
+
+	return nhve_send(streamer, frames ? &frames[IR] : NULL, IR);
+}
+
+//presentation timestamps of the frame in aux subframe after the video ones
+int send_timestamps(nhve *streamer, parallel_encoder *pe, uint32_t framenumber, const int64_t *pts_us, int subframes)
+{
+	uint8_t record[FRAME_TIMESTAMPS_SIZE(FRAME_TIMESTAMPS_MAX)];
+	const int size = frame_timestamps_pack(framenumber, pts_us, subframes, record);
+
+	if(pe)
+		return parallel_encoder_send_aux(pe, record, size, subframes, framenumber);
+
+	nhve_frame frame = {0};
+	frame.data[0] = record;
+	frame.linesize[0] = size;
+
+	return nhve_send(streamer, &frame, subframes);
+}
+
 //true on success, false on failure
-bool main_loop(const input_args& input, rs2::pipeline& realsense, nhve *streamer)
+bool main_loop(const input_args& input, frame_source *realsense, nhve *streamer, parallel_encoder *pe, frame_recorder *recording, bitrate_control *abr)
 {
 	const int frames = input.seconds * input.framerate;
 	int f;
 	nhve_frame frame[2] = { {0}, {0} };
+	frame_latency latency;
+
+	//dummy color planes for P010LE depth (Z16 stride is width * 2) and NV12 infrared (Y8 stride is width)
+	//prepared before the first frame, looked up again only if Realsense stride differs
+	neutral_chroma_stream depth_uv, ir_uv = {CHROMA_NV12, 0, 0, NULL};
 
-	uint16_t *depth_uv = NULL; //data of dummy color plane for P010LE
-	uint8_t *ir_uv = NULL; //data of dummy color plane for NV12 for Realsense infrared
+	if(!neutral_chroma_stream_init(&depth_uv, CHROMA_P010LE, input.width * 2, input.height) ||
+		(input.stream == INFRARED && !neutral_chroma_stream_init(&ir_uv, CHROMA_NV12, input.width, input.height)))
+	{
+		cerr << "failed to prepare neutral chroma planes" << endl;
+		return false;
+	}
 
 	for(f = 0; f < frames; ++f)
 	{
-		rs2::frameset frameset = realsense.wait_for_frames();
+		rs2::frameset frameset = frame_source_wait(realsense, &latency);
 		rs2::depth_frame depth = frameset.get_depth_frame();
 		rs2::video_frame ir = frameset.get_infrared_frame();
+		const int64_t pts[2] = { frame_source_pts(realsense, depth, &latency), frame_source_pts(realsense, ir, &latency) };
 
-		const int w = depth.get_width();
 		const int h = depth.get_height();
 		const int depth_stride=depth.get_stride_in_bytes();
 		const int ir_stride=ir.get_stride_in_bytes();
 
 		//L515 doesn't support setting depth units and clamping
-		if(input.needs_postprocessing)
+		//optional thresholds and slicing are done in the same pass
+		if(depth_conditioning_needed(input.conditioning, input.needs_postprocessing))
+		{
 			process_depth_data(input, depth);
-
-		if(!depth_uv)
-		{  //prepare dummy color plane for P010LE format, half the size of Y
-			//we can't alloc it in advance, this is the first time we know realsense stride
-			//the stride will be at least width * 2 (Realsense Z16, VAAPI P010LE)
-			depth_uv = new uint16_t[depth_stride/2*h/2];
-
-			for(int i=0;i<depth_stride/2*h/2;++i)
-				depth_uv[i] = UINT16_MAX / 2; //dummy middle value for U/V, equals 128 << 8, equals 32768
-
-			//prepare dummy color plane for NV12 format, half the size of Y
-			if(input.stream == INFRARED)
-			{
-				ir_uv = new uint8_t[ir_stride * h /2];
-				memset(ir_uv, 128, ir_stride * h /2);
-			}
+			frame_latency_stamp(&latency, LATENCY_CONDITIONED);
 		}
 
 		//supply realsense depth frame data as ffmpeg frame data
 		frame[0].linesize[0] = frame[0].linesize[1] =  depth_stride; //the strides of Y and UV are equal
 		frame[0].data[0] = (uint8_t*) depth.get_data();
-		frame[0].data[1] = (uint8_t*) depth_uv;
-
-		if(nhve_send(streamer, &frame[0], 0) != NHVE_OK)
-		{
-			cerr << "failed to send" << endl;
-			break;
-		}
+		frame[0].data[1] = (uint8_t*) neutral_chroma_stream_plane(&depth_uv, depth_stride, h);
 
 		//supply realsense infrared frame data as ffmpeg frame data
 		frame[1].linesize[0] = ir_stride;
 		frame[1].data[0] = (uint8_t*) ir.get_data();
 
 		frame[1].linesize[1] = (input.stream == INFRARED) ? ir_stride : 0; //NV12 strides of Y and UV are equal, UYVY is single plane
-		frame[1].data[1] = ir_uv; //data for NV12 or NULL for single plane UYVY
+		frame[1].data[1] = (input.stream == INFRARED) ? //data for NV12 or NULL for single plane UYVY
+			(uint8_t*) neutral_chroma_stream_plane(&ir_uv, ir_stride, ir.get_height()) : NULL;
 
-		if(nhve_send(streamer, &frame[1], 1) != NHVE_OK)
+		if(recording && (frame_recorder_write(recording, f, 0, &frame[0], pts[0]) < 0 ||
+			frame_recorder_write(recording, f, 1, &frame[1], pts[1]) < 0))
+			break;
+
+		frame_latency_stamp(&latency, LATENCY_SUBMITTED);
+
+		if(send_frames(streamer, pe, frame) != NHVE_OK)
 		{
 			cerr << "failed to send" << endl;
 			break;
 		}
+
+		frame_latency_stamp(&latency, LATENCY_ENCODED);
+		frame_latency_record(&latency);
+
+		if(abr && bitrate_control_poll(abr))
+			for(int i = 0; i < 2; ++i)
+				parallel_encoder_set_bitrate(pe, i, bitrate_control_target(abr, i));
+
+		if(input.timestamps && send_timestamps(streamer, pe, f, pts, 2) != NHVE_OK)
+		{
+			cerr << "failed to send timestamps" << endl;
+			break;
+		}
 	}
 
 	//flush the hardware by sending NULL frames
-	nhve_send(streamer, NULL, 0);
-	nhve_send(streamer, NULL, 1);
-
-	delete [] depth_uv;
-	delete [] ir_uv;
+	send_frames(streamer, pe, NULL);
 
 	//all the requested frames processed?
 	return f==frames;
@@ -168,37 +317,34 @@ bool main_loop(const input_args& input, rs2::pipeline& realsense, nhve *streamer
 
 void process_depth_data(const input_args &input, rs2::depth_frame &depth)
 {
-	const int half_stride = depth.get_stride_in_bytes()/2;
-	const int height = depth.get_height();
-
-	const float depth_units_set = depth.get_units();
-	const float multiplier = depth_units_set / input.depth_units;
-
 	//note - we process data in place rather than making a copy
 	uint16_t* data = (uint16_t*)depth.get_data();
 
-	for(int i = 0;i < half_stride * height; ++i)
-	{
-		uint32_t val = data[i] * multiplier;
-		data[i] = val <= P010LE_MAX ? val : 0;
-	}
+	depth_conditioning_process(input.conditioning, data, depth.get_width(), depth.get_height(), depth.get_stride_in_bytes(),
+		depth.get_units(), input.depth_units, input.needs_postprocessing);
 }
 
-void init_realsense(rs2::pipeline& pipe, input_args& input)
+//0 on success, -1 on failure
+int init_realsense(frame_source *source, input_args& input)
 {
-	rs2::config cfg;
-
-	cfg.enable_stream(RS2_STREAM_DEPTH, input.width, input.height, RS2_FORMAT_Z16, input.framerate);
+	frame_source_enable_stream(source, RS2_STREAM_DEPTH, input.width, input.height, RS2_FORMAT_Z16, input.framerate);
 	if(input.stream == INFRARED)
-		cfg.enable_stream(RS2_STREAM_INFRARED, input.width, input.height, RS2_FORMAT_Y8, input.framerate);
+		frame_source_enable_stream(source, RS2_STREAM_INFRARED, input.width, input.height, RS2_FORMAT_Y8, input.framerate);
 	else //INFRARED_RGB
-		cfg.enable_stream(RS2_STREAM_INFRARED, input.width, input.height, RS2_FORMAT_UYVY, input.framerate); // Note: Not supported on L515
+		frame_source_enable_stream(source, RS2_STREAM_INFRARED, input.width, input.height, RS2_FORMAT_UYVY, input.framerate); // Note: Not supported on L515
+
+	if(frame_source_start(source, input.depth_units) < 0)
+		return -1;
 
-	rs2::pipeline_profile profile = pipe.start(cfg);
+	//recorded or generated depth can't be set up on device, convert units and clamp in software
+	if(frame_source_live(source))
+		init_realsense_depth(frame_source_pipeline(source), frame_source_rs2_config(source), input);
+	else
+		input.needs_postprocessing = true;
+
+	print_intrinsics(frame_source_profile(source, RS2_STREAM_DEPTH));
 
-	init_realsense_depth(pipe, cfg, input);
-	
-	print_intrinsics(profile, RS2_STREAM_DEPTH);
+	return 0;
 }
 
 void init_realsense_depth(rs2::pipeline& pipe, const rs2::config &cfg, input_args& input)
@@ -246,6 +392,7 @@ void init_realsense_depth(rs2::pipeline& pipe, const rs2::config &cfg, input_arg
 	cout << "This will result in:" << endl;
 	cout << "-range " << input.depth_units * P010LE_MAX << " m" << endl;
 	cout << "-precision " << input.depth_units*64.0f << " m (" << input.depth_units*64.0f*1000 << " mm)" << endl;
+	cout << "-depth processing with " << depth_kernels_isa_name(depth_kernels_selected()) << " kernels" << endl;
 
 	bool supports_advanced_mode = depth_sensor.supports(RS2_CAMERA_INFO_ADVANCED_MODE);
 
@@ -268,10 +415,11 @@ void init_realsense_depth(rs2::pipeline& pipe, const rs2::config &cfg, input_arg
 	" range at " << input.depth_units * P010LE_MAX << " m" << endl;
 }
 
-void print_intrinsics(const rs2::pipeline_profile& profile, rs2_stream stream)
+void print_intrinsics(const rs2::stream_profile& profile)
 {
-	rs2::video_stream_profile stream_profile = profile.get_stream(stream).as<rs2::video_stream_profile>();
+	rs2::video_stream_profile stream_profile = profile.as<rs2::video_stream_profile>();
 	rs2_intrinsics i = stream_profile.get_intrinsics();
+	rs2_stream stream = profile.stream_type();
 
 	const float rad2deg = 180.0f / M_PI;
 	float hfov = 2 * atan(i.width / (2*i.fx)) * rad2deg;
@@ -286,6 +434,30 @@ void print_intrinsics(const rs2::pipeline_profile& profile, rs2_stream stream)
 
 int process_user_input(int argc, char* argv[], input_args* input, nhve_net_config *net_config, nhve_hw_config *hw_config)
 {
+	if(depth_conditioning_options(&argc, argv, &input->conditioning) < 0)
+		return -1;
+
+	if(frame_source_options(&argc, argv, &input->source) < 0 ||
+		frame_latency_options(&argc, argv) < 0)
+		return -1;
+
+	frame_clock_options(&argc, argv, &input->timestamps);
+
+	if(bitstream_recorder_options(&argc, argv, &input->record) < 0 ||
+		frame_recorder_options(&argc, argv, &input->record_frames) < 0 ||
+		bitrate_control_options(&argc, argv, &input->abr) < 0)
+		return -1;
+
+	input->parallel_encoders = option_flag(&argc, argv, "parallel-encoders");
+
+	const char *encoder = option_value(&argc, argv, "encoder");
+
+	if(encoder && !*encoder)
+	{
+		cerr << "invalid --encoder, expected FFmpeg encoder name e.g. hevc_vaapi, libx265" << endl;
+		return -1;
+	}
+
 	if(argc < 8)
 	{
 		cerr << "Usage: " << argv[0] << " <host> <port> <ir/ir-rgb> <width> <height> <framerate> <seconds> [device] [bitrate_depth] [bitrate_ir] [depth units] [json]" << endl;
@@ -301,6 +473,22 @@ int process_user_input(int argc, char* argv[], input_args* input, nhve_net_confi
 		cerr << argv[0] << " 192.168.0.100 9768 ir 848 480 30 500 /dev/dri/renderD128 8000000 1000000 0.0000125" << endl;
 		cerr << argv[0] << " 192.168.0.100 9768 ir-rgb 848 480 30 500 /dev/dri/renderD128 8000000 1000000 0.00003125" << endl;
 		cerr << argv[0] << " 192.168.0.100 9768 ir 640 480 30 500 /dev/dri/renderD128 8000000 1000000 0.0000390625 my_config.json" << endl;
+		cerr << argv[0] << " 192.168.0.100 9768 ir 848 480 30 500 /dev/dri/renderD128 --parallel-encoders" << endl;
+		cerr << argv[0] << " 127.0.0.1 9768 ir 848 480 30 50 /dev/dri/renderD128 --playback recording.bag" << endl;
+		cerr << argv[0] << " 127.0.0.1 9768 ir 848 480 30 50 /dev/dri/renderD128 --synthetic --fast --parallel-encoders" << endl;
+		cerr << argv[0] << " 127.0.0.1 9768 ir 848 480 30 50 --synthetic --fast --encoder libx265" << endl;
+
+		cerr << endl;
+		depth_conditioning_usage(cerr);
+		frame_source_usage(cerr);
+		frame_latency_usage(cerr);
+		frame_clock_usage(cerr);
+		bitstream_recorder_usage(cerr);
+		frame_recorder_usage(cerr);
+		bitrate_control_usage(cerr);
+		cerr << "encoder options:" << endl
+		     << "       --parallel-encoders # depth and infrared encoded at the same time, each in its own thread" << endl
+		     << "       --encoder <name> # FFmpeg encoder for both streams, default hevc_nvenc, software (e.g. libx265) without GPU" << endl;
 
 		return -1;
 	}
@@ -330,7 +518,7 @@ int process_user_input(int argc, char* argv[], input_args* input, nhve_net_confi
 	//DEPTH hardware encoding configuration
 	hw_config[DEPTH].profile = FF_PROFILE_HEVC_MAIN_10;
 	hw_config[DEPTH].pixel_format = "p010le";
-	hw_config[DEPTH].encoder = "hevc_nvenc";
+	hw_config[DEPTH].encoder = encoder ? encoder : "hevc_nvenc";
 	hw_config[DEPTH].width = input->width = atoi(argv[4]);
 	hw_config[DEPTH].height = input->height = atoi(argv[5]);
 	hw_config[DEPTH].framerate = input->framerate = atoi(argv[6]);
@@ -345,7 +533,7 @@ int process_user_input(int argc, char* argv[], input_args* input, nhve_net_confi
 	//INFRARED hardware encoding configuration
 	hw_config[IR].profile = FF_PROFILE_HEVC_MAIN;
 	hw_config[IR].pixel_format = (input->stream == INFRARED) ? "nv12" : "uyvy422";
-	hw_config[IR].encoder = "hevc_nvenc";
+	hw_config[IR].encoder = encoder ? encoder : "hevc_nvenc";
 	hw_config[IR].width = input->width = atoi(argv[4]);
 	hw_config[IR].height = input->height = atoi(argv[5]);
 	hw_config[IR].framerate = input->framerate = atoi(argv[6]);
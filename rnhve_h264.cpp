@@ -13,6 +13,24 @@
 // Network Hardware Video Encoder
 #include "nhve.h"
 
+// Software encoders (NHVE is hardware only)
+#include "parallel_encoder.h"
+#include "software_encoder.h"
+
+// Encoder input recording for replay
+#include "frame_recorder.h"
+
+// Adaptive bitrate from receiver feedback
+#include "bitrate_control.h"
+
+// Dummy color planes for NV12
+#include "chroma_plane.h"
+
+// Live camera, .bag playback or synthetic frames
+#include "frame_source.h"
+
+#include "options.h"
+
 // Realsense API
 #include <librealsense2/rs.hpp>
 
@@ -32,10 +50,17 @@ struct input_args
 	int framerate;
 	int seconds;
 	StreamType stream;
+	frame_source_config source;
+	bool timestamps; //presentation timestamps in aux channel
+	bitstream_recorder_config record;
+	const char *record_frames; //encoder input to file (--record-frames)
+	bitrate_control_config abr; //adaptive bitrate (--abr)
 };
 
-bool main_loop(const input_args& input, rs2::pipeline& realsense, nhve *streamer);
-void init_realsense(rs2::pipeline& pipe, const input_args& input);
+bool main_loop(const input_args& input, frame_source *realsense, nhve *streamer, parallel_encoder *pe, frame_recorder *recording, bitrate_control *abr);
+int send_frame(nhve *streamer, parallel_encoder *pe, const nhve_frame *frame);
+int send_timestamps(nhve *streamer, parallel_encoder *pe, uint32_t framenumber, const int64_t *pts_us, int subframes);
+int init_realsense(frame_source *source, const input_args& input);
 int process_user_input(int argc, char* argv[], input_args* input, nhve_net_config *net_config, nhve_hw_config *hw_config);
 
 int main(int argc, char* argv[])
@@ -45,23 +70,106 @@ int main(int argc, char* argv[])
 	//prepare NHVE Network Hardware Video Encoder
 	struct nhve_net_config net_config = {0};
 	struct nhve_hw_config hw_config = {0};
-	struct nhve *streamer;
+	struct nhve *streamer = NULL;
+	struct parallel_encoder *pe = NULL;
+	struct bitstream_recorder *recorder = NULL;
+	struct frame_recorder *recording = NULL;
+	struct bitrate_control *abr = NULL;
 
 	struct input_args user_input = {0};
 
-	rs2::pipeline realsense;
+	struct frame_source *realsense;
 
 	if(process_user_input(argc, argv, &user_input, &net_config, &hw_config) < 0)
 		return 1;
 
-	init_realsense(realsense, user_input);
+	if( (realsense = frame_source_init(&user_input.source)) == NULL )
+		return 1;
 
-	if( (streamer = nhve_init(&net_config, &hw_config, 1, 0)) == NULL )
+	if(init_realsense(realsense, user_input) < 0)
+	{
+		frame_source_close(realsense);
+		return 1;
+	}
+
+	if(user_input.record_frames)
+	{
+		const rs2_stream stream = (user_input.stream == COLOR) ? RS2_STREAM_COLOR : RS2_STREAM_INFRARED;
+		const rs2_intrinsics intrinsics = frame_source_profile(realsense, stream).as<rs2::video_stream_profile>().get_intrinsics();
+		frame_recording_stream streams[1];
+
+		if(frame_recording_stream_init(&streams[0], hw_config, &intrinsics, 0.0f) < 0)
+		{
+			frame_source_close(realsense);
+			return 1;
+		}
+
+		if( (recording = frame_recorder_init(user_input.record_frames, streams, 1, user_input.seconds * user_input.framerate)) == NULL )
+		{
+			frame_source_close(realsense);
+			return 1;
+		}
+	}
+
+	//software encoders, recording (encoded packets) and adaptive bitrate need parallel encoder
+	if(software_encoder_is_software(hw_config.encoder) || user_input.record.prefix || user_input.abr.port)
+		pe = parallel_encoder_init(&net_config, &hw_config, 1, user_input.timestamps ? 1 : 0);
+	else
+		streamer = nhve_init(&net_config, &hw_config, 1, user_input.timestamps ? 1 : 0);
+
+	if(!pe && !streamer)
+	{
+		frame_recorder_close(recording);
+		frame_source_close(realsense);
 		return hint_user_on_failure(argv);
+	}
+
+	if(user_input.record.prefix)
+	{
+		const recorder_codec codec = bitstream_recorder_codec(hw_config.encoder);
+
+		if( (recorder = bitstream_recorder_init(user_input.record, &codec, 1)) == NULL )
+		{
+			parallel_encoder_close(pe);
+			frame_recorder_close(recording);
+			frame_source_close(realsense);
+			return 1;
+		}
+
+		parallel_encoder_record(pe, recorder);
+	}
+
+	if(user_input.abr.port)
+	{
+		const int bitrates[1] = { hw_config.bit_rate };
+
+		if( (abr = bitrate_control_init(user_input.abr, bitrates, 1)) == NULL )
+		{
+			parallel_encoder_close(pe);
+			bitstream_recorder_close(recorder);
+			frame_recorder_close(recording);
+			frame_source_close(realsense);
+			return 1;
+		}
+	}
+
+	bool status=main_loop(user_input, realsense, streamer, pe, recording, abr);
 
-	bool status=main_loop(user_input, realsense, streamer);
+	frame_latency_report(cout);
+	frame_source_clock_report(cout, realsense);
+	if(recorder)
+		bitstream_recorder_report(cout, recorder);
+	if(abr)
+		bitrate_control_report(cout, abr);
 
-	nhve_close(streamer);
+	if(streamer)
+		nhve_close(streamer);
+	parallel_encoder_close(pe);
+	bitstream_recorder_close(recorder);
+	bitrate_control_close(abr);
+	frame_recorder_close(recording);
+	frame_source_close(realsense);
+	neutral_chroma_planes_release();
 
 	if(status)
 		cout << "Finished successfully." << endl;
@@ -69,67 +177,126 @@ int main(int argc, char* argv[])
 	return 0;
 }
 
+//NULL to flush, software encoder if pe is set
+int send_frame(nhve *streamer, parallel_encoder *pe, const nhve_frame *frame)
+{
+	return pe ? parallel_encoder_send(pe, frame, 0) : nhve_send(streamer, frame, 0);
+}
+
+//presentation timestamps of the frame in aux subframe after the video ones
+int send_timestamps(nhve *streamer, parallel_encoder *pe, uint32_t framenumber, const int64_t *pts_us, int subframes)
+{
+	uint8_t record[FRAME_TIMESTAMPS_SIZE(FRAME_TIMESTAMPS_MAX)];
+	const int size = frame_timestamps_pack(framenumber, pts_us, subframes, record);
+
+	if(pe)
+		return parallel_encoder_send_aux(pe, record, size, subframes, framenumber);
+
+	nhve_frame frame = {0};
+	frame.data[0] = record;
+	frame.linesize[0] = size;
+
+	return nhve_send(streamer, &frame, subframes);
+}
+
 //true on success, false on failure
-bool main_loop(const input_args& input, rs2::pipeline& realsense, nhve *streamer)
+bool main_loop(const input_args& input, frame_source *realsense, nhve *streamer, parallel_encoder *pe, frame_recorder *recording, bitrate_control *abr)
 {
 	const int frames = input.seconds * input.framerate;
 	int f;
 	nhve_frame frame = {0};
-	uint8_t *color_data = NULL; //data of dummy color plane for NV12 with Realsense infrared
+	frame_latency latency;
+
+	//dummy color plane for NV12 with Realsense infrared, Y8 stride is width
+	//prepared before the first frame, looked up again only if Realsense stride differs
+	neutral_chroma_stream ir_uv = {CHROMA_NV12, 0, 0, NULL};
+
+	if(input.stream == INFRARED && !neutral_chroma_stream_init(&ir_uv, CHROMA_NV12, input.width, input.height))
+	{
+		cerr << "failed to prepare neutral chroma plane" << endl;
+		return false;
+	}
 
 	for(f = 0; f < frames; ++f)
 	{
-		rs2::frameset frameset = realsense.wait_for_frames();
+		rs2::frameset frameset = frame_source_wait(realsense, &latency);
 
 		rs2::video_frame video_frame = (input.stream == COLOR) ? frameset.get_color_frame() : frameset.get_infrared_frame(0);
-
-		if(input.stream == INFRARED && !color_data)
-		{  //prepare dummy color plane for NV12 format, half the size of Y
-		   //we can't alloc it in advance, this is the first time we know realsense stride
-			int size = video_frame.get_stride_in_bytes()*video_frame.get_height()/2;
-			color_data = new uint8_t[size];
-			memset(color_data, 128, size);
-		}
+		const int64_t pts = frame_source_pts(realsense, video_frame, &latency);
 
 		frame.linesize[0] =  video_frame.get_stride_in_bytes();
 		frame.data[0] = (uint8_t*) video_frame.get_data();
 
 		//if we are streaming infrared we have 2 planes (luminance and color)
 		frame.linesize[1] = (input.stream == INFRARED) ? frame.linesize[0] : 0;
-		frame.data[1] = color_data; //dummy color plane for infrared
+		frame.data[1] = (input.stream == INFRARED) ? //dummy color plane for infrared
+			(uint8_t*) neutral_chroma_stream_plane(&ir_uv, frame.linesize[0], video_frame.get_height()) : NULL;
+
+		if(recording && frame_recorder_write(recording, f, 0, &frame, pts) < 0)
+			break;
+
+		frame_latency_stamp(&latency, LATENCY_SUBMITTED);
 
-		if(nhve_send(streamer, &frame, 0) != NHVE_OK)
+		if(send_frame(streamer, pe, &frame) != NHVE_OK)
 		{
 			cerr << "failed to send" << endl;
 			break;
 		}
+
+		frame_latency_stamp(&latency, LATENCY_ENCODED);
+		frame_latency_record(&latency);
+
+		if(abr && bitrate_control_poll(abr))
+			parallel_encoder_set_bitrate(pe, 0, bitrate_control_target(abr, 0));
+
+		if(input.timestamps && send_timestamps(streamer, pe, f, &pts, 1) != NHVE_OK)
+		{
+			cerr << "failed to send timestamps" << endl;
+			break;
+		}
 	}
 
 	//flush the streamer by sending NULL frame
-	nhve_send(streamer, NULL, 0);
-
-	delete [] color_data;
+	send_frame(streamer, pe, NULL);
 
 	//all the requested frames processed?
 	return f==frames;
 }
 
-void init_realsense(rs2::pipeline& pipe, const input_args& input)
+//0 on success, -1 on failure
+int init_realsense(frame_source *source, const input_args& input)
 {
-	rs2::config cfg;
-
 	if(input.stream == COLOR)
-		cfg.enable_stream(RS2_STREAM_COLOR, input.width, input.height, RS2_FORMAT_RGBA8, input.framerate);
+		frame_source_enable_stream(source, RS2_STREAM_COLOR, input.width, input.height, RS2_FORMAT_RGBA8, input.framerate);
 	else if(input.stream == INFRARED)
-		cfg.enable_stream(RS2_STREAM_INFRARED, input.width, input.height, RS2_FORMAT_Y8, input.framerate);
+		frame_source_enable_stream(source, RS2_STREAM_INFRARED, input.width, input.height, RS2_FORMAT_Y8, input.framerate);
 	else //INFRARED_RGB
-		cfg.enable_stream(RS2_STREAM_INFRARED, input.width, input.height, RS2_FORMAT_UYVY, input.framerate); // Note: not supported on L515, Y8 only
+		frame_source_enable_stream(source, RS2_STREAM_INFRARED, input.width, input.height, RS2_FORMAT_UYVY, input.framerate); // Note: not supported on L515, Y8 only
 
-	rs2::pipeline_profile profile = pipe.start(cfg);
+	return frame_source_start(source, 0.001f); //depth units are not used without depth stream
 }
 
 int process_user_input(int argc, char* argv[], input_args* input, nhve_net_config *net_config, nhve_hw_config *hw_config)
 {
+	if(frame_source_options(&argc, argv, &input->source) < 0 ||
+		frame_latency_options(&argc, argv) < 0)
+		return -1;
+
+	frame_clock_options(&argc, argv, &input->timestamps);
+
+	if(bitstream_recorder_options(&argc, argv, &input->record) < 0 ||
+		frame_recorder_options(&argc, argv, &input->record_frames) < 0 ||
+		bitrate_control_options(&argc, argv, &input->abr) < 0)
+		return -1;
+
+	const char *encoder = option_value(&argc, argv, "encoder");
+
+	if(encoder && !*encoder)
+	{
+		cerr << "invalid --encoder, expected FFmpeg encoder name e.g. h264_vaapi, libx264" << endl;
+		return -1;
+	}
+
 	if(argc < 8)
 	{
 		cerr << "Usage: " << argv[0] << " <host> <port> <color/ir/ir-rgb> <width> <height> <framerate> <seconds> [device] [bitrate]" << endl;
@@ -141,6 +308,19 @@ int process_user_input(int argc, char* argv[], input_args* input, nhve_net_confi
 		cerr << argv[0] << " 127.0.0.1 9766 ir 640 360 30 5 /dev/dri/renderD128" << endl;
 		cerr << argv[0] << " 127.0.0.1 9766 ir-rgb 640 360 30 5 /dev/dri/renderD128" << endl;
 		cerr << argv[0] << " 192.168.0.125 9766 color 640 360 30 50 /dev/dri/renderD128 500000" << endl;
+		cerr << argv[0] << " 127.0.0.1 9766 ir 640 360 30 5 /dev/dri/renderD128 --playback recording.bag" << endl;
+		cerr << argv[0] << " 127.0.0.1 9766 color 640 360 30 5 /dev/dri/renderD128 --synthetic --fast" << endl;
+		cerr << argv[0] << " 127.0.0.1 9766 ir 640 360 30 5 --synthetic --fast --encoder libx264" << endl;
+
+		cerr << endl;
+		frame_source_usage(cerr);
+		frame_latency_usage(cerr);
+		frame_clock_usage(cerr);
+		bitstream_recorder_usage(cerr);
+		frame_recorder_usage(cerr);
+		bitrate_control_usage(cerr);
+		cerr << "encoder options:" << endl
+		     << "       --encoder <name> # FFmpeg encoder, default h264_nvenc, software (e.g. libx264) without GPU" << endl;
 
 		return -1;
 	}
@@ -174,7 +354,7 @@ int process_user_input(int argc, char* argv[], input_args* input, nhve_net_confi
 	else if(input->stream == INFRARED_RGB)
 		hw_config->pixel_format = "uyvy422";
 
-	hw_config->encoder = "h264_nvenc";
+	hw_config->encoder = encoder ? encoder : "h264_nvenc";
 	hw_config->width = input->width = atoi(argv[4]);
 	hw_config->height = input->height = atoi(argv[5]);
 	hw_config->framerate = input->framerate = atoi(argv[6]);
@@ -16,6 +16,27 @@
 // Network Hardware Video Encoder
 #include "nhve.h"
 
+// Software encoders (NHVE is hardware only)
+#include "parallel_encoder.h"
+#include "software_encoder.h"
+
+// Encoder input recording for replay
+#include "frame_recorder.h"
+
+// Adaptive bitrate from receiver feedback
+#include "bitrate_control.h"
+
+// Depth conditioning (unit conversion, thresholds, slicing)
+#include "depth_conditioning.h"
+
+// Dummy color planes for NV12/P010LE
+#include "chroma_plane.h"
+
+// Live camera, .bag playback or synthetic frames
+#include "frame_source.h"
+
+#include "options.h"
+
 // Realsense API
 #include <librealsense2/rs.hpp>
 #include <librealsense2/rs_advanced_mode.hpp>
@@ -41,15 +62,23 @@ struct input_args
 	StreamType stream;
 	std::string json;
 	bool needs_postprocessing;
+	depth_conditioning_config conditioning;
+	frame_source_config source;
+	bool timestamps; //presentation timestamps in aux channel
+	bitstream_recorder_config record;
+	const char *record_frames; //encoder input to file (--record-frames)
+	bitrate_control_config abr; //adaptive bitrate (--abr)
 };
 
-bool main_loop_color_infrared(const input_args& input, rs2::pipeline& realsense, nhve *streamer);
-bool main_loop_depth(const input_args& input, rs2::pipeline& realsense, nhve *streamer);
+bool main_loop_color_infrared(const input_args& input, frame_source *realsense, nhve *streamer, parallel_encoder *pe, frame_recorder *recording, bitrate_control *abr);
+bool main_loop_depth(const input_args& input, frame_source *realsense, nhve *streamer, parallel_encoder *pe, frame_recorder *recording, bitrate_control *abr);
+int send_frame(nhve *streamer, parallel_encoder *pe, const nhve_frame *frame);
+int send_timestamps(nhve *streamer, parallel_encoder *pe, uint32_t framenumber, const int64_t *pts_us, int subframes);
 void process_depth_data(const input_args &input, rs2::depth_frame &depth);
 
-void init_realsense(rs2::pipeline& pipe, input_args& input);
+int init_realsense(frame_source *source, input_args& input);
 void init_realsense_depth(rs2::pipeline& pipe, const rs2::config &cfg, input_args& input);
-void print_intrinsics(const rs2::pipeline_profile& profile, rs2_stream stream);
+void print_intrinsics(const rs2::stream_profile& profile);
 
 int process_user_input(int argc, char* argv[], input_args* input, nhve_net_config *net_config, nhve_hw_config *hw_config);
 
@@ -57,49 +86,113 @@ const uint16_t P010LE_MAX = 0xFFC0; //in binary 10 ones followed by 6 zeroes
 
 int main(int argc, char* argv[])
 {
-	//prepare file for raw encoded output
-	FILE* output_file = fopen("output", "w+b");
-
-	if (output_file == NULL)
-	{
-		fprintf(stderr, "unable to open file for output\n");
-		return 3;
-	}
-
 	//nhve_hw_config {WIDTH, HEIGHT, FRAMERATE, DEVICE, ENCODER, PIXEL_FORMAT, PROFILE, BFRAMES, BITRATE, QP, GOP_SIZE};
 	//prepare NHVE Network Hardware Video Encoder
 	struct nhve_net_config net_config = {0};
 	struct nhve_hw_config hw_config = {0};
-	struct nhve *streamer;
+	struct nhve *streamer = NULL;
+	struct parallel_encoder *pe = NULL;
+	struct bitstream_recorder *recorder = NULL;
+	struct frame_recorder *recording = NULL;
+	struct bitrate_control *abr = NULL;
 
 	struct input_args user_input = {0};
 	user_input.depth_units=0.0001f; //optionally override with user input
 
-	rs2::pipeline realsense;
+	struct frame_source *realsense = NULL;
 
-	if (process_user_input(argc, argv, &user_input, &net_config, &hw_config) < 0)
+	if (process_user_input(argc, argv, &user_input, &net_config, &hw_config) < 0 ||
+		(realsense = frame_source_init(&user_input.source)) == NULL ||
+		init_realsense(realsense, user_input) < 0)
 	{
-		fclose(output_file);
+		frame_source_close(realsense);
 		return 1;
 	}
 
-	init_realsense(realsense, user_input);
+	if(user_input.record_frames)
+	{
+		const bool depth = user_input.stream == DEPTH;
+		const rs2_stream stream = depth ? RS2_STREAM_DEPTH : (user_input.stream == COLOR) ? RS2_STREAM_COLOR : RS2_STREAM_INFRARED;
+		const rs2_intrinsics intrinsics = frame_source_profile(realsense, stream).as<rs2::video_stream_profile>().get_intrinsics();
+		frame_recording_stream streams[1];
 
-	if ((streamer = nhve_init(&net_config, &hw_config, 1, 0)) == NULL)
+		if(frame_recording_stream_init(&streams[0], hw_config, &intrinsics, depth ? user_input.depth_units : 0.0f) < 0)
+		{
+			frame_source_close(realsense);
+			return 1;
+		}
+
+		if( (recording = frame_recorder_init(user_input.record_frames, streams, 1, user_input.seconds * user_input.framerate)) == NULL )
+		{
+			frame_source_close(realsense);
+			return 1;
+		}
+	}
+
+	//software encoders, recording (encoded packets) and adaptive bitrate need parallel encoder
+	if (software_encoder_is_software(hw_config.encoder) || user_input.record.prefix || user_input.abr.port)
+		pe = parallel_encoder_init(&net_config, &hw_config, 1, user_input.timestamps ? 1 : 0);
+	else
+		streamer = nhve_init(&net_config, &hw_config, 1, user_input.timestamps ? 1 : 0);
+
+	if (!pe && !streamer)
 	{
-		fclose(output_file);
+		frame_recorder_close(recording);
+		frame_source_close(realsense);
 		return hint_user_on_failure(argv);
 	}
 
+	if(user_input.record.prefix)
+	{
+		const recorder_codec codec = bitstream_recorder_codec(hw_config.encoder);
+
+		if( (recorder = bitstream_recorder_init(user_input.record, &codec, 1)) == NULL )
+		{
+			parallel_encoder_close(pe);
+			frame_recorder_close(recording);
+			frame_source_close(realsense);
+			return 1;
+		}
+
+		parallel_encoder_record(pe, recorder);
+	}
+
+	if(user_input.abr.port)
+	{
+		const int bitrates[1] = { hw_config.bit_rate };
+
+		if( (abr = bitrate_control_init(user_input.abr, bitrates, 1)) == NULL )
+		{
+			parallel_encoder_close(pe);
+			bitstream_recorder_close(recorder);
+			frame_recorder_close(recording);
+			frame_source_close(realsense);
+			return 1;
+		}
+	}
+
 	bool status = false;
 
 	if(user_input.stream == DEPTH)
-		status = main_loop_depth(user_input, realsense, streamer);
+		status = main_loop_depth(user_input, realsense, streamer, pe, recording, abr);
 	else //color, infrared, infrared rgb
-		status = main_loop_color_infrared(user_input, realsense, streamer);
-
-	nhve_close(streamer);
-	fclose(output_file);
+		status = main_loop_color_infrared(user_input, realsense, streamer, pe, recording, abr);
+
+	frame_latency_report(cout);
+	frame_source_clock_report(cout, realsense);
+	if(recorder)
+		bitstream_recorder_report(cout, recorder);
+	if(abr)
+		bitrate_control_report(cout, abr);
+
+	if(streamer)
+		nhve_close(streamer);
+	parallel_encoder_close(pe);
+	bitstream_recorder_close(recorder);
+	bitrate_control_close(abr);
+	frame_recorder_close(recording);
+	frame_source_close(realsense);
+	neutral_chroma_planes_release();
 
 	if(status)
 		cout << "Finished successfully." << endl;
@@ -107,100 +200,158 @@ int main(int argc, char* argv[])
 	return 0;
 }
 
+//NULL to flush, software encoder if pe is set
+int send_frame(nhve *streamer, parallel_encoder *pe, const nhve_frame *frame)
+{
+	return pe ? parallel_encoder_send(pe, frame, 0) : nhve_send(streamer, frame, 0);
+}
+
+//presentation timestamps of the frame in aux subframe after the video ones
+int send_timestamps(nhve *streamer, parallel_encoder *pe, uint32_t framenumber, const int64_t *pts_us, int subframes)
+{
+	uint8_t record[FRAME_TIMESTAMPS_SIZE(FRAME_TIMESTAMPS_MAX)];
+	const int size = frame_timestamps_pack(framenumber, pts_us, subframes, record);
+
+	if(pe)
+		return parallel_encoder_send_aux(pe, record, size, subframes, framenumber);
+
+	nhve_frame frame = {0};
+	frame.data[0] = record;
+	frame.linesize[0] = size;
+
+	return nhve_send(streamer, &frame, subframes);
+}
+
 //true on success, false on failure
-bool main_loop_color_infrared(const input_args& input, rs2::pipeline& realsense, nhve *streamer)
+bool main_loop_color_infrared(const input_args& input, frame_source *realsense, nhve *streamer, parallel_encoder *pe, frame_recorder *recording, bitrate_control *abr)
 {
 	const int frames = input.seconds * input.framerate;
 	int f;
 	nhve_frame frame = {0};
-	uint8_t *color_data = NULL; //data of dummy color plane for NV12 with Realsense infrared
+	frame_latency latency;
+
+	//dummy color plane for NV12 with Realsense infrared, Y8 stride is width
+	//prepared before the first frame, looked up again only if Realsense stride differs
+	neutral_chroma_stream ir_uv = {CHROMA_NV12, 0, 0, NULL};
+
+	if(input.stream == INFRARED && !neutral_chroma_stream_init(&ir_uv, CHROMA_NV12, input.width, input.height))
+	{
+		cerr << "failed to prepare neutral chroma plane" << endl;
+		return false;
+	}
 
 	for(f = 0; f < frames; ++f)
 	{
-		rs2::frameset frameset = realsense.wait_for_frames();
+		rs2::frameset frameset = frame_source_wait(realsense, &latency);
 
 		rs2::video_frame video_frame = (input.stream == COLOR) ? frameset.get_color_frame() : frameset.get_infrared_frame(0);
-
-		if(input.stream == INFRARED && !color_data)
-		{  //prepare dummy color plane for NV12 format, half the size of Y
-		   //we can't alloc it in advance, this is the first time we know realsense stride
-			int size = video_frame.get_stride_in_bytes()*video_frame.get_height()/2;
-			cout << "stride in bytes: " << video_frame.get_stride_in_bytes() << endl;
-			cout << "height: " << video_frame.get_height() << endl;
-			cout << "dummy data size: " << size << endl;
-			color_data = new uint8_t[size];
-			memset(color_data, 128, size);
-		}
+		const int64_t pts = frame_source_pts(realsense, video_frame, &latency);
 
 		frame.linesize[0] =  video_frame.get_stride_in_bytes();
 		frame.data[0] = (uint8_t*) video_frame.get_data();
 
 		//if we are streaming infrared we have 2 planes (luminance and dummy color)
 		frame.linesize[1] = (input.stream == INFRARED) ? frame.linesize[0] : 0;
-		frame.data[1] = color_data; //dummy color plane for infrared
+		frame.data[1] = (input.stream == INFRARED) ? //dummy color plane for infrared
+			(uint8_t*) neutral_chroma_stream_plane(&ir_uv, frame.linesize[0], video_frame.get_height()) : NULL;
+
+		if(recording && frame_recorder_write(recording, f, 0, &frame, pts) < 0)
+			break;
 
-		if(nhve_send(streamer, &frame, 0) != NHVE_OK)
+		frame_latency_stamp(&latency, LATENCY_SUBMITTED);
+
+		if(send_frame(streamer, pe, &frame) != NHVE_OK)
 		{
 			cerr << "failed to send" << endl;
 			break;
 		}
+
+		frame_latency_stamp(&latency, LATENCY_ENCODED);
+		frame_latency_record(&latency);
+
+		if(abr && bitrate_control_poll(abr))
+			parallel_encoder_set_bitrate(pe, 0, bitrate_control_target(abr, 0));
+
+		if(input.timestamps && send_timestamps(streamer, pe, f, &pts, 1) != NHVE_OK)
+		{
+			cerr << "failed to send timestamps" << endl;
+			break;
+		}
 	}
 
 	//flush the streamer by sending NULL frame
-	nhve_send(streamer, NULL, 0);
-
-	delete [] color_data;
+	send_frame(streamer, pe, NULL);
 
 	//all the requested frames processed?
 	return f==frames;
 }
 
 //true on success, false on failure
-bool main_loop_depth(const input_args& input, rs2::pipeline& realsense, nhve *streamer)
+bool main_loop_depth(const input_args& input, frame_source *realsense, nhve *streamer, parallel_encoder *pe, frame_recorder *recording, bitrate_control *abr)
 {
 	const int frames = input.seconds * input.framerate;
 	int f;
 	nhve_frame frame = {0};
-	uint16_t *color_data = NULL; //data of dummy color plane for P010LE
+	frame_latency latency;
+
+	//dummy color plane for P010LE, Realsense Z16 stride is width * 2
+	//prepared before the first frame, looked up again only if Realsense stride differs
+	neutral_chroma_stream depth_uv;
+
+	if(!neutral_chroma_stream_init(&depth_uv, CHROMA_P010LE, input.width * 2, input.height))
+	{
+		cerr << "failed to prepare neutral chroma plane" << endl;
+		return false;
+	}
 
 	for(f = 0; f < frames; ++f)
 	{
-		rs2::frameset frameset = realsense.wait_for_frames();
+		rs2::frameset frameset = frame_source_wait(realsense, &latency);
 		rs2::depth_frame depth = frameset.get_depth_frame();
+		const int64_t pts = frame_source_pts(realsense, depth, &latency);
 
-		const int w = depth.get_width();
 		const int h = depth.get_height();
 		const int stride=depth.get_stride_in_bytes();
 
 		//L515 doesn't support setting depth units and clamping
-		if(input.needs_postprocessing)
+		//optional thresholds and slicing are done in the same pass
+		if(depth_conditioning_needed(input.conditioning, input.needs_postprocessing))
+		{
 			process_depth_data(input, depth);
-
-		if(!color_data)
-		{  //prepare dummy color plane for P010LE format, half the size of Y
-			//we can't alloc it in advance, this is the first time we know realsense stride
-			//the stride will be at least width * 2 (Realsense Z16, VAAPI P010LE)
-			color_data = new uint16_t[stride/2*h/2];
-			for(int i=0;i<w*h/2;++i)
-				color_data[i] = UINT16_MAX / 2; //dummy middle value for U/V, equals 128 << 8, equals 32768
+			frame_latency_stamp(&latency, LATENCY_CONDITIONED);
 		}
 
 		//supply realsense frame data as ffmpeg frame data
 		frame.linesize[0] = frame.linesize[1] =  stride; //the stride of Y and interleaved UV is equal
 		frame.data[0] = (uint8_t*) depth.get_data();
-		frame.data[1] = (uint8_t*) color_data;
+		frame.data[1] = (uint8_t*) neutral_chroma_stream_plane(&depth_uv, stride, h);
+
+		if(recording && frame_recorder_write(recording, f, 0, &frame, pts) < 0)
+			break;
+
+		frame_latency_stamp(&latency, LATENCY_SUBMITTED);
 
-		if(nhve_send(streamer, &frame, 0) != NHVE_OK)
+		if(send_frame(streamer, pe, &frame) != NHVE_OK)
 		{
 			cerr << "failed to send" << endl;
 			break;
 		}
+
+		frame_latency_stamp(&latency, LATENCY_ENCODED);
+		frame_latency_record(&latency);
+
+		if(abr && bitrate_control_poll(abr))
+			parallel_encoder_set_bitrate(pe, 0, bitrate_control_target(abr, 0));
+
+		if(input.timestamps && send_timestamps(streamer, pe, f, &pts, 1) != NHVE_OK)
+		{
+			cerr << "failed to send timestamps" << endl;
+			break;
+		}
 	}
 
 	//flush the streamer by sending NULL frame
-	nhve_send(streamer, NULL, 0);
-
-	delete [] color_data;
+	send_frame(streamer, pe, NULL);
 
 	//all the requested frames processed?
 	return f==frames;
@@ -208,43 +359,40 @@ bool main_loop_depth(const input_args& input, rs2::pipeline& realsense, nhve *st
 
 void process_depth_data(const input_args &input, rs2::depth_frame &depth)
 {
-	const int half_stride = depth.get_stride_in_bytes()/2;
-	const int height = depth.get_height();
-
-	const float depth_units_set = depth.get_units();
-	const float multiplier = depth_units_set / input.depth_units;
-
 	//note - we process data in place rather than making a copy
 	uint16_t* data = (uint16_t*)depth.get_data();
 
-	for(int i = 0;i < half_stride * height; ++i)
-	{
-		uint32_t val = data[i] * multiplier;
-		data[i] = val <= P010LE_MAX ? val : 0;
-	}
+	depth_conditioning_process(input.conditioning, data, depth.get_width(), depth.get_height(), depth.get_stride_in_bytes(),
+		depth.get_units(), input.depth_units, input.needs_postprocessing);
 }
 
-void init_realsense(rs2::pipeline& pipe, input_args& input)
+//0 on success, -1 on failure
+int init_realsense(frame_source *source, input_args& input)
 {
-	rs2::config cfg;
-
 	if(input.stream == COLOR)
-		cfg.enable_stream(RS2_STREAM_COLOR, input.width, input.height, RS2_FORMAT_RGBA8, input.framerate);
+		frame_source_enable_stream(source, RS2_STREAM_COLOR, input.width, input.height, RS2_FORMAT_RGBA8, input.framerate);
 	else if(input.stream == INFRARED)
-		cfg.enable_stream(RS2_STREAM_INFRARED, input.width, input.height, RS2_FORMAT_Y8, input.framerate);
+		frame_source_enable_stream(source, RS2_STREAM_INFRARED, input.width, input.height, RS2_FORMAT_Y8, input.framerate);
 	else if(input.stream == INFRARED_RGB)
-		cfg.enable_stream(RS2_STREAM_INFRARED, input.width, input.height, RS2_FORMAT_UYVY, input.framerate); // Note: Not support on L515, Y8 only
+		frame_source_enable_stream(source, RS2_STREAM_INFRARED, input.width, input.height, RS2_FORMAT_UYVY, input.framerate); // Note: Not support on L515, Y8 only
 	else if(input.stream == DEPTH)
-		cfg.enable_stream(RS2_STREAM_DEPTH, input.width, input.height, RS2_FORMAT_Z16, input.framerate);
+		frame_source_enable_stream(source, RS2_STREAM_DEPTH, input.width, input.height, RS2_FORMAT_Z16, input.framerate);
 
-	rs2::pipeline_profile profile = pipe.start(cfg);
+	if(frame_source_start(source, input.depth_units) < 0)
+		return -1;
 
 	if(input.stream != DEPTH)
-		return;
+		return 0;
+
+	//recorded or generated depth can't be set up on device, convert units and clamp in software
+	if(frame_source_live(source))
+		init_realsense_depth(frame_source_pipeline(source), frame_source_rs2_config(source), input);
+	else
+		input.needs_postprocessing = true;
 
-	init_realsense_depth(pipe, cfg, input);
-	
-	print_intrinsics(profile, RS2_STREAM_DEPTH);
+	print_intrinsics(frame_source_profile(source, RS2_STREAM_DEPTH));
+
+	return 0;
 }
 
 void init_realsense_depth(rs2::pipeline& pipe, const rs2::config &cfg, input_args& input)
@@ -292,6 +440,7 @@ void init_realsense_depth(rs2::pipeline& pipe, const rs2::config &cfg, input_arg
 	cout << "This will result in:" << endl;
 	cout << "-range " << input.depth_units * P010LE_MAX << " m" << endl;
 	cout << "-precision " << input.depth_units*64.0f << " m (" << input.depth_units*64.0f*1000 << " mm)" << endl;
+	cout << "-depth processing with " << depth_kernels_isa_name(depth_kernels_selected()) << " kernels" << endl;
 
 	bool supports_advanced_mode = depth_sensor.supports(RS2_CAMERA_INFO_ADVANCED_MODE);
 
@@ -313,10 +462,11 @@ void init_realsense_depth(rs2::pipeline& pipe, const rs2::config &cfg, input_arg
 	" range at " << input.depth_units * P010LE_MAX << " m" << endl;
 }
 
-void print_intrinsics(const rs2::pipeline_profile& profile, rs2_stream stream)
+void print_intrinsics(const rs2::stream_profile& profile)
 {
-	rs2::video_stream_profile stream_profile = profile.get_stream(stream).as<rs2::video_stream_profile>();
+	rs2::video_stream_profile stream_profile = profile.as<rs2::video_stream_profile>();
 	rs2_intrinsics i = stream_profile.get_intrinsics();
+	rs2_stream stream = profile.stream_type();
 
 	const float rad2deg = 180.0f / M_PI;
 	float hfov = 2 * atan(i.width / (2*i.fx)) * rad2deg;
@@ -331,6 +481,26 @@ void print_intrinsics(const rs2::pipeline_profile& profile, rs2_stream stream)
 
 int process_user_input(int argc, char* argv[], input_args* input, nhve_net_config *net_config, nhve_hw_config *hw_config)
 {
+	if(depth_conditioning_options(&argc, argv, &input->conditioning) < 0 ||
+		frame_source_options(&argc, argv, &input->source) < 0 ||
+		frame_latency_options(&argc, argv) < 0)
+		return -1;
+
+	frame_clock_options(&argc, argv, &input->timestamps);
+
+	if(bitstream_recorder_options(&argc, argv, &input->record) < 0 ||
+		frame_recorder_options(&argc, argv, &input->record_frames) < 0 ||
+		bitrate_control_options(&argc, argv, &input->abr) < 0)
+		return -1;
+
+	const char *encoder = option_value(&argc, argv, "encoder");
+
+	if(encoder && !*encoder)
+	{
+		cerr << "invalid --encoder, expected FFmpeg encoder name e.g. hevc_vaapi, libx265" << endl;
+		return -1;
+	}
+
 	if(argc < 8)
 	{
 		cerr << "Usage: " << argv[0] << " <host> <port> <color/ir/ir-rgb/depth> <width> <height> <framerate> <seconds> [device] [bitrate] [depth units] [json]" << endl;
@@ -350,6 +520,20 @@ int process_user_input(int argc, char* argv[], input_args* input, nhve_net_confi
 		cerr << argv[0] << " 192.168.0.100 9768 depth 848 480 30 500 /dev/dri/renderD128 2000000 0.000025" << endl;
 		cerr << argv[0] << " 192.168.0.100 9768 depth 848 480 30 500 /dev/dri/renderD128 2000000 0.0000125" << endl;
 		cerr << argv[0] << " 192.168.0.100 9768 depth 640 480 30 500 /dev/dri/renderD128 8000000 0.0000390625 my_config.json" << endl;
+		cerr << argv[0] << " 127.0.0.1 9768 depth 848 480 30 50 /dev/dri/renderD128 2000000 --playback recording.bag" << endl;
+		cerr << argv[0] << " 127.0.0.1 9768 depth 848 480 30 50 /dev/dri/renderD128 2000000 --synthetic --fast" << endl;
+		cerr << argv[0] << " 127.0.0.1 9768 depth 848 480 30 50 --synthetic --fast --encoder libx265" << endl;
+
+		cerr << endl;
+		depth_conditioning_usage(cerr);
+		frame_source_usage(cerr);
+		frame_latency_usage(cerr);
+		frame_clock_usage(cerr);
+		bitstream_recorder_usage(cerr);
+		frame_recorder_usage(cerr);
+		bitrate_control_usage(cerr);
+		cerr << "encoder options:" << endl
+		     << "       --encoder <name> # FFmpeg encoder, default hevc_nvenc, software (e.g. libx265) without GPU" << endl;
 
 		return -1;
 	}
@@ -404,7 +588,7 @@ int process_user_input(int argc, char* argv[], input_args* input, nhve_net_confi
 		hw_config->profile = FF_PROFILE_HEVC_MAIN_10;
 	}
 
-	hw_config->encoder = "hevc_nvenc";
+	hw_config->encoder = encoder ? encoder : "hevc_nvenc";
 	hw_config->width = input->width = atoi(argv[4]);
 	hw_config->height = input->height = atoi(argv[5]);
 	hw_config->framerate = input->framerate = atoi(argv[6]);
@@ -0,0 +1,416 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ * (replay of recorded encoder input, no camera needed)
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+// Network Hardware Video Encoder
+#include "nhve.h"
+
+// Parallel and software encoders
+#include "parallel_encoder.h"
+#include "software_encoder.h"
+
+// Recorded frames (--record-frames of the other programs)
+#include "frame_recorder.h"
+
+// Adaptive bitrate from receiver feedback
+#include "bitrate_control.h"
+
+// Region of interest (subject in recorded depth)
+#include "subject_region.h"
+
+// Hole filling of recorded depth
+#include "depth_fill.h"
+
+// Per stage latency (here submit to sent)
+#include "frame_latency.h"
+
+#include "options.h"
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+
+int hint_user_on_failure(char *argv[]);
+
+//user supplied input
+struct input_args
+{
+	const char *file;
+	int repeat;
+	bool fast;              //as fast as possible instead of recorded rate
+	bool preload;           //whole recording in memory before replay
+	bool parallel_encoders; //each encoder in its own thread
+	bitrate_control_config abr; //adaptive bitrate (--abr)
+	float roi; //region of interest quality offset (--roi), 0 disables
+	bitstream_recorder_config record; //encoded output (--record), e.g. for comparing bitrate and quality
+	depth_fill_config fill; //hole filling of recorded depth (--fill)
+	int qp;                 //constant quantizer for all streams (--qp), 0 keeps bitrate control
+};
+
+bool main_loop(const input_args& input, frame_replay *replay, nhve *streamer, parallel_encoder *pe, bitrate_control *abr);
+int process_user_input(int argc, char* argv[], input_args* input, nhve_net_config *net_config, nhve_hw_config *hw_config, const char **encoder);
+
+int main(int argc, char* argv[])
+{
+	struct nhve_net_config net_config = {0};
+	struct nhve_hw_config hw_configs[FRAME_RECORDER_MAX_STREAMS] = { {0}, {0} };
+	struct nhve *streamer = NULL;
+	struct parallel_encoder *pe = NULL;
+	struct frame_replay *replay = NULL;
+	struct bitrate_control *abr = NULL;
+	struct bitstream_recorder *recorder = NULL;
+	struct input_args user_input = {0};
+	const char *encoder = NULL;
+
+	if(process_user_input(argc, argv, &user_input, &net_config, hw_configs, &encoder) < 0)
+		return 1;
+
+	if( (replay = frame_replay_init(user_input.file, user_input.preload)) == NULL )
+		return 1;
+
+	const int streams = frame_replay_streams(replay);
+
+	if((user_input.roi > 0.0f || user_input.fill.fill) && frame_replay_stream(replay, 0).depth_units <= 0.0f)
+	{
+		cerr << "--roi and --fill need recording with depth (subject and holes are in the depth stream)" << endl;
+		frame_replay_close(replay);
+		return 1;
+	}
+
+	//encoders configured as recorded, device and bitrate from the command line
+	for(int i = 0; i < streams; ++i)
+	{
+		const frame_recording_stream &s = frame_replay_stream(replay, i);
+
+		hw_configs[i].width = s.width;
+		hw_configs[i].height = s.height;
+		hw_configs[i].framerate = s.framerate;
+		hw_configs[i].pixel_format = s.pixel_format;
+		hw_configs[i].encoder = encoder ? encoder : s.encoder;
+		hw_configs[i].profile = s.profile;
+		hw_configs[i].compression_level = s.compression_level;
+		hw_configs[i].device = hw_configs[0].device;
+		hw_configs[i].qp = user_input.qp;
+
+		//constant quantizer (--qp) without recorded bitrate
+		if(!hw_configs[i].bit_rate && !user_input.qp)
+			hw_configs[i].bit_rate = s.bit_rate;
+
+		cout << "stream " << i << ": " << s.width << "x" << s.height << " " << s.pixel_format << " @ " << s.framerate <<
+			" fps, " << hw_configs[i].encoder << endl;
+	}
+
+	if(user_input.parallel_encoders || software_encoder_is_software(hw_configs[0].encoder) || user_input.abr.port ||
+		user_input.roi > 0.0f || user_input.record.prefix)
+		pe = parallel_encoder_init(&net_config, hw_configs, streams, 0);
+	else
+		streamer = nhve_init(&net_config, hw_configs, streams, 0);
+
+	if(!pe && !streamer)
+	{
+		frame_replay_close(replay);
+		return hint_user_on_failure(argv);
+	}
+
+	if(user_input.record.prefix)
+	{
+		recorder_codec codecs[FRAME_RECORDER_MAX_STREAMS];
+
+		for(int i = 0; i < streams; ++i)
+			codecs[i] = bitstream_recorder_codec(hw_configs[i].encoder);
+
+		if( (recorder = bitstream_recorder_init(user_input.record, codecs, streams)) == NULL )
+		{
+			parallel_encoder_close(pe);
+			frame_replay_close(replay);
+			return 1;
+		}
+
+		parallel_encoder_record(pe, recorder);
+	}
+
+	if(user_input.abr.port)
+	{
+		const int bitrates[FRAME_RECORDER_MAX_STREAMS] = { hw_configs[0].bit_rate, hw_configs[1].bit_rate };
+
+		if( (abr = bitrate_control_init(user_input.abr, bitrates, streams)) == NULL )
+		{
+			parallel_encoder_close(pe);
+			bitstream_recorder_close(recorder);
+			frame_replay_close(replay);
+			return 1;
+		}
+	}
+
+	bool status = main_loop(user_input, replay, streamer, pe, abr);
+
+	frame_latency_report(cout);
+	if(recorder)
+		bitstream_recorder_report(cout, recorder);
+	if(abr)
+		bitrate_control_report(cout, abr);
+
+	if(streamer)
+		nhve_close(streamer);
+	parallel_encoder_close(pe);
+	bitstream_recorder_close(recorder);
+	bitrate_control_close(abr);
+	frame_replay_close(replay);
+
+	if(status)
+		cout << "Finished successfully." << endl;
+
+	return 0;
+}
+
+//NULL frames to flush
+static int send_frames(nhve *streamer, parallel_encoder *pe, const nhve_frame *frames, int streams)
+{
+	if(pe)
+		return parallel_encoder_send_frames(pe, frames);
+
+	for(int i = 0; i < streams; ++i)
+		if(nhve_send(streamer, frames ? &frames[i] : NULL, i) != NHVE_OK)
+			return NHVE_ERROR;
+
+	return NHVE_OK;
+}
+
+//subject of recorded (conditioned) depth as region of interest of all the streams
+//uniform encoding without subject
+static void set_roi(const input_args& input, frame_replay *replay, parallel_encoder *pe, const nhve_frame *frames)
+{
+	const frame_recording_stream &depth = frame_replay_stream(replay, 0);
+	frame_region subject;
+
+	const bool found = subject_region_find((const uint16_t*)frames[0].data[0], depth.width, depth.height, frames[0].linesize[0], &subject);
+
+	for(int i = 0; i < frame_replay_streams(replay); ++i)
+	{
+		const frame_recording_stream &s = frame_replay_stream(replay, i);
+		const frame_region region = found ? subject_region_scale(subject, depth.width, depth.height, s.width, s.height) : subject;
+
+		parallel_encoder_set_roi(pe, i, found ? &region : NULL, input.roi);
+	}
+}
+
+//recorded depth plane copied to filled and filled there, frame points at the copy
+static void fill_depth(const frame_replay *replay, nhve_frame *frame, vector<uint8_t> *filled)
+{
+	const frame_recording_stream &depth = frame_replay_stream(replay, 0);
+
+	filled->resize(depth.linesize[0] * depth.plane_height[0]);
+	memcpy(filled->data(), frame->data[0], filled->size());
+
+	depth_fill((uint16_t*)filled->data(), depth.width, depth.height, depth.linesize[0]);
+	frame->data[0] = filled->data();
+}
+
+//true on success, false on failure
+bool main_loop(const input_args& input, frame_replay *replay, nhve *streamer, parallel_encoder *pe, bitrate_control *abr)
+{
+	const int frames = frame_replay_frames(replay);
+	const int streams = frame_replay_streams(replay);
+	const int64_t period_us = 1000000 / frame_replay_stream(replay, 0).framerate;
+	nhve_frame frame[FRAME_RECORDER_MAX_STREAMS];
+	frame_latency latency;
+	int64_t first_pts = 0, pts = 0;
+	int64_t loop_us = 0; //added to recorded timestamps with each repeat
+	vector<uint8_t> filled; //recording is mapped read only, depth is filled in a copy
+	uint64_t bytes = 0;
+	int sent = 0;
+	bool ok = true;
+
+	const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	for(int r = 0; r < input.repeat && ok; ++r)
+	{
+		for(int f = 0; f < frames; ++f)
+		{
+			for(int i = 0; i < streams; ++i)
+				if(frame_replay_frame(replay, f, i, &frame[i], i ? NULL : &pts) < 0)
+				{
+					cerr << "frame " << f << " subframe " << i << " was not recorded" << endl;
+					return false;
+				}
+
+			if(r == 0 && f == 0)
+				first_pts = pts;
+
+			if(input.roi > 0.0f)
+				set_roi(input, replay, pe, frame);
+
+			//after the subject is found in the zeros
+			if(input.fill.fill)
+				fill_depth(replay, &frame[0], &filled);
+
+			//recorded pacing, timestamps are host steady clock of the recording
+			if(!input.fast)
+				this_thread::sleep_until(start + chrono::microseconds(pts - first_pts + loop_us));
+
+			frame_latency_clear(&latency);
+			frame_latency_stamp(&latency, LATENCY_SUBMITTED);
+
+			if(send_frames(streamer, pe, frame, streams) != NHVE_OK)
+			{
+				cerr << "failed to send" << endl;
+				ok = false;
+				break;
+			}
+
+			frame_latency_stamp(&latency, LATENCY_ENCODED);
+			frame_latency_record(&latency);
+
+			if(abr && bitrate_control_poll(abr))
+				for(int i = 0; i < streams; ++i)
+					parallel_encoder_set_bitrate(pe, i, bitrate_control_target(abr, i));
+
+			for(int i = 0; i < streams; ++i)
+			{
+				const frame_recording_stream &s = frame_replay_stream(replay, i);
+				for(int p = 0; p < s.planes; ++p)
+					bytes += (uint64_t)s.linesize[p] * s.plane_height[p];
+			}
+			++sent;
+		}
+
+		//next repeat one frame period after the last frame
+		loop_us = (r + 1) * (pts - first_pts + period_us);
+	}
+
+	//flush the encoders by sending NULL frames
+	send_frames(streamer, pe, NULL, streams);
+
+	const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	cout << "replayed " << sent << " frames in " << seconds << " s, " << sent / seconds << " fps, " <<
+		bytes / seconds / (1024 * 1024) << " MB/s encoder input" << endl;
+
+	return ok && sent == frames * input.repeat;
+}
+
+int process_user_input(int argc, char* argv[], input_args* input, nhve_net_config *net_config, nhve_hw_config *hw_config, const char **encoder)
+{
+	int crop_width = 0, crop_height = 0;
+
+	if(frame_latency_options(&argc, argv) < 0 ||
+		bitrate_control_options(&argc, argv, &input->abr) < 0 ||
+		subject_region_options(&argc, argv, &input->roi, &crop_width, &crop_height) < 0 ||
+		bitstream_recorder_options(&argc, argv, &input->record) < 0)
+		return -1;
+
+	if(crop_width)
+	{
+		cerr << "--crop is not supported in replay (recorded frames have fixed size)" << endl;
+		return -1;
+	}
+
+	if(depth_fill_options(&argc, argv, &input->fill) < 0)
+		return -1;
+
+	if(input->fill.mask)
+	{
+		cerr << "--fill-mask is not supported in replay (no aux channel), use --fill" << endl;
+		return -1;
+	}
+
+	const char *qp = option_value(&argc, argv, "qp");
+
+	if(qp)
+	{
+		char *end;
+		input->qp = strtol(qp, &end, 10);
+
+		if(*qp == '\0' || *end != '\0' || input->qp < 1 || input->qp > 51)
+		{
+			cerr << "invalid --qp '" << qp << "', expected quantizer 1-51" << endl;
+			return -1;
+		}
+	}
+
+	const char *repeat = option_value(&argc, argv, "repeat");
+
+	input->fast = option_flag(&argc, argv, "fast");
+	input->preload = option_flag(&argc, argv, "preload");
+	input->parallel_encoders = option_flag(&argc, argv, "parallel-encoders");
+	input->repeat = 1;
+
+	if(repeat)
+	{
+		char *end;
+		input->repeat = strtol(repeat, &end, 10);
+
+		if(*repeat == '\0' || *end != '\0' || input->repeat < 1)
+		{
+			cerr << "invalid --repeat '" << repeat << "', expected positive number of replays" << endl;
+			return -1;
+		}
+	}
+
+	*encoder = option_value(&argc, argv, "encoder");
+
+	if(*encoder && !**encoder)
+	{
+		cerr << "invalid --encoder, expected FFmpeg encoder name e.g. hevc_vaapi, libx265" << endl;
+		return -1;
+	}
+
+	if(argc < 4)
+	{
+		cerr << "Usage: " << argv[0] << " <host> <port> <file> [device] [bitrate_0] [bitrate_1]" << endl;
+		cerr << endl << "examples: " << endl;
+		cerr << argv[0] << " 127.0.0.1 9766 frames.rnrf" << endl;
+		cerr << argv[0] << " 127.0.0.1 9766 frames.rnrf /dev/dri/renderD128" << endl;
+		cerr << argv[0] << " 127.0.0.1 9766 frames.rnrf /dev/dri/renderD128 --fast --preload --repeat 10" << endl;
+		cerr << argv[0] << " 127.0.0.1 9766 frames.rnrf --fast --encoder libx265" << endl;
+		cerr << argv[0] << " 127.0.0.1 9766 frames.rnrf /dev/dri/renderD128 2000000 1000000 --fast --encoder libx265 --roi 0.2 --record roi" << endl;
+		cerr << argv[0] << " 127.0.0.1 9766 frames.rnrf --fast --encoder libx265 --qp 28 --fill --record fill" << endl;
+
+		cerr << endl;
+		frame_latency_usage(cerr);
+		bitrate_control_usage(cerr);
+		subject_region_usage(cerr);
+		depth_fill_usage(cerr);
+		bitstream_recorder_usage(cerr);
+		cerr << "replay options:" << endl
+		     << "       --fast # as fast as possible instead of at recorded rate (encoder throughput)" << endl
+		     << "       --preload # read the whole recording into memory before replay (no page faults)" << endl
+		     << "       --repeat <n> # replay the recording n times, default 1" << endl
+		     << "       --parallel-encoders # each encoder in its own thread" << endl
+		     << "       --qp <n> # constant quantizer 1-51 for all streams instead of bitrate (e.g. comparing --fill)" << endl
+		     << "       --encoder <name> # FFmpeg encoder, default the one recorded with" << endl;
+
+		return -1;
+	}
+
+	net_config->ip = argv[1];
+	net_config->port = atoi(argv[2]);
+	input->file = argv[3];
+
+	hw_config[0].device = argv[4]; //NULL as last argv argument, or device path
+
+	//0 keeps the recorded bitrate
+	for(int i = 0; i < FRAME_RECORDER_MAX_STREAMS && argc > 5 + i; ++i)
+		hw_config[i].bit_rate = atoi(argv[5 + i]);
+
+	return 0;
+}
+
+int hint_user_on_failure(char *argv[])
+{
+	cerr << "unable to initalize, try to specify device e.g:" << endl << endl;
+	cerr << argv[0] << " 127.0.0.1 9766 frames.rnrf /dev/dri/renderD128" << endl;
+	cerr << argv[0] << " 127.0.0.1 9766 frames.rnrf --encoder libx265" << endl;
+	return -1;
+}
@@ -0,0 +1,576 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Tests on synthetic data, no camera or encoder needed (run by ctest)
+ * - depth kernels, each implementation supported by the CPU bit-exact with scalar reference on fuzzed input
+ *   (conditioning, unit conversion, slicing, projection, histogram, hole filling rows)
+ * - hole filling with validity mask of a window in the frame, mask restores exactly the pixels that were filled
+ * - depth in chroma of odd and even sized frames, stays in its plane, round trip without compression in luma step
+ * - frame recording and replay of odd and even sized frames, planes and timestamps come back exactly
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include "depth_kernels.h"
+#include "depth_fill.h"
+#include "depth_chroma.h"
+#include "frame_recorder.h"
+
+#include <iostream>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+using namespace std;
+
+typedef bool (*test_fn)();
+
+struct test
+{
+	const char *name;
+	test_fn run;
+};
+
+bool test_depth_kernels();
+bool test_depth_fill();
+bool test_depth_chroma();
+bool test_frame_recorder();
+
+static const test TESTS[] = {
+	{"depth_kernels", test_depth_kernels},
+	{"depth_fill", test_depth_fill},
+	{"depth_chroma", test_depth_chroma},
+	{"frame_recorder", test_frame_recorder},
+};
+
+//the same input on every platform, LCG
+static uint32_t seed = 1;
+
+static uint32_t random_u32()
+{
+	seed = seed * 1664525u + 1013904223u;
+	return seed ^ (seed >> 16);
+}
+
+static int random_int(int lo, int hi)
+{
+	return lo + random_u32() % (hi - lo + 1);
+}
+
+//depth as it comes, many invalid and saturated values, values around the interesting ones
+static uint16_t random_depth(int around)
+{
+	switch(random_u32() % 8)
+	{
+		case 0: return 0;
+		case 1: return UINT16_MAX - random_int(0, 3);
+		case 2: return around + random_int(-2, 2);
+		default: return random_u32();
+	}
+}
+
+//count not multiple of any vector width exercises the scalar tails, offset the unaligned loads
+static int random_count()
+{
+	return (random_u32() % 4) ? random_int(0, 70) : random_int(1000, 5000);
+}
+
+int main(int argc, char* argv[])
+{
+	bool status = true;
+	int ran = 0;
+
+	for(const test &t : TESTS)
+	{
+		bool selected = argc < 2;
+
+		for(int i = 1; i < argc; ++i)
+			selected |= strcmp(argv[i], t.name) == 0;
+
+		if(!selected)
+			continue;
+
+		const bool ok = t.run();
+		cout << t.name << (ok ? " passed" : " FAILED") << endl;
+		status &= ok;
+		++ran;
+	}
+
+	if(!ran)
+	{
+		cerr << "Usage: " << argv[0] << " [test...]" << endl << "tests:";
+		for(const test &t : TESTS)
+			cerr << " " << t.name;
+		cerr << endl;
+		return 2;
+	}
+
+	return status ? 0 : 1;
+}
+
+static const float MULTIPLIERS[] = {1.0f, 0.25f / 0.1f, 0.5f, 1.0001f, 0.1f, 4.0f};
+
+static depth_condition_params random_condition()
+{
+	depth_condition_params p;
+
+	p.multiplier = MULTIPLIERS[random_u32() % 6];
+	p.lo = random_int(0, 70000);
+	p.hi = random_int(p.lo - 100, 70000);
+	p.offset = (random_u32() % 2) ? random_int(0, p.lo) : 0;
+	p.shift = random_int(0, 6);
+
+	return p;
+}
+
+static bool check_condition(int rounds)
+{
+	vector<uint16_t> source, reference, work;
+
+	for(int i = 0; i < rounds; ++i)
+	{
+		const depth_condition_params p = random_condition();
+		const int count = random_count(), offset = random_int(0, 7);
+
+		source.resize(count + offset);
+		for(uint16_t &d : source)
+			d = random_depth((random_u32() % 2) ? p.lo : p.hi);
+
+		reference = work = source;
+		depth_condition_scalar(&reference[offset], count, p);
+		depth_condition(&work[offset], count, p);
+
+		const uint16_t min_units = random_u32(), max_value = random_u32();
+		const int shift = random_int(0, 6);
+		vector<uint16_t> slice_reference = source, slice = source;
+		vector<uint16_t> units_reference = source, units = source;
+
+		depth_rescale_slice_scalar(&slice_reference[offset], count, min_units, shift);
+		depth_rescale_slice(&slice[offset], count, min_units, shift);
+		depth_rescale_units_scalar(&units_reference[offset], count, p.multiplier, max_value);
+		depth_rescale_units(&units[offset], count, p.multiplier, max_value);
+
+		if(work != reference || slice != slice_reference || units != units_reference)
+		{
+			cerr << "condition mismatch, count " << count << " multiplier " << p.multiplier << " lo " << p.lo << " hi " << p.hi <<
+				" offset " << p.offset << " shift " << p.shift << " slice " << min_units << ":" << shift << " max " << max_value << endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool check_project(int rounds)
+{
+	vector<uint16_t> depth;
+	vector<float> rx, ry, rz;
+	vector<int32_t> x, y, x_ref, y_ref;
+
+	for(int i = 0; i < rounds; ++i)
+	{
+		const int count = random_count(), offset = random_int(0, 7);
+		//Realsense units, camera to the side, behind or in front, rays up to ~120 degrees and some behind the camera
+		const float t = random_int(-100, 100) / 1000.0f, f = random_int(100, 2000);
+		depth_project_params p = {(random_u32() % 2) ? 0.001f : 0.0001f, t, -t / 2, random_int(-10, 10) / 1000.0f,
+			f, f * 1.01f, f / 2, f / 3};
+
+		depth.resize(count + offset);
+		rx.resize(count + offset);
+		ry.resize(count + offset);
+		rz.resize(count + offset);
+		x.assign(count + offset, 0);
+		y.assign(count + offset, 0);
+		x_ref = x;
+		y_ref = y;
+
+		for(int j = 0; j < count + offset; ++j)
+		{
+			depth[j] = random_depth(0);
+			rx[j] = random_int(-2000, 2000) / 1000.0f;
+			ry[j] = random_int(-2000, 2000) / 1000.0f;
+			rz[j] = random_int(-100, 1000) / 1000.0f;
+		}
+
+		depth_project_scalar(&depth[offset], count, &rx[offset], &ry[offset], &rz[offset], p, &x_ref[offset], &y_ref[offset]);
+		depth_project(&depth[offset], count, &rx[offset], &ry[offset], &rz[offset], p, &x[offset], &y[offset]);
+
+		if(x != x_ref || y != y_ref)
+		{
+			cerr << "project mismatch, count " << count << " scale " << p.scale << " t " << p.tx << "," << p.ty << "," << p.tz << " f " << f << endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool check_histogram(int rounds)
+{
+	vector<uint16_t> data;
+	vector<uint32_t> bins, bins_ref;
+
+	for(int i = 0; i < rounds; ++i)
+	{
+		const int count = random_count(), offset = random_int(0, 7), bin_shift = random_int(0, 12);
+		const float multiplier = MULTIPLIERS[random_u32() % 6];
+
+		data.resize(count + offset);
+		for(uint16_t &d : data)
+			d = random_depth(0);
+
+		bins.assign(0x10000 >> bin_shift, 0);
+		bins_ref = bins;
+
+		depth_histogram_scalar(&data[offset], count, multiplier, bin_shift, &bins_ref[0]);
+		depth_histogram(&data[offset], count, multiplier, bin_shift, &bins[0]);
+
+		if(bins != bins_ref)
+		{
+			cerr << "histogram mismatch, count " << count << " multiplier " << multiplier << " bin shift " << bin_shift << endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool check_fill_row(int rounds)
+{
+	vector<uint16_t> row, from, reference;
+
+	for(int i = 0; i < rounds; ++i)
+	{
+		const int count = random_count(), offset = random_int(0, 7);
+		//mostly holes in the row, neighbour row with fewer of them, some neighbours missing too
+		const uint32_t holes = random_int(1, 4);
+
+		row.resize(count + offset);
+		from.resize(count + offset);
+
+		for(int j = 0; j < count + offset; ++j)
+		{
+			row[j] = (random_u32() % holes) ? 0 : random_depth(0);
+			from[j] = (random_u32() % 5) ? random_depth(0) : 0;
+		}
+
+		reference = row;
+		depth_fill_row_scalar(&reference[offset], &from[offset], count);
+		depth_fill_row(&row[offset], &from[offset], count);
+
+		if(row != reference)
+		{
+			cerr << "fill row mismatch, count " << count << endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool test_depth_kernels()
+{
+	bool status = true;
+
+	for(int isa = DEPTH_KERNELS_SCALAR; isa < DEPTH_KERNELS_ISA_COUNT; ++isa)
+	{
+		if(!depth_kernels_select((depth_kernels_isa)isa))
+		{
+			cout << "-" << depth_kernels_isa_name((depth_kernels_isa)isa) << " not supported, skipped" << endl;
+			continue;
+		}
+
+		seed = 1;
+
+		const bool condition = check_condition(2000);
+		const bool project = check_project(1000);
+		const bool histogram = check_histogram(1000);
+		const bool fill_row = check_fill_row(2000);
+		const bool ok = condition && project && histogram && fill_row;
+
+		cout << "-" << depth_kernels_isa_name((depth_kernels_isa)isa) <<
+			" condition " << (condition ? "ok" : "MISMATCH") << " project " << (project ? "ok" : "MISMATCH") <<
+			" histogram " << (histogram ? "ok" : "MISMATCH") << " fill row " << (fill_row ? "ok" : "MISMATCH") << endl;
+
+		status &= ok;
+	}
+
+	depth_kernels_select(depth_kernels_best_isa());
+
+	return status;
+}
+
+//subject with holes and speckles on invalid background, sometimes nothing valid at all
+static void random_holes(vector<uint16_t> &frame, int width, int height, int pitch)
+{
+	const bool empty = random_u32() % 8 == 0;
+	const int left = random_int(0, width - 1), right = random_int(left, width - 1);
+	const int top = random_int(0, height - 1), bottom = random_int(top, height - 1);
+	const uint32_t speckles = random_int(2, 20);
+
+	for(int y = 0; y < height; ++y)
+		for(int x = 0; x < width; ++x)
+		{
+			const bool subject = !empty && x >= left && x <= right && y >= top && y <= bottom;
+			frame[y * pitch + x] = (subject && random_u32() % speckles) ? random_int(1, 0xFFFF) : 0;
+		}
+}
+
+static bool check_fill_mask(int rounds)
+{
+	vector<uint16_t> original, filled;
+	vector<uint8_t> mask;
+
+	for(int i = 0; i < rounds; ++i)
+	{
+		//odd sizes, padded stride, window anywhere in the frame (whole frame without --crop)
+		const int width = random_int(1, 100), height = random_int(1, 60), pitch = width + random_int(0, 9);
+		const int left = random_int(0, width - 1), top = random_int(0, height - 1);
+		const int right = random_int(left + 1, width), bottom = random_int(top + 1, height);
+		const int stride = pitch * sizeof(uint16_t), offset = top * pitch + left;
+
+		original.assign(pitch * height, 0);
+		random_holes(original, width, height, pitch);
+		filled = original;
+
+		mask.resize(DEPTH_FILL_MASK_MAX_SIZE(width, height));
+		const int size = depth_fill_mask_pack(i, &filled[offset], right - left, bottom - top, stride, mask.data());
+		depth_fill(filled.data(), width, height, stride);
+
+		uint32_t framenumber;
+		int mask_width, mask_height, record_size;
+		bool any_valid = false, ok = depth_fill_mask_read(mask.data(), size, &framenumber, &mask_width, &mask_height, &record_size) &&
+			framenumber == (uint32_t)i && mask_width == right - left && mask_height == bottom - top && record_size == size;
+
+		//valid pixels untouched, holes filled (unless nothing was valid)
+		for(int y = 0; y < height; ++y)
+			for(int x = 0; x < width; ++x)
+				any_valid |= original[y * pitch + x] != 0;
+
+		for(int y = 0; ok && y < height; ++y)
+			for(int x = 0; ok && x < width; ++x)
+			{
+				const uint16_t o = original[y * pitch + x], f = filled[y * pitch + x];
+				ok = o ? f == o : (f != 0) == any_valid;
+			}
+
+		//receiver zeroes what was filled in the window and nothing else
+		ok = ok && depth_fill_mask_apply(mask.data(), size, &filled[offset], stride);
+
+		for(int y = 0; ok && y < height; ++y)
+			for(int x = 0; ok && x < width; ++x)
+			{
+				const bool inside = x >= left && x < right && y >= top && y < bottom;
+				const uint16_t o = original[y * pitch + x], f = filled[y * pitch + x];
+				ok = inside ? f == o : (o ? f == o : (f != 0) == any_valid);
+			}
+
+		if(!ok)
+		{
+			cerr << "fill mask mismatch, frame " << width << "x" << height << " pitch " << pitch <<
+				" window " << left << "," << top << "-" << right << "," << bottom << endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool test_depth_fill()
+{
+	bool status = true;
+
+	for(int isa = DEPTH_KERNELS_SCALAR; isa < DEPTH_KERNELS_ISA_COUNT; ++isa)
+	{
+		if(!depth_kernels_select((depth_kernels_isa)isa))
+			continue;
+
+		seed = 1;
+
+		const bool ok = check_fill_mask(500);
+
+		cout << "-" << depth_kernels_isa_name((depth_kernels_isa)isa) << " fill mask " << (ok ? "ok" : "MISMATCH") << endl;
+
+		status &= ok;
+	}
+
+	depth_kernels_select(depth_kernels_best_isa());
+
+	return status;
+}
+
+bool test_depth_chroma()
+{
+	const uint16_t CANARY = 0xDEAD;
+	vector<uint16_t> depth, luma, uv, unpacked;
+
+	for(int i = 0; i < 500; ++i)
+	{
+		//tight strides, uv plane of the least size allowed, canary right after it
+		const int width = random_int(1, 64), height = random_int(1, 48), uv_pitch = (width + 1) / 2 * 2;
+		const int uv_size = uv_pitch * ((height + 1) / 2);
+
+		depth.resize(width * height);
+		luma.resize(width * height);
+		unpacked.assign(width * height, 0);
+		uv.assign(uv_size + 1, 0);
+		uv[uv_size] = CANARY;
+
+		//smooth depth within a luma step or two of the block neighbours, some invalid
+		const int base = random_int(64, 0xFFFF - 512);
+		for(int y = 0; y < height; ++y)
+			for(int x = 0; x < width; ++x)
+				depth[y * width + x] = (random_u32() % 9) ? base + x * 3 + y * 2 : 0;
+
+		for(int j = 0; j < width * height; ++j)
+			luma[j] = depth[j] & 0xFFC0;
+
+		depth_chroma_pack(depth.data(), width, height, width * 2, uv.data(), uv_pitch * 2);
+		depth_chroma_unpack(luma.data(), uv.data(), width, height, width * 2, uv_pitch * 2, unpacked.data(), width * 2);
+
+		bool ok = uv[uv_size] == CANARY;
+
+		//no compression, validity kept and each pixel within its own luma step
+		for(int j = 0; ok && j < width * height; ++j)
+			ok = luma[j] ? (unpacked[j] & 0xFFC0) == luma[j] : unpacked[j] == 0;
+
+		if(!ok)
+		{
+			cerr << "depth chroma mismatch, frame " << width << "x" << height << (uv[uv_size] == CANARY ? "" : " (uv overflow)") << endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//P010LE and NV12 chroma has a pair of samples for each 2x2 block, including partial blocks of odd sizes
+static void plane_size(const frame_recording_stream &s, int p, int *bytes, int *rows)
+{
+	const int bpp = s.linesize[0] / s.width;
+
+	*bytes = p ? (s.width + 1) / 2 * 2 * bpp : s.width * bpp;
+	*rows = p ? (s.height + 1) / 2 : s.height;
+}
+
+//source planes with padding
+static void random_planes(const frame_recording_stream &s, vector<uint8_t> *planes, nhve_frame *frame)
+{
+	memset(frame, 0, sizeof(*frame));
+
+	for(int p = 0; p < s.planes; ++p)
+	{
+		int bytes, rows;
+		plane_size(s, p, &bytes, &rows);
+
+		frame->linesize[p] = bytes + 64;
+		planes[p].resize((size_t)frame->linesize[p] * rows);
+
+		for(size_t i = 0; i < planes[p].size(); ++i)
+			planes[p][i] = random_u32();
+
+		frame->data[p] = planes[p].data();
+	}
+}
+
+static bool check_replay(const frame_replay *replay, int frame, int subframe, const nhve_frame &recorded, int64_t recorded_pts)
+{
+	const frame_recording_stream &s = frame_replay_stream(replay, subframe);
+	nhve_frame replayed;
+	int64_t pts_us;
+
+	if(frame_replay_frame(replay, frame, subframe, &replayed, &pts_us) != 0 || pts_us != recorded_pts)
+		return false;
+
+	for(int p = 0; p < s.planes; ++p)
+	{
+		int bytes, rows;
+		plane_size(s, p, &bytes, &rows);
+
+		//the last row or column of chroma of odd sized frames must be recorded too
+		if(s.linesize[p] < bytes || s.plane_height[p] < rows)
+			return false;
+
+		for(int y = 0; y < rows; ++y)
+			if(memcmp(replayed.data[p] + y * replayed.linesize[p], recorded.data[p] + y * recorded.linesize[p], bytes) != 0)
+				return false;
+	}
+
+	return true;
+}
+
+bool test_frame_recorder()
+{
+#ifdef _WIN32
+	//memory mapped recording is not supported on Windows
+	return true;
+#else
+	const char *FILE_NAME = "rnhve-test.rnrf";
+	const int FRAMES = 3;
+	const struct { int width; int height; const char *pixel_format; } SIZES[][2] =
+	{
+		{ {848, 480, "p010le"}, {848, 480, "nv12"} },
+		{ {847, 479, "p010le"}, {423, 241, "nv12"} },
+		{ {33, 17, "p010le"}, {31, 15, "yuyv422"} },
+	};
+
+	for(const auto &sizes : SIZES)
+	{
+		frame_recording_stream streams[2];
+		vector<uint8_t> planes[2][FRAMES][NHVE_NUM_DATA_POINTERS];
+		nhve_frame frames[2][FRAMES];
+
+		for(int s = 0; s < 2; ++s)
+		{
+			nhve_hw_config hw;
+			memset(&hw, 0, sizeof(hw));
+			hw.width = sizes[s].width;
+			hw.height = sizes[s].height;
+			hw.framerate = 30;
+			hw.pixel_format = sizes[s].pixel_format;
+
+			if(frame_recording_stream_init(&streams[s], hw, NULL, s ? 0.0f : 0.0001f) != 0)
+				return false;
+
+			for(int f = 0; f < FRAMES; ++f)
+				random_planes(streams[s], planes[s][f], &frames[s][f]);
+		}
+
+		frame_recorder *recorder = frame_recorder_init(FILE_NAME, streams, 2, FRAMES);
+
+		if(!recorder)
+			return false;
+
+		bool ok = true;
+
+		for(int f = 0; f < FRAMES; ++f)
+			for(int s = 0; s < 2; ++s)
+				ok &= frame_recorder_write(recorder, f, s, &frames[s][f], f * 33333 + s) == 0;
+
+		frame_recorder_close(recorder);
+
+		frame_replay *replay = frame_replay_init(FILE_NAME, true);
+
+		ok &= replay && frame_replay_frames(replay) == FRAMES && frame_replay_streams(replay) == 2;
+
+		for(int f = 0; ok && f < FRAMES; ++f)
+			for(int s = 0; ok && s < 2; ++s)
+				ok = check_replay(replay, f, s, frames[s][f], f * 33333 + s);
+
+		frame_replay_close(replay);
+		remove(FILE_NAME);
+
+		if(!ok)
+		{
+			cerr << "frame recorder mismatch, frames " << sizes[0].width << "x" << sizes[0].height << " " << sizes[0].pixel_format <<
+				" and " << sizes[1].width << "x" << sizes[1].height << " " << sizes[1].pixel_format << endl;
+			return false;
+		}
+	}
+
+	return true;
+#endif
+}
@@ -0,0 +1,282 @@
+#include "software_encoder.h"
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavutil/opt.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+#include <iostream>
+#include <string.h>
+
+using namespace std;
+
+struct software_encoder
+{
+	AVCodecContext *context;
+	AVFrame *frame;    //encoder input, converted when needed
+	AVPacket *packet;
+	SwsContext *convert; //NULL when encoder takes our pixel format
+	AVPixelFormat input_format;
+	int64_t pts;
+	frame_region roi;  //subject, used with roi_qoffset > 0
+	float roi_qoffset;
+};
+
+//x264/x265 speed presets, compression_level 0 is the fastest
+static const char *PRESETS[] = {"ultrafast", "superfast", "veryfast", "faster", "fast", "medium"};
+static const int PRESETS_COUNT = sizeof(PRESETS) / sizeof(PRESETS[0]);
+
+bool software_encoder_is_software(const char *encoder)
+{
+	if(!encoder || !*encoder)
+		return false;
+
+	const AVCodec *codec = avcodec_find_encoder_by_name(encoder);
+
+	return codec && !(codec->capabilities & AV_CODEC_CAP_HARDWARE);
+}
+
+static void print_error(const char *msg, int error)
+{
+	char text[AV_ERROR_MAX_STRING_SIZE] = {0};
+	av_strerror(error, text, sizeof(text));
+	cerr << "software encoder: " << msg << ": " << text << endl;
+}
+
+//encoder-specific options, missing options are not an error (e.g. qp with other encoders)
+static void set_private_options(AVCodecContext *c, const struct nhve_hw_config *config)
+{
+	int level = config->compression_level;
+	level = level < 0 ? 0 : (level >= PRESETS_COUNT ? PRESETS_COUNT - 1 : level);
+
+	av_opt_set(c->priv_data, "preset", PRESETS[level], 0);
+	av_opt_set(c->priv_data, "tune", "zerolatency", 0);
+
+	if(config->qp)
+		if(av_opt_set_int(c->priv_data, "qp", config->qp, 0) < 0) //x264
+			av_opt_set(c->priv_data, "x265-params", ("qp=" + to_string(config->qp)).c_str(), 0);
+}
+
+struct software_encoder *software_encoder_init(const struct nhve_hw_config *config)
+{
+	const AVCodec *codec = avcodec_find_encoder_by_name(config->encoder ? config->encoder : "");
+
+	if(!codec)
+	{
+		cerr << "software encoder: unknown encoder " << (config->encoder ? config->encoder : "") << endl;
+		return NULL;
+	}
+
+	AVPixelFormat input = av_get_pix_fmt(config->pixel_format ? config->pixel_format : "nv12");
+
+	if(input == AV_PIX_FMT_NONE)
+	{
+		cerr << "software encoder: unknown pixel format " << config->pixel_format << endl;
+		return NULL;
+	}
+
+	//the same format if the encoder takes it, otherwise the closest one (e.g. p010le -> yuv420p10le)
+	AVPixelFormat output = codec->pix_fmts ? avcodec_find_best_pix_fmt_of_list(codec->pix_fmts, input, 0, NULL) : input;
+
+	software_encoder *e = new software_encoder();
+
+	e->context = avcodec_alloc_context3(codec);
+	e->frame = av_frame_alloc();
+	e->packet = av_packet_alloc();
+	e->convert = NULL;
+	e->input_format = input;
+	e->pts = 0;
+	e->roi_qoffset = 0.0f;
+
+	if(!e->context || !e->frame || !e->packet)
+	{
+		cerr << "software encoder: out of memory" << endl;
+		software_encoder_close(e);
+		return NULL;
+	}
+
+	AVCodecContext *c = e->context;
+	const int framerate = config->framerate > 0 ? config->framerate : 30;
+	const AVRational time_base = {1, framerate}, rate = {framerate, 1};
+
+	c->width = config->width;
+	c->height = config->height;
+	c->time_base = time_base;
+	c->framerate = rate;
+	c->pix_fmt = output;
+	c->bit_rate = config->bit_rate;
+	c->gop_size = config->gop_size ? config->gop_size : c->gop_size;
+	c->max_b_frames = config->max_b_frames;
+	c->profile = config->profile ? config->profile : FF_PROFILE_UNKNOWN;
+	c->flags |= AV_CODEC_FLAG_LOW_DELAY;
+	c->thread_count = 0; //automatic, zerolatency keeps x264/x265 threads from adding frames of delay
+
+	set_private_options(c, config);
+
+	int err;
+
+	if( (err = avcodec_open2(c, codec, NULL)) < 0 )
+	{
+		print_error("failed to open encoder", err);
+		software_encoder_close(e);
+		return NULL;
+	}
+
+	e->frame->format = output;
+	e->frame->width = config->width;
+	e->frame->height = config->height;
+
+	if(output != input)
+	{
+		cout << "software encoder: " << codec->name << " converting " << av_get_pix_fmt_name(input) <<
+			" to " << av_get_pix_fmt_name(output) << endl;
+
+		//point sampling, formats differ only in layout/bit depth/subsampling, depth must not be interpolated
+		e->convert = sws_getContext(c->width, c->height, input, c->width, c->height, output, SWS_POINT, NULL, NULL, NULL);
+
+		if(!e->convert || (err = av_frame_get_buffer(e->frame, 0)) < 0)
+		{
+			cerr << "software encoder: failed to prepare pixel format conversion" << endl;
+			software_encoder_close(e);
+			return NULL;
+		}
+	}
+
+	return e;
+}
+
+void software_encoder_close(struct software_encoder *e)
+{
+	if(!e)
+		return;
+
+	sws_freeContext(e->convert);
+	av_packet_free(&e->packet);
+	av_frame_free(&e->frame);
+	avcodec_free_context(&e->context);
+
+	delete e;
+}
+
+bool software_encoder_set_bitrate(struct software_encoder *e, int bit_rate)
+{
+	//libx264 compares context bitrate with its own before each frame and reconfigures
+	if(strcmp(e->context->codec->name, "libx264") != 0)
+		return false;
+
+	e->context->bit_rate = bit_rate;
+	return true;
+}
+
+void software_encoder_set_roi(struct software_encoder *e, const frame_region *subject, float qoffset)
+{
+	e->roi_qoffset = subject ? qoffset : 0.0f;
+
+	if(subject)
+		e->roi = *subject;
+}
+
+//subject first (the first region covering a block applies), then the whole frame as background
+static int add_regions_of_interest(software_encoder *e)
+{
+	AVFrameSideData *side = av_frame_new_side_data(e->frame, AV_FRAME_DATA_REGIONS_OF_INTEREST, 2 * sizeof(AVRegionOfInterest));
+
+	if(!side)
+		return -1;
+
+	AVRegionOfInterest *roi = (AVRegionOfInterest*)side->data;
+	const int q = (int)(e->roi_qoffset * 100.0f);
+
+	roi[0].self_size = sizeof(AVRegionOfInterest);
+	roi[0].left = e->roi.left;
+	roi[0].top = e->roi.top;
+	roi[0].right = e->roi.right;
+	roi[0].bottom = e->roi.bottom;
+	roi[0].qoffset.num = -q;
+	roi[0].qoffset.den = 100;
+
+	roi[1].self_size = sizeof(AVRegionOfInterest);
+	roi[1].left = 0;
+	roi[1].top = 0;
+	roi[1].right = e->context->width;
+	roi[1].bottom = e->context->height;
+	roi[1].qoffset.num = q;
+	roi[1].qoffset.den = 100;
+
+	return 0;
+}
+
+int software_encoder_send_frame(struct software_encoder *e, const struct nhve_frame *frame)
+{
+	int err;
+
+	if(!frame)
+	{
+		if( (err = avcodec_send_frame(e->context, NULL)) < 0 && err != AVERROR_EOF )
+		{
+			print_error("failed to flush", err);
+			return -1;
+		}
+
+		return 0;
+	}
+
+	if(e->convert)
+	{
+		if( (err = av_frame_make_writable(e->frame)) < 0 )
+		{
+			print_error("failed to make frame writable", err);
+			return -1;
+		}
+
+		sws_scale(e->convert, frame->data, frame->linesize, 0, e->context->height, e->frame->data, e->frame->linesize);
+	}
+	else //encode caller data in place
+		for(int i = 0; i < NHVE_NUM_DATA_POINTERS && i < AV_NUM_DATA_POINTERS; ++i)
+		{
+			e->frame->data[i] = frame->data[i];
+			e->frame->linesize[i] = frame->linesize[i];
+		}
+
+	e->frame->pts = e->pts++;
+
+	av_frame_remove_side_data(e->frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+
+	if(e->roi_qoffset > 0.0f && add_regions_of_interest(e) < 0)
+	{
+		cerr << "software encoder: out of memory for region of interest" << endl;
+		return -1;
+	}
+
+	if( (err = avcodec_send_frame(e->context, e->frame)) < 0 )
+	{
+		print_error("failed to send frame", err);
+		return -1;
+	}
+
+	return 0;
+}
+
+AVPacket *software_encoder_receive_packet(struct software_encoder *e, int *error)
+{
+	av_packet_unref(e->packet);
+
+	int err = avcodec_receive_packet(e->context, e->packet);
+
+	*error = 0;
+
+	if(err == AVERROR(EAGAIN) || err == AVERROR_EOF)
+		return NULL;
+
+	if(err < 0)
+	{
+		print_error("failed to encode", err);
+		*error = -1;
+		return NULL;
+	}
+
+	return e->packet;
+}
@@ -0,0 +1,50 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Software encoder
+ * - FFmpeg software encoders (libx265, libx264, ...) with the same configuration as hardware encoders
+ * - the same input layouts (p010le, nv12, rgb0, uyvy422...), converted if encoder doesn't take them
+ * - for machines without VAAPI/NVENC, e.g. benchmarking and regression testing on CPU
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef SOFTWARE_ENCODER_H
+#define SOFTWARE_ENCODER_H
+
+// Network Hardware Video Encoder configuration and frames
+#include "nhve.h"
+
+// Region of interest
+#include "subject_region.h"
+
+struct software_encoder;
+struct AVPacket;
+
+// true if encoder is FFmpeg software encoder (e.g. "libx265"), false for hardware or unknown
+bool software_encoder_is_software(const char *encoder);
+
+// the same configuration as hardware encoder, device is ignored, NULL on failure
+// tuned for latency (zerolatency, no b-frames), compression_level picks speed preset
+struct software_encoder *software_encoder_init(const struct nhve_hw_config *config);
+void software_encoder_close(struct software_encoder *e);
+
+// bitrate for the next frames, true if encoder reconfigured in place (libx264)
+// false if encoder takes bitrate only at init (restart it with new config)
+bool software_encoder_set_bitrate(struct software_encoder *e, int bit_rate);
+
+// region of interest for the next frames, NULL subject (or 0 qoffset) disables
+// subject at -qoffset, the rest of the frame at +qoffset (fraction of quantizer range, 0-1)
+// encoder has to support it (e.g. libx264 with adaptive quantization, libx265), otherwise ignored
+void software_encoder_set_roi(struct software_encoder *e, const frame_region *subject, float qoffset);
+
+// the same semantics as hve_send_frame/hve_receive_packet
+// send frame (NULL to flush) then receive packets until NULL
+// packet is valid until the next call, error is 0 on success, -1 on failure
+int software_encoder_send_frame(struct software_encoder *e, const struct nhve_frame *frame);
+AVPacket *software_encoder_receive_packet(struct software_encoder *e, int *error);
+
+#endif
@@ -0,0 +1,87 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Stage queue
+ * - bounded blocking queue connecting pipeline stages (one or more producers and consumers)
+ * - full queue blocks the producer, so the slowest stage sets the pace
+ * - closing wakes everyone up, consumers drain what is left
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef STAGE_QUEUE_H
+#define STAGE_QUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <stddef.h>
+
+template<class T>
+class stage_queue
+{
+public:
+	explicit stage_queue(size_t capacity) :
+		capacity(capacity > 0 ? capacity : 1),
+		closed(false)
+	{}
+
+	// blocks while full, false if queue was closed (item is not queued then)
+	bool push(T &&item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		not_full.wait(lock, [this] { return closed || items.size() < capacity; });
+
+		if(closed)
+			return false;
+
+		items.push_back(std::move(item));
+		lock.unlock();
+		not_empty.notify_one();
+		return true;
+	}
+
+	// blocks while empty, false if queue was closed and there is nothing left
+	bool pop(T &item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		not_empty.wait(lock, [this] { return closed || !items.empty(); });
+
+		if(items.empty())
+			return false;
+
+		item = std::move(items.front());
+		items.pop_front();
+		lock.unlock();
+		not_full.notify_one();
+		return true;
+	}
+
+	// no more pushes, pending pops return what is left
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			closed = true;
+		}
+		not_full.notify_all();
+		not_empty.notify_all();
+	}
+
+private:
+	stage_queue(const stage_queue&);
+	stage_queue& operator=(const stage_queue&);
+
+	const size_t capacity;
+	bool closed;
+	std::deque<T> items;
+	std::mutex mutex;
+	std::condition_variable not_full;
+	std::condition_variable not_empty;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#include "stage_timing.h"
+
+#include <iomanip>
+
+using namespace std;
+
+static double elapsed_ms(stage_timing *t)
+{
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+	double ms = chrono::duration<double, milli>(now - t->mark).count();
+	t->mark = now;
+	return ms;
+}
+
+void stage_timing_init(stage_timing *t, const char *name)
+{
+	t->name = name;
+	t->frames = 0;
+	t->busy_ms = t->max_busy_ms = t->wait_ms = 0.0;
+	t->mark = chrono::steady_clock::now();
+}
+
+void stage_timing_waited(stage_timing *t)
+{
+	t->wait_ms += elapsed_ms(t);
+}
+
+void stage_timing_worked(stage_timing *t)
+{
+	const double ms = elapsed_ms(t);
+
+	t->busy_ms += ms;
+	t->max_busy_ms = ms > t->max_busy_ms ? ms : t->max_busy_ms;
+	++t->frames;
+}
+
+static double average_busy_ms(const stage_timing &t)
+{
+	return t.frames ? t.busy_ms / t.frames : 0.0;
+}
+
+void stage_timing_report(ostream &out, const stage_timing *timings, int count, double wall_ms)
+{
+	int slowest = 0;
+	uint64_t frames = 0;
+
+	for(int i = 0; i < count; ++i)
+	{
+		frames = timings[i].frames > frames ? timings[i].frames : frames;
+
+		if(average_busy_ms(timings[i]) > average_busy_ms(timings[slowest]))
+			slowest = i;
+	}
+
+	out << fixed << setprecision(2);
+	out << "pipeline stages (" << frames << " frames in " << wall_ms / 1000.0 << " s, " <<
+		(wall_ms > 0.0 ? frames * 1000.0 / wall_ms : 0.0) << " fps):" << endl;
+
+	for(int i = 0; i < count; ++i)
+	{
+		const stage_timing &t = timings[i];
+
+		out << "-" << setw(12) << left << t.name << right <<
+			" busy avg " << average_busy_ms(t) << " ms max " << t.max_busy_ms << " ms" <<
+			", waiting avg " << (t.frames ? t.wait_ms / t.frames : 0.0) << " ms" <<
+			(i == slowest ? " <- slowest" : "") << endl;
+	}
+
+	out.unsetf(ios::floatfield);
+	out << setprecision(6);
+}
@@ -0,0 +1,43 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Stage timing
+ * - time each pipeline stage spends working and waiting for other stages
+ * - each stage owns its stage_timing, no synchronization, report after stages finish
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef STAGE_TIMING_H
+#define STAGE_TIMING_H
+
+#include <chrono>
+#include <ostream>
+#include <stdint.h>
+
+struct stage_timing
+{
+	const char *name;
+	uint64_t frames;
+	double busy_ms;      //doing stage work
+	double max_busy_ms;  //worst frame
+	double wait_ms;      //waiting for input or for room in output queue
+
+	std::chrono::steady_clock::time_point mark;
+};
+
+void stage_timing_init(stage_timing *t, const char *name);
+
+// time since the previous call is accounted as
+// - waiting, call when the stage gets its input (after blocking pop/push)
+// - busy with one frame, call when the stage is done with the frame
+void stage_timing_waited(stage_timing *t);
+void stage_timing_worked(stage_timing *t);
+
+// per stage averages, the stage with the highest busy time bounds the throughput
+void stage_timing_report(std::ostream &out, const stage_timing *timings, int count, double wall_ms);
+
+#endif
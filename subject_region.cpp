@@ -0,0 +1,273 @@
+#include "subject_region.h"
+#include "options.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace std;
+
+//every other row and column
+static const int STEP = 2;
+//subject may move that far (fraction of window on each side) without moving the window
+static const int CROP_MARGIN_DIVISOR = 8;
+
+//row or column belongs to the subject with at least that fraction of pixels of the fullest one (and 2 of them)
+//speckles in the background are a few pixels in a line, the subject fills many
+static const int MIN_LINE_DIVISOR = 8;
+
+//first and last index of subject lines, false if there is none
+static bool line_extent(const vector<uint16_t> &counts, int *first, int *last)
+{
+	const int min = max(2, *max_element(counts.begin(), counts.end()) / MIN_LINE_DIVISOR);
+	int i = 0, j = (int)counts.size() - 1;
+
+	while(i <= j && counts[i] < min)
+		++i;
+	while(j >= i && counts[j] < min)
+		--j;
+
+	*first = i;
+	*last = j;
+
+	return i <= j;
+}
+
+bool subject_region_find(const uint16_t *data, int width, int height, int stride, frame_region *region)
+{
+	const int half_stride = stride / 2;
+	const int columns = (width + STEP - 1) / STEP;
+	const int rows = (height + STEP - 1) / STEP;
+	vector<uint16_t> column_counts(columns, 0), row_counts(rows, 0);
+
+	for(int r = 0; r < rows; ++r)
+	{
+		const uint16_t *line = data + r * STEP * half_stride;
+		uint16_t count = 0;
+
+		for(int c = 0; c < columns; ++c)
+		{
+			const uint16_t valid = line[c * STEP] != 0;
+			column_counts[c] += valid;
+			count += valid;
+		}
+
+		row_counts[r] = count;
+	}
+
+	int left, right, top, bottom;
+
+	if(!line_extent(column_counts, &left, &right) || !line_extent(row_counts, &top, &bottom))
+		return false;
+
+	//subject may start anywhere between the last sample outside and the first inside
+	region->left = max(0, left * STEP - (STEP - 1));
+	region->top = max(0, top * STEP - (STEP - 1));
+	region->right = min(width, right * STEP + STEP);
+	region->bottom = min(height, bottom * STEP + STEP);
+
+	return true;
+}
+
+frame_region subject_region_scale(const frame_region &region, int width, int height, int to_width, int to_height)
+{
+	if(width == to_width && height == to_height)
+		return region;
+
+	//outwards, the scaled region covers at least the same content
+	frame_region scaled;
+	scaled.left = (int)((int64_t)region.left * to_width / width);
+	scaled.top = (int)((int64_t)region.top * to_height / height);
+	scaled.right = (int)(((int64_t)region.right * to_width + width - 1) / width);
+	scaled.bottom = (int)(((int64_t)region.bottom * to_height + height - 1) / height);
+
+	return scaled;
+}
+
+frame_region subject_region_clip(const frame_region &region, const frame_region &window)
+{
+	frame_region clipped;
+
+	clipped.left = max(region.left, window.left) - window.left;
+	clipped.top = max(region.top, window.top) - window.top;
+	clipped.right = max(min(region.right, window.right) - window.left, clipped.left);
+	clipped.bottom = max(min(region.bottom, window.bottom) - window.top, clipped.top);
+
+	return clipped;
+}
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v & 0xFF; p[1] = v >> 8; }
+static uint16_t get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+int subject_crop_pack(uint32_t framenumber, const frame_region &window, int width, int height, uint8_t *out)
+{
+	out[0] = 'R';
+	out[1] = 'C';
+	out[2] = 'R';
+	out[3] = SUBJECT_CROP_VERSION;
+	put16(out + 4, framenumber & 0xFFFF);
+	put16(out + 6, framenumber >> 16);
+	put16(out + 8, width);
+	put16(out + 10, height);
+	put16(out + 12, window.left);
+	put16(out + 14, window.top);
+	put16(out + 16, window.right - window.left);
+	put16(out + 18, window.bottom - window.top);
+
+	return SUBJECT_CROP_SIZE;
+}
+
+bool subject_crop_read(const uint8_t *data, int size, uint32_t *framenumber, frame_region *window, int *width, int *height)
+{
+	if(size < SUBJECT_CROP_SIZE || data[0] != 'R' || data[1] != 'C' || data[2] != 'R' || data[3] != SUBJECT_CROP_VERSION)
+		return false;
+
+	*framenumber = get16(data + 4) | ((uint32_t)get16(data + 6) << 16);
+	*width = get16(data + 8);
+	*height = get16(data + 10);
+	window->left = get16(data + 12);
+	window->top = get16(data + 14);
+	window->right = window->left + get16(data + 16);
+	window->bottom = window->top + get16(data + 18);
+
+	return true;
+}
+
+struct subject_crop
+{
+	int width;
+	int height;
+	int crop_width;
+	int crop_height;
+	frame_region window;
+	int moves;
+};
+
+//window start centered on center, aligned, within frame (even at frame edge for chroma subsampling)
+static int place(int center, int size, int frame)
+{
+	int start = (center - size / 2 + SUBJECT_CROP_ALIGN / 2) / SUBJECT_CROP_ALIGN * SUBJECT_CROP_ALIGN;
+
+	start = min(start, (frame - size) & ~1);
+	return max(start, 0);
+}
+
+struct subject_crop *subject_crop_init(int width, int height, int crop_width, int crop_height)
+{
+	if(crop_width <= 0 || crop_height <= 0 || crop_width % SUBJECT_CROP_ALIGN || crop_height % SUBJECT_CROP_ALIGN ||
+		crop_width > width || crop_height > height)
+	{
+		cerr << "subject crop: " << crop_width << "x" << crop_height << " has to be multiple of " << SUBJECT_CROP_ALIGN <<
+			" and fit in " << width << "x" << height << " frame" << endl;
+		return NULL;
+	}
+
+	subject_crop *c = new subject_crop();
+
+	c->width = width;
+	c->height = height;
+	c->crop_width = crop_width;
+	c->crop_height = crop_height;
+	c->window.left = place(width / 2, crop_width, width);
+	c->window.top = place(height / 2, crop_height, height);
+	c->window.right = c->window.left + crop_width;
+	c->window.bottom = c->window.top + crop_height;
+	c->moves = 0;
+
+	return c;
+}
+
+void subject_crop_close(struct subject_crop *c)
+{
+	delete c;
+}
+
+//subject within margin inside the window, or for subject larger than that its center within margin of window center
+static bool holds(int start, int end, int window_start, int window_size)
+{
+	const int margin = window_size / CROP_MARGIN_DIVISOR;
+
+	if(end - start <= window_size - 2 * margin)
+		return start >= window_start + margin && end <= window_start + window_size - margin;
+
+	return abs((start + end) / 2 - (window_start + window_size / 2)) <= margin;
+}
+
+frame_region subject_crop_update(struct subject_crop *c, const frame_region *subject)
+{
+	if(!subject)
+		return c->window;
+
+	frame_region &w = c->window;
+
+	const bool hold_x = holds(subject->left, subject->right, w.left, c->crop_width);
+	const bool hold_y = holds(subject->top, subject->bottom, w.top, c->crop_height);
+
+	if(hold_x && hold_y)
+		return w;
+
+	//both directions at once, encoder sees one jump instead of two
+	const int left = place((subject->left + subject->right) / 2, c->crop_width, c->width);
+	const int top = place((subject->top + subject->bottom) / 2, c->crop_height, c->height);
+
+	//at frame edge subject may stay out of margin, nothing to move
+	if(left == w.left && top == w.top)
+		return w;
+
+	w.left = left;
+	w.top = top;
+	w.right = left + c->crop_width;
+	w.bottom = top + c->crop_height;
+	++c->moves;
+
+	return w;
+}
+
+int subject_crop_moves(const struct subject_crop *c)
+{
+	return c->moves;
+}
+
+int subject_region_options(int *argc, char *argv[], float *qoffset, int *crop_width, int *crop_height)
+{
+	const char *roi = option_value(argc, argv, "roi");
+	const char *crop = option_value(argc, argv, "crop");
+
+	*qoffset = 0.0f;
+	*crop_width = *crop_height = 0;
+
+	if(roi)
+	{
+		char *end;
+		*qoffset = strtof(roi, &end);
+
+		if(*roi == '\0' || *end != '\0' || *qoffset <= 0.0f || *qoffset > 1.0f)
+		{
+			cerr << "invalid --roi '" << roi << "', expected quality offset in (0, 1], e.g. 0.2" << endl;
+			return -1;
+		}
+	}
+
+	if(crop)
+	{
+		char end;
+
+		if(sscanf(crop, "%dx%d%c", crop_width, crop_height, &end) != 2 || *crop_width <= 0 || *crop_height <= 0 ||
+			*crop_width % SUBJECT_CROP_ALIGN || *crop_height % SUBJECT_CROP_ALIGN)
+		{
+			cerr << "invalid --crop '" << crop << "', expected <width>x<height> multiples of " << SUBJECT_CROP_ALIGN << ", e.g. 512x384" << endl;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void subject_region_usage(ostream &out)
+{
+	out << "region of interest options:" << endl
+	    << "       --roi <offset> # subject (bounding volume) at -offset, background at +offset of quantizer range, e.g. 0.2" << endl
+	    << "       --crop <width>x<height> # encode only that window following the subject, multiples of 16, e.g. 512x384" << endl;
+}
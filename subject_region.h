@@ -0,0 +1,73 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Subject region
+ * - bounding box of the subject in conditioned depth (pixels inside bounding volume/thresholds)
+ * - subsampled, rows and columns with only a few pixels (speckles) don't count
+ * - region of interest for encoders, more bits for the subject than for the background
+ * - crop window following the subject (hysteresis, macroblock aligned) for smaller encoders
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef SUBJECT_REGION_H
+#define SUBJECT_REGION_H
+
+#include <ostream>
+#include <stdint.h>
+
+// rectangle in pixels, right and bottom exclusive
+struct frame_region
+{
+	int left;
+	int top;
+	int right;
+	int bottom;
+};
+
+// non-zero pixels of conditioned Z16/P010LE depth (stride in bytes) are the subject
+// false if there is no subject, region is not changed then
+bool subject_region_find(const uint16_t *data, int width, int height, int stride, frame_region *region);
+
+// the same region in frame of other size (e.g. depth region on color frame)
+frame_region subject_region_scale(const frame_region &region, int width, int height, int to_width, int to_height);
+
+// region relative to window (e.g. crop), clipped to it
+frame_region subject_region_clip(const frame_region &region, const frame_region &window);
+
+// crop window record, sent with the frame so that receiver can place the cropped frame
+// 0-3 'R' 'C' 'R' version, 4-7 frame number, 8-9 frame width, 10-11 frame height,
+// 12-13 left, 14-15 top, 16-17 window width, 18-19 window height, little endian
+#define SUBJECT_CROP_VERSION 1
+#define SUBJECT_CROP_SIZE 20
+#define SUBJECT_CROP_ALIGN 16 //macroblock
+
+// returns SUBJECT_CROP_SIZE
+int subject_crop_pack(uint32_t framenumber, const frame_region &window, int width, int height, uint8_t *out);
+// false if it is not a valid record
+bool subject_crop_read(const uint8_t *data, int size, uint32_t *framenumber, frame_region *window, int *width, int *height);
+
+struct subject_crop;
+
+// window of crop_width x crop_height (SUBJECT_CROP_ALIGN multiples) in width x height frames, NULL on failure
+// starts centered
+struct subject_crop *subject_crop_init(int width, int height, int crop_width, int crop_height);
+void subject_crop_close(struct subject_crop *c);
+
+// window for the frame, moves only when subject leaves the inner part of the window
+// then centers on the subject at macroblock aligned position, NULL subject keeps the window
+frame_region subject_crop_update(struct subject_crop *c, const frame_region *subject);
+
+// window moves so far
+int subject_crop_moves(const struct subject_crop *c);
+
+// removes recognized options from argv, -1 on invalid value
+// qoffset - quality offset of region of interest (0-1 of encoder quantizer range), 0 without --roi
+// crop_width, crop_height - crop window size, 0 without --crop
+int subject_region_options(int *argc, char *argv[], float *qoffset, int *crop_width, int *crop_height);
+void subject_region_usage(std::ostream &out);
+
+#endif
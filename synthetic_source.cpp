@@ -0,0 +1,332 @@
+#include "synthetic_source.h"
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI           3.14159265358979323846  /* pi */
+#endif
+
+using namespace std;
+
+struct synthetic_sensor
+{
+	synthetic_stream config;
+	rs2::software_sensor sensor;
+	rs2::stream_profile profile;
+	int bpp;
+};
+
+struct synthetic_source
+{
+	rs2::software_device device;
+	vector<synthetic_sensor> sensors;
+	rs2::syncer sync;
+
+	float depth_units;
+	bool real_time;
+	int frame;
+
+	chrono::steady_clock::time_point start;
+	chrono::nanoseconds period;
+};
+
+//plane moving left and right in front of the background, full cycle every PLANE_PERIOD frames
+static const int PLANE_PERIOD = 120;
+
+static void plane_rect(int width, int height, int frame, int *x0, int *y0, int *x1, int *y1)
+{
+	const float phase = 2.0f * M_PI * (frame % PLANE_PERIOD) / PLANE_PERIOD;
+	const int cx = width / 2 + (int)(width / 4 * sinf(phase));
+	const int cy = height / 2;
+
+	*x0 = cx - width / 8;
+	*x1 = cx + width / 8;
+	*y0 = cy - height / 6;
+	*y1 = cy + height / 6;
+}
+
+static uint16_t meters_to_units(float meters, float depth_units)
+{
+	const float units = meters / depth_units;
+	return units < UINT16_MAX ? (uint16_t)units : UINT16_MAX;
+}
+
+void synthetic_depth(uint16_t *data, int width, int height, int stride, int frame, float depth_units)
+{
+	int x0, y0, x1, y1;
+	plane_rect(width, height, frame, &x0, &y0, &x1, &y1);
+
+	const float plane = 0.8f + 0.1f * sinf(2.0f * M_PI * (frame % PLANE_PERIOD) / PLANE_PERIOD * 2);
+	uint32_t seed = 1 + frame; //LCG, reproducible across platforms
+
+	for(int y = 0; y < height; ++y)
+		for(int x = 0; x < width; ++x)
+		{
+			seed = seed * 1664525u + 1013904223u;
+
+			//every 37th pixel on average has no depth, like shadows/holes in Realsense Z16
+			if((seed >> 16) % 37 == 0)
+			{
+				data[y * stride + x] = 0;
+				continue;
+			}
+
+			const bool in_plane = x >= x0 && x < x1 && y >= y0 && y < y1;
+			//ramp 1.2 - 2.5 m left to right, 0.3 m top to bottom
+			float meters = in_plane ? plane : 1.2f + 1.3f * x / width + 0.3f * y / height;
+			meters += ((int)(seed >> 29) - 4) * 0.0005f; //+-2 mm noise
+
+			data[y * stride + x] = meters_to_units(meters, depth_units);
+		}
+}
+
+void synthetic_color(uint8_t *rgba, int width, int height, int stride, int frame)
+{
+	int x0, y0, x1, y1;
+	plane_rect(width, height, frame, &x0, &y0, &x1, &y1);
+
+	for(int y = 0; y < height; ++y)
+	{
+		uint8_t *row = rgba + y * stride * 4;
+
+		for(int x = 0; x < width; ++x)
+		{
+			const bool in_plane = x >= x0 && x < x1 && y >= y0 && y < y1;
+			uint8_t *p = row + x * 4;
+
+			p[0] = in_plane ? 255 : (uint8_t)(255 * x / width);
+			p[1] = in_plane ? 128 : (uint8_t)(255 * y / height);
+			p[2] = in_plane ? 0 : 96;
+			p[3] = 255;
+		}
+	}
+}
+
+void synthetic_infrared(uint8_t *y8, int width, int height, int stride, int frame)
+{
+	int x0, y0, x1, y1;
+	plane_rect(width, height, frame, &x0, &y0, &x1, &y1);
+
+	for(int y = 0; y < height; ++y)
+		for(int x = 0; x < width; ++x)
+		{
+			const bool in_plane = x >= x0 && x < x1 && y >= y0 && y < y1;
+			//closer is brighter with IR projector, dotted pattern
+			const uint8_t base = in_plane ? 192 : (uint8_t)(160 - 96 * x / width);
+			y8[y * stride + x] = ((x + y * 3) % 7 == 0) ? base / 2 : base;
+		}
+}
+
+//infrared as UYVY, luminance only
+static void synthetic_infrared_uyvy(uint8_t *uyvy, int width, int height, int stride, int frame)
+{
+	vector<uint8_t> y8(width * height);
+	synthetic_infrared(&y8[0], width, height, width, frame);
+
+	for(int y = 0; y < height; ++y)
+		for(int x = 0; x < width; ++x)
+		{
+			uint8_t *p = uyvy + y * stride * 2 + x * 2;
+			p[0] = 128; //U or V
+			p[1] = y8[y * width + x];
+		}
+}
+
+//roughly D435 field of view, no distortion
+static rs2_intrinsics synthetic_intrinsics(int width, int height, float hfov_deg)
+{
+	rs2_intrinsics i = {0};
+	i.width = width;
+	i.height = height;
+	i.ppx = width / 2.0f;
+	i.ppy = height / 2.0f;
+	i.fx = i.fy = width / (2.0f * tanf(hfov_deg * M_PI / 360.0f));
+	i.model = RS2_DISTORTION_NONE;
+	return i;
+}
+
+static void delete_pixels(void *pixels)
+{
+	delete [] (uint8_t*)pixels;
+}
+
+static int bytes_per_pixel(rs2_format format)
+{
+	switch(format)
+	{
+		case RS2_FORMAT_Z16: return 2;
+		case RS2_FORMAT_RGBA8: return 4;
+		case RS2_FORMAT_Y8: return 1;
+		case RS2_FORMAT_UYVY: return 2;
+		default: return 0;
+	}
+}
+
+struct synthetic_source *synthetic_source_init(const synthetic_stream *streams, int count, float depth_units, bool real_time)
+{
+	if(count <= 0 || streams[0].framerate <= 0 || depth_units <= 0.0f)
+	{
+		cerr << "synthetic source: invalid streams, framerate or depth units" << endl;
+		return NULL;
+	}
+
+	synthetic_source *s = new synthetic_source();
+
+	s->depth_units = depth_units;
+	s->real_time = real_time;
+	s->frame = 0;
+	s->period = chrono::nanoseconds(1000000000LL / streams[0].framerate);
+
+	bool has_depth = false, has_color = false, has_infrared = false;
+
+	try
+	{
+		for(int i = 0; i < count; ++i)
+		{
+			const synthetic_stream &c = streams[i];
+			const int bpp = bytes_per_pixel(c.format);
+
+			if(c.width <= 0 || c.height <= 0 || bpp == 0 ||
+				(c.stream == RS2_STREAM_DEPTH) != (c.format == RS2_FORMAT_Z16))
+			{
+				cerr << "synthetic source: unsupported stream " << c.stream << " " << c.width << "x" << c.height << endl;
+				delete s;
+				return NULL;
+			}
+
+			//roughly D435, left infrared imager is the depth origin, color has narrower field of view
+			const float hfov = (c.stream == RS2_STREAM_COLOR) ? 69.0f : 87.0f;
+			//left infrared is index 1 like on the camera
+			rs2_video_stream vs = {c.stream, (c.stream == RS2_STREAM_INFRARED) ? 1 : 0, i, c.width, c.height, streams[0].framerate,
+				bpp, c.format, synthetic_intrinsics(c.width, c.height, hfov)};
+
+			synthetic_sensor sensor = {c, s->device.add_sensor("Synthetic " + to_string(i)), rs2::stream_profile(), bpp};
+			sensor.profile = sensor.sensor.add_video_stream(vs);
+
+			if(c.stream == RS2_STREAM_DEPTH)
+				sensor.sensor.add_read_only_option(RS2_OPTION_DEPTH_UNITS, depth_units);
+
+			has_depth |= c.stream == RS2_STREAM_DEPTH;
+			has_color |= c.stream == RS2_STREAM_COLOR;
+			has_infrared |= c.stream == RS2_STREAM_INFRARED;
+
+			s->sensors.push_back(sensor);
+		}
+
+		//color camera 15 mm to the side of the first stream, the rest share its origin
+		for(size_t i = 1; i < s->sensors.size(); ++i)
+		{
+			const float x = (s->sensors[i].config.stream == RS2_STREAM_COLOR) ? 0.015f : 0.0f;
+			rs2_extrinsics extrinsics = { {1, 0, 0, 0, 1, 0, 0, 0, 1}, {x, 0, 0} };
+			s->sensors[0].profile.register_extrinsics_to(s->sensors[i].profile, extrinsics);
+		}
+
+		if(has_depth && has_color)
+			s->device.create_matcher(RS2_MATCHER_DLR_C);
+		else if(has_depth && has_infrared)
+			s->device.create_matcher(RS2_MATCHER_DI);
+		else
+			s->device.create_matcher(RS2_MATCHER_DEFAULT);
+
+		for(size_t i = 0; i < s->sensors.size(); ++i)
+		{
+			s->sensors[i].sensor.open(s->sensors[i].profile);
+			s->sensors[i].sensor.start(s->sync);
+		}
+	}
+	catch(const rs2::error &)
+	{
+		cerr << "synthetic source: failed to create Realsense software device" << endl;
+		delete s;
+		return NULL;
+	}
+
+	s->start = chrono::steady_clock::now();
+
+	return s;
+}
+
+static void send_frame(synthetic_sensor &sensor, int frame, double timestamp, float depth_units)
+{
+	const synthetic_stream &c = sensor.config;
+	uint8_t *pixels = new uint8_t[c.width * c.height * sensor.bpp];
+
+	if(c.format == RS2_FORMAT_Z16)
+		synthetic_depth((uint16_t*)pixels, c.width, c.height, c.width, frame, depth_units);
+	else if(c.format == RS2_FORMAT_RGBA8)
+		synthetic_color(pixels, c.width, c.height, c.width, frame);
+	else if(c.format == RS2_FORMAT_Y8)
+		synthetic_infrared(pixels, c.width, c.height, c.width, frame);
+	else
+		synthetic_infrared_uyvy(pixels, c.width, c.height, c.width, frame);
+
+	rs2_software_video_frame f;
+	f.pixels = pixels;
+	f.deleter = delete_pixels; //frame owns the pixels, freed when Realsense releases the frame
+	f.stride = c.width * sensor.bpp;
+	f.bpp = sensor.bpp;
+	f.timestamp = timestamp;
+	f.domain = RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK;
+	f.frame_number = frame;
+	f.profile = sensor.profile.get();
+	f.depth_units = (c.format == RS2_FORMAT_Z16) ? depth_units : 0.0f;
+
+	sensor.sensor.on_video_frame(f);
+}
+
+rs2::frameset synthetic_source_wait(struct synthetic_source *s)
+{
+	for(;;)
+	{
+		if(s->real_time)
+			this_thread::sleep_until(s->start + s->period * s->frame);
+
+		const int n = s->frame++;
+		//the same timestamp and frame number for all streams so that syncer matches them
+		const double timestamp = chrono::duration<double, milli>(s->period * n).count();
+
+		for(size_t i = 0; i < s->sensors.size(); ++i)
+			send_frame(s->sensors[i], n, timestamp, s->depth_units);
+
+		//syncer may occasionally output incomplete set, like with the camera skip it
+		rs2::frameset frameset;
+
+		while(s->sync.try_wait_for_frames(&frameset, 100))
+			if(frameset.size() == s->sensors.size())
+				return frameset;
+	}
+}
+
+rs2::stream_profile synthetic_source_profile(struct synthetic_source *s, rs2_stream stream)
+{
+	for(size_t i = 0; i < s->sensors.size(); ++i)
+		if(s->sensors[i].config.stream == stream)
+			return s->sensors[i].profile;
+
+	return rs2::stream_profile();
+}
+
+void synthetic_source_close(struct synthetic_source *s)
+{
+	if(!s)
+		return;
+
+	try
+	{
+		for(size_t i = 0; i < s->sensors.size(); ++i)
+		{
+			s->sensors[i].sensor.stop();
+			s->sensors[i].sensor.close();
+		}
+	}
+	catch(const rs2::error &)
+	{
+		cerr << "synthetic source: failed to stop software device" << endl;
+	}
+
+	delete s;
+}
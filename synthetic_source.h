@@ -0,0 +1,52 @@
+/*
+ * Realsense Network Hardware Video Encoder
+ *
+ * Synthetic frame source
+ * - deterministic Z16 depth, RGBA8 color and Y8/UYVY infrared frames, no camera needed
+ * - depth ramp, moving plane and noise, color/infrared matching the plane
+ * - delivered as rs2::frameset through Realsense software device (works with rs2::align)
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef SYNTHETIC_SOURCE_H
+#define SYNTHETIC_SOURCE_H
+
+// Realsense API
+#include <librealsense2/rs.hpp>
+
+#include <stdint.h>
+
+// stream to generate, Z16 depth, RGBA8 color, Y8 or UYVY infrared
+struct synthetic_stream
+{
+	rs2_stream stream;
+	int width;
+	int height;
+	rs2_format format;
+	int framerate;
+};
+
+struct synthetic_source;
+
+// all streams at the framerate of the first one, NULL on failure
+// real_time - paced at framerate, otherwise as fast as possible
+struct synthetic_source *synthetic_source_init(const synthetic_stream *streams, int count, float depth_units, bool real_time);
+
+// next frameset with all the streams
+rs2::frameset synthetic_source_wait(struct synthetic_source *s);
+
+// empty profile if stream is not generated
+rs2::stream_profile synthetic_source_profile(struct synthetic_source *s, rs2_stream stream);
+
+void synthetic_source_close(struct synthetic_source *s);
+
+// frame content, the same for the same arguments (stride in pixels)
+void synthetic_depth(uint16_t *data, int width, int height, int stride, int frame, float depth_units);
+void synthetic_color(uint8_t *rgba, int width, int height, int stride, int frame);
+void synthetic_infrared(uint8_t *y8, int width, int height, int stride, int frame);
+
+#endif